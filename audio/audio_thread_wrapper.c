@@ -15,9 +15,10 @@
 
 #include "audio_thread_wrapper.h"
 #include <rthreads/rthreads.h>
+#include <rthreads/ratomic.h>
 #include "../general.h"
 #include "../performance.h"
-#include "../fifo_buffer.h"
+#include "../spsc_buffer.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -36,12 +37,79 @@ typedef struct audio_thread
 
    int inited;
 
+   // If the core does not drive audio with a callback,
+   // the emulation thread writes into this ring and the
+   // audio thread drains it into the driver.
+   // Lock-free, lock is only taken to sleep.
+   spsc_buffer_t *buffer;
+   size_t buffer_size;
+   uint8_t *chunk;
+   size_t chunk_size;
+   size_t frame_size;
+   bool nonblock;
+   volatile size_t writer_asleep;
+   volatile size_t reader_asleep;
+
    // Init options.
    const char *device;
    unsigned out_rate;
    unsigned latency;
 } audio_thread_t;
 
+static void audio_thread_fail(audio_thread_t *thr)
+{
+   slock_lock(thr->lock);
+   thr->alive = false;
+   scond_signal(thr->cond);
+   slock_unlock(thr->lock);
+}
+
+// Moves one chunk from the ring to the driver.
+// The driver blocks, the emulation thread does not.
+static void audio_thread_drain(audio_thread_t *thr)
+{
+   size_t avail = spsc_read_avail(thr->buffer);
+   size_t written = 0;
+
+   if (!avail)
+   {
+      slock_lock(thr->lock);
+      ratomic_store_release(&thr->reader_asleep, 1);
+      ratomic_fence();
+      if (thr->alive && !thr->stopped && !spsc_read_avail(thr->buffer))
+         scond_wait(thr->cond, thr->lock);
+      ratomic_store_release(&thr->reader_asleep, 0);
+      slock_unlock(thr->lock);
+      return;
+   }
+
+   if (avail > thr->chunk_size)
+      avail = thr->chunk_size;
+   spsc_read(thr->buffer, thr->chunk, avail);
+
+   // Either the writer sees the room we just made,
+   // or we see it's asleep.
+   ratomic_fence();
+   if (ratomic_load_acquire(&thr->writer_asleep))
+   {
+      slock_lock(thr->lock);
+      scond_signal(thr->cond);
+      slock_unlock(thr->lock);
+   }
+
+   while (written < avail)
+   {
+      ssize_t ret = thr->driver->write(thr->driver_data,
+            thr->chunk + written, avail - written);
+      if (ret < 0)
+      {
+         audio_thread_fail(thr);
+         return;
+      }
+      written += ret;
+   }
+}
+
 static void audio_thread_loop(void *data)
 {
    audio_thread_t *thr = (audio_thread_t*)data;
@@ -86,7 +154,11 @@ static void audio_thread_loop(void *data)
       }
 
       slock_unlock(thr->lock);
-      g_extern.system.audio_callback.callback();
+
+      if (thr->buffer)
+         audio_thread_drain(thr);
+      else
+         g_extern.system.audio_callback.callback();
    }
 
    RARCH_LOG("[Audio Thread]: Tearing down driver.\n");
@@ -130,6 +202,8 @@ static void audio_thread_free(void *data)
       slock_free(thr->lock);
    if (thr->cond)
       scond_free(thr->cond);
+   spsc_free(thr->buffer);
+   free(thr->chunk);
    free(thr);
 }
 
@@ -137,6 +211,9 @@ static bool audio_thread_alive(void *data)
 {
    bool alive = false;
    audio_thread_t *thr = (audio_thread_t*)data;
+   if (thr->buffer)
+      return !thr->is_paused;
+
    audio_thread_block(thr);
    alive = !thr->is_paused;
    audio_thread_unblock(thr);
@@ -148,23 +225,26 @@ static bool audio_thread_stop(void *data)
    audio_thread_t *thr = (audio_thread_t*)data;
    audio_thread_block(thr);
    thr->is_paused = true;
-   g_extern.system.audio_callback.set_state(false);
+   if (!thr->buffer)
+      g_extern.system.audio_callback.set_state(false);
    return true;
 }
 
 static bool audio_thread_start(void *data)
 {
    audio_thread_t *thr = (audio_thread_t*)data;
-   g_extern.system.audio_callback.set_state(true);
+   if (!thr->buffer)
+      g_extern.system.audio_callback.set_state(true);
    thr->is_paused = false;
    audio_thread_unblock(thr);
    return true;
 }
 
+// The driver itself always blocks on the audio thread.
 static void audio_thread_set_nonblock_state(void *data, bool state)
 {
-   (void)data;
-   (void)state;
+   audio_thread_t *thr = (audio_thread_t*)data;
+   thr->nonblock = state;
 }
 
 static bool audio_thread_use_float(void *data)
@@ -173,20 +253,95 @@ static bool audio_thread_use_float(void *data)
    return thr->use_float;
 }
 
-static ssize_t audio_thread_write(void *data, const void *buf, size_t size)
+// Without a ring, the callback writes from the audio thread itself.
+static ssize_t audio_thread_write_driver(audio_thread_t *thr,
+      const void *buf, size_t size)
 {
-   audio_thread_t *thr = (audio_thread_t*)data;
    ssize_t ret = thr->driver->write(thr->driver_data, buf, size);
    if (ret < 0)
+      audio_thread_fail(thr);
+   return ret;
+}
+
+static bool audio_thread_wait_write(audio_thread_t *thr)
+{
+   bool alive;
+
+   slock_lock(thr->lock);
+   ratomic_store_release(&thr->writer_asleep, 1);
+   ratomic_fence();
+   if (thr->alive && spsc_write_avail(thr->buffer) < thr->frame_size)
+      scond_wait(thr->cond, thr->lock);
+   ratomic_store_release(&thr->writer_asleep, 0);
+   alive = thr->alive;
+   slock_unlock(thr->lock);
+
+   return alive;
+}
+
+static ssize_t audio_thread_write(void *data, const void *buf, size_t size)
+{
+   size_t written = 0;
+   audio_thread_t *thr = (audio_thread_t*)data;
+
+   if (!thr->buffer)
+      return audio_thread_write_driver(thr, buf, size);
+
+   while (written < size)
    {
-      slock_lock(thr->lock);
-      thr->alive = false;
-      scond_signal(thr->cond);
-      slock_unlock(thr->lock);
-      return ret;
+      size_t avail = spsc_write_avail(thr->buffer);
+      avail -= avail % thr->frame_size;
+
+      if (!avail)
+      {
+         if (thr->nonblock)
+         {
+            bool alive;
+            slock_lock(thr->lock);
+            alive = thr->alive;
+            slock_unlock(thr->lock);
+            if (!alive)
+               return -1;
+            break;
+         }
+
+         if (!audio_thread_wait_write(thr))
+            return -1;
+         continue;
+      }
+
+      if (avail > size - written)
+         avail = size - written;
+      spsc_write(thr->buffer, (const uint8_t*)buf + written, avail);
+      written += avail;
+
+      ratomic_fence();
+      if (ratomic_load_acquire(&thr->reader_asleep))
+      {
+         slock_lock(thr->lock);
+         scond_signal(thr->cond);
+         slock_unlock(thr->lock);
+      }
    }
 
-   return ret;
+   return written;
+}
+
+static size_t audio_thread_write_avail(void *data)
+{
+   audio_thread_t *thr = (audio_thread_t*)data;
+
+   // With a callback there is no ring to write into,
+   // and buffer_size is zero as well.
+   if (!thr->buffer)
+      return 0;
+   return spsc_write_avail(thr->buffer);
+}
+
+static size_t audio_thread_buffer_size(void *data)
+{
+   audio_thread_t *thr = (audio_thread_t*)data;
+   return thr->buffer_size;
 }
 
 static const audio_driver_t audio_thread = {
@@ -199,8 +354,8 @@ static const audio_driver_t audio_thread = {
    audio_thread_free,
    audio_thread_use_float,
    "audio-thread",
-   NULL, // No point in using rate control with threaded audio.
-   NULL,
+   audio_thread_write_avail,
+   audio_thread_buffer_size,
 };
 
 bool rarch_threaded_audio_init(const audio_driver_t **out_driver, void **out_data,
@@ -236,6 +391,27 @@ bool rarch_threaded_audio_init(const audio_driver_t **out_driver, void **out_dat
    if (thr->inited < 0) // Thread failed.
       goto error;
 
+   // The core pushes audio itself, so give it a ring
+   // holding the requested latency, and start draining.
+   if (!g_extern.system.audio_callback.callback)
+   {
+      thr->frame_size = 2 * (thr->use_float ? sizeof(float) : sizeof(int16_t));
+      thr->buffer_size = (size_t)audio_out_rate * latency / 1000;
+      if (thr->buffer_size < 64)
+         thr->buffer_size = 64;
+      thr->chunk_size = (thr->buffer_size / 8) * thr->frame_size;
+      thr->buffer_size *= thr->frame_size;
+
+      if (!(thr->chunk = (uint8_t*)malloc(thr->chunk_size)))
+         goto error;
+      if (!(thr->buffer = spsc_new(thr->buffer_size)))
+         goto error;
+
+      RARCH_LOG("[Audio Thread]: Buffering %u frames for the driver.\n",
+            (unsigned)(thr->buffer_size / thr->frame_size));
+      audio_thread_unblock(thr);
+   }
+
    *out_driver = &audio_thread;
    *out_data   = thr;
    return true;
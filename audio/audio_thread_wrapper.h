@@ -21,7 +21,10 @@
 
 // Starts a audio driver in a new thread.
 // Access to audio driver will be mediated through this driver.
-// This driver interfaces with audio callback and is only used in that case.
+// With an audio callback, the thread drives the core.
+// Otherwise, writes go through a lock-free ring that the thread
+// drains into the driver, and the ring's fill level is what
+// write_avail()/buffer_size() report for rate control.
 bool rarch_threaded_audio_init(const audio_driver_t **out_driver, void **out_data,
       const char *device, unsigned out_rate, unsigned latency,
       const audio_driver_t *driver);
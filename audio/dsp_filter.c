@@ -124,6 +124,7 @@ extern const struct dspfilter_implementation *phaser_dspfilter_get_implementatio
 extern const struct dspfilter_implementation *wahwah_dspfilter_get_implementation(dspfilter_simd_mask_t mask);
 extern const struct dspfilter_implementation *eq_dspfilter_get_implementation(dspfilter_simd_mask_t mask);
 extern const struct dspfilter_implementation *chorus_dspfilter_get_implementation(dspfilter_simd_mask_t mask);
+extern const struct dspfilter_implementation *convolution_dspfilter_get_implementation(dspfilter_simd_mask_t mask);
 
 static const dspfilter_get_implementation_t dsp_plugs_builtin[] = {
    panning_dspfilter_get_implementation,
@@ -133,6 +134,7 @@ static const dspfilter_get_implementation_t dsp_plugs_builtin[] = {
    wahwah_dspfilter_get_implementation,
    eq_dspfilter_get_implementation,
    chorus_dspfilter_get_implementation,
+   convolution_dspfilter_get_implementation,
 };
 
 static bool append_plugs(rarch_dsp_filter_t *dsp)
@@ -0,0 +1,28 @@
+filters = 1
+filter0 = convolution
+
+# Convolves with an impulse response loaded from a WAV file,
+# e.g. one recorded in a real room or a hardware reverb.
+# 16, 24 and 32-bit integer and 32-bit float files are supported.
+# A mono response is used for both channels.
+# Responses are resampled to the audio rate if needed.
+convolution_impulse = "/path/to/impulse.wav"
+
+# Defaults.
+# convolution_dry = 1.0
+# convolution_wet = 0.5
+
+# Scales the response to unit energy, so that wet levels are comparable between responses.
+# convolution_normalize = 1
+
+# Cuts off responses longer than this many seconds.
+# convolution_max_length = 4.0
+
+# The start of the response is convolved in partitions of this size,
+# which is also the latency of the wet signal.
+# convolution_partition_size_log2 = 7
+
+# The rest of the response is convolved in larger partitions of this size,
+# with the work spread out over the small partitions.
+# 0 uses small partitions throughout, which costs a lot more for long responses.
+# convolution_tail_size_log2 = 11
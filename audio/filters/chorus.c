@@ -18,6 +18,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #ifndef M_PI
 #define M_PI 3.1415926535897932384626433832795
 #endif
@@ -27,7 +31,8 @@
 
 struct chorus_data
 {
-   float old[2][CHORUS_MAX_DELAY];
+   /* Left and right interleaved. */
+   float old[CHORUS_MAX_DELAY][2];
    unsigned old_ptr;
 
    float delay;
@@ -37,8 +42,33 @@ struct chorus_data
    float mix_wet;
    unsigned lfo_ptr;
    unsigned lfo_period;
+
+   /* The LFO is a rotating phasor, instead of a sin() per frame.
+    * It restarts from the exact phase every period. */
+   double lfo_sin, lfo_cos;
+   double lfo_step_sin, lfo_step_cos;
 };
 
+/* Returns the delay for the current frame in frames,
+ * and advances the LFO. */
+static inline float chorus_lfo_delay(struct chorus_data *ch)
+{
+   float delay = (ch->delay + ch->depth * ch->lfo_sin) * ch->input_rate;
+   double lfo_sin = ch->lfo_sin;
+
+   ch->lfo_sin = lfo_sin * ch->lfo_step_cos + ch->lfo_cos * ch->lfo_step_sin;
+   ch->lfo_cos = ch->lfo_cos * ch->lfo_step_cos - lfo_sin * ch->lfo_step_sin;
+
+   if (++ch->lfo_ptr >= ch->lfo_period)
+   {
+      ch->lfo_ptr = 0;
+      ch->lfo_sin = 0.0;
+      ch->lfo_cos = 1.0;
+   }
+
+   return delay;
+}
+
 static void chorus_free(void *data)
 {
    free(data);
@@ -58,27 +88,22 @@ static void chorus_process(void *data, struct dspfilter_output *output,
    {
       float in[2] = { out[0], out[1] };
 
-      float delay = ch->delay + ch->depth * sin((2.0 * M_PI * ch->lfo_ptr++) / ch->lfo_period);
-      delay *= ch->input_rate;
-      if (ch->lfo_ptr >= ch->lfo_period)
-         ch->lfo_ptr = 0;
+      float delay = chorus_lfo_delay(ch);
 
       unsigned delay_int = (unsigned)delay;
       if (delay_int >= CHORUS_MAX_DELAY - 1)
          delay_int = CHORUS_MAX_DELAY - 2;
       float delay_frac = delay - delay_int;
 
-      ch->old[0][ch->old_ptr] = in[0];
-      ch->old[1][ch->old_ptr] = in[1];
+      ch->old[ch->old_ptr][0] = in[0];
+      ch->old[ch->old_ptr][1] = in[1];
 
-      float l_a = ch->old[0][(ch->old_ptr - delay_int - 0) & CHORUS_DELAY_MASK];
-      float l_b = ch->old[0][(ch->old_ptr - delay_int - 1) & CHORUS_DELAY_MASK];
-      float r_a = ch->old[1][(ch->old_ptr - delay_int - 0) & CHORUS_DELAY_MASK];
-      float r_b = ch->old[1][(ch->old_ptr - delay_int - 1) & CHORUS_DELAY_MASK];
+      const float *a = ch->old[(ch->old_ptr - delay_int - 0) & CHORUS_DELAY_MASK];
+      const float *b = ch->old[(ch->old_ptr - delay_int - 1) & CHORUS_DELAY_MASK];
 
       // Lerp introduces aliasing of the chorus component, but doing full polyphase here is probably overkill.
-      float chorus_l = l_a * (1.0f - delay_frac) + l_b * delay_frac;
-      float chorus_r = r_a * (1.0f - delay_frac) + r_b * delay_frac;
+      float chorus_l = a[0] * (1.0f - delay_frac) + b[0] * delay_frac;
+      float chorus_r = a[1] * (1.0f - delay_frac) + b[1] * delay_frac;
 
       out[0] = ch->mix_dry * in[0] + ch->mix_wet * chorus_l;
       out[1] = ch->mix_dry * in[1] + ch->mix_wet * chorus_r;
@@ -87,6 +112,48 @@ static void chorus_process(void *data, struct dspfilter_output *output,
    }
 }
 
+#ifdef __SSE__
+static void chorus_process_sse(void *data, struct dspfilter_output *output,
+      const struct dspfilter_input *input)
+{
+   unsigned i;
+   struct chorus_data *ch = (struct chorus_data*)data;
+
+   output->samples = input->samples;
+   output->frames  = input->frames;
+   float *out = output->samples;
+
+   __m128 mix_dry = _mm_set1_ps(ch->mix_dry);
+   __m128 mix_wet = _mm_set1_ps(ch->mix_wet);
+
+   for (i = 0; i < input->frames; i++, out += 2)
+   {
+      __m128 in = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)out);
+
+      float delay = chorus_lfo_delay(ch);
+
+      unsigned delay_int = (unsigned)delay;
+      if (delay_int >= CHORUS_MAX_DELAY - 1)
+         delay_int = CHORUS_MAX_DELAY - 2;
+      __m128 frac = _mm_set1_ps(delay - delay_int);
+
+      _mm_storel_pi((__m64*)ch->old[ch->old_ptr], in);
+
+      __m128 a = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)
+            ch->old[(ch->old_ptr - delay_int - 0) & CHORUS_DELAY_MASK]);
+      __m128 b = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)
+            ch->old[(ch->old_ptr - delay_int - 1) & CHORUS_DELAY_MASK]);
+
+      __m128 chorus = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), frac));
+
+      _mm_storel_pi((__m64*)out, _mm_add_ps(_mm_mul_ps(mix_dry, in),
+               _mm_mul_ps(mix_wet, chorus)));
+
+      ch->old_ptr = (ch->old_ptr + 1) & CHORUS_DELAY_MASK;
+   }
+}
+#endif
+
 static void *chorus_init(const struct dspfilter_info *info,
       const struct dspfilter_config *config, void *userdata)
 {
@@ -120,6 +187,10 @@ static void *chorus_init(const struct dspfilter_info *info,
    ch->input_rate = info->input_rate;
    if (!ch->lfo_period)
       ch->lfo_period = 1;
+
+   ch->lfo_cos      = 1.0;
+   ch->lfo_step_sin = sin(2.0 * M_PI / ch->lfo_period);
+   ch->lfo_step_cos = cos(2.0 * M_PI / ch->lfo_period);
    return ch;
 }
 
@@ -133,12 +204,28 @@ static const struct dspfilter_implementation chorus_plug = {
    "chorus",
 };
 
+#ifdef __SSE__
+static const struct dspfilter_implementation chorus_sse_plug = {
+   chorus_init,
+   chorus_process_sse,
+   chorus_free,
+
+   DSPFILTER_API_VERSION,
+   "Chorus",
+   "chorus",
+};
+#endif
+
 #ifdef HAVE_FILTERS_BUILTIN
 #define dspfilter_get_implementation chorus_dspfilter_get_implementation
 #endif
 
 const struct dspfilter_implementation *dspfilter_get_implementation(dspfilter_simd_mask_t mask)
 {
+#ifdef __SSE__
+   if (mask & DSPFILTER_SIMD_SSE)
+      return &chorus_sse_plug;
+#endif
    (void)mask;
    return &chorus_plug;
 }
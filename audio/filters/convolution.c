@@ -0,0 +1,358 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "dspfilter.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "fft/convolve.c"
+
+#define CONVOLUTION_CHUNK 1024
+
+struct convolution_data
+{
+   fft_convolve_t *conv;
+   float dry;
+   float wet;
+   float buffer[2 * CONVOLUTION_CHUNK];
+};
+
+struct convolution_impulse
+{
+   float *samples;
+   unsigned frames;
+   unsigned channels;
+   unsigned rate;
+};
+
+static unsigned convolution_le16(const unsigned char *data)
+{
+   return data[0] | (data[1] << 8);
+}
+
+static unsigned convolution_le32(const unsigned char *data)
+{
+   return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned)data[3] << 24);
+}
+
+static float convolution_sample(const unsigned char *data,
+      unsigned format, unsigned bits)
+{
+   union
+   {
+      unsigned u;
+      float f;
+   } u;
+
+   switch (bits)
+   {
+      case 16:
+         return (int16_t)convolution_le16(data) / 32768.0f;
+      case 24:
+         return (int32_t)((data[0] << 8) | (data[1] << 16) |
+               ((unsigned)data[2] << 24)) / 2147483648.0f;
+      case 32:
+         u.u = convolution_le32(data);
+         if (format == 3)
+            return u.f;
+         return (int32_t)u.u / 2147483648.0f;
+      default:
+         return 0.0f;
+   }
+}
+
+/* Loads a RIFF WAVE file with 16, 24 or 32-bit integer or
+ * 32-bit float samples into interleaved floats. */
+static int convolution_load_wav(struct convolution_impulse *impulse,
+      const char *path)
+{
+   unsigned i;
+   long len;
+   unsigned char *data = NULL;
+   const unsigned char *ptr, *end;
+   const unsigned char *fmt = NULL, *samples = NULL;
+   unsigned fmt_size = 0, samples_size = 0;
+   unsigned format, bits, block_align;
+
+   FILE *file = fopen(path, "rb");
+   if (!file)
+      return 0;
+
+   fseek(file, 0, SEEK_END);
+   len = ftell(file);
+   rewind(file);
+
+   if (len < 12)
+      goto error;
+
+   data = (unsigned char*)malloc(len);
+   if (!data || fread(data, 1, len, file) != (size_t)len)
+      goto error;
+
+   if (memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4))
+      goto error;
+
+   ptr = data + 12;
+   end = data + len;
+   while (end - ptr >= 8)
+   {
+      unsigned size = convolution_le32(ptr + 4);
+      if (size > (unsigned)(end - ptr - 8))
+         size = end - ptr - 8;
+
+      if (!memcmp(ptr, "fmt ", 4))
+      {
+         fmt = ptr + 8;
+         fmt_size = size;
+      }
+      else if (!memcmp(ptr, "data", 4))
+      {
+         samples = ptr + 8;
+         samples_size = size;
+      }
+
+      ptr += 8 + size + (size & 1);
+   }
+
+   if (!fmt || fmt_size < 16 || !samples)
+      goto error;
+
+   format            = convolution_le16(fmt);
+   impulse->channels = convolution_le16(fmt + 2);
+   impulse->rate     = convolution_le32(fmt + 4);
+   block_align       = convolution_le16(fmt + 12);
+   bits              = convolution_le16(fmt + 14);
+
+   // WAVE_FORMAT_EXTENSIBLE keeps the actual format in the sub-format GUID.
+   if (format == 0xfffe && fmt_size >= 26)
+      format = convolution_le16(fmt + 24);
+
+   if ((format != 1 && format != 3) || (format == 3 && bits != 32) ||
+         (bits != 16 && bits != 24 && bits != 32) ||
+         !impulse->channels || !impulse->rate ||
+         block_align < impulse->channels * (bits / 8))
+      goto error;
+
+   impulse->frames = samples_size / block_align;
+   if (!impulse->frames)
+      goto error;
+
+   impulse->samples = (float*)malloc(impulse->frames *
+         impulse->channels * sizeof(float));
+   if (!impulse->samples)
+      goto error;
+
+   for (i = 0; i < impulse->frames * impulse->channels; i++)
+   {
+      unsigned frame = i / impulse->channels;
+      unsigned channel = i % impulse->channels;
+      impulse->samples[i] = convolution_sample(samples +
+            frame * block_align + channel * (bits / 8), format, bits);
+   }
+
+   free(data);
+   fclose(file);
+   return 1;
+
+error:
+   free(data);
+   fclose(file);
+   return 0;
+}
+
+/* Linear interpolation is plenty for a reverb tail.
+ * Scales as well, so that the response keeps its gain. */
+static int convolution_resample(struct convolution_impulse *impulse,
+      float rate)
+{
+   unsigned i, c;
+   double ratio = impulse->rate / rate;
+   float gain = ratio;
+   unsigned frames = (unsigned)((impulse->frames - 1) / ratio) + 1;
+   float *samples;
+
+   if (fabs(ratio - 1.0) < 1e-6)
+      return 1;
+
+   samples = (float*)malloc(frames * impulse->channels * sizeof(float));
+   if (!samples)
+      return 0;
+
+   for (i = 0; i < frames; i++)
+   {
+      double pos = i * ratio;
+      unsigned index = (unsigned)pos;
+      float lerp = pos - index;
+      unsigned next = index + 1 < impulse->frames ? index + 1 : index;
+
+      for (c = 0; c < impulse->channels; c++)
+      {
+         float a = impulse->samples[index * impulse->channels + c];
+         float b = impulse->samples[next * impulse->channels + c];
+         samples[i * impulse->channels + c] = gain * (a + lerp * (b - a));
+      }
+   }
+
+   free(impulse->samples);
+   impulse->samples = samples;
+   impulse->frames = frames;
+   impulse->rate = (unsigned)rate;
+   return 1;
+}
+
+/* Scales the response so that the louder channel has unit energy. */
+static void convolution_normalize(struct convolution_impulse *impulse)
+{
+   unsigned i, c;
+   double energy = 0.0;
+
+   for (c = 0; c < impulse->channels; c++)
+   {
+      double sum = 0.0;
+      for (i = 0; i < impulse->frames; i++)
+      {
+         float s = impulse->samples[i * impulse->channels + c];
+         sum += s * s;
+      }
+      if (sum > energy)
+         energy = sum;
+   }
+
+   if (energy <= 0.0)
+      return;
+
+   for (i = 0; i < impulse->frames * impulse->channels; i++)
+      impulse->samples[i] *= 1.0 / sqrt(energy);
+}
+
+static void convolution_free(void *data)
+{
+   struct convolution_data *conv = (struct convolution_data*)data;
+   if (!conv)
+      return;
+
+   fft_convolve_free(conv->conv);
+   free(conv);
+}
+
+static void convolution_process(void *data, struct dspfilter_output *output,
+      const struct dspfilter_input *input)
+{
+   unsigned i;
+   struct convolution_data *conv = (struct convolution_data*)data;
+   float *samples = input->samples;
+   unsigned frames = input->frames;
+
+   output->samples = input->samples;
+   output->frames  = input->frames;
+
+   while (frames)
+   {
+      unsigned chunk = frames < CONVOLUTION_CHUNK ? frames : CONVOLUTION_CHUNK;
+
+      fft_convolve_process(conv->conv, conv->buffer, samples, chunk);
+      for (i = 0; i < 2 * chunk; i++)
+         samples[i] = conv->dry * samples[i] + conv->wet * conv->buffer[i];
+
+      samples += 2 * chunk;
+      frames -= chunk;
+   }
+}
+
+static void *convolution_init(const struct dspfilter_info *info,
+      const struct dspfilter_config *config, void *userdata)
+{
+   unsigned c;
+   float max_length;
+   int partition_log2, tail_log2, normalize;
+   char *path = NULL;
+   struct convolution_impulse impulse = {0};
+   struct convolution_data *conv = (struct convolution_data*)calloc(1, sizeof(*conv));
+   if (!conv)
+      return NULL;
+
+   config->get_float(userdata, "dry", &conv->dry, 1.0f);
+   config->get_float(userdata, "wet", &conv->wet, 0.5f);
+   config->get_float(userdata, "max_length", &max_length, 4.0f);
+   config->get_int(userdata, "normalize", &normalize, 1);
+   config->get_int(userdata, "partition_size_log2", &partition_log2, 7);
+   config->get_int(userdata, "tail_size_log2", &tail_log2, 11);
+   if (partition_log2 < FFT_CONVOLVE_MIN_PARTITION_LOG2)
+      partition_log2 = FFT_CONVOLVE_MIN_PARTITION_LOG2;
+   if (tail_log2 < 0)
+      tail_log2 = 0;
+
+   if (!config->get_string(userdata, "impulse", &path, "") ||
+         !convolution_load_wav(&impulse, path))
+      goto error;
+   config->free(path);
+   path = NULL;
+
+   if (!convolution_resample(&impulse, info->input_rate))
+      goto error;
+
+   if (impulse.frames > max_length * info->input_rate)
+      impulse.frames = max_length * info->input_rate;
+   if (!impulse.frames)
+      goto error;
+
+   if (normalize)
+      convolution_normalize(&impulse);
+
+   conv->conv = fft_convolve_new(2, impulse.frames, partition_log2, tail_log2);
+   if (!conv->conv)
+      goto error;
+
+   // A mono response is used for both channels.
+   for (c = 0; c < 2; c++)
+      fft_convolve_set_impulse(conv->conv, c,
+            impulse.samples + (c < impulse.channels ? c : 0),
+            impulse.frames, impulse.channels);
+
+   free(impulse.samples);
+   return conv;
+
+error:
+   config->free(path);
+   free(impulse.samples);
+   convolution_free(conv);
+   return NULL;
+}
+
+static const struct dspfilter_implementation convolution_plug = {
+   convolution_init,
+   convolution_process,
+   convolution_free,
+
+   DSPFILTER_API_VERSION,
+   "Convolution Reverb",
+   "convolution",
+};
+
+#ifdef HAVE_FILTERS_BUILTIN
+#define dspfilter_get_implementation convolution_dspfilter_get_implementation
+#endif
+
+const struct dspfilter_implementation *dspfilter_get_implementation(dspfilter_simd_mask_t mask)
+{
+   (void)mask;
+   return &convolution_plug;
+}
+
+#undef dspfilter_get_implementation
+
@@ -18,7 +18,7 @@
 #include <string.h>
 #include <stdio.h>
 
-#include "fft/fft.c"
+#include "fft/convolve.c"
 
 #ifndef M_PI
 #define M_PI 3.1415926535897932384626433832795
@@ -30,15 +30,8 @@
 
 struct eq_data
 {
-   fft_t *fft;
-   float buffer[8 * 1024];
-
-   float *save;
-   float *block;
-   fft_complex_t *filter;
-   fft_complex_t *fftblock;
+   fft_convolve_t *conv;
    unsigned block_size;
-   unsigned block_ptr;
 };
 
 struct eq_gain
@@ -53,11 +46,7 @@ static void eq_free(void *data)
    if (!eq)
       return;
 
-   fft_free(eq->fft);
-   free(eq->save);
-   free(eq->block);
-   free(eq->fftblock);
-   free(eq->filter);
+   fft_convolve_free(eq->conv);
    free(eq);
 }
 
@@ -66,50 +55,12 @@ static void eq_process(void *data, struct dspfilter_output *output,
 {
    struct eq_data *eq = (struct eq_data*)data;
 
-   output->samples = eq->buffer;
-   output->frames  = 0;
-
-   float *out = eq->buffer;
-   const float *in = input->samples;
-   unsigned input_frames = input->frames;
-
-   while (input_frames)
-   {
-      unsigned write_avail = eq->block_size - eq->block_ptr;
-      if (input_frames < write_avail)
-         write_avail = input_frames;
-
-      memcpy(eq->block + eq->block_ptr * 2, in, write_avail * 2 * sizeof(float));
+   // The convolution outputs one frame for every frame in,
+   // delayed by one partition.
+   output->samples = input->samples;
+   output->frames  = input->frames;
 
-      in += write_avail * 2;
-      input_frames -= write_avail;
-      eq->block_ptr += write_avail;
-
-      // Convolve a new block.
-      if (eq->block_ptr == eq->block_size)
-      {
-         unsigned i, c;
-
-         for (c = 0; c < 2; c++)
-         {
-            fft_process_forward(eq->fft, eq->fftblock, eq->block + c, 2);
-            for (i = 0; i < 2 * eq->block_size; i++)
-               eq->fftblock[i] = fft_complex_mul(eq->fftblock[i], eq->filter[i]);
-            fft_process_inverse(eq->fft, out + c, eq->fftblock, 2);
-         }
-
-         // Overlap add method, so add in saved block now.
-         for (i = 0; i < 2 * eq->block_size; i++)
-            out[i] += eq->save[i];
-
-         // Save block for later.
-         memcpy(eq->save, out + 2 * eq->block_size, 2 * eq->block_size * sizeof(float));
-
-         out += eq->block_size * 2;
-         output->frames += eq->block_size;
-         eq->block_ptr = 0;
-      }
-   }
+   fft_convolve_process(eq->conv, input->samples, input->samples, input->frames);
 }
 
 static int gains_cmp(const void *a_, const void *b_)
@@ -224,18 +175,19 @@ static void create_filter(struct eq_data *eq, unsigned size_log2,
    double window_mod = 1.0 / kaiser_window(0.0, beta);
 
    fft_t *fft = fft_new(size_log2);
-   float *time_filter = (float*)calloc(eq->block_size * 2 + 1, sizeof(*time_filter));
-   if (!fft || !time_filter)
+   fft_complex_t *response = (fft_complex_t*)calloc(eq->block_size + 1, sizeof(*response));
+   float *time_filter = (float*)calloc(eq->block_size, sizeof(*time_filter));
+   if (!fft || !response || !time_filter)
       goto end;
 
    // Make sure bands are in correct order.
    qsort(gains, num_gains, sizeof(*gains), gains_cmp);
 
    // Compute desired filter response.
-   generate_response(eq->filter, gains, num_gains, half_block_size);
+   generate_response(response, gains, num_gains, half_block_size);
 
    // Get equivalent time-domain filter.
-   fft_process_inverse(fft, time_filter, eq->filter, 1);
+   fft_process_inverse(fft, time_filter, response, 1);
 
    // ifftshift() to create the correct linear phase filter.
    // The filter response was designed with zero phase, which won't work unless we compensate
@@ -268,13 +220,14 @@ static void create_filter(struct eq_data *eq, unsigned size_log2,
       }
    }
 
-   // Padded FFT to create our FFT filter.
    // Make our even-length filter odd by discarding the first coefficient.
    // For some interesting reason, this allows us to design an odd-length linear phase filter.
-   fft_process_forward(eq->fft, eq->filter, time_filter + 1, 1);
+   fft_convolve_set_impulse(eq->conv, 0, time_filter + 1, eq->block_size - 1, 1);
+   fft_convolve_set_impulse(eq->conv, 1, time_filter + 1, eq->block_size - 1, 1);
 
 end:
    fft_free(fft);
+   free(response);
    free(time_filter);
 }
 
@@ -296,6 +249,15 @@ static void *eq_init(const struct dspfilter_info *info,
    config->get_int(userdata, "block_size_log2", &size_log2, 8);
    unsigned size = 1 << size_log2;
 
+   // Partitions of the filter are convolved separately,
+   // so the latency is one partition rather than the whole filter.
+   int partition_log2;
+   config->get_int(userdata, "partition_size_log2", &partition_log2, 6);
+   if (partition_log2 > size_log2)
+      partition_log2 = size_log2;
+   if (partition_log2 < FFT_CONVOLVE_MIN_PARTITION_LOG2)
+      partition_log2 = FFT_CONVOLVE_MIN_PARTITION_LOG2;
+
    struct eq_gain *gains = NULL;
    float *frequencies, *gain;
    unsigned num_freq, num_gain;
@@ -324,17 +286,8 @@ static void *eq_init(const struct dspfilter_info *info,
    config->free(gain);
 
    eq->block_size = size;
-
-   eq->save     = (float*)calloc(    size, 2 * sizeof(*eq->save));
-   eq->block    = (float*)calloc(2 * size, 2 * sizeof(*eq->block));
-   eq->fftblock = (fft_complex_t*)calloc(2 * size, sizeof(*eq->fftblock));
-   eq->filter   = (fft_complex_t*)calloc(2 * size, sizeof(*eq->filter));
-
-   // Use an FFT which is twice the block size with zero-padding
-   // to make circular convolution => proper convolution.
-   eq->fft = fft_new(size_log2 + 1);
-
-   if (!eq->fft || !eq->fftblock || !eq->save || !eq->block || !eq->filter)
+   eq->conv = fft_convolve_new(2, size - 1, partition_log2, 0);
+   if (!eq->conv)
       goto error;
 
    create_filter(eq, size_log2, gains, num_gain, beta, filter_path);
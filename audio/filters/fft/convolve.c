@@ -0,0 +1,411 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Plugins include this file directly.
+ * Guard against the griffin build pulling it in twice. */
+#ifndef RARCH_FFT_CONVOLVE_C__
+#define RARCH_FFT_CONVOLVE_C__
+
+#include "convolve.h"
+#include "fft.c"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* One set of equally sized partitions.
+ * Spectra only keep the size + 1 non-redundant bins
+ * since all signals are real. */
+struct fft_convolve_stage
+{
+   fft_t *fft;
+   unsigned size;
+   unsigned bins;
+   unsigned partitions;
+
+   /* [channels][partitions][bins] */
+   fft_complex_t *filter;
+   /* Spectra of past input, newest at fdl_pos. */
+   fft_complex_t *fdl;
+   unsigned fdl_pos;
+   /* [channels][bins] */
+   fft_complex_t *acc;
+
+   /* [channels][2 * size], previous partition followed by the current one. */
+   float *input;
+   /* [channels][size] */
+   float *output;
+};
+
+struct fft_convolve
+{
+   unsigned channels;
+   unsigned pos;
+
+   struct fft_convolve_stage head;
+   struct fft_convolve_stage tail;
+
+   /* Head partitions per tail partition. */
+   unsigned ratio;
+   unsigned phase;
+   /* Tail partition currently being convolved, and its result. */
+   int tail_busy;
+   float *tail_next;
+
+   fft_complex_t *spectrum;
+   float *block;
+};
+
+static void fft_convolve_mac(fft_complex_t *acc, const fft_complex_t *x,
+      const fft_complex_t *h, unsigned bins)
+{
+   unsigned i = 0;
+
+#ifdef __SSE__
+   const __m128 sign = _mm_set_ps(1.0f, -1.0f, 1.0f, -1.0f);
+   for (; i + 2 <= bins; i += 2)
+   {
+      __m128 a    = _mm_loadu_ps(&x[i].real);
+      __m128 b    = _mm_loadu_ps(&h[i].real);
+      __m128 b_re = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+      __m128 b_im = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+      __m128 a_sw = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+      __m128 res  = _mm_add_ps(_mm_mul_ps(a, b_re),
+            _mm_mul_ps(_mm_mul_ps(a_sw, b_im), sign));
+
+      _mm_storeu_ps(&acc[i].real,
+            _mm_add_ps(_mm_loadu_ps(&acc[i].real), res));
+   }
+#endif
+
+   for (; i < bins; i++)
+      acc[i] = fft_complex_add(acc[i], fft_complex_mul(x[i], h[i]));
+}
+
+static int fft_convolve_stage_init(struct fft_convolve_stage *stage,
+      unsigned channels, unsigned size_log2, unsigned partitions)
+{
+   stage->size       = 1 << size_log2;
+   stage->bins       = stage->size + 1;
+   stage->partitions = partitions;
+
+   stage->fft    = fft_new(size_log2 + 1);
+   stage->filter = (fft_complex_t*)calloc(channels * partitions * stage->bins,
+         sizeof(*stage->filter));
+   stage->fdl    = (fft_complex_t*)calloc(channels * partitions * stage->bins,
+         sizeof(*stage->fdl));
+   stage->acc    = (fft_complex_t*)calloc(channels * stage->bins,
+         sizeof(*stage->acc));
+   stage->input  = (float*)calloc(channels * 2 * stage->size,
+         sizeof(*stage->input));
+   stage->output = (float*)calloc(channels * stage->size,
+         sizeof(*stage->output));
+
+   return stage->fft && stage->filter && stage->fdl &&
+      stage->acc && stage->input && stage->output;
+}
+
+static void fft_convolve_stage_free(struct fft_convolve_stage *stage)
+{
+   fft_free(stage->fft);
+   free(stage->filter);
+   free(stage->fdl);
+   free(stage->acc);
+   free(stage->input);
+   free(stage->output);
+}
+
+static void fft_convolve_stage_filter(fft_convolve_t *conv,
+      struct fft_convolve_stage *stage, unsigned channel,
+      const float *impulse, unsigned len, unsigned step)
+{
+   unsigned p, i;
+   fft_complex_t *filter = stage->filter +
+      channel * stage->partitions * stage->bins;
+
+   for (p = 0; p < stage->partitions; p++, filter += stage->bins)
+   {
+      unsigned offset = p * stage->size;
+      unsigned samples = 0;
+
+      if (offset < len)
+         samples = len - offset;
+      if (samples > stage->size)
+         samples = stage->size;
+
+      /* Zero-padded to twice the size, so that circular
+       * convolution becomes proper convolution. */
+      memset(conv->block, 0, 2 * stage->size * sizeof(float));
+      for (i = 0; i < samples; i++)
+         conv->block[i] = impulse[(offset + i) * step];
+
+      fft_process_forward(stage->fft, conv->spectrum, conv->block, 1);
+      memcpy(filter, conv->spectrum, stage->bins * sizeof(*filter));
+   }
+}
+
+/* Pushes the spectrum of the last two partitions of input
+ * into the delay line, and starts a new accumulation. */
+static void fft_convolve_stage_forward(fft_convolve_t *conv,
+      struct fft_convolve_stage *stage, unsigned channel)
+{
+   float *input = stage->input + channel * 2 * stage->size;
+   fft_complex_t *fdl = stage->fdl +
+      (channel * stage->partitions + stage->fdl_pos) * stage->bins;
+
+   fft_process_forward(stage->fft, conv->spectrum, input, 1);
+   memcpy(fdl, conv->spectrum, stage->bins * sizeof(*fdl));
+   memmove(input, input + stage->size, stage->size * sizeof(float));
+
+   memset(stage->acc + channel * stage->bins, 0,
+         stage->bins * sizeof(*stage->acc));
+}
+
+static void fft_convolve_stage_mac(struct fft_convolve_stage *stage,
+      unsigned channel, unsigned first, unsigned last)
+{
+   unsigned p;
+   const fft_complex_t *filter = stage->filter +
+      channel * stage->partitions * stage->bins;
+   const fft_complex_t *fdl = stage->fdl +
+      channel * stage->partitions * stage->bins;
+   fft_complex_t *acc = stage->acc + channel * stage->bins;
+
+   for (p = first; p < last; p++)
+   {
+      unsigned slot = (stage->fdl_pos + stage->partitions - p) % stage->partitions;
+      fft_convolve_mac(acc, fdl + slot * stage->bins,
+            filter + p * stage->bins, stage->bins);
+   }
+}
+
+/* Overlap-save, so only the second half of the inverse is valid. */
+static void fft_convolve_stage_inverse(fft_convolve_t *conv,
+      struct fft_convolve_stage *stage, unsigned channel, float *out)
+{
+   unsigned i;
+   unsigned size = stage->size;
+   const fft_complex_t *acc = stage->acc + channel * stage->bins;
+
+   memcpy(conv->spectrum, acc, stage->bins * sizeof(*acc));
+   for (i = 1; i < size; i++)
+      conv->spectrum[2 * size - i] = fft_complex_conj(acc[i]);
+
+   fft_process_inverse(stage->fft, conv->block, conv->spectrum, 1);
+   memcpy(out, conv->block + size, size * sizeof(float));
+}
+
+void fft_convolve_free(fft_convolve_t *conv)
+{
+   if (!conv)
+      return;
+
+   fft_convolve_stage_free(&conv->head);
+   fft_convolve_stage_free(&conv->tail);
+   free(conv->tail_next);
+   free(conv->spectrum);
+   free(conv->block);
+   free(conv);
+}
+
+fft_convolve_t *fft_convolve_new(unsigned channels, unsigned impulse_len,
+      unsigned partition_log2, unsigned tail_log2)
+{
+   unsigned head_len, max_size;
+   fft_convolve_t *conv = (fft_convolve_t*)calloc(1, sizeof(*conv));
+   if (!conv)
+      return NULL;
+
+   conv->channels = channels;
+   if (!impulse_len)
+      impulse_len = 1;
+
+   /* The tail only kicks in past two tail partitions,
+    * which leaves one tail partition worth of time to convolve it. */
+   head_len = impulse_len;
+   if (tail_log2 > partition_log2 && impulse_len > (2u << tail_log2))
+      head_len = 2u << tail_log2;
+   else
+      tail_log2 = 0;
+
+   if (!fft_convolve_stage_init(&conv->head, channels, partition_log2,
+            (head_len + (1u << partition_log2) - 1) >> partition_log2))
+      goto error;
+   max_size = conv->head.size;
+
+   if (tail_log2)
+   {
+      unsigned tail_len = impulse_len - head_len;
+      if (!fft_convolve_stage_init(&conv->tail, channels, tail_log2,
+               (tail_len + (1u << tail_log2) - 1) >> tail_log2))
+         goto error;
+
+      conv->ratio     = conv->tail.size / conv->head.size;
+      conv->tail_next = (float*)calloc(channels * conv->tail.size,
+            sizeof(*conv->tail_next));
+      if (!conv->tail_next)
+         goto error;
+      max_size = conv->tail.size;
+   }
+
+   conv->spectrum = (fft_complex_t*)calloc(2 * max_size, sizeof(*conv->spectrum));
+   conv->block    = (float*)calloc(2 * max_size, sizeof(*conv->block));
+   if (!conv->spectrum || !conv->block)
+      goto error;
+
+   return conv;
+
+error:
+   fft_convolve_free(conv);
+   return NULL;
+}
+
+void fft_convolve_set_impulse(fft_convolve_t *conv, unsigned channel,
+      const float *impulse, unsigned len, unsigned step)
+{
+   unsigned head_len = conv->head.partitions * conv->head.size;
+
+   fft_convolve_stage_filter(conv, &conv->head, channel, impulse, len, step);
+
+   if (conv->tail.partitions)
+   {
+      unsigned tail_len = len > head_len ? len - head_len : 0;
+      fft_convolve_stage_filter(conv, &conv->tail, channel,
+            impulse + head_len * step, tail_len, step);
+   }
+}
+
+/* Feeds the head partition which was just filled to the tail,
+ * and does this head partition's share of the tail work.
+ *
+ * A tail partition is transformed once the next one starts,
+ * its partitions are accumulated over the next ratio head
+ * partitions, and the result is output over the ratio head
+ * partitions after that, which is just when it is due. */
+static void fft_convolve_tail(fft_convolve_t *conv)
+{
+   unsigned c;
+   struct fft_convolve_stage *head = &conv->head;
+   struct fft_convolve_stage *tail = &conv->tail;
+   unsigned first, last;
+
+   if (conv->phase == 0 && conv->tail_busy)
+      tail->fdl_pos = (tail->fdl_pos + 1) % tail->partitions;
+
+   for (c = 0; c < conv->channels; c++)
+   {
+      if (conv->phase == 0 && conv->tail_busy)
+         fft_convolve_stage_forward(conv, tail, c);
+
+      memcpy(tail->input + c * 2 * tail->size + tail->size + conv->phase * head->size,
+            head->input + c * 2 * head->size + head->size,
+            head->size * sizeof(float));
+   }
+
+   if (!conv->tail_busy)
+      return;
+
+   first = conv->phase * tail->partitions / conv->ratio;
+   last  = (conv->phase + 1) * tail->partitions / conv->ratio;
+
+   for (c = 0; c < conv->channels; c++)
+   {
+      fft_convolve_stage_mac(tail, c, first, last);
+      if (conv->phase == conv->ratio - 1)
+         fft_convolve_stage_inverse(conv, tail, c,
+               conv->tail_next + c * tail->size);
+   }
+}
+
+static void fft_convolve_partition(fft_convolve_t *conv)
+{
+   unsigned c, i;
+   struct fft_convolve_stage *head = &conv->head;
+
+   if (conv->tail.partitions)
+      fft_convolve_tail(conv);
+
+   head->fdl_pos = (head->fdl_pos + 1) % head->partitions;
+
+   for (c = 0; c < conv->channels; c++)
+   {
+      float *out = head->output + c * head->size;
+
+      fft_convolve_stage_forward(conv, head, c);
+      fft_convolve_stage_mac(head, c, 0, head->partitions);
+      fft_convolve_stage_inverse(conv, head, c, out);
+
+      if (conv->tail.partitions)
+      {
+         const float *tail_out = conv->tail.output +
+            c * conv->tail.size + conv->phase * head->size;
+         for (i = 0; i < head->size; i++)
+            out[i] += tail_out[i];
+      }
+   }
+
+   if (conv->tail.partitions && ++conv->phase == conv->ratio)
+   {
+      float *tmp = conv->tail.output;
+      conv->tail.output = conv->tail_next;
+      conv->tail_next = tmp;
+
+      conv->phase = 0;
+      conv->tail_busy = 1;
+   }
+}
+
+void fft_convolve_process(fft_convolve_t *conv,
+      float *out, const float *in, unsigned frames)
+{
+   unsigned c, i;
+   unsigned channels = conv->channels;
+   struct fft_convolve_stage *head = &conv->head;
+
+   while (frames)
+   {
+      unsigned avail = head->size - conv->pos;
+      if (avail > frames)
+         avail = frames;
+
+      for (c = 0; c < channels; c++)
+      {
+         float *input = head->input + c * 2 * head->size + head->size + conv->pos;
+         const float *output = head->output + c * head->size + conv->pos;
+
+         for (i = 0; i < avail; i++)
+         {
+            input[i] = in[i * channels + c];
+            out[i * channels + c] = output[i];
+         }
+      }
+
+      in += avail * channels;
+      out += avail * channels;
+      frames -= avail;
+
+      conv->pos += avail;
+      if (conv->pos == head->size)
+      {
+         fft_convolve_partition(conv);
+         conv->pos = 0;
+      }
+   }
+}
+
+#endif
+
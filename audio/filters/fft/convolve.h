@@ -0,0 +1,55 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RARCH_FFT_CONVOLVE_H__
+#define RARCH_FFT_CONVOLVE_H__
+
+#include "fft.h"
+
+/* Partitioned overlap-save convolution of interleaved audio.
+ * Every channel has its own impulse response.
+ *
+ * The head of the impulse response is cut into partitions of
+ * 1 << partition_log2 samples, which is also the latency.
+ * Every partition of audio costs the same amount of FFT work,
+ * no matter when in the stream it comes.
+ *
+ * With a non-zero tail_log2, everything past the first
+ * 2 << tail_log2 samples of the impulse response is convolved
+ * in partitions of 1 << tail_log2 samples instead, which is far
+ * cheaper for long responses. The tail work is spread out over
+ * the head partitions, so it does not add spikes. */
+typedef struct fft_convolve fft_convolve_t;
+
+/* Smaller partitions barely lower latency any further,
+ * but make every sample cost far more FFT work. */
+#define FFT_CONVOLVE_MIN_PARTITION_LOG2 4
+
+fft_convolve_t *fft_convolve_new(unsigned channels, unsigned impulse_len,
+      unsigned partition_log2, unsigned tail_log2);
+
+void fft_convolve_free(fft_convolve_t *conv);
+
+/* Sets the impulse response of a channel from len samples,
+ * step apart. len must not exceed impulse_len. */
+void fft_convolve_set_impulse(fft_convolve_t *conv, unsigned channel,
+      const float *impulse, unsigned len, unsigned step);
+
+/* Convolves frames of interleaved audio. out may be in. */
+void fft_convolve_process(fft_convolve_t *conv,
+      float *out, const float *in, unsigned frames);
+
+#endif
+
@@ -19,6 +19,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 #define phaserlfoshape 4.0
 #define phaserlfoskipsamples 20
 
@@ -33,7 +37,8 @@ struct phaser_data
    float fb;
    float depth;
    float drywet;
-   float old[2][24];
+   /* Left and right interleaved. */
+   float old[24][2];
    float gain;
    float fbout[2];
    float lfoskip;
@@ -48,6 +53,16 @@ static void phaser_free(void *data)
    free(data);
 }
 
+static inline void phaser_update_gain(struct phaser_data *ph)
+{
+   if ((ph->skipcount++ % phaserlfoskipsamples) == 0)
+   {
+      ph->gain = 0.5 * (1.0 + cos(ph->skipcount * ph->lfoskip + ph->phase));
+      ph->gain = (exp(ph->gain * phaserlfoshape) - 1.0) / (exp(phaserlfoshape) - 1);
+      ph->gain = 1.0 - ph->gain * ph->depth;
+   }
+}
+
 static void phaser_process(void *data, struct dspfilter_output *output,
       const struct dspfilter_input *input)
 {
@@ -67,20 +82,15 @@ static void phaser_process(void *data, struct dspfilter_output *output,
       for (c = 0; c < 2; c++)
          m[c] = in[c] + ph->fbout[c] * ph->fb * 0.01f;
 
-      if ((ph->skipcount++ % phaserlfoskipsamples) == 0)
-      {
-         ph->gain = 0.5 * (1.0 + cos(ph->skipcount * ph->lfoskip + ph->phase));
-         ph->gain = (exp(ph->gain * phaserlfoshape) - 1.0) / (exp(phaserlfoshape) - 1);
-         ph->gain = 1.0 - ph->gain * ph->depth;
-      }
+      phaser_update_gain(ph);
 
       for (s = 0; s < ph->stages; s++)
       {
          for (c = 0; c < 2; c++)
          {
-            tmp[c] = ph->old[c][s];
-            ph->old[c][s] = ph->gain * tmp[c] + m[c];
-            m[c] = tmp[c] - ph->gain * ph->old[c][s];
+            tmp[c] = ph->old[s][c];
+            ph->old[s][c] = ph->gain * tmp[c] + m[c];
+            m[c] = tmp[c] - ph->gain * ph->old[s][c];
          }
       }
 
@@ -92,6 +102,49 @@ static void phaser_process(void *data, struct dspfilter_output *output,
    }
 }
 
+#ifdef __SSE__
+/* Left and right go through the stages together in the low lanes. */
+static void phaser_process_sse(void *data, struct dspfilter_output *output,
+      const struct dspfilter_input *input)
+{
+   unsigned i;
+   int s;
+   struct phaser_data *ph = (struct phaser_data*)data;
+
+   output->samples = input->samples;
+   output->frames  = input->frames;
+   float *out = output->samples;
+
+   __m128 fb     = _mm_set1_ps(ph->fb * 0.01f);
+   __m128 wet    = _mm_set1_ps(ph->drywet);
+   __m128 dry    = _mm_set1_ps(1.0f - ph->drywet);
+   __m128 fbout  = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)ph->fbout);
+
+   for (i = 0; i < input->frames; i++, out += 2)
+   {
+      __m128 in = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)out);
+      __m128 m  = _mm_add_ps(in, _mm_mul_ps(fbout, fb));
+
+      phaser_update_gain(ph);
+      __m128 gain = _mm_set1_ps(ph->gain);
+
+      for (s = 0; s < ph->stages; s++)
+      {
+         __m128 tmp = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)ph->old[s]);
+         __m128 old = _mm_add_ps(_mm_mul_ps(gain, tmp), m);
+         _mm_storel_pi((__m64*)ph->old[s], old);
+         m = _mm_sub_ps(tmp, _mm_mul_ps(gain, old));
+      }
+
+      fbout = m;
+      _mm_storel_pi((__m64*)out, _mm_add_ps(_mm_mul_ps(m, wet),
+               _mm_mul_ps(in, dry)));
+   }
+
+   _mm_storel_pi((__m64*)ph->fbout, fbout);
+}
+#endif
+
 static void *phaser_init(const struct dspfilter_info *info,
       const struct dspfilter_config *config, void *userdata)
 {
@@ -129,12 +182,28 @@ static const struct dspfilter_implementation phaser_plug = {
    "phaser",
 };
 
+#ifdef __SSE__
+static const struct dspfilter_implementation phaser_sse_plug = {
+   phaser_init,
+   phaser_process_sse,
+   phaser_free,
+
+   DSPFILTER_API_VERSION,
+   "Phaser",
+   "phaser",
+};
+#endif
+
 #ifdef HAVE_FILTERS_BUILTIN
 #define dspfilter_get_implementation phaser_dspfilter_get_implementation
 #endif
 
 const struct dspfilter_implementation *dspfilter_get_implementation(dspfilter_simd_mask_t mask)
 {
+#ifdef __SSE__
+   if (mask & DSPFILTER_SIMD_SSE)
+      return &phaser_sse_plug;
+#endif
    (void)mask;
    return &phaser_plug;
 }
@@ -19,50 +19,66 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+/* Left and right run the same model with the same tunings,
+ * so their delay lines are interleaved, and share an index. */
+
 struct comb
 {
    float *buffer;
    unsigned bufsize;
    unsigned bufidx;
 
-   float feedback;
-   float filterstore;
-   float damp1, damp2;
+   float filterstore[2];
 };
 
-static inline float comb_process(struct comb *c, float input)
+static inline void comb_process(struct comb *c, const float *input,
+      float *output, float feedback, float damp1, float damp2)
 {
-   float output = c->buffer[c->bufidx];
-   c->filterstore = (output * c->damp2) + (c->filterstore * c->damp1);
+   unsigned i;
+   float *buf = c->buffer + c->bufidx * 2;
 
-   c->buffer[c->bufidx] = input + (c->filterstore * c->feedback);
+   for (i = 0; i < 2; i++)
+   {
+      float bufout = buf[i];
+      c->filterstore[i] = (bufout * damp2) + (c->filterstore[i] * damp1);
+      buf[i] = input[i] + (c->filterstore[i] * feedback);
+      output[i] += bufout;
+   }
 
    c->bufidx++;
    if (c->bufidx >= c->bufsize)
       c->bufidx = 0;
-
-   return output;
 }
 
 struct allpass
 {
    float *buffer;
-   float feedback;
    unsigned bufsize;
    unsigned bufidx;
 };
 
-static inline float allpass_process(struct allpass *a, float input)
+static const float allpassfeedback = 0.5f;
+
+static inline void allpass_process(struct allpass *a, float *inout)
 {
-   float bufout = a->buffer[a->bufidx];
-   float output = -input + bufout;
-   a->buffer[a->bufidx] = input + bufout * a->feedback;
+   unsigned i;
+   float *buf = a->buffer + a->bufidx * 2;
+
+   for (i = 0; i < 2; i++)
+   {
+      float bufout = buf[i];
+      float output = -inout[i] + bufout;
+      buf[i] = inout[i] + bufout * allpassfeedback;
+      inout[i] = output;
+   }
 
    a->bufidx++;
    if (a->bufidx >= a->bufsize)
       a->bufidx = 0;
-
-   return output;
 }
 
 #define numcombs 8
@@ -100,47 +116,48 @@ struct revmodel
    struct comb combL[numcombs];
    struct allpass allpassL[numallpasses];
 
-   float bufcombL1[combtuningL1];
-   float bufcombL2[combtuningL2];
-   float bufcombL3[combtuningL3];
-   float bufcombL4[combtuningL4];
-   float bufcombL5[combtuningL5];
-   float bufcombL6[combtuningL6];
-   float bufcombL7[combtuningL7];
-   float bufcombL8[combtuningL8];
+   float bufcombL1[combtuningL1 * 2];
+   float bufcombL2[combtuningL2 * 2];
+   float bufcombL3[combtuningL3 * 2];
+   float bufcombL4[combtuningL4 * 2];
+   float bufcombL5[combtuningL5 * 2];
+   float bufcombL6[combtuningL6 * 2];
+   float bufcombL7[combtuningL7 * 2];
+   float bufcombL8[combtuningL8 * 2];
 
-   float bufallpassL1[allpasstuningL1];
-   float bufallpassL2[allpasstuningL2];
-   float bufallpassL3[allpasstuningL3];
-   float bufallpassL4[allpasstuningL4];
+   float bufallpassL1[allpasstuningL1 * 2];
+   float bufallpassL2[allpasstuningL2 * 2];
+   float bufallpassL3[allpasstuningL3 * 2];
+   float bufallpassL4[allpasstuningL4 * 2];
 
    float gain;
    float roomsize, roomsize1;
-   float damp, damp1;
+   float damp, damp1, damp2;
    float wet, wet1, wet2;
    float dry;
    float width;
    float mode;
 };
 
-static float revmodel_process(struct revmodel *rev, float in)
+static void revmodel_process(struct revmodel *rev, float *inout)
 {
    int i;
-   float mono_out = 0.0f;
-   float mono_in = in;
-   float input = mono_in * rev->gain;
+   float out[2] = { 0.0f, 0.0f };
+   float input[2] = { inout[0] * rev->gain, inout[1] * rev->gain };
+
    for (i = 0; i < numcombs; i++)
-      mono_out += comb_process(&rev->combL[i], input);
+      comb_process(&rev->combL[i], input, out,
+            rev->roomsize1, rev->damp1, rev->damp2);
 
    for (i = 0; i < numallpasses; i++)
-      mono_out = allpass_process(&rev->allpassL[i], mono_out);
+      allpass_process(&rev->allpassL[i], out);
 
-   return mono_in * rev->dry + mono_out * rev->wet1;
+   inout[0] = inout[0] * rev->dry + out[0] * rev->wet1;
+   inout[1] = inout[1] * rev->dry + out[1] * rev->wet1;
 }
 
 static void revmodel_update(struct revmodel *rev)
 {
-   int i;
    rev->wet1 = rev->wet * (rev->width / 2.0f + 0.5f);
 
    if (rev->mode >= freezemode)
@@ -156,12 +173,7 @@ static void revmodel_update(struct revmodel *rev)
       rev->gain = fixedgain;
    }
 
-   for (i = 0; i < numcombs; i++)
-   {
-      rev->combL[i].feedback = rev->roomsize1;
-      rev->combL[i].damp1 = rev->damp1;
-      rev->combL[i].damp2 = 1.0f - rev->damp1;
-   }
+   rev->damp2 = 1.0f - rev->damp1;
 }
 
 static void revmodel_setroomsize(struct revmodel *rev, float value)
@@ -216,11 +228,6 @@ static void revmodel_init(struct revmodel *rev)
    rev->allpassL[2].buffer = rev->bufallpassL3; rev->allpassL[2].bufsize = allpasstuningL3;
    rev->allpassL[3].buffer = rev->bufallpassL4; rev->allpassL[3].bufsize = allpasstuningL4;
 
-   rev->allpassL[0].feedback = 0.5f;
-   rev->allpassL[1].feedback = 0.5f;
-   rev->allpassL[2].feedback = 0.5f;
-   rev->allpassL[3].feedback = 0.5f;
-
    revmodel_setwet(rev, initialwet);
    revmodel_setroomsize(rev, initialroom);
    revmodel_setdry(rev, initialdry);
@@ -231,7 +238,7 @@ static void revmodel_init(struct revmodel *rev)
 
 struct reverb_data
 {
-   struct revmodel left, right;
+   struct revmodel rev;
 };
 
 static void reverb_free(void *data)
@@ -249,14 +256,100 @@ static void reverb_process(void *data, struct dspfilter_output *output,
    output->frames  = input->frames;
    float *out = output->samples;
 
+   for (i = 0; i < input->frames; i++, out += 2)
+      revmodel_process(&rev->rev, out);
+}
+
+#ifdef __SSE__
+/* Runs two combs at a time, with lanes { A.l, A.r, B.l, B.r }. */
+static void reverb_process_sse(void *data, struct dspfilter_output *output,
+      const struct dspfilter_input *input)
+{
+   unsigned i, c;
+   struct reverb_data *data_ = (struct reverb_data*)data;
+   struct revmodel *rev = &data_->rev;
+   __m128 filterstore[numcombs / 2];
+
+   output->samples = input->samples;
+   output->frames  = input->frames;
+   float *out = output->samples;
+
+   __m128 gain     = _mm_set1_ps(rev->gain);
+   __m128 feedback = _mm_set1_ps(rev->roomsize1);
+   __m128 damp1    = _mm_set1_ps(rev->damp1);
+   __m128 damp2    = _mm_set1_ps(rev->damp2);
+   __m128 dry      = _mm_set1_ps(rev->dry);
+   __m128 wet1     = _mm_set1_ps(rev->wet1);
+   __m128 apfb     = _mm_set1_ps(allpassfeedback);
+
+   for (c = 0; c < numcombs / 2; c++)
+   {
+      filterstore[c] = _mm_loadl_pi(_mm_setzero_ps(),
+            (const __m64*)rev->combL[2 * c].filterstore);
+      filterstore[c] = _mm_loadh_pi(filterstore[c],
+            (const __m64*)rev->combL[2 * c + 1].filterstore);
+   }
+
    for (i = 0; i < input->frames; i++, out += 2)
    {
-      float in[2] = { out[0], out[1] };
+      __m128 in    = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)out);
+      __m128 comb_in = _mm_mul_ps(_mm_movelh_ps(in, in), gain);
+      __m128 sum   = _mm_setzero_ps();
+
+      for (c = 0; c < numcombs / 2; c++)
+      {
+         struct comb *a = &rev->combL[2 * c];
+         struct comb *b = &rev->combL[2 * c + 1];
+         float *buf_a = a->buffer + a->bufidx * 2;
+         float *buf_b = b->buffer + b->bufidx * 2;
+
+         __m128 bufout = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)buf_a);
+         bufout = _mm_loadh_pi(bufout, (const __m64*)buf_b);
+
+         filterstore[c] = _mm_add_ps(_mm_mul_ps(bufout, damp2),
+               _mm_mul_ps(filterstore[c], damp1));
+
+         __m128 store = _mm_add_ps(comb_in,
+               _mm_mul_ps(filterstore[c], feedback));
+         _mm_storel_pi((__m64*)buf_a, store);
+         _mm_storeh_pi((__m64*)buf_b, store);
+
+         sum = _mm_add_ps(sum, bufout);
+
+         if (++a->bufidx >= a->bufsize)
+            a->bufidx = 0;
+         if (++b->bufidx >= b->bufsize)
+            b->bufidx = 0;
+      }
+
+      /* { l, r, l, r } -> { L, R } */
+      __m128 mono = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+
+      for (c = 0; c < numallpasses; c++)
+      {
+         struct allpass *a = &rev->allpassL[c];
+         float *buf = a->buffer + a->bufidx * 2;
+         __m128 bufout = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)buf);
+
+         _mm_storel_pi((__m64*)buf,
+               _mm_add_ps(mono, _mm_mul_ps(bufout, apfb)));
+         mono = _mm_sub_ps(bufout, mono);
+
+         if (++a->bufidx >= a->bufsize)
+            a->bufidx = 0;
+      }
+
+      _mm_storel_pi((__m64*)out, _mm_add_ps(_mm_mul_ps(in, dry),
+               _mm_mul_ps(mono, wet1)));
+   }
 
-      out[0] = revmodel_process(&rev->left, in[0]);
-      out[1] = revmodel_process(&rev->right, in[1]);
+   for (c = 0; c < numcombs / 2; c++)
+   {
+      _mm_storel_pi((__m64*)rev->combL[2 * c].filterstore, filterstore[c]);
+      _mm_storeh_pi((__m64*)rev->combL[2 * c + 1].filterstore, filterstore[c]);
    }
 }
+#endif
 
 static void *reverb_init(const struct dspfilter_info *info,
       const struct dspfilter_config *config, void *userdata)
@@ -272,20 +365,13 @@ static void *reverb_init(const struct dspfilter_info *info,
    config->get_float(userdata, "roomwidth", &roomwidth, 0.56f);
    config->get_float(userdata, "roomsize", &roomsize, 0.56f);
 
-   revmodel_init(&rev->left);
-   revmodel_init(&rev->right);
+   revmodel_init(&rev->rev);
 
-   revmodel_setdamp(&rev->left, damping);
-   revmodel_setdry(&rev->left, drytime);
-   revmodel_setwet(&rev->left, wettime);
-   revmodel_setwidth(&rev->left, roomwidth);
-   revmodel_setroomsize(&rev->left, roomsize);
-
-   revmodel_setdamp(&rev->right, damping);
-   revmodel_setdry(&rev->right, drytime);
-   revmodel_setwet(&rev->right, wettime);
-   revmodel_setwidth(&rev->right, roomwidth);
-   revmodel_setroomsize(&rev->right, roomsize);
+   revmodel_setdamp(&rev->rev, damping);
+   revmodel_setdry(&rev->rev, drytime);
+   revmodel_setwet(&rev->rev, wettime);
+   revmodel_setwidth(&rev->rev, roomwidth);
+   revmodel_setroomsize(&rev->rev, roomsize);
 
    return rev;
 }
@@ -300,12 +386,28 @@ static const struct dspfilter_implementation reverb_plug = {
    "reverb",
 };
 
+#ifdef __SSE__
+static const struct dspfilter_implementation reverb_sse_plug = {
+   reverb_init,
+   reverb_process_sse,
+   reverb_free,
+
+   DSPFILTER_API_VERSION,
+   "Reverb",
+   "reverb",
+};
+#endif
+
 #ifdef HAVE_FILTERS_BUILTIN
 #define dspfilter_get_implementation reverb_dspfilter_get_implementation
 #endif
 
 const struct dspfilter_implementation *dspfilter_get_implementation(dspfilter_simd_mask_t mask)
 {
+#ifdef __SSE__
+   if (mask & DSPFILTER_SIMD_SSE)
+      return &reverb_sse_plug;
+#endif
    (void)mask;
    return &reverb_plug;
 }
@@ -25,6 +25,7 @@
 #include "../../general.h"
 #else
 /* FIXME - variadic macros not supported for MSVC 2003 */
+#include <stdio.h>
 #define RARCH_LOG(...) fprintf(stderr, __VA_ARGS__)
 #endif
 
@@ -188,11 +189,12 @@ static void resampler_CC_free(void *re_)
 }
 
 static void *resampler_CC_init(const struct resampler_config *config,
-      double bandwidth_mod, resampler_simd_mask_t mask)
+      void *userdata, double bandwidth_mod, resampler_simd_mask_t mask)
 {
    (void)mask;
    (void)bandwidth_mod;
    (void)config;
+   (void)userdata;
 
    __asm__ (
          ".set      push\n"
@@ -551,7 +553,7 @@ static void resampler_CC_free(void *re_)
 }
 
 static void *resampler_CC_init(const struct resampler_config *config,
-      double bandwidth_mod, resampler_simd_mask_t mask)
+      void *userdata, double bandwidth_mod, resampler_simd_mask_t mask)
 {
    int i;
    rarch_CC_resampler_t *re = (rarch_CC_resampler_t*)
@@ -563,6 +565,7 @@ static void *resampler_CC_init(const struct resampler_config *config,
     * Android. */
    (void)mask;
    (void)config;
+   (void)userdata;
 
    if (!re)
       return NULL;
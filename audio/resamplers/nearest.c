@@ -8,6 +8,7 @@
 #include "../../general.h"
 #else
 /* FIXME - variadic macros not supported for MSVC 2003 */
+#include <stdio.h>
 #define RARCH_LOG(...) fprintf(stderr, __VA_ARGS__)
 #endif
  
@@ -49,12 +50,13 @@ static void resampler_nearest_free(void *re_)
 }
  
 static void *resampler_nearest_init(const struct resampler_config *config,
-      double bandwidth_mod, resampler_simd_mask_t mask)
+      void *userdata, double bandwidth_mod, resampler_simd_mask_t mask)
 {
    rarch_nearest_resampler_t *re = (rarch_nearest_resampler_t*)
       calloc(1, sizeof(rarch_nearest_resampler_t));
 
    (void)config;
+   (void)userdata;
    (void)mask;
 
    if (!re)
@@ -95,13 +95,34 @@ static const rarch_resampler_t *find_resampler_driver(const char *ident)
    }
 }
 
+/* Resampler options are loaded along with the main config file. 
+ * Hand them to the backend without reading that file again. */
+static config_file_t *resampler_config_open(void)
+{
+   config_file_t *conf = config_file_new(NULL);
+#if !defined(RESAMPLER_TEST) && defined(RARCH_INTERNAL)
+   if (conf && *g_settings.audio.resampler_quality)
+      config_set_string(conf, "audio_resampler_quality",
+            g_settings.audio.resampler_quality);
+#endif
+   return conf;
+}
+
 static bool resampler_append_plugs(void **re,
       const rarch_resampler_t **backend,
       double bw_ratio)
 {
+   struct config_file_userdata userdata;
    resampler_simd_mask_t mask = rarch_get_cpu_features();
 
-   *re = (*backend)->init(&resampler_config, bw_ratio, mask);
+   userdata.conf      = resampler_config_open();
+   userdata.prefix[0] = "audio_resampler";
+   userdata.prefix[1] = (*backend)->short_ident;
+   if (!userdata.conf)
+      return false;
+
+   *re = (*backend)->init(&resampler_config, &userdata, bw_ratio, mask);
+   config_file_free(userdata.conf);
 
    if (!*re)
       return false;
@@ -53,7 +53,7 @@ extern "C" {
  */
 typedef unsigned resampler_simd_mask_t;
 
-#define RESAMPLER_API_VERSION 1
+#define RESAMPLER_API_VERSION 2
 
 struct resampler_data
 {
@@ -105,10 +105,13 @@ struct resampler_config
    resampler_config_free_t free; 
 };
 
-/* Bandwidth factor. Will be < 1.0 for downsampling, > 1.0 for upsampling. 
+/* userdata is passed to the config callbacks. Keys are looked up as
+ * "audio_resampler_<key>", then "<short_ident>_<key>".
+ *
+ * Bandwidth factor. Will be < 1.0 for downsampling, > 1.0 for upsampling. 
  * Corresponds to expected resampling ratio. */
 typedef void *(*resampler_init_t)(const struct resampler_config *config,
-      double bandwidth_mod, resampler_simd_mask_t mask);
+      void *userdata, double bandwidth_mod, resampler_simd_mask_t mask);
 
 /* Frees the handle. */
 typedef void (*resampler_free_t)(void *data);
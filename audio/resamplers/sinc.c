@@ -21,10 +21,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <compat/posix_string.h>
+#include <retro_simd.h>
 
 #if !defined(RESAMPLER_TEST) && defined(RARCH_INTERNAL)
 #include "../../general.h"
 #else
+#include <stdio.h>
 #define RARCH_LOG(...) fprintf(stderr, __VA_ARGS__)
 #endif
 
@@ -32,77 +34,70 @@
 #include <xmmintrin.h>
 #endif
 
+#ifdef HAVE_RETRO_TARGET_X86
+#include <immintrin.h>
+#endif
+
 /* Rough SNR values for upsampling:
  * LOWEST: 40 dB
  * LOWER: 55 dB
  * NORMAL: 70 dB
  * HIGHER: 110 dB
  * HIGHEST: 140 dB
+ *
+ * Selected with audio_resampler_quality in the config.
+ * The SINC_*_QUALITY defines only pick the default.
  */
 
-/* TODO, make all this more configurable. */
 #if defined(SINC_LOWEST_QUALITY)
-#define SINC_WINDOW_LANCZOS
-#define CUTOFF 0.98
-#define PHASE_BITS 12
-#define SINC_COEFF_LERP 0
-#define SUBPHASE_BITS 10
-#define SIDELOBES 2
-#define ENABLE_AVX 0
+#define SINC_DEFAULT_QUALITY "lowest"
 #elif defined(SINC_LOWER_QUALITY)
-#define SINC_WINDOW_LANCZOS
-#define CUTOFF 0.98
-#define PHASE_BITS 12
-#define SUBPHASE_BITS 10
-#define SINC_COEFF_LERP 0
-#define SIDELOBES 4
-#define ENABLE_AVX 0
+#define SINC_DEFAULT_QUALITY "lower"
 #elif defined(SINC_HIGHER_QUALITY)
-#define SINC_WINDOW_KAISER
-#define SINC_WINDOW_KAISER_BETA 10.5
-#define CUTOFF 0.90
-#define PHASE_BITS 10
-#define SUBPHASE_BITS 14
-#define SINC_COEFF_LERP 1
-#define SIDELOBES 32
-#define ENABLE_AVX 1
+#define SINC_DEFAULT_QUALITY "higher"
 #elif defined(SINC_HIGHEST_QUALITY)
-#define SINC_WINDOW_KAISER
-#define SINC_WINDOW_KAISER_BETA 14.5
-#define CUTOFF 0.962
-#define PHASE_BITS 10
-#define SUBPHASE_BITS 14
-#define SINC_COEFF_LERP 1
-#define SIDELOBES 128
-#define ENABLE_AVX 1
+#define SINC_DEFAULT_QUALITY "highest"
 #else
-#define SINC_WINDOW_KAISER
-#define SINC_WINDOW_KAISER_BETA 5.5
-#define CUTOFF 0.825
-#define PHASE_BITS 8
-#define SUBPHASE_BITS 16
-#define SINC_COEFF_LERP 1
-#define SIDELOBES 8
-#define ENABLE_AVX 0
+#define SINC_DEFAULT_QUALITY "normal"
 #endif
 
-/* For the little amount of taps we're using,
- * SSE1 is faster than AVX for some reason.
- * AVX code is kept here though as by increasing number
- * of sinc taps, the AVX code is clearly faster than SSE1.
- */
+enum sinc_window
+{
+   SINC_WINDOW_LANCZOS = 0,
+   SINC_WINDOW_KAISER
+};
 
-#if defined(__AVX__) && ENABLE_AVX
-#include <immintrin.h>
-#endif
+struct sinc_quality
+{
+   const char *ident;
+   enum sinc_window window;
+   double kaiser_beta;
+   double cutoff;
+   unsigned phase_bits;
+   unsigned subphase_bits;
+   bool coeff_lerp;
+   unsigned sidelobes;
+
+   /* For the little amount of taps the lower levels use,
+    * SSE is faster than AVX for some reason. With more
+    * taps, the 8-wide code is clearly faster. */
+   bool wide;
+};
+
+static const struct sinc_quality sinc_qualities[] = {
+   { "lowest",  SINC_WINDOW_LANCZOS, 0.0,  0.98,  12, 10, false, 2,   false },
+   { "lower",   SINC_WINDOW_LANCZOS, 0.0,  0.98,  12, 10, false, 4,   false },
+   { "normal",  SINC_WINDOW_KAISER,  5.5,  0.825, 8,  16, true,  8,   false },
+   { "higher",  SINC_WINDOW_KAISER,  10.5, 0.90,  10, 14, true,  32,  true  },
+   { "highest", SINC_WINDOW_KAISER,  14.5, 0.962, 10, 14, true,  128, true  },
+};
 
-#define PHASES (1 << (PHASE_BITS + SUBPHASE_BITS))
+typedef struct rarch_sinc_resampler rarch_sinc_resampler_t;
 
-#define TAPS (SIDELOBES * 2)
-#define SUBPHASE_MASK ((1 << SUBPHASE_BITS) - 1)
-#define SUBPHASE_MOD (1.0f / (1 << SUBPHASE_BITS))
+typedef void (*process_sinc_t)(rarch_sinc_resampler_t *resamp,
+      float *out_buffer);
 
-typedef struct rarch_sinc_resampler
+struct rarch_sinc_resampler
 {
    float *phase_table;
    float *buffer_l;
@@ -113,11 +108,18 @@ typedef struct rarch_sinc_resampler
    unsigned ptr;
    uint32_t time;
 
+   uint32_t phases;
+   unsigned subphase_bits;
+   uint32_t subphase_mask;
+   float subphase_mod;
+
+   process_sinc_t process;
+
    /* A buffer for phase_table, buffer_l and buffer_r 
     * are created in a single calloc().
     * Ensure that we get as good cache locality as we can hope for. */
    float *main_buffer;
-} rarch_sinc_resampler_t;
+};
 
 static inline double sinc(double val)
 {
@@ -126,12 +128,6 @@ static inline double sinc(double val)
    return sin(val) / val;
 }
 
-#if defined(SINC_WINDOW_LANCZOS)
-static inline double window_function(double idx)
-{
-   return sinc(M_PI * idx);
-}
-#elif defined(SINC_WINDOW_KAISER)
 /* Modified Bessel function of first order.
  * Check Wiki for mathematical definition ... */
 static inline double besseli0(double x)
@@ -160,19 +156,19 @@ static inline double besseli0(double x)
    return sum;
 }
 
-static inline double window_function(double idx)
+static inline double window_function(const struct sinc_quality *q,
+      double idx)
 {
-   return besseli0(SINC_WINDOW_KAISER_BETA * sqrt(1 - idx * idx));
+   if (q->window == SINC_WINDOW_LANCZOS)
+      return sinc(M_PI * idx);
+   return besseli0(q->kaiser_beta * sqrt(1 - idx * idx));
 }
-#else
-#error "No SINC window function defined."
-#endif
 
-static void init_sinc_table(rarch_sinc_resampler_t *resamp, double cutoff,
+static void init_sinc_table(const struct sinc_quality *q, double cutoff,
       float *phase_table, int phases, int taps, bool calculate_delta)
 {
    int i, j, p;
-   double window_mod = window_function(0.0); /* Need to normalize w(0) to 1.0. */
+   double window_mod = window_function(q, 0.0); /* Need to normalize w(0) to 1.0. */
    int stride = calculate_delta ? 2 : 1;
    double sidelobes = taps / 2.0;
 
@@ -188,7 +184,7 @@ static void init_sinc_table(rarch_sinc_resampler_t *resamp, double cutoff,
          sinc_phase = sidelobes * window_phase;
 
          val = cutoff * sinc(M_PI * sinc_phase * cutoff) * 
-            window_function(window_phase) / window_mod;
+            window_function(q, window_phase) / window_mod;
          phase_table[i * stride * taps + j] = val;
       }
    }
@@ -217,7 +213,7 @@ static void init_sinc_table(rarch_sinc_resampler_t *resamp, double cutoff,
          sinc_phase = sidelobes * window_phase;
 
          val = cutoff * sinc(M_PI * sinc_phase * cutoff) * 
-            window_function(window_phase) / window_mod;
+            window_function(q, window_phase) / window_mod;
          delta = (val - phase_table[phase * stride * taps + j]);
          phase_table[(phase * stride + 1) * taps + j] = delta;
       }
@@ -248,33 +244,45 @@ static void aligned_free__(void *ptr)
    free(p[-1]);
 }
 
-#if !(defined(__AVX__) && ENABLE_AVX) && !defined(__SSE__)
-static inline void process_sinc_C(rarch_sinc_resampler_t *resamp,
-      float *out_buffer)
+/* Each kernel is instanced with and without coefficient
+ * interpolation. The lerp flag is a constant after inlining. */
+#define SINC_KERNEL_SETUP(lerp) \
+   const float *buffer_l = resamp->buffer_l + resamp->ptr; \
+   const float *buffer_r = resamp->buffer_r + resamp->ptr; \
+   unsigned taps = resamp->taps; \
+   unsigned phase = resamp->time >> resamp->subphase_bits; \
+   const float *phase_table = resamp->phase_table + \
+      phase * taps * ((lerp) ? 2 : 1); \
+   const float *delta_table = phase_table + taps; \
+   float delta_f = (float)(resamp->time & resamp->subphase_mask) * \
+      resamp->subphase_mod; \
+   (void)delta_table; \
+   (void)delta_f
+
+#define SINC_KERNEL_INSTANCES(name, target) \
+static target void name(rarch_sinc_resampler_t *resamp, float *out_buffer) \
+{ \
+   name##_body(resamp, out_buffer, false); \
+} \
+static target void name##_lerp(rarch_sinc_resampler_t *resamp, float *out_buffer) \
+{ \
+   name##_body(resamp, out_buffer, true); \
+}
+
+/* Also the reference the SIMD kernels are benchmarked against. */
+RETRO_SIMD_INLINE void process_sinc_C_body(rarch_sinc_resampler_t *resamp,
+      float *out_buffer, bool lerp)
 {
    unsigned i;
    float sum_l = 0.0f;
    float sum_r = 0.0f;
-   const float *buffer_l = resamp->buffer_l + resamp->ptr;
-   const float *buffer_r = resamp->buffer_r + resamp->ptr;
-
-   unsigned taps  = resamp->taps;
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-#if SINC_COEFF_LERP
-   const float *phase_table = resamp->phase_table + phase * taps * 2;
-   const float *delta_table = phase_table + taps;
-   float delta = (float)(resamp->time & SUBPHASE_MASK) * SUBPHASE_MOD;
-#else
-   const float *phase_table = resamp->phase_table + phase * taps;
-#endif
+   SINC_KERNEL_SETUP(lerp);
 
    for (i = 0; i < taps; i++)
    {
-#if SINC_COEFF_LERP
-      float sinc_val = phase_table[i] + delta_table[i] * delta;
-#else
       float sinc_val = phase_table[i];
-#endif
+      if (lerp)
+         sinc_val += delta_table[i] * delta_f;
       sum_l         += buffer_l[i] * sinc_val;
       sum_r         += buffer_r[i] * sinc_val;
    }
@@ -282,94 +290,31 @@ static inline void process_sinc_C(rarch_sinc_resampler_t *resamp,
    out_buffer[0] = sum_l;
    out_buffer[1] = sum_r;
 }
-#endif
-
-#if defined(__AVX__) && ENABLE_AVX
-#define process_sinc_func process_sinc
-static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
-{
-   unsigned i;
-   __m256 sum_l = _mm256_setzero_ps();
-   __m256 sum_r = _mm256_setzero_ps();
-
-   const float *buffer_l = resamp->buffer_l + resamp->ptr;
-   const float *buffer_r = resamp->buffer_r + resamp->ptr;
-
-   unsigned taps = resamp->taps;
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-#if SINC_COEFF_LERP
-   const float *phase_table = resamp->phase_table + phase * taps * 2;
-   const float *delta_table = phase_table + taps;
-   __m256 delta = _mm256_set1_ps((float)
-         (resamp->time & SUBPHASE_MASK) * SUBPHASE_MOD);
-#else
-   const float *phase_table = resamp->phase_table + phase * taps;
-#endif
-
-   for (i = 0; i < taps; i += 8)
-   {
-      __m256 buf_l = _mm256_loadu_ps(buffer_l + i);
-      __m256 buf_r = _mm256_loadu_ps(buffer_r + i);
-
-#if SINC_COEFF_LERP
-      __m256 deltas = _mm256_load_ps(delta_table + i);
-      __m256 sinc = _mm256_add_ps(_mm256_load_ps(phase_table + i),
-            _mm256_mul_ps(deltas, delta));
-#else
-      __m256 sinc = _mm256_load_ps(phase_table + i);
-#endif
-      sum_l       = _mm256_add_ps(sum_l, _mm256_mul_ps(buf_l, sinc));
-      sum_r       = _mm256_add_ps(sum_r, _mm256_mul_ps(buf_r, sinc));
-   }
 
-   /* hadd on AVX is weird, and acts on low-lanes 
-    * and high-lanes separately. */
-   __m256 res_l = _mm256_hadd_ps(sum_l, sum_l);
-   __m256 res_r = _mm256_hadd_ps(sum_r, sum_r);
-   res_l = _mm256_hadd_ps(res_l, res_l);
-   res_r = _mm256_hadd_ps(res_r, res_r);
-   res_l = _mm256_add_ps(_mm256_permute2f128_ps(res_l, res_l, 1), res_l);
-   res_r = _mm256_add_ps(_mm256_permute2f128_ps(res_r, res_r, 1), res_r);
+SINC_KERNEL_INSTANCES(process_sinc_C, )
 
-   /* This is optimized to mov %xmmN, [mem].
-    * There doesn't seem to be any _mm256_store_ss intrinsic. */
-   _mm_store_ss(out_buffer + 0, _mm256_extractf128_ps(res_l, 0));
-   _mm_store_ss(out_buffer + 1, _mm256_extractf128_ps(res_r, 0));
-}
-#elif defined(__SSE__)
-#define process_sinc_func process_sinc
-static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
+#ifdef __SSE__
+RETRO_SIMD_INLINE void process_sinc_SSE_body(rarch_sinc_resampler_t *resamp,
+      float *out_buffer, bool lerp)
 {
    unsigned i;
+   __m128 sum, delta;
    __m128 sum_l = _mm_setzero_ps();
    __m128 sum_r = _mm_setzero_ps();
+   SINC_KERNEL_SETUP(lerp);
 
-   const float *buffer_l = resamp->buffer_l + resamp->ptr;
-   const float *buffer_r = resamp->buffer_r + resamp->ptr;
-
-   unsigned taps = resamp->taps;
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
-#if SINC_COEFF_LERP
-   const float *phase_table = resamp->phase_table + phase * taps * 2;
-   const float *delta_table = phase_table + taps;
-   __m128 delta = _mm_set1_ps((float)
-         (resamp->time & SUBPHASE_MASK) * SUBPHASE_MOD);
-#else
-   const float *phase_table = resamp->phase_table + phase * taps;
-#endif
+   delta = _mm_set1_ps(delta_f);
 
    for (i = 0; i < taps; i += 4)
    {
       __m128 buf_l = _mm_loadu_ps(buffer_l + i);
       __m128 buf_r = _mm_loadu_ps(buffer_r + i);
-
-#if SINC_COEFF_LERP
-      __m128 deltas = _mm_load_ps(delta_table + i);
-      __m128 _sinc = _mm_add_ps(_mm_load_ps(phase_table + i),
-            _mm_mul_ps(deltas, delta));
-#else
       __m128 _sinc = _mm_load_ps(phase_table + i);
-#endif
+
+      if (lerp)
+         _sinc = _mm_add_ps(_sinc,
+               _mm_mul_ps(_mm_load_ps(delta_table + i), delta));
+
       sum_l       = _mm_add_ps(sum_l, _mm_mul_ps(buf_l, _sinc));
       sum_r       = _mm_add_ps(sum_r, _mm_mul_ps(buf_r, _sinc));
    }
@@ -379,7 +324,7 @@ static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
     * sum_r = { r3, r2, r1, r0 }
     */
 
-   __m128 sum = _mm_add_ps(_mm_shuffle_ps(sum_l, sum_r,
+   sum = _mm_add_ps(_mm_shuffle_ps(sum_l, sum_r,
             _MM_SHUFFLE(1, 0, 1, 0)),
          _mm_shuffle_ps(sum_l, sum_r, _MM_SHUFFLE(3, 2, 3, 2)));
 
@@ -399,19 +344,138 @@ static void process_sinc(rarch_sinc_resampler_t *resamp, float *out_buffer)
    /* movehl { X, R, X, L } == { X, R, X, R } */
    _mm_store_ss(out_buffer + 1, _mm_movehl_ps(sum, sum));
 }
-#elif defined(__ARM_NEON__)
 
-#if SINC_COEFF_LERP
-#error "NEON asm does not support SINC lerp."
+SINC_KERNEL_INSTANCES(process_sinc_SSE, )
 #endif
 
-/* Need to make this function pointer as Android doesn't 
- * have built-in targets for NEON and plain ARMv7a.
- */
-static void (*process_sinc_func)(rarch_sinc_resampler_t *resamp,
-      float *out_buffer);
+#ifdef HAVE_RETRO_TARGET_X86
+/* Two accumulators per channel to hide the add latency,
+ * and a horizontal add to finish. Taps is a multiple of 4. */
+RETRO_SIMD_INLINE RETRO_TARGET("sse4.1") void process_sinc_SSE41_body(
+      rarch_sinc_resampler_t *resamp, float *out_buffer, bool lerp)
+{
+   unsigned i;
+   __m128 sum, delta;
+   __m128 sum_l0 = _mm_setzero_ps();
+   __m128 sum_l1 = _mm_setzero_ps();
+   __m128 sum_r0 = _mm_setzero_ps();
+   __m128 sum_r1 = _mm_setzero_ps();
+   SINC_KERNEL_SETUP(lerp);
+
+   delta = _mm_set1_ps(delta_f);
+
+#define SINC_SSE41_STEP(sum_l, sum_r, i) do { \
+   __m128 _sinc = _mm_load_ps(phase_table + (i)); \
+   if (lerp) \
+      _sinc = _mm_add_ps(_sinc, \
+            _mm_mul_ps(_mm_load_ps(delta_table + (i)), delta)); \
+   sum_l = _mm_add_ps(sum_l, _mm_mul_ps(_mm_loadu_ps(buffer_l + (i)), _sinc)); \
+   sum_r = _mm_add_ps(sum_r, _mm_mul_ps(_mm_loadu_ps(buffer_r + (i)), _sinc)); \
+} while (0)
+
+   for (i = 0; i + 8 <= taps; i += 8)
+   {
+      SINC_SSE41_STEP(sum_l0, sum_r0, i);
+      SINC_SSE41_STEP(sum_l1, sum_r1, i + 4);
+   }
+   if (i < taps)
+      SINC_SSE41_STEP(sum_l0, sum_r0, i);
+
+#undef SINC_SSE41_STEP
+
+   /* { L, R, L, R } */
+   sum = _mm_hadd_ps(_mm_add_ps(sum_l0, sum_l1),
+         _mm_add_ps(sum_r0, sum_r1));
+   sum = _mm_hadd_ps(sum, sum);
+   _mm_storel_pi((__m64*)out_buffer, sum);
+}
+
+SINC_KERNEL_INSTANCES(process_sinc_SSE41, RETRO_TARGET("sse4.1"))
+
+RETRO_SIMD_INLINE RETRO_TARGET("avx") void process_sinc_AVX_body(
+      rarch_sinc_resampler_t *resamp, float *out_buffer, bool lerp)
+{
+   unsigned i;
+   __m256 delta, res_l, res_r;
+   __m256 sum_l = _mm256_setzero_ps();
+   __m256 sum_r = _mm256_setzero_ps();
+   SINC_KERNEL_SETUP(lerp);
+
+   delta = _mm256_set1_ps(delta_f);
+
+   for (i = 0; i < taps; i += 8)
+   {
+      __m256 buf_l = _mm256_loadu_ps(buffer_l + i);
+      __m256 buf_r = _mm256_loadu_ps(buffer_r + i);
+      __m256 sinc = _mm256_load_ps(phase_table + i);
+
+      if (lerp)
+         sinc = _mm256_add_ps(sinc,
+               _mm256_mul_ps(_mm256_load_ps(delta_table + i), delta));
+
+      sum_l       = _mm256_add_ps(sum_l, _mm256_mul_ps(buf_l, sinc));
+      sum_r       = _mm256_add_ps(sum_r, _mm256_mul_ps(buf_r, sinc));
+   }
+
+   /* hadd on AVX is weird, and acts on low-lanes 
+    * and high-lanes separately. */
+   res_l = _mm256_hadd_ps(sum_l, sum_l);
+   res_r = _mm256_hadd_ps(sum_r, sum_r);
+   res_l = _mm256_hadd_ps(res_l, res_l);
+   res_r = _mm256_hadd_ps(res_r, res_r);
+   res_l = _mm256_add_ps(_mm256_permute2f128_ps(res_l, res_l, 1), res_l);
+   res_r = _mm256_add_ps(_mm256_permute2f128_ps(res_r, res_r, 1), res_r);
+
+   /* This is optimized to mov %xmmN, [mem].
+    * There doesn't seem to be any _mm256_store_ss intrinsic. */
+   _mm_store_ss(out_buffer + 0, _mm256_extractf128_ps(res_l, 0));
+   _mm_store_ss(out_buffer + 1, _mm256_extractf128_ps(res_r, 0));
+}
+
+SINC_KERNEL_INSTANCES(process_sinc_AVX, RETRO_TARGET("avx"))
+
+/* Same as AVX, but with the lerp and the multiply-adds fused,
+ * and a cheaper reduction through 128-bit lanes. */
+RETRO_SIMD_INLINE RETRO_TARGET("avx2,fma") void process_sinc_AVX2_body(
+      rarch_sinc_resampler_t *resamp, float *out_buffer, bool lerp)
+{
+   unsigned i;
+   __m256 delta;
+   __m128 sum;
+   __m256 sum_l = _mm256_setzero_ps();
+   __m256 sum_r = _mm256_setzero_ps();
+   SINC_KERNEL_SETUP(lerp);
+
+   delta = _mm256_set1_ps(delta_f);
+
+   for (i = 0; i < taps; i += 8)
+   {
+      __m256 sinc = _mm256_load_ps(phase_table + i);
+
+      if (lerp)
+         sinc = _mm256_fmadd_ps(_mm256_load_ps(delta_table + i),
+               delta, sinc);
 
-/* Assumes that taps >= 8, and that taps is a multiple of 8. */
+      sum_l = _mm256_fmadd_ps(_mm256_loadu_ps(buffer_l + i), sinc, sum_l);
+      sum_r = _mm256_fmadd_ps(_mm256_loadu_ps(buffer_r + i), sinc, sum_r);
+   }
+
+   /* { L, R, L, R } */
+   sum = _mm_hadd_ps(
+         _mm_add_ps(_mm256_castps256_ps128(sum_l),
+            _mm256_extractf128_ps(sum_l, 1)),
+         _mm_add_ps(_mm256_castps256_ps128(sum_r),
+            _mm256_extractf128_ps(sum_r, 1)));
+   sum = _mm_hadd_ps(sum, sum);
+   _mm_storel_pi((__m64*)out_buffer, sum);
+}
+
+SINC_KERNEL_INSTANCES(process_sinc_AVX2, RETRO_TARGET("avx2,fma"))
+#endif
+
+#ifdef __ARM_NEON__
+/* Assumes that taps >= 8, and that taps is a multiple of 8.
+ * Does not do coefficient interpolation. */
 void process_sinc_neon_asm(float *out, const float *left, 
       const float *right, const float *coeff, unsigned taps);
 
@@ -421,21 +485,20 @@ static void process_sinc_neon(rarch_sinc_resampler_t *resamp,
    const float *buffer_l = resamp->buffer_l + resamp->ptr;
    const float *buffer_r = resamp->buffer_r + resamp->ptr;
 
-   unsigned phase = resamp->time >> SUBPHASE_BITS;
+   unsigned phase = resamp->time >> resamp->subphase_bits;
    unsigned taps = resamp->taps;
    const float *phase_table = resamp->phase_table + phase * taps;
 
    process_sinc_neon_asm(out_buffer, buffer_l, buffer_r, phase_table, taps);
 }
-#else /* Plain ol' C99 */
-#define process_sinc_func process_sinc_C
 #endif
 
 static void resampler_sinc_process(void *re_, struct resampler_data *data)
 {
    rarch_sinc_resampler_t *re = (rarch_sinc_resampler_t*)re_;
 
-   uint32_t ratio = PHASES / data->ratio;
+   uint32_t phases = re->phases;
+   uint32_t ratio = phases / data->ratio;
 
    const float *input = data->data_in;
    float *output      = data->data_out;
@@ -444,7 +507,7 @@ static void resampler_sinc_process(void *re_, struct resampler_data *data)
 
    while (frames)
    {
-      while (frames && re->time >= PHASES)
+      while (frames && re->time >= phases)
       {
          /* Push in reverse to make filter more obvious. */
          if (!re->ptr)
@@ -454,13 +517,13 @@ static void resampler_sinc_process(void *re_, struct resampler_data *data)
          re->buffer_l[re->ptr + re->taps] = re->buffer_l[re->ptr] = *input++;
          re->buffer_r[re->ptr + re->taps] = re->buffer_r[re->ptr] = *input++;
 
-         re->time -= PHASES;
+         re->time -= phases;
          frames--;
       }
 
-      while (re->time < PHASES)
+      while (re->time < phases)
       {
-         process_sinc_func(re, output);
+         re->process(re, output);
          output += 2;
          out_frames++;
          re->time += ratio;
@@ -478,22 +541,102 @@ static void resampler_sinc_free(void *re)
    free(resampler);
 }
 
+static const struct sinc_quality *sinc_find_quality(
+      const struct resampler_config *config, void *userdata)
+{
+   unsigned i;
+   char *ident = NULL;
+   const struct sinc_quality *q = NULL;
+
+   config->get_string(userdata, "quality", &ident, SINC_DEFAULT_QUALITY);
+
+   for (i = 0; i < sizeof(sinc_qualities) / sizeof(sinc_qualities[0]); i++)
+   {
+      if (ident && !strcasecmp(ident, sinc_qualities[i].ident))
+         q = &sinc_qualities[i];
+      if (!q && !strcmp(SINC_DEFAULT_QUALITY, sinc_qualities[i].ident))
+         q = &sinc_qualities[i];
+   }
+
+   config->free(ident);
+   return q;
+}
+
+/* Picks the kernel, and returns how many taps it works on at once. */
+static unsigned sinc_find_kernel(rarch_sinc_resampler_t *re,
+      const struct sinc_quality *q, resampler_simd_mask_t mask,
+      const char **simd)
+{
+   bool lerp = q->coeff_lerp;
+
+#ifdef HAVE_RETRO_TARGET_X86
+   /* There is no feature bit for FMA, check it here. */
+   if (q->wide && (mask & RESAMPLER_SIMD_AVX2) &&
+         __builtin_cpu_supports("fma"))
+   {
+      re->process = lerp ? process_sinc_AVX2_lerp : process_sinc_AVX2;
+      *simd = "AVX2";
+      return 8;
+   }
+   if (q->wide && (mask & RESAMPLER_SIMD_AVX))
+   {
+      re->process = lerp ? process_sinc_AVX_lerp : process_sinc_AVX;
+      *simd = "AVX";
+      return 8;
+   }
+   if (mask & RESAMPLER_SIMD_SSE4)
+   {
+      re->process = lerp ? process_sinc_SSE41_lerp : process_sinc_SSE41;
+      *simd = "SSE4.1";
+      return 4;
+   }
+#endif
+#ifdef __SSE__
+   if (mask & RESAMPLER_SIMD_SSE)
+   {
+      re->process = lerp ? process_sinc_SSE_lerp : process_sinc_SSE;
+      *simd = "SSE";
+      return 4;
+   }
+#endif
+#ifdef __ARM_NEON__
+   if (!lerp && (mask & RESAMPLER_SIMD_NEON))
+   {
+      re->process = process_sinc_neon;
+      *simd = "NEON";
+      return 8;
+   }
+#endif
+   re->process = lerp ? process_sinc_C_lerp : process_sinc_C;
+   *simd = "C";
+   return 4;
+}
+
 static void *resampler_sinc_new(const struct resampler_config *config,
-      double bandwidth_mod, resampler_simd_mask_t mask)
+      void *userdata, double bandwidth_mod, resampler_simd_mask_t mask)
 {
+   unsigned width;
    size_t phase_elems, elems;
    double cutoff;
+   const char *simd = NULL;
+   const struct sinc_quality *q = NULL;
    rarch_sinc_resampler_t *re = (rarch_sinc_resampler_t*)
       calloc(1, sizeof(*re));
-   (void)config;
 
    if (!re)
       return NULL;
 
    memset(re, 0, sizeof(*re));
 
-   re->taps = TAPS;
-   cutoff = CUTOFF;
+   q = sinc_find_quality(config, userdata);
+
+   re->subphase_bits = q->subphase_bits;
+   re->subphase_mask = (1 << q->subphase_bits) - 1;
+   re->subphase_mod  = 1.0f / (1 << q->subphase_bits);
+   re->phases        = 1 << (q->phase_bits + q->subphase_bits);
+
+   re->taps = q->sidelobes * 2;
+   cutoff = q->cutoff;
 
    /* Downsampling, must lower cutoff, and extend number of 
     * taps accordingly to keep same stopband attenuation. */
@@ -504,45 +647,30 @@ static void *resampler_sinc_new(const struct resampler_config *config,
    }
 
    /* Be SIMD-friendly. */
-#if (defined(__AVX__) && ENABLE_AVX) || defined(__ARM_NEON__)
-   re->taps = (re->taps + 7) & ~7;
-#else
-   re->taps = (re->taps + 3) & ~3;
-#endif
+   width = sinc_find_kernel(re, q, mask, &simd);
+   re->taps = (re->taps + width - 1) & ~(width - 1);
 
-   phase_elems = (1 << PHASE_BITS) * re->taps;
-#if SINC_COEFF_LERP
-   phase_elems *= 2;
-#endif
+   phase_elems = (1 << q->phase_bits) * re->taps;
+   if (q->coeff_lerp)
+      phase_elems *= 2;
    elems = phase_elems + 4 * re->taps;
 
    re->main_buffer = (float*)
       aligned_alloc__(128, sizeof(float) * elems);
    if (!re->main_buffer)
       goto error;
+   memset(re->main_buffer, 0, sizeof(float) * elems);
 
    re->phase_table = re->main_buffer;
    re->buffer_l = re->main_buffer + phase_elems;
    re->buffer_r = re->buffer_l + 2 * re->taps;
 
-   init_sinc_table(re, cutoff, re->phase_table,
-         1 << PHASE_BITS, re->taps, SINC_COEFF_LERP);
-
-#if defined(__AVX__) && ENABLE_AVX
-   RARCH_LOG("Sinc resampler [AVX]\n");
-#elif defined(__SSE__)
-   RARCH_LOG("Sinc resampler [SSE]\n");
-#elif defined(__ARM_NEON__)
-   process_sinc_func = mask & RESAMPLER_SIMD_NEON 
-      ? process_sinc_neon : process_sinc_C;
-   RARCH_LOG("Sinc resampler [%s]\n",
-         mask & RESAMPLER_SIMD_NEON ? "NEON" : "C");
-#else
-   RARCH_LOG("Sinc resampler [C]\n");
-#endif
+   init_sinc_table(q, cutoff, re->phase_table,
+         1 << q->phase_bits, re->taps, q->coeff_lerp);
 
-   RARCH_LOG("SINC params (%u phase bits, %u taps).\n",
-         PHASE_BITS, re->taps);
+   RARCH_LOG("Sinc resampler [%s]\n", simd);
+   RARCH_LOG("SINC params (%s quality, %u phase bits, %u taps).\n",
+         q->ident, q->phase_bits, re->taps);
    return re;
 
 error:
@@ -558,4 +686,3 @@ rarch_resampler_t sinc_resampler = {
    "sinc",
    "sinc"
 };
-
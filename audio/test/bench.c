@@ -0,0 +1,598 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Benchmarks every resampler backend and DSP plugin, and measures resampler quality.
+// Prints one CSV row per configuration to stdout, so runs can be compared across
+// devices and commits. Every SIMD level the CPU has is run, and compared against
+// the plain one.
+
+// The DSP plugins are built in, the way griffin does it.
+#define HAVE_FILTERS_BUILTIN
+#include "../filters/chorus.c"
+#include "../filters/convolution.c"
+#include "../filters/echo.c"
+#include "../filters/eq.c"
+#include "../filters/iir.c"
+#include "../filters/panning.c"
+#include "../filters/phaser.c"
+#include "../filters/reverb.c"
+#include "../filters/wahwah.c"
+
+#include "../resamplers/resampler.h"
+#include <file/config_file_userdata.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <complex.h>
+#include <time.h>
+#include <unistd.h>
+
+// Same as the tiles audio_flush() works on.
+#define BENCH_CHUNK 128
+#define BENCH_FFT_SIZE (1 << 16)
+#define BENCH_SETTLE 8192
+#define BENCH_KAISER_BETA 20.0
+#define BENCH_LOBE 12
+
+struct bench_simd
+{
+   const char *ident;
+   unsigned mask;
+};
+
+struct bench_rate
+{
+   unsigned in_rate;
+   unsigned out_rate;
+};
+
+struct bench_result
+{
+   double ns_per_frame;
+   double realtime;
+   double snr;
+   double thd;
+   double alias;
+   double diff;
+
+   bool has_quality;
+   bool has_diff;
+};
+
+static const struct bench_rate bench_rates[] = {
+   { 44100, 48000 },
+   { 48000, 44100 },
+   { 32040, 48000 },
+   { 32000, 48000 },
+   { 96000, 48000 },
+   { 22050, 48000 },
+};
+
+static const char *bench_qualities[] = {
+   "lowest", "lower", "normal", "higher", "highest",
+};
+
+static const dspfilter_get_implementation_t bench_dsp_plugs[] = {
+   chorus_dspfilter_get_implementation,
+   convolution_dspfilter_get_implementation,
+   echo_dspfilter_get_implementation,
+   eq_dspfilter_get_implementation,
+   iir_dspfilter_get_implementation,
+   panning_dspfilter_get_implementation,
+   phaser_dspfilter_get_implementation,
+   reverb_dspfilter_get_implementation,
+   wahwah_dspfilter_get_implementation,
+};
+
+static const struct resampler_config bench_resampler_config = {
+   config_userdata_get_float,
+   config_userdata_get_int,
+   config_userdata_get_float_array,
+   config_userdata_get_int_array,
+   config_userdata_get_string,
+   config_userdata_free,
+};
+
+static const struct dspfilter_config bench_dsp_config = {
+   config_userdata_get_float,
+   config_userdata_get_int,
+   config_userdata_get_float_array,
+   config_userdata_get_int_array,
+   config_userdata_get_string,
+   config_userdata_free,
+};
+
+static bool bench_quick;
+static double bench_min_time;
+static const char *bench_filter;
+
+static struct bench_simd bench_simd_levels[8];
+static unsigned bench_num_simd_levels;
+
+static double bench_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1e9;
+}
+
+// SIMD levels are cumulative, the first one is plain code.
+static void bench_find_simd_levels(void)
+{
+   unsigned mask = 0;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "none", 0 };
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   __builtin_cpu_init();
+   if (!__builtin_cpu_supports("sse2"))
+      return;
+   mask |= RESAMPLER_SIMD_SSE | RESAMPLER_SIMD_SSE2;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "sse2", mask };
+
+   if (!__builtin_cpu_supports("sse4.1"))
+      return;
+   mask |= RESAMPLER_SIMD_SSE3 | RESAMPLER_SIMD_SSSE3 | RESAMPLER_SIMD_SSE4;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "sse4", mask };
+
+   if (!__builtin_cpu_supports("avx"))
+      return;
+   mask |= RESAMPLER_SIMD_SSE42 | RESAMPLER_SIMD_AVX;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "avx", mask };
+
+   if (!__builtin_cpu_supports("avx2"))
+      return;
+   mask |= RESAMPLER_SIMD_AVX2;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "avx2", mask };
+#elif defined(__ARM_NEON__)
+   mask |= RESAMPLER_SIMD_NEON;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "neon", mask };
+#endif
+   (void)mask;
+}
+
+static bool bench_selected(const char *ident)
+{
+   return !bench_filter || strstr(ident, bench_filter);
+}
+
+static void bench_noise(float *out, size_t samples, unsigned seed)
+{
+   srand(seed);
+   for (size_t i = 0; i < samples; i++)
+      out[i] = 0.5f * ((2.0f * rand()) / RAND_MAX - 1.0f);
+}
+
+static void bench_tone(float *out, size_t frames, double freq, unsigned rate)
+{
+   double omega = 2.0 * M_PI * freq / rate;
+   for (size_t i = 0; i < frames; i++)
+      out[2 * i + 0] = out[2 * i + 1] = 0.5 * cos(omega * i);
+}
+
+// Largest difference between two runs, in dB relative to full scale.
+static double bench_diff(const float *a, const float *b, size_t samples)
+{
+   double diff = 0.0;
+   for (size_t i = 0; i < samples; i++)
+   {
+      double d = fabs(a[i] - b[i]);
+      if (d > diff)
+         diff = d;
+   }
+
+   return 20.0 * log10(diff + 1e-12);
+}
+
+static void bench_fft(complex double *buf, size_t samples)
+{
+   for (size_t i = 1, j = 0; i < samples; i++)
+   {
+      size_t bit = samples >> 1;
+      for (; j & bit; bit >>= 1)
+         j ^= bit;
+      j |= bit;
+
+      if (i < j)
+      {
+         complex double tmp = buf[i];
+         buf[i] = buf[j];
+         buf[j] = tmp;
+      }
+   }
+
+   for (size_t len = 2; len <= samples; len <<= 1)
+   {
+      complex double step = cexp(-2.0 * M_PI * I / len);
+      for (size_t i = 0; i < samples; i += len)
+      {
+         complex double w = 1.0;
+         for (size_t j = 0; j < len / 2; j++, w *= step)
+         {
+            complex double a = buf[i + j];
+            complex double b = buf[i + j + len / 2] * w;
+            buf[i + j] = a + b;
+            buf[i + j + len / 2] = a - b;
+         }
+      }
+   }
+}
+
+static void *bench_resampler_new(const rarch_resampler_t *backend,
+      const char *quality, double ratio, unsigned mask)
+{
+   struct config_file_userdata userdata;
+   void *re;
+
+   userdata.conf = config_file_new(NULL);
+   userdata.prefix[0] = "audio_resampler";
+   userdata.prefix[1] = backend->short_ident;
+   if (!userdata.conf)
+      return NULL;
+
+   if (quality)
+      config_set_string(userdata.conf, "audio_resampler_quality", quality);
+
+   re = backend->init(&bench_resampler_config, &userdata, ratio, mask);
+   config_file_free(userdata.conf);
+   return re;
+}
+
+// Resamples in chunks, like the audio driver does. Returns output frames.
+static size_t bench_resample(const rarch_resampler_t *backend, void *re,
+      float *out, const float *in, size_t frames, double ratio)
+{
+   size_t out_frames = 0;
+
+   for (size_t i = 0; i < frames; i += BENCH_CHUNK)
+   {
+      struct resampler_data data = {
+         .data_in = in + 2 * i,
+         .data_out = out + 2 * out_frames,
+         .input_frames = frames - i < BENCH_CHUNK ? frames - i : BENCH_CHUNK,
+         .ratio = ratio,
+      };
+
+      backend->process(re, &data);
+      out_frames += data.output_frames;
+   }
+
+   return out_frames;
+}
+
+static double bench_besseli0(double x)
+{
+   double sum = 1.0, term = 1.0;
+   for (unsigned i = 1; i < 64; i++)
+   {
+      term *= (x * x) / (4.0 * i * i);
+      sum += term;
+   }
+   return sum;
+}
+
+// Resamplers round their step, so tones end up slightly off any FFT bin.
+// A Kaiser window keeps the leakage far below what is measured, at the
+// cost of a wide main lobe, which is left out of the noise.
+// Everything but the tone and its harmonics is counted as aliasing and noise.
+static void bench_measure_tone(struct bench_result *res,
+      const rarch_resampler_t *backend, const char *quality, unsigned mask,
+      const struct bench_rate *rate, double freq, complex double *spectrum)
+{
+   double ratio = (double)rate->out_rate / rate->in_rate;
+   size_t out_frames = BENCH_SETTLE + BENCH_FFT_SIZE + 1024;
+   size_t in_frames = out_frames / ratio + BENCH_CHUNK;
+   unsigned bin = round(freq * BENCH_FFT_SIZE / rate->out_rate);
+   float *in = calloc(2 * in_frames, sizeof(float));
+   float *out = calloc(2 * (out_frames + 1024), sizeof(float));
+   void *re = bench_resampler_new(backend, quality, ratio, mask);
+   if (!re || !in || !out)
+      goto end;
+
+   bench_tone(in, in_frames, (double)bin * rate->out_rate / BENCH_FFT_SIZE, rate->in_rate);
+   bench_resample(backend, re, out, in, in_frames, ratio);
+
+   for (size_t i = 0; i < BENCH_FFT_SIZE; i++)
+   {
+      double phase = 2.0 * i / (BENCH_FFT_SIZE - 1) - 1.0;
+      double window = bench_besseli0(BENCH_KAISER_BETA * sqrt(1.0 - phase * phase)) /
+         bench_besseli0(BENCH_KAISER_BETA);
+      spectrum[i] = window * out[2 * (BENCH_SETTLE + i)];
+   }
+   bench_fft(spectrum, BENCH_FFT_SIZE);
+
+   double signal = 0.0, signal_peak = 0.0, harmonics = 0.0, noise = 0.0, spur = 0.0;
+   bool in_band_harmonics = false;
+   for (unsigned i = BENCH_LOBE + 1; i < BENCH_FFT_SIZE / 2; i++)
+   {
+      double power = creal(spectrum[i] * conj(spectrum[i]));
+      unsigned harmonic = (i + BENCH_LOBE) / bin;
+      bool in_lobe = harmonic >= 1 && harmonic <= 5 &&
+         i + BENCH_LOBE - harmonic * bin <= 2 * BENCH_LOBE;
+
+      if (in_lobe && harmonic == 1)
+      {
+         signal += power;
+         if (power > signal_peak)
+            signal_peak = power;
+      }
+      else if (in_lobe)
+      {
+         harmonics += power;
+         in_band_harmonics = true;
+      }
+      else
+      {
+         noise += power;
+         if (power > spur)
+            spur = power;
+      }
+   }
+
+   double snr = 10.0 * log10(signal / (noise + harmonics + 1e-20));
+   double thd = 10.0 * log10((harmonics + 1e-20) / signal);
+   double alias = 10.0 * log10((spur + 1e-20) / signal_peak);
+
+   // The worst tone in the corpus decides.
+   if (snr < res->snr)
+      res->snr = snr;
+   if (in_band_harmonics && thd > res->thd)
+      res->thd = thd;
+   if (alias > res->alias)
+      res->alias = alias;
+
+end:
+   if (re)
+      backend->free(re);
+   free(in);
+   free(out);
+}
+
+static void bench_print(const char *kind, const char *name, const char *variant,
+      const char *simd, unsigned in_rate, unsigned out_rate,
+      const struct bench_result *res)
+{
+   printf("%s,%s,%s,%s,%u,%u,%.2f,%.1f,", kind, name, variant, simd,
+         in_rate, out_rate, res->ns_per_frame, res->realtime);
+
+   if (!res->has_quality)
+      printf(",,,");
+   else
+      printf("%.2f,%.2f,%.2f,", res->snr, res->thd, res->alias);
+
+   if (!res->has_diff)
+      printf("\n");
+   else
+      printf("%.1f\n", res->diff);
+   fflush(stdout);
+}
+
+static void bench_resampler(const rarch_resampler_t *backend, const char *quality,
+      bool uses_simd, float *in, float *out, float *ref, complex double *spectrum)
+{
+   unsigned levels = uses_simd ? bench_num_simd_levels : 1;
+   unsigned num_rates = bench_quick ? 2 : sizeof(bench_rates) / sizeof(bench_rates[0]);
+
+   for (unsigned r = 0; r < num_rates; r++)
+   {
+      const struct bench_rate *rate = &bench_rates[r];
+      double ratio = (double)rate->out_rate / rate->in_rate;
+      unsigned min_rate = rate->in_rate < rate->out_rate ? rate->in_rate : rate->out_rate;
+      const double tones[] = { 1000.0, 5000.0, 0.45 * min_rate };
+      size_t ref_frames = 0;
+
+      for (unsigned s = 0; s < levels; s++)
+      {
+         const struct bench_simd *simd = &bench_simd_levels[s];
+         struct bench_result res = { 0.0, 0.0, 1e9, -1e9, -1e9, 0.0, true, s != 0 };
+
+         // One second of noise, over and over until enough time has passed.
+         void *re = bench_resampler_new(backend, quality, ratio, simd->mask);
+         if (!re)
+            continue;
+
+         size_t out_frames = 0;
+         unsigned passes = 0;
+         double start = bench_time(), elapsed;
+         do
+         {
+            out_frames += bench_resample(backend, re, out, in, rate->in_rate, ratio);
+            passes++;
+            elapsed = bench_time() - start;
+         } while (elapsed < bench_min_time);
+
+         res.ns_per_frame = 1e9 * elapsed / out_frames;
+         res.realtime = passes / elapsed;
+         backend->free(re);
+
+         // The first pass from a fresh resampler is compared against the plain code.
+         re = bench_resampler_new(backend, quality, ratio, simd->mask);
+         out_frames = bench_resample(backend, re, out, in, rate->in_rate, ratio);
+         backend->free(re);
+         if (s == 0)
+         {
+            memcpy(ref, out, 2 * out_frames * sizeof(float));
+            ref_frames = out_frames;
+         }
+         else
+            res.diff = bench_diff(ref, out,
+                  2 * (out_frames < ref_frames ? out_frames : ref_frames));
+
+         for (unsigned t = 0; t < sizeof(tones) / sizeof(tones[0]); t++)
+            bench_measure_tone(&res, backend, quality, simd->mask, rate, tones[t], spectrum);
+
+         bench_print("resampler", backend->short_ident, quality ? quality : "-",
+               simd->ident, rate->in_rate, rate->out_rate, &res);
+      }
+   }
+}
+
+// Writes a decaying noise impulse response for the convolution plugin.
+static bool bench_write_impulse(char *path, unsigned rate, unsigned frames)
+{
+   int fd = mkstemp(path);
+   FILE *file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+   if (!file)
+      return false;
+
+   uint32_t size = frames * sizeof(float);
+   const uint32_t header[] = {
+      0x46464952, 36 + size, 0x45564157, // RIFF, WAVE
+      0x20746d66, 16, 3 | (1 << 16), rate, rate * 4, 4 | (32 << 16), // fmt, mono float
+      0x61746164, size, // data
+   };
+   fwrite(header, sizeof(header), 1, file);
+
+   srand(2);
+   for (unsigned i = 0; i < frames; i++)
+   {
+      float s = ((2.0f * rand()) / RAND_MAX - 1.0f) * expf(-6.0f * i / frames);
+      fwrite(&s, sizeof(s), 1, file);
+   }
+
+   fclose(file);
+   return true;
+}
+
+static void bench_dsp(dspfilter_get_implementation_t get_impl,
+      config_file_t *conf, float *in, float *out, float *ref)
+{
+   const unsigned rate = 48000;
+   const struct dspfilter_implementation *plain = get_impl(0);
+   const struct dspfilter_implementation *last = NULL;
+
+   if (!bench_selected(plain->short_ident))
+      return;
+
+   for (unsigned s = 0; s < bench_num_simd_levels; s++)
+   {
+      const struct bench_simd *simd = &bench_simd_levels[s];
+      const struct dspfilter_implementation *impl = get_impl(simd->mask);
+      struct dspfilter_info info = { rate };
+      struct config_file_userdata userdata = { conf, { impl->short_ident, impl->short_ident } };
+      struct bench_result res = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, false, s != 0 };
+
+      // The plugins only have a few levels, don't run any of them twice.
+      if (impl == last)
+         continue;
+      last = impl;
+
+      void *data = impl->init(&info, &bench_dsp_config, &userdata);
+      if (!data)
+      {
+         fprintf(stderr, "Failed to create DSP plugin \"%s\".\n", impl->short_ident);
+         return;
+      }
+
+      // Filters may work in place, so give each pass a fresh copy of the input.
+      size_t frames = 0;
+      unsigned passes = 0;
+      double elapsed = 0.0;
+      do
+      {
+         memcpy(out, in, 2 * rate * sizeof(float));
+
+         double start = bench_time();
+         for (unsigned i = 0; i < rate; i += BENCH_CHUNK)
+         {
+            struct dspfilter_input input = { out + 2 * i, BENCH_CHUNK };
+            struct dspfilter_output output = { 0 };
+            impl->process(data, &output, &input);
+            if (passes == 0 && output.frames)
+               memmove(out + 2 * frames, output.samples, 2 * output.frames * sizeof(float));
+            frames += output.frames;
+         }
+         elapsed += bench_time() - start;
+
+         if (passes == 0)
+         {
+            if (s == 0)
+               memcpy(ref, out, 2 * frames * sizeof(float));
+            else
+               res.diff = bench_diff(ref, out, 2 * frames);
+         }
+         passes++;
+      } while (elapsed < bench_min_time);
+
+      res.ns_per_frame = 1e9 * elapsed / (passes * rate);
+      res.realtime = passes / elapsed;
+      impl->free(data);
+
+      bench_print("dsp", impl->short_ident, "-", simd->ident, rate, rate, &res);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   int opt;
+   while ((opt = getopt(argc, argv, "q")) != -1)
+   {
+      if (opt == 'q')
+         bench_quick = true;
+      else
+      {
+         fprintf(stderr, "Usage: %s [-q] [name]\n", argv[0]);
+         fprintf(stderr, "   -q: Quick run, with less rates and shorter timings.\n");
+         fprintf(stderr, "   name: Only run resamplers and DSP plugins with this in their name.\n");
+         return 1;
+      }
+   }
+   if (optind < argc)
+      bench_filter = argv[optind];
+
+   bench_min_time = bench_quick ? 0.02 : 0.25;
+   bench_find_simd_levels();
+
+   // One second of stereo at the highest rate.
+   size_t samples = 2 * 96000;
+   float *in = calloc(samples, sizeof(float));
+   float *out = calloc(samples, sizeof(float));
+   float *ref = calloc(samples, sizeof(float));
+   complex double *spectrum = calloc(BENCH_FFT_SIZE, sizeof(complex double));
+   if (!in || !out || !ref || !spectrum)
+      return 1;
+
+   puts("kind,name,variant,simd,in_rate,out_rate,ns_per_frame,realtime,snr_db,thd_db,alias_db,diff_db");
+
+   bench_noise(in, samples, 1);
+   if (bench_selected(sinc_resampler.short_ident))
+   {
+      for (unsigned q = 0; q < sizeof(bench_qualities) / sizeof(bench_qualities[0]); q++)
+         bench_resampler(&sinc_resampler, bench_qualities[q], true, in, out, ref, spectrum);
+   }
+   if (bench_selected(CC_resampler.short_ident))
+      bench_resampler(&CC_resampler, NULL, false, in, out, ref, spectrum);
+   if (bench_selected(nearest_resampler.short_ident))
+      bench_resampler(&nearest_resampler, NULL, false, in, out, ref, spectrum);
+
+   char impulse[] = "/tmp/rarch-bench-XXXXXX";
+   config_file_t *conf = config_file_new(NULL);
+   if (conf && bench_write_impulse(impulse, 48000, 48000 * 3 / 2))
+   {
+      config_set_string(conf, "convolution_impulse", impulse);
+      for (unsigned i = 0; i < sizeof(bench_dsp_plugs) / sizeof(bench_dsp_plugs[0]); i++)
+         bench_dsp(bench_dsp_plugs[i], conf, in, out, ref);
+
+      unlink(impulse);
+   }
+
+   config_file_free(conf);
+   free(in);
+   free(out);
+   free(ref);
+   free(spectrum);
+   return 0;
+}
+
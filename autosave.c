@@ -20,6 +20,18 @@
 #include <string.h>
 #include <stdio.h>
 #include "general.h"
+#include "hash.h"
+
+#if defined(_WIN32) && !defined(_XBOX)
+#include <io.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define HAVE_AUTOSAVE_FSYNC
+#endif
+
+/* SRAM is tracked in blocks of this size. Only blocks whose
+ * checksum changed are copied out of the core's buffer. */
+#define AUTOSAVE_BLOCK_SIZE 4096
 
 struct autosave
 {
@@ -35,8 +47,104 @@ struct autosave
    const char *path;
    size_t bufsize;
    unsigned interval;
+
+   /* Checksum of each block as it is in buffer. */
+   uint32_t *hashes;
+   size_t *dirty;
+   size_t num_blocks;
+   /* Last write failed, try again even if nothing changed. */
+   bool pending;
 };
 
+static size_t autosave_block_size(autosave_t *save, size_t block)
+{
+   size_t offset = block * AUTOSAVE_BLOCK_SIZE;
+   size_t size = save->bufsize - offset;
+   return size < AUTOSAVE_BLOCK_SIZE ? size : AUTOSAVE_BLOCK_SIZE;
+}
+
+/* Checks every block against its last known checksum, and returns
+ * the number of blocks found to differ.
+ *
+ * This deliberately runs without the autosave lock. The core only
+ * touches SRAM from within retro_run(), and a block read while it
+ * is being written just shows up as changed. The actual copy is
+ * done under the lock, and the checksum is redone on that copy,
+ * so anything missed here is picked up on the next pass. */
+static size_t autosave_find_dirty(autosave_t *save)
+{
+   size_t i, num_dirty = 0;
+   const uint8_t *data = (const uint8_t*)save->retro_buffer;
+
+   for (i = 0; i < save->num_blocks; i++)
+   {
+      uint32_t hash = crc32_calculate(data + i * AUTOSAVE_BLOCK_SIZE,
+            autosave_block_size(save, i));
+      if (hash != save->hashes[i])
+         save->dirty[num_dirty++] = i;
+   }
+
+   return num_dirty;
+}
+
+/* Flushes file all the way to disk, so that it can't be renamed
+ * over the old save before its data has reached the disk. */
+static bool autosave_sync(FILE *file)
+{
+   if (fflush(file) != 0)
+      return false;
+#if defined(_WIN32) && !defined(_XBOX)
+   return _commit(_fileno(file)) == 0;
+#elif defined(HAVE_AUTOSAVE_FSYNC)
+   return fsync(fileno(file)) == 0;
+#else
+   return true;
+#endif
+}
+
+/* Writes the whole buffer to a temporary file next to the
+ * save file, syncs it, and renames it over the old one once
+ * it is complete. A crash or a full disk never leaves a half
+ * written save file behind. Platforms without a way to sync
+ * only get that guarantee for a crash of RetroArch itself,
+ * not for a power loss. */
+static bool autosave_write(autosave_t *save)
+{
+   bool failed = false;
+   char tmp_path[PATH_MAX];
+   FILE *file;
+
+   snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", save->path);
+
+   file = fopen(tmp_path, "wb");
+   if (!file)
+      return false;
+
+   failed |= fwrite(save->buffer, 1, save->bufsize, file)
+      != save->bufsize;
+   failed |= !autosave_sync(file);
+   failed |= fclose(file) != 0;
+
+   if (failed)
+   {
+      remove(tmp_path);
+      return false;
+   }
+
+   if (rename(tmp_path, save->path) != 0)
+   {
+      /* Windows won't rename over an existing file. */
+      remove(save->path);
+      if (rename(tmp_path, save->path) != 0)
+      {
+         remove(tmp_path);
+         return false;
+      }
+   }
+
+   return true;
+}
+
 static void autosave_thread(void *data)
 {
    autosave_t *save = (autosave_t*)data;
@@ -45,39 +153,52 @@ static void autosave_thread(void *data)
 
    while (!save->quit)
    {
-      autosave_lock(save);
-      bool differ = memcmp(save->buffer, save->retro_buffer,
-            save->bufsize) != 0;
-      if (differ)
-         memcpy(save->buffer, save->retro_buffer, save->bufsize);
-      autosave_unlock(save);
-
-      if (differ)
+      size_t i;
+      size_t num_dirty = autosave_find_dirty(save);
+
+      if (num_dirty)
       {
-         /* Should probably deal with this more elegantly. */
-         FILE *file = fopen(save->path, "wb");
-         if (file)
+         uint8_t *buffer = (uint8_t*)save->buffer;
+         const uint8_t *retro_buffer = (const uint8_t*)save->retro_buffer;
+
+         /* Keep this short, the main thread holds the lock
+          * around every retro_run(). */
+         autosave_lock(save);
+         for (i = 0; i < num_dirty; i++)
+         {
+            size_t block = save->dirty[i];
+            size_t offset = block * AUTOSAVE_BLOCK_SIZE;
+            memcpy(buffer + offset, retro_buffer + offset,
+                  autosave_block_size(save, block));
+         }
+         autosave_unlock(save);
+
+         for (i = 0; i < num_dirty; i++)
          {
-            /* Avoid spamming down stderr ... */
-            if (first_log)
-            {
-               RARCH_LOG("Autosaving SRAM to \"%s\", will continue to check every %u seconds ...\n",
-                     save->path, save->interval);
-               first_log = false;
-            }
-            else
-               RARCH_LOG("SRAM changed ... autosaving ...\n");
-
-            bool failed = false;
-            failed |= fwrite(save->buffer, 1, save->bufsize, file)
-               != save->bufsize;
-            failed |= fflush(file) != 0;
-            failed |= fclose(file) != 0;
-            if (failed)
-               RARCH_WARN("Failed to autosave SRAM. Disk might be full.\n");
+            size_t block = save->dirty[i];
+            save->hashes[block] = crc32_calculate(
+                  buffer + block * AUTOSAVE_BLOCK_SIZE,
+                  autosave_block_size(save, block));
          }
       }
 
+      if (num_dirty || save->pending)
+      {
+         /* Avoid spamming down stderr ... */
+         if (first_log)
+         {
+            RARCH_LOG("Autosaving SRAM to \"%s\", will continue to check every %u seconds ...\n",
+                  save->path, save->interval);
+            first_log = false;
+         }
+         else
+            RARCH_LOG("SRAM changed ... autosaving ...\n");
+
+         save->pending = !autosave_write(save);
+         if (save->pending)
+            RARCH_WARN("Failed to autosave SRAM. Disk might be full.\n");
+      }
+
       slock_lock(save->cond_lock);
 
       if (!save->quit)
@@ -91,6 +212,7 @@ static void autosave_thread(void *data)
 autosave_t *autosave_new(const char *path, const void *data, size_t size,
       unsigned interval)
 {
+   size_t i;
    autosave_t *handle = (autosave_t*)calloc(1, sizeof(*handle));
    if (!handle)
       return NULL;
@@ -100,14 +222,28 @@ autosave_t *autosave_new(const char *path, const void *data, size_t size,
    handle->path = path;
    handle->buffer = malloc(size);
    handle->retro_buffer = data;
+   handle->num_blocks = (size + AUTOSAVE_BLOCK_SIZE - 1) /
+      AUTOSAVE_BLOCK_SIZE;
+   handle->hashes = (uint32_t*)calloc(handle->num_blocks,
+         sizeof(*handle->hashes));
+   handle->dirty = (size_t*)calloc(handle->num_blocks,
+         sizeof(*handle->dirty));
 
-   if (!handle->buffer)
+   if (!handle->buffer || !handle->hashes || !handle->dirty)
    {
+      free(handle->buffer);
+      free(handle->hashes);
+      free(handle->dirty);
       free(handle);
       return NULL;
    }
    memcpy(handle->buffer, handle->retro_buffer, handle->bufsize);
 
+   for (i = 0; i < handle->num_blocks; i++)
+      handle->hashes[i] = crc32_calculate(
+            (const uint8_t*)handle->buffer + i * AUTOSAVE_BLOCK_SIZE,
+            autosave_block_size(handle, i));
+
    handle->lock = slock_new();
    handle->cond_lock = slock_new();
    handle->cond = scond_new();
@@ -143,6 +279,8 @@ void autosave_free(autosave_t *handle)
    scond_free(handle->cond);
 
    free(handle->buffer);
+   free(handle->hashes);
+   free(handle->dirty);
    free(handle);
 }
 
@@ -544,6 +544,10 @@ static const int out_latency = 64;
 /* Will sync audio. (recommended) */
 static const bool audio_sync = true;
 
+/* Writes audio to the driver from a thread of its own,
+ * so the emulator never blocks on the sound device. */
+static const bool audio_threaded = false;
+
 /* Audio rate control. */
 #if defined(GEKKO) || !defined(RARCH_CONSOLE)
 static const bool rate_control = true;
@@ -555,6 +559,10 @@ static const bool rate_control = false;
  * is allowed to adjust input rate. */
 static const float rate_control_delta = 0.005;
 
+/* Lets rate control lower the buffer fill it aims for while
+ * the driver does not underrun, and raise it after an underrun. */
+static const bool audio_latency_adaptive = false;
+
 /* Default audio volume in dB. (0.0 dB == unity gain). */
 static const float audio_volume = 0.0;
 
@@ -574,6 +582,19 @@ static const unsigned rewind_buffer_size = 20 << 20; /* 20MiB */
 /* How many frames to rewind at a time. */
 static const unsigned rewind_granularity = 1;
 
+/* Generate rewind deltas on a separate thread. 
+ * Takes delta compression off the main thread at the cost 
+ * of a few extra savestate-sized buffers. */
+static const bool rewind_threaded = false;
+
+/* Compress every Nth rewind state as a keyframe, allowing to 
+ * seek past the rewind buffer into a compressed archive. 
+ * 0 disables keyframes. Needs threads and zlib. */
+static const unsigned rewind_keyframe_interval = 0;
+
+/* The size of the compressed rewind archive. */
+static const unsigned rewind_archive_size = 50 << 20; /* 50MiB */
+
 /* Pause gameplay when gameplay loses focus. */
 static const bool pause_nonactive = false;
 
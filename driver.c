@@ -877,7 +877,7 @@ static void init_menu(void)
 static void init_audio(void)
 {
    size_t max_bufsamples = AUDIO_CHUNK_SIZE_NONBLOCKING * 2;
-   size_t outsamples_max;
+   size_t outsamples_max, tile_samples;
 
    audio_convert_init_simd();
 
@@ -912,7 +912,7 @@ static void init_audio(void)
 
    find_audio_driver();
 #ifdef HAVE_THREADS
-   if (g_extern.system.audio_callback.callback)
+   if (g_extern.system.audio_callback.callback || g_settings.audio.threaded)
    {
       RARCH_LOG("Starting threaded audio driver ...\n");
       if (!rarch_threaded_audio_init(&driver.audio, &driver.audio_data,
@@ -970,15 +970,23 @@ static void init_audio(void)
       driver.audio_active = false;
    }
 
+   /* Scratch space for one tile of input, and its resampled output. */
+   tile_samples = AUDIO_TILE_FRAMES * 2;
    rarch_assert(g_extern.audio_data.data = (float*)
-         malloc(max_bufsamples * sizeof(float)));
+         malloc((tile_samples + tile_samples * AUDIO_MAX_RATIO *
+               g_settings.slowmotion_ratio) * sizeof(float)));
 
    g_extern.audio_data.data_ptr = 0;
 
    rarch_assert(g_settings.audio.out_rate <
          g_extern.audio_data.in_rate * AUDIO_MAX_RATIO);
-   rarch_assert(g_extern.audio_data.outsamples = (float*)
-         malloc(outsamples_max * sizeof(float)));
+
+   if (g_extern.audio_data.use_float)
+      rarch_assert(g_extern.audio_data.outsamples = (float*)
+            malloc(outsamples_max * sizeof(float)));
+   else
+      rarch_assert(g_extern.audio_data.outsamples_s16 = (int16_t*)
+            malloc(outsamples_max * sizeof(int16_t)));
 
    g_extern.audio_data.rate_control = false;
    if (!g_extern.system.audio_callback.callback && driver.audio_active &&
@@ -989,6 +997,11 @@ static void init_audio(void)
          g_extern.audio_data.driver_buffer_size = 
             driver.audio->buffer_size(driver.audio_data);
          g_extern.audio_data.rate_control = true;
+         g_extern.audio_data.rate_integral = 0.0;
+         g_extern.audio_data.target_fill = 0.5f;
+         g_extern.audio_data.underruns = 0;
+         g_extern.audio_data.adapt_count = 0;
+         g_extern.audio_data.underrun = false;
       }
       else
          RARCH_WARN("Audio rate control was desired, but driver does not support needed features.\n");
@@ -1439,6 +1452,11 @@ static void compute_audio_buffer_statistics(void)
    RARCH_LOG("Amount of time spent close to underrun: %.2f %%. Close to blocking: %.2f %%.\n",
          (100.0 * low_water_count) / (samples - 1),
          (100.0 * high_water_count) / (samples - 1));
+   RARCH_LOG("Estimated audio clock: %.2f Hz (%+.1f ppm). Target buffer saturation: %.2f %%. Underruns: %u.\n",
+         g_settings.audio.out_rate * (1.0 + g_extern.audio_data.rate_integral),
+         g_extern.audio_data.rate_integral * 1000000.0,
+         g_extern.audio_data.target_fill * 100.0,
+         g_extern.audio_data.underruns);
 }
 
 static void uninit_audio(void)
@@ -1468,6 +1486,9 @@ static void uninit_audio(void)
    free(g_extern.audio_data.outsamples);
    g_extern.audio_data.outsamples = NULL;
 
+   free(g_extern.audio_data.outsamples_s16);
+   g_extern.audio_data.outsamples_s16 = NULL;
+
    rarch_main_command(RARCH_CMD_DSP_FILTER_DEINIT);
 
    compute_audio_buffer_statistics();
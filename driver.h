@@ -60,6 +60,10 @@ extern "C" {
 
 #define AUDIO_MAX_RATIO 16
 
+/* audio_flush() runs the whole audio chain on tiles of this
+ * many frames, so intermediate data stays in cache. */
+#define AUDIO_TILE_FRAMES 128
+
 /* Specialized _POINTER that targets the full screen regardless of viewport.
  * Should not be used by a libretro implementation as coordinates returned
  * make no sense.
@@ -241,10 +241,10 @@ struct settings
       unsigned swap_interval;
       unsigned hard_sync_frames;
       unsigned frame_delay;
+	  bool rgui_reset;
 #ifdef GEKKO
       unsigned viwidth;
       bool vfilter;
-	  bool rgui_reset;
 	  unsigned vres;
 #endif
       unsigned hover_color;
@@ -328,14 +328,17 @@ struct settings
       char device[PATH_MAX];
       unsigned latency;
       bool sync;
+      bool threaded;
 
       char dsp_plugin[PATH_MAX];
       char filter_dir[PATH_MAX];
 
       bool rate_control;
       float rate_control_delta;
+      bool latency_adaptive;
       float volume; /* dB scale. */
       char resampler[32];
+      char resampler_quality[32];
    } audio;
 
    struct
@@ -394,6 +397,9 @@ struct settings
    bool rewind_enable;
    size_t rewind_buffer_size;
    unsigned rewind_granularity;
+   bool rewind_threaded;
+   unsigned rewind_keyframe_interval;
+   size_t rewind_archive_size;
 
    float slowmotion_ratio;
    float fastforward_ratio;
@@ -478,6 +484,8 @@ struct global
    bool has_set_username;
    bool has_set_netplay_ip_address;
    bool has_set_netplay_delay_frames;
+   bool has_set_netplay_input_delay;
+   bool has_set_netplay_players;
    bool has_set_netplay_ip_port;
 
    /* Config associated with global "default" config. */
@@ -579,7 +587,10 @@ struct global
       bool use_float;
       bool mute;
 
+      /* Driver output, outsamples_s16 is used instead
+       * if the driver does not take floats. */
       float *outsamples;
+      int16_t *outsamples_s16;
       int16_t *conv_outsamples;
 
       int16_t *rewind_buf;
@@ -592,6 +603,15 @@ struct global
       double orig_src_ratio;
       size_t driver_buffer_size;
 
+      /* Rate control state, see readjust_audio_input_rate(). 
+       * rate_integral is the estimated audio clock skew,
+       * target_fill the driver buffer fill to aim for. */
+      double rate_integral;
+      float target_fill;
+      unsigned underruns;
+      unsigned adapt_count;
+      bool underrun;
+
       float volume_gain;
    } audio_data;
 
@@ -629,6 +649,14 @@ struct global
    /* Rewind support. */
    state_manager_t *state_manager;
    size_t state_size;
+   /* Settings state_manager was created with. */
+   struct
+   {
+      size_t buffer_size;
+      bool threaded;
+      unsigned keyframe_interval;
+      size_t archive_size;
+   } rewind;
    bool frame_is_reverse;
 
    /* Movie playback/recording support. */
@@ -677,6 +705,8 @@ struct global
    bool netplay_is_client;
    bool netplay_is_spectate;
    unsigned netplay_sync_frames;
+   unsigned netplay_input_delay;
+   unsigned netplay_players;
    unsigned netplay_port;
 #endif
 
@@ -22,6 +22,7 @@
 #include <file/dir_list.h>
 #include "../performance.h"
 #include <stdlib.h>
+#include <string.h>
 
 struct rarch_soft_plug
 {
@@ -32,51 +33,57 @@ struct rarch_soft_plug
 };
 
 #ifdef HAVE_THREADS
-#include <rthreads/rthreads.h>
-
-struct filter_thread_data
-{
-   sthread_t *thread;
-   const struct softfilter_work_packet *packet;
-   scond_t *cond;
-   slock_t *lock;
-   void *userdata;
-   bool die;
-   bool done;
-};
+#include <rthreads/rpool.h>
+#endif
 
-static void filter_thread_loop(void *data)
+/* Input rows a stage runs on past what the next stage needs,
+ * above and below, so that the edges of a band are not seen
+ * in the output. The filters look at most two rows away. */
+#define SOFTFILTER_TILE_HALO 2
+/* Bands start on a multiple of this many input rows, so that
+ * filters which alternate by row, like the NTSC burst phase
+ * every third row, give the same rows as a whole frame would. */
+#define SOFTFILTER_TILE_ALIGN 6
+/* Rows of slack around intermediate bands, as filters read
+ * a little past the edges of what they are given. */
+#define SOFTFILTER_TILE_GUARD 4
+/* Rough size of a band of final output.
+ * The intermediate bands are of similar size, so that the
+ * whole chain works on a band while it is still in cache. */
+#define SOFTFILTER_TILE_BYTES (512 * 1024)
+
+struct softfilter_stage
 {
-   struct filter_thread_data *thr = (struct filter_thread_data*)data;
-
-   for (;;)
-   {
-      slock_lock(thr->lock);
-      while (thr->done && !thr->die)
-         scond_wait(thr->cond, thr->lock);
-      bool die = thr->die;
-      slock_unlock(thr->lock);
-
-      if (die)
-         break;
+   const struct softfilter_implementation *impl;
+   void *impl_data;
 
-      if (thr->packet && thr->packet->work)
-         thr->packet->work(thr->userdata, thr->packet->thread_data);
+   struct softfilter_work_packet *packets;
+   unsigned threads;
 
-      slock_lock(thr->lock);
-      thr->done = true;
-      scond_signal(thr->cond);
-      slock_unlock(thr->lock);
-   }
-}
-#endif
+   enum retro_pixel_format pix_fmt, out_pix_fmt;
+   unsigned max_out_width, max_out_height;
+   /* Output rows per input row. */
+   unsigned scale;
+
+   /* Output of the stage when chained, a band or a whole frame. */
+   uint8_t *buffer_base;
+   uint8_t *buffer;
+   size_t pitch;
+
+   /* Per frame. Input rows [first, last) are run for a band. */
+   unsigned width, height, out_width;
+   unsigned first, last;
+};
 
 struct rarch_softfilter
 {
    config_file_t *conf;
 
-   const struct softfilter_implementation *impl;
-   void *impl_data;
+   struct softfilter_stage *stages;
+   unsigned num_stages;
+   /* Rows of final output per band, 
+    * 0 if the chain is run a frame at a time. */
+   unsigned tile_rows;
 
    struct rarch_soft_plug *plugs;
    unsigned num_plugs;
@@ -84,11 +91,9 @@ struct rarch_softfilter
    unsigned max_width, max_height;
    enum retro_pixel_format pix_fmt, out_pix_fmt;
 
-   struct softfilter_work_packet *packets;
-   unsigned threads;
-
 #ifdef HAVE_THREADS
-   struct filter_thread_data *thread_data;
+   /* Shared with the other users of the process-wide pool. */
+   rpool_t *pool;
 #endif
 };
 
@@ -114,34 +119,35 @@ static const struct softfilter_config softfilter_config = {
    config_userdata_free,
 };
 
-static bool create_softfilter_graph(rarch_softfilter_t *filt,
+static bool create_softfilter_stage(rarch_softfilter_t *filt,
+      struct softfilter_stage *stage, const char *key,
       enum retro_pixel_format in_pixel_format,
       unsigned max_width, unsigned max_height,
       softfilter_simd_mask_t cpu_features,
       unsigned threads)
 {
-   unsigned input_fmts, input_fmt, output_fmts;
-   char key[64];
+   unsigned input_fmts, input_fmt, output_fmts, output_fmt;
    struct config_file_userdata userdata;
-
-   snprintf(key, sizeof(key), "filter");
-
    char name[64];
+
    if (!config_get_array(filt->conf, key, name, sizeof(name)))
       return false;
 
-   filt->impl = softfilter_find_implementation(filt, name);
-   if (!filt->impl)
+   stage->impl = softfilter_find_implementation(filt, name);
+   if (!stage->impl)
+   {
+      RARCH_ERR("[SoftFilter]: Could not find softfilter \"%s\".\n", name);
       return false;
+   }
 
    userdata.conf = filt->conf;
    /* Index-specific configs take priority over ident-specific. */
    userdata.prefix[0] = key; 
-   userdata.prefix[1] = filt->impl->short_ident;
+   userdata.prefix[1] = stage->impl->short_ident;
 
    /* Simple assumptions. */
-   filt->pix_fmt = in_pixel_format;
-   input_fmts = filt->impl->query_input_formats();
+   stage->pix_fmt = in_pixel_format;
+   input_fmts = stage->impl->query_input_formats();
 
    switch (in_pixel_format)
    {
@@ -161,35 +167,41 @@ static bool create_softfilter_graph(rarch_softfilter_t *filt,
       return false;
    }
 
-   output_fmts = filt->impl->query_output_formats(input_fmt);
+   output_fmts = stage->impl->query_output_formats(input_fmt);
    /* If we have a match of input/output formats, use that. */
    if (output_fmts & input_fmt)
-      filt->out_pix_fmt = in_pixel_format;
+   {
+      stage->out_pix_fmt = in_pixel_format;
+      output_fmt = input_fmt;
+   }
    else if (output_fmts & SOFTFILTER_FMT_XRGB8888)
-      filt->out_pix_fmt = RETRO_PIXEL_FORMAT_XRGB8888;
+   {
+      stage->out_pix_fmt = RETRO_PIXEL_FORMAT_XRGB8888;
+      output_fmt = SOFTFILTER_FMT_XRGB8888;
+   }
    else if (output_fmts & SOFTFILTER_FMT_RGB565)
-      filt->out_pix_fmt = RETRO_PIXEL_FORMAT_RGB565;
+   {
+      stage->out_pix_fmt = RETRO_PIXEL_FORMAT_RGB565;
+      output_fmt = SOFTFILTER_FMT_RGB565;
+   }
    else
    {
       RARCH_ERR("Did not find suitable output format for softfilter.\n");
       return false;
    }
 
-   filt->max_width = max_width;
-   filt->max_height = max_height;
-
-   filt->impl_data = filt->impl->create(
-         &softfilter_config, input_fmt, input_fmt, max_width, max_height,
+   stage->impl_data = stage->impl->create(
+         &softfilter_config, input_fmt, output_fmt, max_width, max_height,
          threads != RARCH_SOFTFILTER_THREADS_AUTO ? threads : 
          rarch_get_cpu_cores(), cpu_features,
          &userdata);
-   if (!filt->impl_data)
+   if (!stage->impl_data)
    {
       RARCH_ERR("Failed to create softfilter state.\n");
       return false;
    }
 
-   threads = filt->impl->query_num_threads(filt->impl_data);
+   threads = stage->impl->query_num_threads(stage->impl_data);
    if (!threads)
    {
       RARCH_ERR("Invalid number of threads.\n");
@@ -198,43 +210,169 @@ static bool create_softfilter_graph(rarch_softfilter_t *filt,
 
    RARCH_LOG("Using %u threads for softfilter.\n", threads);
 
-   filt->packets = (struct softfilter_work_packet*)
-      calloc(threads, sizeof(*filt->packets));
-   if (!filt->packets)
+   stage->packets = (struct softfilter_work_packet*)
+      calloc(threads, sizeof(*stage->packets));
+   if (!stage->packets)
    {
       RARCH_ERR("Failed to allocate softfilter packets.\n");
       return false;
    }
 
-#ifdef HAVE_THREADS
-   filt->thread_data = (struct filter_thread_data*)
-      calloc(threads, sizeof(*filt->thread_data));
-   if (!filt->thread_data)
+   stage->threads = threads;
+
+   stage->impl->query_output_size(stage->impl_data,
+         &stage->max_out_width, &stage->max_out_height,
+         max_width, max_height);
+   stage->scale = 0;
+   if (max_height && stage->max_out_height % max_height == 0)
+      stage->scale = stage->max_out_height / max_height;
+
+   return true;
+}
+
+static bool softfilter_alloc_stage_buffer(struct softfilter_stage *stage,
+      unsigned rows)
+{
+   size_t bpp = stage->out_pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888 ?
+      sizeof(uint32_t) : sizeof(uint16_t);
+
+   /* 64 bytes of slack on either side of a row, 
+    * and rows stay cache line aligned. */
+   stage->pitch = ((stage->max_out_width * bpp + 63) & ~63) + 128;
+   stage->buffer_base = (uint8_t*)calloc(
+         rows + 2 * SOFTFILTER_TILE_GUARD, stage->pitch);
+   if (!stage->buffer_base)
       return false;
-   filt->threads = threads;
 
-   unsigned i;
-   for (i = 0; i < threads; i++)
+   stage->buffer = stage->buffer_base + 
+      SOFTFILTER_TILE_GUARD * stage->pitch + 64;
+   return true;
+}
+
+/* Sizes the intermediate buffers. If every stage scales height
+ * by a whole number, the chain runs in bands of final output,
+ * otherwise a whole frame at a time. */
+static bool create_softfilter_buffers(rarch_softfilter_t *filt)
+{
+   int i;
+   unsigned rows;
+   struct softfilter_stage *last = &filt->stages[filt->num_stages - 1];
+   size_t out_bpp = filt->out_pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888 ?
+      sizeof(uint32_t) : sizeof(uint16_t);
+
+   filt->tile_rows = 0;
+   if (filt->num_stages < 2)
+      return true;
+
+   /* Filters that carry state from one call to the next
+    * can ask for whole frames with tile_rows = 0. */
+   if (!config_get_uint(filt->conf, "tile_rows", &filt->tile_rows))
    {
-      filt->thread_data[i].userdata = filt->impl_data;
-      filt->thread_data[i].done = true;
+      filt->tile_rows = SOFTFILTER_TILE_BYTES / 
+         (last->max_out_width * out_bpp + 1);
+      if (filt->tile_rows < 16)
+         filt->tile_rows = 16;
+   }
 
-      filt->thread_data[i].lock = slock_new();
-      if (!filt->thread_data[i].lock)
-         return false;
-      filt->thread_data[i].cond = scond_new();
-      if (!filt->thread_data[i].cond)
-         return false;
-      filt->thread_data[i].thread = sthread_create(
-            filter_thread_loop, &filt->thread_data[i]);
-      if (!filt->thread_data[i].thread)
+   for (i = 0; i < (int)filt->num_stages; i++)
+      if (!filt->stages[i].scale)
+         filt->tile_rows = 0;
+
+   if (filt->tile_rows >= last->max_out_height)
+      filt->tile_rows = 0;
+
+   if (!filt->tile_rows)
+   {
+      /* Last stage writes straight to the output. */
+      for (i = 0; i < (int)filt->num_stages - 1; i++)
+         if (!softfilter_alloc_stage_buffer(&filt->stages[i],
+                  filt->stages[i].max_out_height))
+            return false;
+
+      RARCH_LOG("[SoftFilter]: Running %u filters a frame at a time.\n",
+            filt->num_stages);
+      return true;
+   }
+
+   /* Worst case band of every stage, from the last one back. */
+   rows = filt->tile_rows;
+   for (i = filt->num_stages - 1; i >= 0; i--)
+   {
+      struct softfilter_stage *stage = &filt->stages[i];
+      unsigned in_rows = (rows + stage->scale - 1) / stage->scale + 
+         1 + 2 * SOFTFILTER_TILE_HALO + SOFTFILTER_TILE_ALIGN - 1;
+
+      if (!softfilter_alloc_stage_buffer(stage, in_rows * stage->scale))
          return false;
+
+      rows = in_rows;
    }
-#endif
 
+   RARCH_LOG("[SoftFilter]: Running %u filters in bands of %u rows.\n",
+         filt->num_stages, filt->tile_rows);
    return true;
 }
 
+/* A .filt config either names one filter with "filter", 
+ * or a chain with "filters" and "filter0", "filter1", ... */
+static bool create_softfilter_graph(rarch_softfilter_t *filt,
+      enum retro_pixel_format in_pixel_format,
+      unsigned max_width, unsigned max_height,
+      softfilter_simd_mask_t cpu_features,
+      unsigned threads)
+{
+   unsigned i, filters = 0;
+   char key[64];
+   bool chain = config_get_uint(filt->conf, "filters", &filters);
+
+   if (!chain)
+      filters = 1;
+   if (!filters)
+      return false;
+
+   filt->stages = (struct softfilter_stage*)
+      calloc(filters, sizeof(*filt->stages));
+   if (!filt->stages)
+      return false;
+
+   filt->pix_fmt = in_pixel_format;
+   filt->max_width = max_width;
+   filt->max_height = max_height;
+
+   for (i = 0; i < filters; i++)
+   {
+      struct softfilter_stage *stage = &filt->stages[i];
+
+      if (chain)
+         snprintf(key, sizeof(key), "filter%u", i);
+      else
+         snprintf(key, sizeof(key), "filter");
+
+      filt->num_stages++;
+      if (!create_softfilter_stage(filt, stage, key, in_pixel_format,
+               max_width, max_height, cpu_features, threads))
+         return false;
+
+      in_pixel_format = stage->out_pix_fmt;
+      max_width = stage->max_out_width;
+      max_height = stage->max_out_height;
+
+#ifdef HAVE_THREADS
+      /* The calling thread runs packets too, hence one worker less. */
+      if (stage->threads > 1 && !filt->pool)
+      {
+         filt->pool = rpool_shared_acquire(rarch_get_cpu_cores() - 1);
+         if (!filt->pool)
+            return false;
+      }
+#endif
+   }
+
+   filt->out_pix_fmt = in_pixel_format;
+
+   return create_softfilter_buffers(filt);
+}
+
 #ifdef HAVE_DYLIB
 static bool append_softfilter_plugs(rarch_softfilter_t *filt,
       struct string_list *list)
@@ -397,9 +535,16 @@ void rarch_softfilter_free(rarch_softfilter_t *filt)
    if (!filt)
       return;
 
-   free(filt->packets);
-   if (filt->impl && filt->impl_data)
-      filt->impl->destroy(filt->impl_data);
+   for (i = 0; i < filt->num_stages; i++)
+   {
+      struct softfilter_stage *stage = &filt->stages[i];
+
+      free(stage->packets);
+      free(stage->buffer_base);
+      if (stage->impl && stage->impl_data)
+         stage->impl->destroy(stage->impl_data);
+   }
+   free(filt->stages);
 
 #ifdef HAVE_DYLIB
    for (i = 0; i < filt->num_plugs; i++)
@@ -411,20 +556,11 @@ void rarch_softfilter_free(rarch_softfilter_t *filt)
 #endif
 
 #ifdef HAVE_THREADS
-   for (i = 0; i < filt->threads; i++)
-   {
-      if (!filt->thread_data[i].thread)
-         continue;
-      slock_lock(filt->thread_data[i].lock);
-      filt->thread_data[i].die = true;
-      scond_signal(filt->thread_data[i].cond);
-      slock_unlock(filt->thread_data[i].lock);
-      sthread_join(filt->thread_data[i].thread);
-      slock_free(filt->thread_data[i].lock);
-      scond_free(filt->thread_data[i].cond);
-   }
-   free(filt->thread_data);
+   if (filt->pool)
+      rpool_shared_release();
 #endif
+   if (filt->conf)
+      config_file_free(filt->conf);
    free(filt);
 }
 
@@ -439,9 +575,21 @@ void rarch_softfilter_get_output_size(rarch_softfilter_t *filt,
       unsigned *out_width, unsigned *out_height,
       unsigned width, unsigned height)
 {
-   if (filt && filt->impl && filt->impl->query_output_size)
-      filt->impl->query_output_size(filt->impl_data, out_width,
-            out_height, width, height);
+   unsigned i;
+
+   if (!filt)
+      return;
+
+   for (i = 0; i < filt->num_stages; i++)
+   {
+      struct softfilter_stage *stage = &filt->stages[i];
+      if (stage->impl && stage->impl->query_output_size)
+         stage->impl->query_output_size(stage->impl_data, 
+               &width, &height, width, height);
+   }
+
+   *out_width = width;
+   *out_height = height;
 }
 
 enum retro_pixel_format rarch_softfilter_get_output_format(
@@ -450,44 +598,141 @@ enum retro_pixel_format rarch_softfilter_get_output_format(
    return filt->out_pix_fmt;
 }
 
-void rarch_softfilter_process(rarch_softfilter_t *filt,
+static void softfilter_work(void *data, unsigned index)
+{
+   struct softfilter_stage *stage = (struct softfilter_stage*)data;
+   if (stage->packets[index].work)
+      stage->packets[index].work(stage->impl_data,
+            stage->packets[index].thread_data);
+}
+
+static void softfilter_run_stage(rarch_softfilter_t *filt,
+      struct softfilter_stage *stage,
       void *output, size_t output_stride,
       const void *input, unsigned width, unsigned height, size_t input_stride)
 {
-   unsigned i;
+   stage->impl->get_work_packets(stage->impl_data, stage->packets,
+         output, output_stride, input, width, height, input_stride);
 
-   if (filt && filt->impl && filt->impl->get_work_packets)
-      filt->impl->get_work_packets(filt->impl_data, filt->packets,
-            output, output_stride, input, width, height, input_stride);
-   
 #ifdef HAVE_THREADS
-   /* Fire off workers */
-   for (i = 0; i < filt->threads; i++)
-   {
-#if 0
-      RARCH_LOG("Firing off filter thread %u ...\n", i);
+   rpool_parallel_for(filt->pool, stage->threads, softfilter_work, stage);
+#else
+   unsigned i;
+   for (i = 0; i < stage->threads; i++)
+      softfilter_work(stage, i);
 #endif
-      filt->thread_data[i].packet = &filt->packets[i];
-      slock_lock(filt->thread_data[i].lock);
-      filt->thread_data[i].done = false;
-      scond_signal(filt->thread_data[i].cond);
-      slock_unlock(filt->thread_data[i].lock);
+}
+
+/* Runs every stage over just enough rows for
+ * rows [out_first, out_last) of the final output, 
+ * then copies those out of the last band. */
+static void softfilter_process_band(rarch_softfilter_t *filt,
+      uint8_t *output, size_t output_stride,
+      const uint8_t *input, size_t input_stride,
+      unsigned out_first, unsigned out_last)
+{
+   int i;
+   unsigned y, first = out_first, last = out_last;
+   size_t row_size;
+   struct softfilter_stage *stage = NULL;
+
+   /* From the back, which input rows each stage runs on. */
+   for (i = filt->num_stages - 1; i >= 0; i--)
+   {
+      stage = &filt->stages[i];
+      first = first / stage->scale;
+      last = (last + stage->scale - 1) / stage->scale;
+
+      stage->first = first > SOFTFILTER_TILE_HALO ? 
+         first - SOFTFILTER_TILE_HALO : 0;
+      stage->first -= stage->first % SOFTFILTER_TILE_ALIGN;
+      stage->last = last + SOFTFILTER_TILE_HALO < stage->height ?
+         last + SOFTFILTER_TILE_HALO : stage->height;
+
+      first = stage->first;
+      last = stage->last;
    }
 
-   /* Wait for workers */
-   for (i = 0; i < filt->threads; i++)
+   for (i = 0; i < (int)filt->num_stages; i++)
    {
-#if 0
-      RARCH_LOG("Waiting for filter thread %u ...\n", i);
-#endif
-      slock_lock(filt->thread_data[i].lock);
-      while (!filt->thread_data[i].done)
-         scond_wait(filt->thread_data[i].cond, filt->thread_data[i].lock);
-      slock_unlock(filt->thread_data[i].lock);
+      const uint8_t *in;
+      size_t in_stride = input_stride;
+
+      stage = &filt->stages[i];
+      in = input + stage->first * input_stride;
+
+      if (i > 0)
+      {
+         struct softfilter_stage *prev = &filt->stages[i - 1];
+         in = prev->buffer + 
+            (stage->first - prev->first * prev->scale) * prev->pitch;
+         in_stride = prev->pitch;
+      }
+
+      softfilter_run_stage(filt, stage, stage->buffer, stage->pitch,
+            in, stage->width, stage->last - stage->first, in_stride);
    }
-#else
-   for (i = 0; i < filt->threads; i++)
-      filt->packets[i].work(filt->impl_data, filt->packets[i].thread_data);
-#endif
+
+   row_size = filt->out_pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888 ?
+      sizeof(uint32_t) : sizeof(uint16_t);
+   row_size *= stage->out_width;
+   if (row_size > output_stride)
+      row_size = output_stride;
+
+   for (y = out_first; y < out_last; y++)
+      memcpy(output + y * output_stride, stage->buffer + 
+            (y - stage->first * stage->scale) * stage->pitch, row_size);
 }
 
+void rarch_softfilter_process(rarch_softfilter_t *filt,
+      void *output, size_t output_stride,
+      const void *input, unsigned width, unsigned height, size_t input_stride)
+{
+   unsigned i, y, out_height;
+   struct softfilter_stage *last = NULL;
+
+   if (!filt || !filt->num_stages)
+      return;
+
+   /* The size of every stage for this frame. */
+   for (i = 0; i < filt->num_stages; i++)
+   {
+      struct softfilter_stage *stage = &filt->stages[i];
+      if (stage->impl->start_frame)
+         stage->impl->start_frame(stage->impl_data);
+
+      stage->width = width;
+      stage->height = height;
+      stage->impl->query_output_size(stage->impl_data,
+            &width, &height, width, height);
+      stage->out_width = width;
+   }
+
+   out_height = height;
+   last = &filt->stages[filt->num_stages - 1];
+
+   if (filt->tile_rows)
+   {
+      for (y = 0; y < out_height; y += filt->tile_rows)
+         softfilter_process_band(filt, (uint8_t*)output, output_stride,
+               (const uint8_t*)input, input_stride, y,
+               y + filt->tile_rows < out_height ? 
+               y + filt->tile_rows : out_height);
+      return;
+   }
+
+   for (i = 0; i < filt->num_stages; i++)
+   {
+      struct softfilter_stage *stage = &filt->stages[i];
+
+      if (stage == last)
+         softfilter_run_stage(filt, stage, output, output_stride,
+               input, stage->width, stage->height, input_stride);
+      else
+         softfilter_run_stage(filt, stage, stage->buffer, stage->pitch,
+               input, stage->width, stage->height, input_stride);
+
+      input = stage->buffer;
+      input_stride = stage->pitch;
+   }
+}
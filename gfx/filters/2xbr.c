@@ -34,6 +34,8 @@
 */
  
 #include "softfilter.h"
+#include <retro_simd.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -56,13 +58,35 @@ struct softfilter_thread_data
    unsigned height;
    int first;
    int last;
+
+   /* Luma of the five rows around the current one,
+    * for the vector RGB565 kernel. */
+   uint16_t *luma;
+   int luma_row[5];
 };
 
+struct filter_data;
+
+/* Filters one row of a packet. rows[] holds the indices of the
+ * rows from two above to two below it, clamped to the frame. */
+typedef void (*twoxbr_row_rgb565_t)(struct filter_data *filt,
+      struct softfilter_thread_data *thr, const uint16_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint16_t *dst, unsigned dst_stride);
+
+typedef void (*twoxbr_row_xrgb8888_t)(struct filter_data *filt,
+      struct softfilter_thread_data *thr, const uint32_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint32_t *dst, unsigned dst_stride);
+
 struct filter_data
 {
    unsigned threads;
    struct softfilter_thread_data *workers;
    unsigned in_fmt;
+   twoxbr_row_rgb565_t row_rgb565;
+   twoxbr_row_xrgb8888_t row_xrgb8888;
+   uint16_t *luma;
    uint16_t RGBtoYUV[65536];
    uint16_t tbl_5_to_8[32];
    uint16_t tbl_6_to_8[64];
@@ -219,12 +243,16 @@ static void SetupFormat(void * data)
    }
 }
  
+static int twoxbr_init_kernels(struct filter_data *filt,
+      unsigned max_width, softfilter_simd_mask_t simd);
+
+static void twoxbr_generic_destroy(void *data);
+
 static void *twoxbr_generic_create(const struct softfilter_config *config,
       unsigned in_fmt, unsigned out_fmt,
       unsigned max_width, unsigned max_height,
       unsigned threads, softfilter_simd_mask_t simd, void *userdata)
 {
-   (void)simd;
    (void)config;
    (void)userdata;
  
@@ -233,11 +261,11 @@ static void *twoxbr_generic_create(const struct softfilter_config *config,
       return NULL;
    filt->workers = (struct softfilter_thread_data*)
       calloc(threads, sizeof(struct softfilter_thread_data));
-   filt->threads = 1;
+   filt->threads = threads;
    filt->in_fmt  = in_fmt;
-   if (!filt->workers)
+   if (!filt->workers || !twoxbr_init_kernels(filt, max_width, simd))
    {
-      free(filt);
+      twoxbr_generic_destroy(filt);
       return NULL;
    }
 
@@ -262,6 +290,7 @@ static void twoxbr_generic_destroy(void *data)
       return;
 
    free(filt->workers);
+   free(filt->luma);
    free(filt);
 }
  
@@ -534,30 +563,30 @@ int eq8(uint32_t A, uint32_t B,
  
  
  
-#define twoxbr_declare_variables(typename_t, in, nextline) \
+#define twoxbr_declare_variables(typename_t, in, up2, up, down, down2) \
          typename_t E[4]; \
          typename_t ex, e, i, ke, ki, ex2, ex3, px; \
-         typename_t A1 = *(in - nextline - nextline - 1); \
-         typename_t B1 = *(in - nextline - nextline); \
-         typename_t C1 = *(in - nextline - nextline + 1); \
-         typename_t A0 = *(in - nextline - 2); \
-         typename_t PA = *(in - nextline - 1); \
-         typename_t PB = *(in - nextline); \
-         typename_t PC = *(in - nextline + 1); \
-         typename_t C4 = *(in - nextline + 2); \
+         typename_t A1 = *(in - up2 - 1); \
+         typename_t B1 = *(in - up2); \
+         typename_t C1 = *(in - up2 + 1); \
+         typename_t A0 = *(in - up - 2); \
+         typename_t PA = *(in - up - 1); \
+         typename_t PB = *(in - up); \
+         typename_t PC = *(in - up + 1); \
+         typename_t C4 = *(in - up + 2); \
          typename_t D0 = *(in - 2); \
          typename_t PD = *(in - 1); \
          typename_t PE = *(in); \
          typename_t PF = *(in + 1); \
          typename_t F4 = *(in + 2); \
-         typename_t G0 = *(in + nextline - 2); \
-         typename_t PG = *(in + nextline - 1); \
-         typename_t PH = *(in + nextline); \
-         typename_t PI = *(in + nextline + 1); \
-         typename_t I4 = *(in + nextline + 2); \
-         typename_t G5 = *(in + nextline + nextline - 1); \
-         typename_t H5 = *(in + nextline + nextline); \
-         typename_t I5 = *(in + nextline + nextline + 1); \
+         typename_t G0 = *(in + down - 2); \
+         typename_t PG = *(in + down - 1); \
+         typename_t PH = *(in + down); \
+         typename_t PI = *(in + down + 1); \
+         typename_t I4 = *(in + down + 2); \
+         typename_t G5 = *(in + down2 - 1); \
+         typename_t H5 = *(in + down2); \
+         typename_t I5 = *(in + down2 + 1); \
  
 #ifndef twoxbr_function
 #define twoxbr_function(FILTRO, Z) \
@@ -573,86 +602,226 @@ int eq8(uint32_t A, uint32_t B,
          ++in; \
          out += 2
 #endif
- 
- 
-static void twoxbr_generic_xrgb8888(void *data, unsigned width, unsigned height,
-      int first, int last, uint32_t *src,
-      unsigned src_stride, uint32_t *dst, unsigned dst_stride)
+
+/* Indices of the rows from two above to two below row y of a packet.
+ * Packets can read the rows of their neighbours, but rows past the
+ * top or bottom of the frame repeat the edge row. */
+static void twoxbr_clamp_rows(int *rows, unsigned y, unsigned height,
+      int first, int last)
+{
+   int k;
+   for (k = 0; k < 5; k++)
+   {
+      int row = (int)y + k - 2;
+      if (row < -first)
+         row = -first;
+      if (last && row > (int)height - 1)
+         row = height - 1;
+      rows[k] = row;
+   }
+}
+
+static void twoxbr_span_xrgb8888(struct filter_data *filt,
+      const uint32_t *in, unsigned src_stride, const int *rows,
+      unsigned width, uint32_t *out, unsigned dst_stride)
 {
-   unsigned nextline, finish;
    uint32_t pg_red_mask      = RED_MASK8888;
    uint32_t pg_green_mask    = GREEN_MASK8888;
    uint32_t pg_blue_mask     = BLUE_MASK8888;
    uint32_t pg_lbmask        = PG_LBMASK8888;
    uint32_t pg_alpha_mask    = ALPHA_MASK8888;
-   struct filter_data *filt = (struct filter_data*)data;
+   unsigned up2   = (rows[2] - rows[0]) * src_stride;
+   unsigned up    = (rows[2] - rows[1]) * src_stride;
+   unsigned down  = (rows[3] - rows[2]) * src_stride;
+   unsigned down2 = (rows[4] - rows[2]) * src_stride;
 
-   (void)filt;
+   for (; width; width--)
+   {
+      twoxbr_declare_variables(uint32_t, in, up2, up, down, down2);
 
-   nextline = (last) ? 0 : src_stride;
-   
-   for (; height; height--)
+      /*
+       * Map of the pixels:          A1 B1 C1
+       *                          A0 PA PB PC C4
+       *                          D0 PD PE PF F4
+       *                          G0 PG PH PI I4
+       *                             G5 H5 I5
+       */
+
+      twoxbr_function(FILTRO_RGB8888, filt);
+   }
+}
+
+static void twoxbr_span_rgb565(struct filter_data *filt,
+      const uint16_t *in, unsigned src_stride, const int *rows,
+      unsigned width, uint16_t *out, unsigned dst_stride)
+{
+   uint16_t pg_red_mask   = RED_MASK565;
+   uint16_t pg_green_mask = GREEN_MASK565;
+   uint16_t pg_blue_mask  = BLUE_MASK565;
+   uint16_t pg_lbmask     = PG_LBMASK565;
+   unsigned up2   = (rows[2] - rows[0]) * src_stride;
+   unsigned up    = (rows[2] - rows[1]) * src_stride;
+   unsigned down  = (rows[3] - rows[2]) * src_stride;
+   unsigned down2 = (rows[4] - rows[2]) * src_stride;
+
+   for (; width; width--)
    {
-      uint32_t *in  = (uint32_t*)src;
-      uint32_t *out = (uint32_t*)dst;
- 
-      for (finish = width; finish; finish -= 1)
-      {
-         twoxbr_declare_variables(uint32_t, in, nextline);
- 
-         /*
-          * Map of the pixels:          A1 B1 C1
-          *                          A0 PA PB PC C4
-          *                          D0 PD PE PF F4
-          *                          G0 PG PH PI I4
-          *                             G5 H5 I5
-          */
- 
-         twoxbr_function(FILTRO_RGB8888, filt);
-      }
- 
-      src += src_stride;
-      dst += 2 * dst_stride;
+      twoxbr_declare_variables(uint16_t, in, up2, up, down, down2);
+
+      /*
+       * Map of the pixels:          A1 B1 C1
+       *                          A0 PA PB PC C4
+       *                          D0 PD PE PF F4
+       *                          G0 PG PH PI I4
+       *                             G5 H5 I5
+       */
+
+      twoxbr_function(FILTRO_RGB565, filt);
    }
 }
- 
-static void twoxbr_generic_rgb565(void *data, unsigned width, unsigned height,
+
+static void twoxbr_row_xrgb8888_C(struct filter_data *filt,
+      struct softfilter_thread_data *thr, const uint32_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint32_t *dst, unsigned dst_stride)
+{
+   (void)thr;
+   twoxbr_span_xrgb8888(filt, src + rows[2] * (int)src_stride,
+         src_stride, rows, width, dst, dst_stride);
+}
+
+static void twoxbr_row_rgb565_C(struct filter_data *filt,
+      struct softfilter_thread_data *thr, const uint16_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint16_t *dst, unsigned dst_stride)
+{
+   (void)thr;
+   twoxbr_span_rgb565(filt, src + rows[2] * (int)src_stride,
+         src_stride, rows, width, dst, dst_stride);
+}
+
+#if defined(__GNUC__) && (__GNUC__ >= 9 || defined(__clang__)) && \
+   !defined(MSB_FIRST) && \
+   (__SSE2__ || defined(HAVE_RETRO_TARGET_X86) || defined(__ARM_NEON__))
+#define TWOXBR_SIMD
+
+/* Luma rows are read from two pixels left of the row
+ * to two pixels right of it. */
+#define TWOXBR_LUMA_BORDER 2
+#define TWOXBR_LUMA_PITCH(width) (((width) + 2 * TWOXBR_LUMA_BORDER + 15) & ~15)
+
+/* Pixel dx, dy away from x, with the neighbourhood turned
+ * by rot quarters like the arguments of FILTRO. */
+#define TWOXBR_AT(rows, x, rot, dx, dy) \
+   ((rot) == 0 ? rows[2 + (dy)] + (x) + (dx) : \
+    (rot) == 1 ? rows[2 - (dx)] + (x) + (dy) : \
+    (rot) == 2 ? rows[2 - (dy)] + (x) - (dx) : \
+                 rows[2 + (dx)] + (x) - (dy))
+
+/* The vector kernels are written once with GCC vector extensions
+ * and built for each instruction set, as twoxbr_row_*_<ISA>.
+ * XRGB8888 compares pixels in doubles, which only pays off
+ * with AVX2. */
+#if __SSE2__
+#define TWOXBR_ISA SSE2
+#define TWOXBR_TARGET
+#define TWOXBR_VECTOR_SIZE 16
+#include "2xbr_vector.h"
+#endif
+
+#ifdef HAVE_RETRO_TARGET_X86
+#define TWOXBR_ISA AVX2
+#define TWOXBR_TARGET RETRO_TARGET("avx2")
+#define TWOXBR_VECTOR_SIZE 32
+#define TWOXBR_XRGB8888
+#include "2xbr_vector.h"
+#endif
+
+#ifdef __ARM_NEON__
+#define TWOXBR_ISA NEON
+#define TWOXBR_TARGET
+#define TWOXBR_VECTOR_SIZE 16
+#include "2xbr_vector.h"
+#endif
+#endif
+
+static int twoxbr_init_kernels(struct filter_data *filt,
+      unsigned max_width, softfilter_simd_mask_t simd)
+{
+   (void)max_width;
+   (void)simd;
+
+   filt->row_rgb565   = twoxbr_row_rgb565_C;
+   filt->row_xrgb8888 = twoxbr_row_xrgb8888_C;
+
+#ifdef TWOXBR_SIMD
+#if __SSE2__
+   filt->row_rgb565   = twoxbr_row_rgb565_SSE2;
+#endif
+#ifdef HAVE_RETRO_TARGET_X86
+   if (simd & SOFTFILTER_SIMD_AVX2)
+   {
+      filt->row_rgb565   = twoxbr_row_rgb565_AVX2;
+      filt->row_xrgb8888 = twoxbr_row_xrgb8888_AVX2;
+   }
+#endif
+#ifdef __ARM_NEON__
+   if (simd & SOFTFILTER_SIMD_NEON)
+      filt->row_rgb565   = twoxbr_row_rgb565_NEON;
+#endif
+
+   if (filt->row_rgb565 != twoxbr_row_rgb565_C)
+   {
+      unsigned i;
+      size_t pitch = TWOXBR_LUMA_PITCH(max_width);
+
+      filt->luma = (uint16_t*)
+         calloc(filt->threads * 5 * pitch, sizeof(uint16_t));
+      if (!filt->luma)
+         return 0;
+
+      for (i = 0; i < filt->threads; i++)
+         filt->workers[i].luma = filt->luma + i * 5 * pitch;
+   }
+#endif
+
+   return 1;
+}
+
+static void twoxbr_generic_xrgb8888(struct filter_data *filt,
+      struct softfilter_thread_data *thr, unsigned width, unsigned height,
+      int first, int last, uint32_t *src,
+      unsigned src_stride, uint32_t *dst, unsigned dst_stride)
+{
+   unsigned y;
+
+   for (y = 0; y < height; y++)
+   {
+      int rows[5];
+
+      twoxbr_clamp_rows(rows, y, height, first, last);
+      filt->row_xrgb8888(filt, thr, src, src_stride, rows, width,
+            dst + 2 * y * dst_stride, dst_stride);
+   }
+}
+
+static void twoxbr_generic_rgb565(struct filter_data *filt,
+      struct softfilter_thread_data *thr, unsigned width, unsigned height,
       int first, int last, uint16_t *src,
       unsigned src_stride, uint16_t *dst, unsigned dst_stride)
 {
-   uint16_t pg_red_mask, pg_green_mask, pg_blue_mask, pg_lbmask;
-   unsigned nextline, finish;
-   struct filter_data *filt = (struct filter_data*)data;
+   unsigned y;
 
-   pg_red_mask   = RED_MASK565;
-   pg_green_mask = GREEN_MASK565;
-   pg_blue_mask  = BLUE_MASK565;
-   pg_lbmask     = PG_LBMASK565;
-   nextline = (last) ? 0 : src_stride;
-   
- 
-   for (; height; height--)
+   for (y = 0; y < 5; y++)
+      thr->luma_row[y] = INT_MIN;
+
+   for (y = 0; y < height; y++)
    {
-      uint16_t *in  = (uint16_t*)src;
-      uint16_t *out = (uint16_t*)dst;
- 
-      for (finish = width; finish; finish -= 1)
-      {
-         twoxbr_declare_variables(uint16_t, in, nextline);
- 
-         /*
-          * Map of the pixels:          A1 B1 C1
-          *                          A0 PA PB PC C4
-          *                          D0 PD PE PF F4
-          *                          G0 PG PH PI I4
-          *                             G5 H5 I5
-          */
- 
-         twoxbr_function(FILTRO_RGB565, filt);
-      }
- 
-      src += src_stride;
-      dst += 2 * dst_stride;
+      int rows[5];
+
+      twoxbr_clamp_rows(rows, y, height, first, last);
+      filt->row_rgb565(filt, thr, src, src_stride, rows, width,
+            dst + 2 * y * dst_stride, dst_stride);
    }
 }
  
@@ -665,7 +834,7 @@ static void twoxbr_work_cb_rgb565(void *data, void *thread_data)
    unsigned width = thr->width;
    unsigned height = thr->height;
  
-   twoxbr_generic_rgb565(data, width, height,
+   twoxbr_generic_rgb565((struct filter_data*)data, thr, width, height,
          thr->first, thr->last, input,
          thr->in_pitch / SOFTFILTER_BPP_RGB565, output,
          thr->out_pitch / SOFTFILTER_BPP_RGB565);
@@ -680,7 +849,7 @@ static void twoxbr_work_cb_xrgb8888(void *data, void *thread_data)
    unsigned width = thr->width;
    unsigned height = thr->height;
  
-   twoxbr_generic_xrgb8888(data, width, height,
+   twoxbr_generic_xrgb8888((struct filter_data*)data, thr, width, height,
          thr->first, thr->last, input,
          thr->in_pitch / SOFTFILTER_BPP_XRGB8888, output,
          thr->out_pitch / SOFTFILTER_BPP_XRGB8888);
@@ -0,0 +1,474 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *  Copyright (C) 2011-2014 - Daniel De Matteis
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Vector kernels of 2xbr.c. The file is included once per
+ * instruction set, with TWOXBR_ISA (name suffix), TWOXBR_TARGET
+ * (function attributes) and TWOXBR_VECTOR_SIZE (bytes) defined.
+ * TWOXBR_XRGB8888 adds the XRGB8888 kernel, which needs fast
+ * double vectors to match the scalar code.
+ *
+ * A kernel filters a row of pixels a vector at a time, with every
+ * branch of FILTRO turned into a lane select. The output is the
+ * same as that of the scalar code. */
+
+#define TWOXBR_PASTE_(name, isa) name##_##isa
+#define TWOXBR_PASTE(name, isa) TWOXBR_PASTE_(name, isa)
+#define TWOXBR_FN(name) TWOXBR_PASTE(name, TWOXBR_ISA)
+
+#define twoxbr_u16v TWOXBR_FN(twoxbr_u16v)
+#define twoxbr_s16v TWOXBR_FN(twoxbr_s16v)
+#define twoxbr_u32v TWOXBR_FN(twoxbr_u32v)
+#define twoxbr_s32v TWOXBR_FN(twoxbr_s32v)
+#define twoxbr_f64v TWOXBR_FN(twoxbr_f64v)
+#define twoxbr_any TWOXBR_FN(twoxbr_any)
+#define twoxbr_load16 TWOXBR_FN(twoxbr_load16)
+#define twoxbr_load_luma TWOXBR_FN(twoxbr_load_luma)
+#define twoxbr_load32 TWOXBR_FN(twoxbr_load32)
+#define twoxbr_df16 TWOXBR_FN(twoxbr_df16)
+#define twoxbr_select16 TWOXBR_FN(twoxbr_select16)
+#define twoxbr_select32 TWOXBR_FN(twoxbr_select32)
+#define twoxbr_blend16 TWOXBR_FN(twoxbr_blend16)
+#define twoxbr_blend16_128 TWOXBR_FN(twoxbr_blend16_128)
+#define twoxbr_blend32 TWOXBR_FN(twoxbr_blend32)
+#define twoxbr_blend32_128 TWOXBR_FN(twoxbr_blend32_128)
+#define twoxbr_filtro_rgb565_vec TWOXBR_FN(twoxbr_filtro_rgb565_vec)
+#define twoxbr_yuv32 TWOXBR_FN(twoxbr_yuv32)
+#define twoxbr_filtro_xrgb8888_vec TWOXBR_FN(twoxbr_filtro_xrgb8888_vec)
+
+#define TWOXBR_LANES16 (TWOXBR_VECTOR_SIZE / 2)
+#define TWOXBR_LANES32 (TWOXBR_VECTOR_SIZE / 4)
+
+typedef uint16_t twoxbr_u16v __attribute__((vector_size(TWOXBR_VECTOR_SIZE)));
+typedef int16_t  twoxbr_s16v __attribute__((vector_size(TWOXBR_VECTOR_SIZE)));
+typedef uint32_t twoxbr_u32v __attribute__((vector_size(TWOXBR_VECTOR_SIZE)));
+typedef int32_t  twoxbr_s32v __attribute__((vector_size(TWOXBR_VECTOR_SIZE)));
+typedef double   twoxbr_f64v __attribute__((vector_size(TWOXBR_VECTOR_SIZE * 2)));
+
+RETRO_SIMD_INLINE TWOXBR_TARGET int twoxbr_any(twoxbr_s32v mask)
+{
+   unsigned k;
+   uint64_t q[TWOXBR_VECTOR_SIZE / 8], all = 0;
+
+   memcpy(q, &mask, sizeof(q));
+   for (k = 0; k < TWOXBR_VECTOR_SIZE / 8; k++)
+      all |= q[k];
+   return all != 0;
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u16v twoxbr_load16(const uint16_t *ptr)
+{
+   twoxbr_u16v v;
+   memcpy(&v, ptr, sizeof(v));
+   return v;
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_s16v twoxbr_load_luma(const uint16_t *ptr)
+{
+   twoxbr_s16v v;
+   memcpy(&v, ptr, sizeof(v));
+   return v;
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u32v twoxbr_load32(const uint32_t *ptr)
+{
+   twoxbr_u32v v;
+   memcpy(&v, ptr, sizeof(v));
+   return v;
+}
+
+/* Luma and its differences fit in 15 bits. Ordered compares are
+ * kept signed throughout, which every instruction set has. */
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_s16v twoxbr_df16(twoxbr_s16v a,
+      twoxbr_s16v b)
+{
+   twoxbr_s16v gt = a > b;
+   return ((a - b) & gt) | ((b - a) & ~gt);
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u16v twoxbr_select16(twoxbr_s16v mask,
+      twoxbr_u16v a, twoxbr_u16v b)
+{
+   return (a & (twoxbr_u16v)mask) | (b & ~(twoxbr_u16v)mask);
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u32v twoxbr_select32(twoxbr_s32v mask,
+      twoxbr_u32v a, twoxbr_u32v b)
+{
+   return (a & (twoxbr_u32v)mask) | (b & ~(twoxbr_u32v)mask);
+}
+
+/* dst + (src - dst) * weight / 8 per channel, rounded down
+ * like ALPHA_BLEND_*_W. */
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u16v twoxbr_blend16(twoxbr_u16v dst,
+      twoxbr_u16v src, int16_t weight)
+{
+   twoxbr_s16v dr = (twoxbr_s16v)(dst >> 11);
+   twoxbr_s16v dg = (twoxbr_s16v)((dst >> 5) & 0x3f);
+   twoxbr_s16v db = (twoxbr_s16v)(dst & 0x1f);
+
+   dr += (((twoxbr_s16v)(src >> 11) - dr) * weight) >> 3;
+   dg += (((twoxbr_s16v)((src >> 5) & 0x3f) - dg) * weight) >> 3;
+   db += (((twoxbr_s16v)(src & 0x1f) - db) * weight) >> 3;
+
+   return (twoxbr_u16v)((dr << 11) | (dg << 5) | db);
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u16v twoxbr_blend16_128(
+      twoxbr_u16v dst, twoxbr_u16v src)
+{
+   return ((src & PG_LBMASK565) >> 1) + ((dst & PG_LBMASK565) >> 1);
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u32v twoxbr_blend32(twoxbr_u32v dst,
+      twoxbr_u32v src, int32_t weight)
+{
+   twoxbr_s32v dr = (twoxbr_s32v)(dst & 0xff);
+   twoxbr_s32v dg = (twoxbr_s32v)((dst >> 8) & 0xff);
+   twoxbr_s32v db = (twoxbr_s32v)((dst >> 16) & 0xff);
+
+   dr += (((twoxbr_s32v)(src & 0xff) - dr) * weight) >> 3;
+   dg += (((twoxbr_s32v)((src >> 8) & 0xff) - dg) * weight) >> 3;
+   db += (((twoxbr_s32v)((src >> 16) & 0xff) - db) * weight) >> 3;
+
+   return (twoxbr_u32v)(dr | (dg << 8) | (db << 16)) | ALPHA_MASK8888;
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET twoxbr_u32v twoxbr_blend32_128(
+      twoxbr_u32v dst, twoxbr_u32v src)
+{
+   return ((src & PG_LBMASK8888) >> 1) + ((dst & PG_LBMASK8888) >> 1);
+}
+
+/* Applies the blends FILTRO picked for every lane to E.
+ * e <= i is passed in, as e and i may be unsigned. */
+#define TWOXBR_APPLY(bits, E, n1, n2, n3, px, ex, cond, e_le_i, ke, ki, ex2, ex3) \
+   do { \
+      twoxbr_s##bits##v left = ((ke << 1) <= ki) & ex3; \
+      twoxbr_s##bits##v up   = (ke >= (ki << 1)) & ex2; \
+      twoxbr_s##bits##v run  = ex & cond; \
+      twoxbr_s##bits##v lu   = run & left & up; \
+      twoxbr_s##bits##v l    = run & left & ~up; \
+      twoxbr_s##bits##v u    = run & ~left & up; \
+      twoxbr_s##bits##v dia  = (run & ~left & ~up) | (ex & ~cond & e_le_i); \
+      twoxbr_u##bits##v e2 = twoxbr_select##bits(lu | l, \
+            twoxbr_blend##bits(E[n2], px, 2), E[n2]); \
+      E[n3] = twoxbr_select##bits(lu, twoxbr_blend##bits(E[n3], px, 7), \
+            twoxbr_select##bits(l | u, twoxbr_blend##bits(E[n3], px, 6), \
+            twoxbr_select##bits(dia, twoxbr_blend##bits##_128(E[n3], px), \
+            E[n3]))); \
+      E[n1] = twoxbr_select##bits(lu, e2, \
+            twoxbr_select##bits(u, twoxbr_blend##bits(E[n1], px, 2), E[n1])); \
+      E[n2] = e2; \
+   } while (0)
+
+RETRO_SIMD_INLINE TWOXBR_TARGET void twoxbr_filtro_rgb565_vec(twoxbr_u16v *E,
+      const uint16_t * const *pix, const uint16_t * const *luma,
+      int x, int rot, int n1, int n2, int n3)
+{
+   twoxbr_u16v PE, PF, PH, PG, PC, PD, PB, px;
+   twoxbr_s16v YE, YF, YH, YI, YG, YC, YD, YB, YF4, YI4, YH5, YI5;
+   twoxbr_s16v e, i, ke, ki, ex, ex2, ex3, cond, e_le_i;
+   twoxbr_s16v d_hd, d_hi5, d_fi4, d_fb, d_ei, d_ec, d_eg;
+
+   PE = twoxbr_load16(TWOXBR_AT(pix, x, rot,  0,  0));
+   PF = twoxbr_load16(TWOXBR_AT(pix, x, rot,  1,  0));
+   PH = twoxbr_load16(TWOXBR_AT(pix, x, rot,  0,  1));
+
+   ex = (PE != PH) & (PE != PF);
+   if (!twoxbr_any((twoxbr_s32v)ex))
+      return;
+
+   PG = twoxbr_load16(TWOXBR_AT(pix, x, rot, -1,  1));
+   PC = twoxbr_load16(TWOXBR_AT(pix, x, rot,  1, -1));
+   PD = twoxbr_load16(TWOXBR_AT(pix, x, rot, -1,  0));
+   PB = twoxbr_load16(TWOXBR_AT(pix, x, rot,  0, -1));
+
+   YE  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  0,  0));
+   YF  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  1,  0));
+   YH  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  0,  1));
+   YI  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  1,  1));
+   YG  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot, -1,  1));
+   YC  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  1, -1));
+   YD  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot, -1,  0));
+   YB  = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  0, -1));
+   YF4 = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  2,  0));
+   YI4 = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  2,  1));
+   YH5 = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  0,  2));
+   YI5 = twoxbr_load_luma(TWOXBR_AT(luma, x, rot,  1,  2));
+
+   d_ec  = twoxbr_df16(YE, YC);
+   d_eg  = twoxbr_df16(YE, YG);
+   d_hd  = twoxbr_df16(YH, YD);
+   d_hi5 = twoxbr_df16(YH, YI5);
+   d_fi4 = twoxbr_df16(YF, YI4);
+   d_fb  = twoxbr_df16(YF, YB);
+   d_ei  = twoxbr_df16(YE, YI);
+
+   /* e and i are uint16_t in FILTRO, and their sums wrap.
+    * Flipping the top bit turns the unsigned compares signed. */
+   e = d_ec + d_eg + twoxbr_df16(YI, YH5) + twoxbr_df16(YI, YF4) +
+      (twoxbr_df16(YH, YF) << 2);
+   i = d_hd + d_hi5 + d_fi4 + d_fb + (d_ei << 2);
+   e ^= INT16_MIN;
+   i ^= INT16_MIN;
+   e_le_i = e <= i;
+
+#define TWOXBR_EQ16(d) ((d) < 155)
+   cond = (e < i) & (
+         (~TWOXBR_EQ16(d_fb) & ~TWOXBR_EQ16(twoxbr_df16(YF, YC))) |
+         (~TWOXBR_EQ16(d_hd) & ~TWOXBR_EQ16(twoxbr_df16(YH, YG))) |
+         (TWOXBR_EQ16(d_ei) &
+          ((~TWOXBR_EQ16(twoxbr_df16(YF, YF4)) & ~TWOXBR_EQ16(d_fi4)) |
+           (~TWOXBR_EQ16(twoxbr_df16(YH, YH5)) & ~TWOXBR_EQ16(d_hi5)))) |
+         TWOXBR_EQ16(d_eg) | TWOXBR_EQ16(d_ec));
+#undef TWOXBR_EQ16
+
+   ke  = twoxbr_df16(YF, YG);
+   ki  = twoxbr_df16(YH, YC);
+   ex2 = (PE != PC) & (PB != PC);
+   ex3 = (PE != PG) & (PD != PG);
+   px  = twoxbr_select16(twoxbr_df16(YE, YF) <= twoxbr_df16(YE, YH), PF, PH);
+
+   TWOXBR_APPLY(16, E, n1, n2, n3, px, ex, cond, e_le_i, ke, ki, ex2, ex3);
+}
+
+#ifdef TWOXBR_XRGB8888
+/* df8() and eq8() of every lane, with the same double
+ * arithmetic as the scalar code so that the terms truncate
+ * alike. */
+RETRO_SIMD_INLINE TWOXBR_TARGET void twoxbr_yuv32(twoxbr_u32v a,
+      twoxbr_u32v b, twoxbr_s32v *df, twoxbr_s32v *eq)
+{
+   twoxbr_s32v r, g, bl, y, u, v;
+   twoxbr_f64v fr, fg, fb;
+
+   r  = (twoxbr_s32v)(a & 0xff) - (twoxbr_s32v)(b & 0xff);
+   g  = (twoxbr_s32v)((a >> 8) & 0xff) - (twoxbr_s32v)((b >> 8) & 0xff);
+   bl = (twoxbr_s32v)((a >> 16) & 0xff) - (twoxbr_s32v)((b >> 16) & 0xff);
+   fr = __builtin_convertvector((r ^ (r >> 31)) - (r >> 31), twoxbr_f64v);
+   fg = __builtin_convertvector((g ^ (g >> 31)) - (g >> 31), twoxbr_f64v);
+   fb = __builtin_convertvector((bl ^ (bl >> 31)) - (bl >> 31), twoxbr_f64v);
+
+   y = __builtin_convertvector(0.299 * fr + 0.587 * fg + 0.114 * fb,
+         twoxbr_s32v);
+   u = __builtin_convertvector(-0.169 * fr - 0.331 * fg + 0.500 * fb,
+         twoxbr_s32v);
+   v = __builtin_convertvector(0.500 * fr - 0.419 * fg - 0.081 * fb,
+         twoxbr_s32v);
+   u = (u ^ (u >> 31)) - (u >> 31);
+   v = (v ^ (v >> 31)) - (v >> 31);
+
+   *df = 48 * y + 7 * u + 6 * v;
+   *eq = (y <= 48) & (u <= 7) & (v <= 6);
+}
+
+RETRO_SIMD_INLINE TWOXBR_TARGET void twoxbr_filtro_xrgb8888_vec(
+      twoxbr_u32v *E, const uint32_t * const *pix,
+      int x, int rot, int n1, int n2, int n3)
+{
+   twoxbr_u32v PE, PF, PH, PI, PG, PC, PD, PB, F4, I4, H5, I5, px;
+   twoxbr_s32v e, i, ke, ki, ex, ex2, ex3, cond, e_le_i, d_ef, d_eh, unused;
+   twoxbr_s32v d_ec, d_eg, d_ih5, d_if4, d_hf, d_hd, d_hi5, d_fi4, d_fb, d_ei;
+   twoxbr_s32v q_ec, q_eg, q_hd, q_hi5, q_fi4, q_fb, q_ei, q_fc, q_hg,
+               q_ff4, q_hh5;
+
+   PE = twoxbr_load32(TWOXBR_AT(pix, x, rot,  0,  0));
+   PF = twoxbr_load32(TWOXBR_AT(pix, x, rot,  1,  0));
+   PH = twoxbr_load32(TWOXBR_AT(pix, x, rot,  0,  1));
+
+   ex = (PE != PH) & (PE != PF);
+   if (!twoxbr_any(ex))
+      return;
+
+   PI = twoxbr_load32(TWOXBR_AT(pix, x, rot,  1,  1));
+   PG = twoxbr_load32(TWOXBR_AT(pix, x, rot, -1,  1));
+   PC = twoxbr_load32(TWOXBR_AT(pix, x, rot,  1, -1));
+   PD = twoxbr_load32(TWOXBR_AT(pix, x, rot, -1,  0));
+   PB = twoxbr_load32(TWOXBR_AT(pix, x, rot,  0, -1));
+   F4 = twoxbr_load32(TWOXBR_AT(pix, x, rot,  2,  0));
+   I4 = twoxbr_load32(TWOXBR_AT(pix, x, rot,  2,  1));
+   H5 = twoxbr_load32(TWOXBR_AT(pix, x, rot,  0,  2));
+   I5 = twoxbr_load32(TWOXBR_AT(pix, x, rot,  1,  2));
+
+   twoxbr_yuv32(PE, PC, &d_ec,  &q_ec);
+   twoxbr_yuv32(PE, PG, &d_eg,  &q_eg);
+   twoxbr_yuv32(PI, H5, &d_ih5, &unused);
+   twoxbr_yuv32(PI, F4, &d_if4, &unused);
+   twoxbr_yuv32(PH, PF, &d_hf,  &unused);
+   twoxbr_yuv32(PH, PD, &d_hd,  &q_hd);
+   twoxbr_yuv32(PH, I5, &d_hi5, &q_hi5);
+   twoxbr_yuv32(PF, I4, &d_fi4, &q_fi4);
+   twoxbr_yuv32(PF, PB, &d_fb,  &q_fb);
+   twoxbr_yuv32(PE, PI, &d_ei,  &q_ei);
+
+   e = d_ec + d_eg + d_ih5 + d_if4 + (d_hf << 2);
+   i = d_hd + d_hi5 + d_fi4 + d_fb + (d_ei << 2);
+   e_le_i = e <= i;
+
+   /* Most lanes with an edge do not blend at all. */
+   if (!twoxbr_any(ex & e_le_i))
+      return;
+
+   twoxbr_yuv32(PF, PC, &unused, &q_fc);
+   twoxbr_yuv32(PH, PG, &unused, &q_hg);
+   twoxbr_yuv32(PF, F4, &unused, &q_ff4);
+   twoxbr_yuv32(PH, H5, &unused, &q_hh5);
+
+   cond = (e < i) & (
+         (~q_fb & ~q_fc) | (~q_hd & ~q_hg) |
+         (q_ei & ((~q_ff4 & ~q_fi4) | (~q_hh5 & ~q_hi5))) |
+         q_eg | q_ec);
+
+   twoxbr_yuv32(PF, PG, &ke, &unused);
+   twoxbr_yuv32(PH, PC, &ki, &unused);
+   twoxbr_yuv32(PE, PF, &d_ef, &unused);
+   twoxbr_yuv32(PE, PH, &d_eh, &unused);
+
+   ex2 = (PE != PC) & (PB != PC);
+   ex3 = (PE != PG) & (PD != PG);
+   px  = twoxbr_select32(d_ef <= d_eh, PF, PH);
+
+   TWOXBR_APPLY(32, E, n1, n2, n3, px, ex, cond, e_le_i, ke, ki, ex2, ex3);
+}
+
+#endif
+
+/* Writes a into the even and b into the odd pixels of out. */
+#define TWOXBR_STORE_PAIRS(out, a, b, lanes) \
+   do { \
+      unsigned lane; \
+      for (lane = 0; lane < (lanes); lane++) \
+      { \
+         (out)[2 * lane]     = (a)[lane]; \
+         (out)[2 * lane + 1] = (b)[lane]; \
+      } \
+   } while (0)
+
+static TWOXBR_TARGET void TWOXBR_FN(twoxbr_row_rgb565)(
+      struct filter_data *filt, struct softfilter_thread_data *thr,
+      const uint16_t *src, unsigned src_stride, const int *rows,
+      unsigned width, uint16_t *dst, unsigned dst_stride)
+{
+   unsigned k, x;
+   const uint16_t *pix[5];
+   const uint16_t *luma[5];
+   unsigned pitch = TWOXBR_LUMA_PITCH(width);
+
+   /* The luma of a row is looked up once, and kept while
+    * the row is in the window. */
+   for (k = 0; k < 5; k++)
+   {
+      int row = rows[k];
+      unsigned slot = (row + 5 * 3) % 5;
+      uint16_t *out = thr->luma + slot * pitch + TWOXBR_LUMA_BORDER;
+
+      pix[k]  = src + row * (int)src_stride;
+      luma[k] = out;
+
+      if (thr->luma_row[slot] == row)
+         continue;
+
+      for (x = 0; x < width + 2 * TWOXBR_LUMA_BORDER; x++)
+      {
+         int pos = (int)x - TWOXBR_LUMA_BORDER;
+         out[pos] = filt->RGBtoYUV[pix[k][pos]];
+      }
+      thr->luma_row[slot] = row;
+   }
+
+   for (x = 0; x + TWOXBR_LANES16 <= width; x += TWOXBR_LANES16)
+   {
+      twoxbr_u16v E[4];
+
+      E[0] = E[1] = E[2] = E[3] = twoxbr_load16(pix[2] + x);
+      twoxbr_filtro_rgb565_vec(E, pix, luma, x, 0, 1, 2, 3);
+      twoxbr_filtro_rgb565_vec(E, pix, luma, x, 1, 0, 3, 1);
+      twoxbr_filtro_rgb565_vec(E, pix, luma, x, 2, 2, 1, 0);
+      twoxbr_filtro_rgb565_vec(E, pix, luma, x, 3, 3, 0, 2);
+
+      TWOXBR_STORE_PAIRS(dst + 2 * x, E[0], E[1], TWOXBR_LANES16);
+      TWOXBR_STORE_PAIRS(dst + dst_stride + 2 * x, E[2], E[3],
+            TWOXBR_LANES16);
+   }
+
+   twoxbr_span_rgb565(filt, pix[2] + x, src_stride, rows,
+         width - x, dst + 2 * x, dst_stride);
+}
+
+#ifdef TWOXBR_XRGB8888
+static TWOXBR_TARGET void TWOXBR_FN(twoxbr_row_xrgb8888)(
+      struct filter_data *filt, struct softfilter_thread_data *thr,
+      const uint32_t *src, unsigned src_stride, const int *rows,
+      unsigned width, uint32_t *dst, unsigned dst_stride)
+{
+   unsigned k, x;
+   const uint32_t *pix[5];
+
+   (void)thr;
+
+   for (k = 0; k < 5; k++)
+      pix[k] = src + rows[k] * (int)src_stride;
+
+   for (x = 0; x + TWOXBR_LANES32 <= width; x += TWOXBR_LANES32)
+   {
+      twoxbr_u32v E[4];
+
+      E[0] = E[1] = E[2] = E[3] = twoxbr_load32(pix[2] + x);
+      twoxbr_filtro_xrgb8888_vec(E, pix, x, 0, 1, 2, 3);
+      twoxbr_filtro_xrgb8888_vec(E, pix, x, 1, 0, 3, 1);
+      twoxbr_filtro_xrgb8888_vec(E, pix, x, 2, 2, 1, 0);
+      twoxbr_filtro_xrgb8888_vec(E, pix, x, 3, 3, 0, 2);
+
+      TWOXBR_STORE_PAIRS(dst + 2 * x, E[0], E[1], TWOXBR_LANES32);
+      TWOXBR_STORE_PAIRS(dst + dst_stride + 2 * x, E[2], E[3],
+            TWOXBR_LANES32);
+   }
+
+   twoxbr_span_xrgb8888(filt, pix[2] + x, src_stride, rows,
+         width - x, dst + 2 * x, dst_stride);
+}
+#endif
+
+#undef TWOXBR_STORE_PAIRS
+#undef TWOXBR_APPLY
+#undef TWOXBR_LANES16
+#undef TWOXBR_LANES32
+#undef twoxbr_u16v
+#undef twoxbr_s16v
+#undef twoxbr_u32v
+#undef twoxbr_s32v
+#undef twoxbr_f64v
+#undef twoxbr_any
+#undef twoxbr_load16
+#undef twoxbr_load_luma
+#undef twoxbr_load32
+#undef twoxbr_df16
+#undef twoxbr_select16
+#undef twoxbr_select32
+#undef twoxbr_blend16
+#undef twoxbr_blend16_128
+#undef twoxbr_blend32
+#undef twoxbr_blend32_128
+#undef twoxbr_filtro_rgb565_vec
+#undef twoxbr_yuv32
+#undef twoxbr_filtro_xrgb8888_vec
+#undef TWOXBR_FN
+#undef TWOXBR_PASTE
+#undef TWOXBR_PASTE_
+#undef TWOXBR_ISA
+#undef TWOXBR_TARGET
+#undef TWOXBR_VECTOR_SIZE
+#undef TWOXBR_XRGB8888
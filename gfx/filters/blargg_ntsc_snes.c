@@ -15,6 +15,7 @@
  */
 
 #include "softfilter.h"
+#include <retro_simd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,8 +40,14 @@ struct softfilter_thread_data
    unsigned height;
    int first;
    int last;
+   int burst;
 };
 
+typedef void (*blargg_ntsc_snes_blit_t)(snes_ntsc_t const *ntsc,
+      SNES_NTSC_IN_T const *input, long in_row_width,
+      int burst_phase, int in_width, int in_height,
+      void *rgb_out, long out_pitch, int first, int last);
+
 struct filter_data
 {
    unsigned threads;
@@ -49,8 +56,133 @@ struct filter_data
    struct snes_ntsc_t *ntsc;
    int burst;
    int burst_toggle;
+   blargg_ntsc_snes_blit_t blit;
 };
 
+/* The vector blitter reads a few kernel entries
+ * past the end of the table. */
+#define BLARGG_NTSC_SNES_TABLE_SLACK 64
+
+#if defined(__GNUC__) && SNES_NTSC_OUT_DEPTH == 16 && UINT_MAX == 0xFFFFFFFF && \
+   (__SSE2__ || defined(HAVE_RETRO_TARGET_X86) || defined(__ARM_NEON__))
+#define BLARGG_NTSC_SNES_SIMD
+
+/* snes_ntsc_blit, with the seven output pixels of a chunk 
+ * summed as one vector. The kernel entries an output pixel sums
+ * sit at rotated positions in their kernels, which turns into
+ * two loads and a select per kernel. Kernels change part way
+ * through a chunk at pixels 2 and 4, which fall on the same
+ * selects. Lane 7 is not used. */
+typedef snes_ntsc_rgb_t blargg_ntsc_snes_vec_t __attribute__((vector_size(32)));
+
+#define blargg_ntsc_snes_load(kernel, offset, out) \
+   memcpy(&(out), (kernel) + (offset), sizeof(out))
+
+#define blargg_ntsc_snes_select(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+#define BLARGG_NTSC_SNES_KERNELS(isa, attr) \
+static attr void blargg_ntsc_snes_blit_##isa(snes_ntsc_t const *ntsc, \
+      SNES_NTSC_IN_T const *input, long in_row_width, \
+      int burst_phase, int in_width, int in_height, \
+      void *rgb_out, long out_pitch, int first, int last) \
+{ \
+   const blargg_ntsc_snes_vec_t lo2 = { ~0u, ~0u }; \
+   const blargg_ntsc_snes_vec_t lo4 = { ~0u, ~0u, ~0u, ~0u }; \
+   int chunk_count = (in_width - 1) / snes_ntsc_in_chunk; \
+   (void)first; \
+   (void)last; \
+   for ( ; in_height; --in_height) \
+   { \
+      char const *ktable = (char const*)ntsc->table + \
+         burst_phase * (snes_ntsc_burst_size * sizeof(snes_ntsc_rgb_t)); \
+      SNES_NTSC_IN_T const *line_in = input; \
+      snes_ntsc_out_t *line_out = (snes_ntsc_out_t*)rgb_out; \
+      snes_ntsc_rgb_t const *black = SNES_NTSC_IN_FORMAT(ktable, snes_ntsc_black); \
+      snes_ntsc_rgb_t const *kernel0 = black, *kernel1 = black; \
+      snes_ntsc_rgb_t const *kernel2 = SNES_NTSC_IN_FORMAT(ktable, line_in[0]); \
+      snes_ntsc_rgb_t const *kernelx1 = black, *kernelx2 = black; \
+      int n; \
+      ++line_in; \
+      for (n = chunk_count; n >= 0; --n) \
+      { \
+         unsigned x; \
+         unsigned p0 = n ? line_in[0] : snes_ntsc_black; \
+         unsigned p1 = n ? line_in[1] : snes_ntsc_black; \
+         unsigned p2 = n ? line_in[2] : snes_ntsc_black; \
+         snes_ntsc_rgb_t const *next0 = SNES_NTSC_IN_FORMAT(ktable, p0); \
+         snes_ntsc_rgb_t const *next1 = SNES_NTSC_IN_FORMAT(ktable, p1); \
+         snes_ntsc_rgb_t const *next2 = SNES_NTSC_IN_FORMAT(ktable, p2); \
+         blargg_ntsc_snes_vec_t a, b, c, d, e, f, g, h, raw, sub, clamp; \
+         blargg_ntsc_snes_load(next0,    0, a); \
+         blargg_ntsc_snes_load(kernel0,  7, b); \
+         blargg_ntsc_snes_load(kernel1, 19, c); \
+         blargg_ntsc_snes_load(next1,   12, d); \
+         blargg_ntsc_snes_load(kernelx1, 26, e); \
+         blargg_ntsc_snes_load(kernel2, 31, f); \
+         blargg_ntsc_snes_load(next2,   24, g); \
+         blargg_ntsc_snes_load(kernelx2, 38, h); \
+         raw = a + b + \
+            blargg_ntsc_snes_select(lo2, c, d) + \
+            blargg_ntsc_snes_select(lo2, e, c) + \
+            blargg_ntsc_snes_select(lo4, f, g) + \
+            blargg_ntsc_snes_select(lo4, h, f); \
+         sub   = raw >> 8 & (snes_ntsc_rgb_t)snes_ntsc_clamp_mask; \
+         clamp = (snes_ntsc_rgb_t)snes_ntsc_clamp_add - sub; \
+         raw  |= clamp; \
+         clamp -= sub; \
+         raw  &= clamp; \
+         raw = (raw >> 12 & 0xF800) | (raw >> 7 & 0x07E0) | (raw >> 3 & 0x001F); \
+         for (x = 0; x < snes_ntsc_out_chunk; x++) \
+            line_out[x] = raw[x]; \
+         kernelx1 = kernel1; \
+         kernelx2 = kernel2; \
+         kernel0 = next0; \
+         kernel1 = next1; \
+         kernel2 = next2; \
+         line_in  += 3; \
+         line_out += 7; \
+      } \
+      burst_phase = (burst_phase + 1) % snes_ntsc_burst_count; \
+      input += in_row_width; \
+      rgb_out = (char*)rgb_out + out_pitch; \
+   } \
+}
+
+#if __SSE2__
+BLARGG_NTSC_SNES_KERNELS(SSE2, )
+#endif
+
+#ifdef HAVE_RETRO_TARGET_X86
+BLARGG_NTSC_SNES_KERNELS(AVX2, RETRO_TARGET("avx2"))
+#endif
+
+#ifdef __ARM_NEON__
+BLARGG_NTSC_SNES_KERNELS(NEON, )
+#endif
+#endif
+
+static void blargg_ntsc_snes_init_blit(struct filter_data *filt,
+      softfilter_simd_mask_t simd)
+{
+   (void)simd;
+
+   filt->blit = snes_ntsc_blit;
+
+#ifdef BLARGG_NTSC_SNES_SIMD
+#if __SSE2__
+   filt->blit = blargg_ntsc_snes_blit_SSE2;
+#endif
+#ifdef HAVE_RETRO_TARGET_X86
+   if (simd & SOFTFILTER_SIMD_AVX2)
+      filt->blit = blargg_ntsc_snes_blit_AVX2;
+#endif
+#ifdef __ARM_NEON__
+   if (simd & SOFTFILTER_SIMD_NEON)
+      filt->blit = blargg_ntsc_snes_blit_NEON;
+#endif
+#endif
+}
+
 
 static unsigned blargg_ntsc_snes_generic_input_fmts(void)
 {
@@ -76,7 +208,8 @@ static void blargg_ntsc_snes_initialize(void *data,
    snes_ntsc_setup_t setup;
    struct filter_data *filt = (struct filter_data*)data;
 
-   filt->ntsc = (snes_ntsc_t*)calloc(1, sizeof(*filt->ntsc));
+   filt->ntsc = (snes_ntsc_t*)calloc(1,
+         sizeof(*filt->ntsc) + BLARGG_NTSC_SNES_TABLE_SLACK);
 
    if (config->get_string(userdata, "tvtype", &tvtype, "composite"))
    {
@@ -112,8 +245,9 @@ static void blargg_ntsc_snes_initialize(void *data,
 
    snes_ntsc_init(filt->ntsc, &setup);
 
-   filt->burst = 0;
    filt->burst_toggle = (setup.merge_fields ? 0 : 1);
+   /* Stepped back to 0 before the first frame. */
+   filt->burst = filt->burst_toggle;
 }
 
 static void *blargg_ntsc_snes_generic_create(const struct softfilter_config *config,
@@ -121,14 +255,12 @@ static void *blargg_ntsc_snes_generic_create(const struct softfilter_config *con
       unsigned max_width, unsigned max_height,
       unsigned threads, softfilter_simd_mask_t simd, void *userdata)
 {
-   (void)simd;
-
    struct filter_data *filt = (struct filter_data*)calloc(1, sizeof(*filt));
    if (!filt)
       return NULL;
    filt->workers = (struct softfilter_thread_data*)
       calloc(threads, sizeof(struct softfilter_thread_data));
-   filt->threads = 1;
+   filt->threads = threads;
    filt->in_fmt  = in_fmt;
    if (!filt->workers)
    {
@@ -137,6 +269,7 @@ static void *blargg_ntsc_snes_generic_create(const struct softfilter_config *con
    }
 
    blargg_ntsc_snes_initialize(filt, config, userdata);
+   blargg_ntsc_snes_init_blit(filt, simd);
 
    return filt;
 }
@@ -165,26 +298,24 @@ static void blargg_ntsc_snes_generic_destroy(void *data)
 }
 
 static void blargg_ntsc_snes_render_rgb565(void *data, int width, int height,
-      int first, int last,
+      int first, int last, int burst,
       uint16_t *input, int pitch, uint16_t *output, int outpitch)
 {
    struct filter_data *filt = (struct filter_data*)data;
    if(width <= 256)
-      snes_ntsc_blit(filt->ntsc, input, pitch, filt->burst,
+      filt->blit(filt->ntsc, input, pitch, burst,
             width, height, output, outpitch * 2, first, last);
    else
-      snes_ntsc_blit_hires(filt->ntsc, input, pitch, filt->burst,
+      snes_ntsc_blit_hires(filt->ntsc, input, pitch, burst,
             width, height, output, outpitch * 2, first, last);
-
-   filt->burst ^= filt->burst_toggle;
 }
 
 static void blargg_ntsc_snes_rgb565(void *data, unsigned width, unsigned height,
-      int first, int last, uint16_t *src, 
+      int first, int last, int burst, uint16_t *src, 
       unsigned src_stride, uint16_t *dst, unsigned dst_stride)
 {
    blargg_ntsc_snes_render_rgb565(data, width, height,
-         first, last,
+         first, last, burst,
          src, src_stride,
          dst, dst_stride);
 
@@ -200,7 +331,7 @@ static void blargg_ntsc_snes_work_cb_rgb565(void *data, void *thread_data)
    unsigned height = thr->height;
 
    blargg_ntsc_snes_rgb565(data, width, height,
-         thr->first, thr->last, input,
+         thr->first, thr->last, thr->burst, input,
          thr->in_pitch / SOFTFILTER_BPP_RGB565,
          output,
          thr->out_pitch / SOFTFILTER_BPP_RGB565);
@@ -232,12 +363,23 @@ static void blargg_ntsc_snes_generic_packets(void *data,
       thr->first = y_start;
       thr->last = y_end == height;
 
+      /* The burst phase steps once per row. */
+      thr->burst = (filt->burst + y_start) % snes_ntsc_burst_count;
+
       if (filt->in_fmt == SOFTFILTER_FMT_RGB565)
          packets[i].work = blargg_ntsc_snes_work_cb_rgb565;
       packets[i].thread_data = thr;
    }
 }
 
+/* Chains call get_work_packets once per band, 
+ * so the burst phase of a field steps here. */
+static void blargg_ntsc_snes_generic_start_frame(void *data)
+{
+   struct filter_data *filt = (struct filter_data*)data;
+   filt->burst ^= filt->burst_toggle;
+}
+
 static const struct softfilter_implementation blargg_ntsc_snes_generic = {
    blargg_ntsc_snes_generic_input_fmts,
    blargg_ntsc_snes_generic_output_fmts,
@@ -251,6 +393,7 @@ static const struct softfilter_implementation blargg_ntsc_snes_generic = {
    SOFTFILTER_API_VERSION,
    "Blargg NTSC SNES",
    "blargg_ntsc_snes",
+   blargg_ntsc_snes_generic_start_frame,
 };
 
 const struct softfilter_implementation *softfilter_get_implementation(
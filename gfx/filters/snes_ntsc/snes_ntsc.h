@@ -5,6 +5,7 @@
 #define SNES_NTSC_H
 
 #include "snes_ntsc_config.h"
+#include <limits.h>
 
 #ifdef __cplusplus
 	extern "C" {
@@ -133,7 +134,13 @@ statement in a block (unless you're using C++). */
 /* private */
 enum { snes_ntsc_entry_size = 128 };
 enum { snes_ntsc_palette_size = 0x2000 };
-typedef unsigned long snes_ntsc_rgb_t;
+/* Only the low 32 bits of a kernel entry are ever used,
+so a 32-bit type halves the table. */
+#if UINT_MAX >= 0xFFFFFFFF
+	typedef unsigned int  snes_ntsc_rgb_t;
+#else
+	typedef unsigned long snes_ntsc_rgb_t;
+#endif
 struct snes_ntsc_t {
 	snes_ntsc_rgb_t table [snes_ntsc_palette_size] [snes_ntsc_entry_size];
 };
@@ -92,7 +92,7 @@ typedef const struct softfilter_implementation
 const struct softfilter_implementation *softfilter_get_implementation(
       softfilter_simd_mask_t simd);
 
-#define SOFTFILTER_API_VERSION  2
+#define SOFTFILTER_API_VERSION  3
 
 /* Required base color formats */
 
@@ -147,12 +147,23 @@ typedef void (*softfilter_query_output_size_t)(void *data,
  *
  * The number of elements in the array is as returned by query_num_threads.
  * The processing itself happens in worker threads after this returns.
+ *
+ * When filters are chained, this is called once per band of rows 
+ * instead, with input and output pointing into the band. A few rows 
+ * of valid input are kept around the band, and bands start on a 
+ * multiple of six rows. Anything which changes from one frame to the 
+ * next must be stepped in start_frame instead, or the bands of a 
+ * frame will not match.
  */
 typedef void (*softfilter_get_work_packets_t)(void *data,
       struct softfilter_work_packet *packets,
       void *output, size_t output_stride,
       const void *input, unsigned width, unsigned height, size_t input_stride);
 
+/* Called once before every frame, before any call to 
+ * get_work_packets for it. Optional, can be NULL. */
+typedef void (*softfilter_start_frame_t)(void *data);
+
 /* Returns the number of worker threads the filter will use.
  * This can differ from the value passed to create() instead the filter 
  * cannot be parallelized, etc. The number of threads must be less-or-equal 
@@ -178,6 +189,8 @@ struct softfilter_implementation
    /* Computer-friendly short version of ident.
     * Lower case, no spaces and special characters, etc. */
    const char *short_ident;
+
+   softfilter_start_frame_t start_frame;
 };
 
 #ifdef __cplusplus
@@ -17,7 +17,9 @@
 // Compile: gcc -o supertwoxsai.so -shared supertwoxsai.c -std=c99 -O3 -Wall -pedantic -fPIC
 
 #include "softfilter.h"
+#include <retro_simd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef RARCH_INTERNAL
 #define softfilter_get_implementation supertwoxsai_get_implementation
@@ -40,11 +42,23 @@ struct softfilter_thread_data
    int last;
 };
 
+/* Filters one row. rows[] holds the indices of the rows
+ * from one above to two below it, clamped to the frame. */
+typedef void (*supertwoxsai_row_rgb565_t)(const uint16_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint16_t *dst, unsigned dst_stride);
+
+typedef void (*supertwoxsai_row_xrgb8888_t)(const uint32_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint32_t *dst, unsigned dst_stride);
+
 struct filter_data
 {
    unsigned threads;
    struct softfilter_thread_data *workers;
    unsigned in_fmt;
+   supertwoxsai_row_rgb565_t row_rgb565;
+   supertwoxsai_row_xrgb8888_t row_xrgb8888;
 };
 
 static unsigned supertwoxsai_generic_input_fmts(void)
@@ -63,12 +77,14 @@ static unsigned supertwoxsai_generic_threads(void *data)
    return filt->threads;
 }
 
+static void supertwoxsai_init_kernels(struct filter_data *filt,
+      softfilter_simd_mask_t simd);
+
 static void *supertwoxsai_generic_create(const struct softfilter_config *config,
       unsigned in_fmt, unsigned out_fmt,
       unsigned max_width, unsigned max_height,
       unsigned threads, softfilter_simd_mask_t simd, void *userdata)
 {
-   (void)simd;
    (void)config;
    (void)userdata;
 
@@ -76,13 +92,14 @@ static void *supertwoxsai_generic_create(const struct softfilter_config *config,
    if (!filt)
       return NULL;
    filt->workers = (struct softfilter_thread_data*)calloc(threads, sizeof(struct softfilter_thread_data));
-   filt->threads = 1;
+   filt->threads = threads;
    filt->in_fmt  = in_fmt;
    if (!filt->workers)
    {
       free(filt);
       return NULL;
    }
+   supertwoxsai_init_kernels(filt, simd);
    return filt;
 }
 
@@ -108,19 +125,19 @@ static void supertwoxsai_generic_destroy(void *data)
 
 #define supertwoxsai_interpolate2_xrgb8888(A, B, C, D) ((((A) & 0xFCFCFCFC) >> 2) + (((B) & 0xFCFCFCFC) >> 2) + (((C) & 0xFCFCFCFC) >> 2) + (((D) & 0xFCFCFCFC) >> 2) + (((((A) & 0x03030303) + ((B) & 0x03030303) + ((C) & 0x03030303) + ((D) & 0x03030303)) >> 2) & 0x03030303))
 
-#define supertwoxsai_interpolate_rgb565(A, B) ((((A) & 0xF7DE) >> 1) + (((B) & 0xF7DE) >> 1) + ((A) & (B) & 0x0821));
+#define supertwoxsai_interpolate_rgb565(A, B) ((((A) & 0xF7DE) >> 1) + (((B) & 0xF7DE) >> 1) + ((A) & (B) & 0x0821))
 
 #define supertwoxsai_interpolate2_rgb565(A, B, C, D) ((((A) & 0xE79C) >> 2) + (((B) & 0xE79C) >> 2) + (((C) & 0xE79C) >> 2) + (((D) & 0xE79C) >> 2)  + (((((A) & 0x1863) + ((B) & 0x1863) + ((C) & 0x1863) + ((D) & 0x1863)) >> 2) & 0x1863))
 
 #define supertwoxsai_result(A, B, C, D) (((A) != (C) || (A) != (D)) - ((B) != (C) || (B) != (D)))
 
 #ifndef supertwoxsai_declare_variables
-#define supertwoxsai_declare_variables(typename_t, in, nextline) \
+#define supertwoxsai_declare_variables(typename_t, in, prevline, nextline, nextline2) \
          typename_t product1a, product1b, product2a, product2b; \
-         const typename_t colorB0 = *(in - nextline - 1); \
-         const typename_t colorB1 = *(in - nextline + 0); \
-         const typename_t colorB2 = *(in - nextline + 1); \
-         const typename_t colorB3 = *(in - nextline + 2); \
+         const typename_t colorB0 = *(in - prevline - 1); \
+         const typename_t colorB1 = *(in - prevline + 0); \
+         const typename_t colorB2 = *(in - prevline + 1); \
+         const typename_t colorB3 = *(in - prevline + 2); \
          const typename_t color4  = *(in - 1); \
          const typename_t color5  = *(in + 0); \
          const typename_t color6  = *(in + 1); \
@@ -129,10 +146,10 @@ static void supertwoxsai_generic_destroy(void *data)
          const typename_t color2  = *(in + nextline + 0); \
          const typename_t color3  = *(in + nextline + 1); \
          const typename_t colorS1 = *(in + nextline + 2); \
-         const typename_t colorA0 = *(in + nextline + nextline - 1); \
-         const typename_t colorA1 = *(in + nextline + nextline + 0); \
-         const typename_t colorA2 = *(in + nextline + nextline + 1); \
-         const typename_t colorA3 = *(in + nextline + nextline + 2)
+         const typename_t colorA0 = *(in + nextline2 - 1); \
+         const typename_t colorA1 = *(in + nextline2 + 0); \
+         const typename_t colorA2 = *(in + nextline2 + 1); \
+         const typename_t colorA3 = *(in + nextline2 + 2)
 #endif
 
 #ifndef supertwoxsai_function
@@ -198,63 +215,275 @@ static void supertwoxsai_generic_destroy(void *data)
          out += 2
 #endif
 
-static void supertwoxsai_generic_xrgb8888(unsigned width, unsigned height,
+/* Indices of the rows from one above to two below row y of a packet.
+ * Packets can read the rows of their neighbours, but rows past the
+ * top or bottom of the frame repeat the edge row. */
+static void supertwoxsai_clamp_rows(int *rows, unsigned y, unsigned height,
+      int first, int last)
+{
+   int k;
+   for (k = 0; k < 4; k++)
+   {
+      int row = (int)y + k - 1;
+      if (row < -first)
+         row = -first;
+      if (last && row > (int)height - 1)
+         row = height - 1;
+      rows[k] = row;
+   }
+}
+
+static void supertwoxsai_span_xrgb8888(const uint32_t *in,
+      unsigned prevline, unsigned nextline, unsigned nextline2,
+      unsigned width, uint32_t *out, unsigned dst_stride)
+{
+   for (; width; width--)
+   {
+      supertwoxsai_declare_variables(uint32_t, in, prevline, nextline, nextline2);
+
+      //---------------------------    B1 B2
+      //                             4  5  6 S2
+      //                             1  2  3 S1
+      //                               A1 A2
+      //--------------------------------------
+
+      supertwoxsai_function(supertwoxsai_result, supertwoxsai_interpolate_xrgb8888, supertwoxsai_interpolate2_xrgb8888);
+   }
+}
+
+static void supertwoxsai_span_rgb565(const uint16_t *in,
+      unsigned prevline, unsigned nextline, unsigned nextline2,
+      unsigned width, uint16_t *out, unsigned dst_stride)
+{
+   for (; width; width--)
+   {
+      supertwoxsai_declare_variables(uint16_t, in, prevline, nextline, nextline2);
+
+      //---------------------------    B1 B2
+      //                             4  5  6 S2
+      //                             1  2  3 S1
+      //                               A1 A2
+      //--------------------------------------
+
+      supertwoxsai_function(supertwoxsai_result, supertwoxsai_interpolate_rgb565, supertwoxsai_interpolate2_rgb565);
+   }
+}
+
+#define supertwoxsai_row_lines(rows, src_stride) \
+   unsigned prevline  = (rows[1] - rows[0]) * src_stride; \
+   unsigned nextline  = (rows[2] - rows[1]) * src_stride; \
+   unsigned nextline2 = (rows[3] - rows[1]) * src_stride
+
+static void supertwoxsai_row_xrgb8888_C(const uint32_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint32_t *dst, unsigned dst_stride)
+{
+   supertwoxsai_row_lines(rows, src_stride);
+   supertwoxsai_span_xrgb8888(src + rows[1] * (int)src_stride,
+         prevline, nextline, nextline2, width, dst, dst_stride);
+}
+
+static void supertwoxsai_row_rgb565_C(const uint16_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint16_t *dst, unsigned dst_stride)
+{
+   supertwoxsai_row_lines(rows, src_stride);
+   supertwoxsai_span_rgb565(src + rows[1] * (int)src_stride,
+         prevline, nextline, nextline2, width, dst, dst_stride);
+}
+
+#if defined(__GNUC__) && \
+   (__SSE2__ || defined(HAVE_RETRO_TARGET_X86) || defined(__ARM_NEON__))
+#define SUPERTWOXSAI_SIMD
+
+/* The vector kernels run supertwoxsai_function on a vector of pixels
+ * at once, with its branches turned into lane selects. They are
+ * written with GCC vector extensions and built for each instruction
+ * set. Comparisons give all-ones lanes, so result_cb turns into
+ * a difference of masks. */
+#define supertwoxsai_select(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+#define supertwoxsai_vector_result(mask_t, A, B, C, D) \
+   ((mask_t)(((B) != (C)) | ((B) != (D))) - (mask_t)(((A) != (C)) | ((A) != (D))))
+
+#define supertwoxsai_vector_load(color, ptr) memcpy(&(color), (ptr), sizeof(color))
+
+#define supertwoxsai_vector_declare_variables(vec_t, in, prevline, nextline, nextline2) \
+         vec_t product1a, product1b, product2a, product2b, same; \
+         vec_t colorB0, colorB1, colorB2, colorB3, color4, color5, color6, colorS2; \
+         vec_t color1, color2, color3, colorS1, colorA0, colorA1, colorA2, colorA3; \
+         supertwoxsai_vector_load(colorB0, in - prevline - 1); \
+         supertwoxsai_vector_load(colorB1, in - prevline + 0); \
+         supertwoxsai_vector_load(colorB2, in - prevline + 1); \
+         supertwoxsai_vector_load(colorB3, in - prevline + 2); \
+         supertwoxsai_vector_load(color4,  in - 1); \
+         supertwoxsai_vector_load(color5,  in + 0); \
+         supertwoxsai_vector_load(color6,  in + 1); \
+         supertwoxsai_vector_load(colorS2, in + 2); \
+         supertwoxsai_vector_load(color1,  in + nextline - 1); \
+         supertwoxsai_vector_load(color2,  in + nextline + 0); \
+         supertwoxsai_vector_load(color3,  in + nextline + 1); \
+         supertwoxsai_vector_load(colorS1, in + nextline + 2); \
+         supertwoxsai_vector_load(colorA0, in + nextline2 - 1); \
+         supertwoxsai_vector_load(colorA1, in + nextline2 + 0); \
+         supertwoxsai_vector_load(colorA2, in + nextline2 + 1); \
+         supertwoxsai_vector_load(colorA3, in + nextline2 + 2)
+
+#define supertwoxsai_vector_function(vec_t, mask_t, interpolate_cb, interpolate2_cb) \
+         { \
+            const vec_t c26 = (vec_t)(color2 == color6); \
+            const vec_t c53 = (vec_t)(color5 == color3); \
+            const mask_t r = \
+               supertwoxsai_vector_result(mask_t, color6, color5, color1, colorA1) + \
+               supertwoxsai_vector_result(mask_t, color6, color5, color4, colorB1) + \
+               supertwoxsai_vector_result(mask_t, color6, color5, colorA2, colorS1) + \
+               supertwoxsai_vector_result(mask_t, color6, color5, colorB2, colorS2); \
+            same = supertwoxsai_select(c26 & ~c53, color2, \
+                  supertwoxsai_select(c53 & ~c26, color5, \
+                  supertwoxsai_select((vec_t)(r > 0), color6, \
+                  supertwoxsai_select((vec_t)(r < 0), color5, \
+                  interpolate_cb(color5, color6))))); \
+            product2b = supertwoxsai_select(c26 | c53, same, \
+                  supertwoxsai_select((vec_t)((color6 == color3) & (color3 == colorA1) & \
+                        (color2 != colorA2) & (color3 != colorA0)), \
+                     interpolate2_cb(color3, color3, color3, color2), \
+                  supertwoxsai_select((vec_t)((color5 == color2) & (color2 == colorA2) & \
+                        (colorA1 != color3) & (color2 != colorA3)), \
+                     interpolate2_cb(color2, color2, color2, color3), \
+                  interpolate_cb(color2, color3)))); \
+            product1b = supertwoxsai_select(c26 | c53, same, \
+                  supertwoxsai_select((vec_t)((color6 == color3) & (color6 == colorB1) & \
+                        (color5 != colorB2) & (color6 != colorB0)), \
+                     interpolate2_cb(color6, color6, color6, color5), \
+                  supertwoxsai_select((vec_t)((color5 == color2) & (color5 == colorB2) & \
+                        (colorB1 != color6) & (color5 != colorB3)), \
+                     interpolate2_cb(color6, color5, color5, color5), \
+                  interpolate_cb(color5, color6)))); \
+            product2a = supertwoxsai_select((c53 & ~c26 & \
+                     (vec_t)((color4 == color5) & (color5 != colorA2))) | \
+                  (vec_t)((color5 == color1) & (color6 == color5) & \
+                     (color4 != color2) & (color5 != colorA0)), \
+                  interpolate_cb(color2, color5), color2); \
+            product1a = supertwoxsai_select((c26 & ~c53 & \
+                     (vec_t)((color1 == color2) & (color2 != colorB2))) | \
+                  (vec_t)((color4 == color2) & (color3 == color2) & \
+                     (color1 != color5) & (color2 != colorB0)), \
+                  interpolate_cb(color2, color5), color5); \
+         }
+
+#define SUPERTWOXSAI_ROW_KERNEL(isa, attr, fmt, typename_t, vec_t, mask_t) \
+static attr void supertwoxsai_row_##fmt##_##isa(const typename_t *src, \
+      unsigned src_stride, const int *rows, unsigned width, \
+      typename_t *dst, unsigned dst_stride) \
+{ \
+   unsigned x, lane; \
+   const unsigned lanes = sizeof(vec_t) / sizeof(typename_t); \
+   const typename_t *in = src + rows[1] * (int)src_stride; \
+   typename_t *out = dst; \
+   supertwoxsai_row_lines(rows, src_stride); \
+   for (x = 0; x + lanes <= width; x += lanes) \
+   { \
+      supertwoxsai_vector_declare_variables(vec_t, in, prevline, nextline, nextline2); \
+      supertwoxsai_vector_function(vec_t, mask_t, \
+            supertwoxsai_interpolate_##fmt, supertwoxsai_interpolate2_##fmt); \
+      for (lane = 0; lane < lanes; lane++) \
+      { \
+         out[2 * lane] = product1a[lane]; \
+         out[2 * lane + 1] = product1b[lane]; \
+         out[dst_stride + 2 * lane] = product2a[lane]; \
+         out[dst_stride + 2 * lane + 1] = product2b[lane]; \
+      } \
+      in += lanes; \
+      out += 2 * lanes; \
+   } \
+   supertwoxsai_span_##fmt(in, prevline, nextline, nextline2, \
+         width - x, out, dst_stride); \
+}
+
+#define SUPERTWOXSAI_KERNELS(isa, attr, size) \
+typedef uint16_t supertwoxsai_u16v_##isa __attribute__((vector_size(size))); \
+typedef int16_t supertwoxsai_s16v_##isa __attribute__((vector_size(size))); \
+typedef uint32_t supertwoxsai_u32v_##isa __attribute__((vector_size(size))); \
+typedef int32_t supertwoxsai_s32v_##isa __attribute__((vector_size(size))); \
+SUPERTWOXSAI_ROW_KERNEL(isa, attr, rgb565, uint16_t, \
+      supertwoxsai_u16v_##isa, supertwoxsai_s16v_##isa) \
+SUPERTWOXSAI_ROW_KERNEL(isa, attr, xrgb8888, uint32_t, \
+      supertwoxsai_u32v_##isa, supertwoxsai_s32v_##isa)
+
+#if __SSE2__
+SUPERTWOXSAI_KERNELS(SSE2, , 16)
+#endif
+
+#ifdef HAVE_RETRO_TARGET_X86
+SUPERTWOXSAI_KERNELS(AVX2, RETRO_TARGET("avx2"), 32)
+#endif
+
+#ifdef __ARM_NEON__
+SUPERTWOXSAI_KERNELS(NEON, , 16)
+#endif
+#endif
+
+static void supertwoxsai_init_kernels(struct filter_data *filt,
+      softfilter_simd_mask_t simd)
+{
+   (void)simd;
+
+   filt->row_rgb565   = supertwoxsai_row_rgb565_C;
+   filt->row_xrgb8888 = supertwoxsai_row_xrgb8888_C;
+
+#ifdef SUPERTWOXSAI_SIMD
+#if __SSE2__
+   filt->row_rgb565   = supertwoxsai_row_rgb565_SSE2;
+   filt->row_xrgb8888 = supertwoxsai_row_xrgb8888_SSE2;
+#endif
+#ifdef HAVE_RETRO_TARGET_X86
+   if (simd & SOFTFILTER_SIMD_AVX2)
+   {
+      filt->row_rgb565   = supertwoxsai_row_rgb565_AVX2;
+      filt->row_xrgb8888 = supertwoxsai_row_xrgb8888_AVX2;
+   }
+#endif
+#ifdef __ARM_NEON__
+   if (simd & SOFTFILTER_SIMD_NEON)
+   {
+      filt->row_rgb565   = supertwoxsai_row_rgb565_NEON;
+      filt->row_xrgb8888 = supertwoxsai_row_xrgb8888_NEON;
+   }
+#endif
+#endif
+}
+
+static void supertwoxsai_generic_xrgb8888(struct filter_data *filt,
+      unsigned width, unsigned height,
       int first, int last, uint32_t *src, 
       unsigned src_stride, uint32_t *dst, unsigned dst_stride)
 {
-   unsigned nextline, finish;
-   nextline = (last) ? 0 : src_stride;
+   unsigned y;
 
-   for (; height; height--)
+   for (y = 0; y < height; y++)
    {
-      uint32_t *in  = (uint32_t*)src;
-      uint32_t *out = (uint32_t*)dst;
-
-      for (finish = width; finish; finish -= 1)
-      {
-         supertwoxsai_declare_variables(uint32_t, in, nextline);
-
-         //---------------------------    B1 B2
-         //                             4  5  6 S2
-         //                             1  2  3 S1
-         //                               A1 A2
-         //--------------------------------------
-         
-         supertwoxsai_function(supertwoxsai_result, supertwoxsai_interpolate_xrgb8888, supertwoxsai_interpolate2_xrgb8888);
-      }
-
-      src += src_stride;
-      dst += 2 * dst_stride;
+      int rows[4];
+
+      supertwoxsai_clamp_rows(rows, y, height, first, last);
+      filt->row_xrgb8888(src, src_stride, rows, width,
+            dst + 2 * y * dst_stride, dst_stride);
    }
 }
 
-static void supertwoxsai_generic_rgb565(unsigned width, unsigned height,
+static void supertwoxsai_generic_rgb565(struct filter_data *filt,
+      unsigned width, unsigned height,
       int first, int last, uint16_t *src, 
       unsigned src_stride, uint16_t *dst, unsigned dst_stride)
 {
-   unsigned nextline, finish;
-   nextline = (last) ? 0 : src_stride;
+   unsigned y;
 
-   for (; height; height--)
+   for (y = 0; y < height; y++)
    {
-      uint16_t *in  = (uint16_t*)src;
-      uint16_t *out = (uint16_t*)dst;
-
-      for (finish = width; finish; finish -= 1)
-      {
-         supertwoxsai_declare_variables(uint16_t, in, nextline);
-
-         //---------------------------    B1 B2
-         //                             4  5  6 S2
-         //                             1  2  3 S1
-         //                               A1 A2
-         //--------------------------------------
-         
-         supertwoxsai_function(supertwoxsai_result, supertwoxsai_interpolate_rgb565, supertwoxsai_interpolate2_rgb565);
-      }
-
-      src += src_stride;
-      dst += 2 * dst_stride;
+      int rows[4];
+
+      supertwoxsai_clamp_rows(rows, y, height, first, last);
+      filt->row_rgb565(src, src_stride, rows, width,
+            dst + 2 * y * dst_stride, dst_stride);
    }
 }
 
@@ -266,7 +495,7 @@ static void supertwoxsai_work_cb_rgb565(void *data, void *thread_data)
    unsigned width = thr->width;
    unsigned height = thr->height;
 
-   supertwoxsai_generic_rgb565(width, height,
+   supertwoxsai_generic_rgb565((struct filter_data*)data, width, height,
          thr->first, thr->last, input, thr->in_pitch / SOFTFILTER_BPP_RGB565, output, thr->out_pitch / SOFTFILTER_BPP_RGB565);
 }
 
@@ -278,7 +507,7 @@ static void supertwoxsai_work_cb_xrgb8888(void *data, void *thread_data)
    unsigned width = thr->width;
    unsigned height = thr->height;
 
-   supertwoxsai_generic_xrgb8888(width, height,
+   supertwoxsai_generic_xrgb8888((struct filter_data*)data, width, height,
          thr->first, thr->last, input, thr->in_pitch / SOFTFILTER_BPP_XRGB8888, output, thr->out_pitch / SOFTFILTER_BPP_XRGB8888);
 }
 
@@ -17,7 +17,9 @@
 // Compile: gcc -o supereagle.so -shared supereagle.c -std=c99 -O3 -Wall -pedantic -fPIC
 
 #include "softfilter.h"
+#include <retro_simd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef RARCH_INTERNAL
 #define softfilter_get_implementation supereagle_get_implementation
@@ -40,11 +42,23 @@ struct softfilter_thread_data
    int last;
 };
 
+/* Filters one row. rows[] holds the indices of the rows
+ * from one above to two below it, clamped to the frame. */
+typedef void (*supereagle_row_rgb565_t)(const uint16_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint16_t *dst, unsigned dst_stride);
+
+typedef void (*supereagle_row_xrgb8888_t)(const uint32_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint32_t *dst, unsigned dst_stride);
+
 struct filter_data
 {
    unsigned threads;
    struct softfilter_thread_data *workers;
    unsigned in_fmt;
+   supereagle_row_rgb565_t row_rgb565;
+   supereagle_row_xrgb8888_t row_xrgb8888;
 };
 
 static unsigned supereagle_generic_input_fmts(void)
@@ -63,12 +77,14 @@ static unsigned supereagle_generic_threads(void *data)
    return filt->threads;
 }
 
+static void supereagle_init_kernels(struct filter_data *filt,
+      softfilter_simd_mask_t simd);
+
 static void *supereagle_generic_create(const struct softfilter_config *config,
       unsigned in_fmt, unsigned out_fmt,
       unsigned max_width, unsigned max_height,
       unsigned threads, softfilter_simd_mask_t simd, void *userdata)
 {
-   (void)simd;
    (void)config;
    (void)userdata;
 
@@ -76,13 +92,14 @@ static void *supereagle_generic_create(const struct softfilter_config *config,
    if (!filt)
       return NULL;
    filt->workers = (struct softfilter_thread_data*)calloc(threads, sizeof(struct softfilter_thread_data));
-   filt->threads = 1;
+   filt->threads = threads;
    filt->in_fmt  = in_fmt;
    if (!filt->workers)
    {
       free(filt);
       return NULL;
    }
+   supereagle_init_kernels(filt, simd);
    return filt;
 }
 
@@ -108,16 +125,16 @@ static void supereagle_generic_destroy(void *data)
 
 #define supereagle_interpolate2_xrgb8888(A, B, C, D) ((((A) & 0xFCFCFCFC) >> 2) + (((B) & 0xFCFCFCFC) >> 2) + (((C) & 0xFCFCFCFC) >> 2) + (((D) & 0xFCFCFCFC) >> 2) + (((((A) & 0x03030303) + ((B) & 0x03030303) + ((C) & 0x03030303) + ((D) & 0x03030303)) >> 2) & 0x03030303))
 
-#define supereagle_interpolate_rgb565(A, B) ((((A) & 0xF7DE) >> 1) + (((B) & 0xF7DE) >> 1) + ((A) & (B) & 0x0821));
+#define supereagle_interpolate_rgb565(A, B) ((((A) & 0xF7DE) >> 1) + (((B) & 0xF7DE) >> 1) + ((A) & (B) & 0x0821))
 
 #define supereagle_interpolate2_rgb565(A, B, C, D) ((((A) & 0xE79C) >> 2) + (((B) & 0xE79C) >> 2) + (((C) & 0xE79C) >> 2) + (((D) & 0xE79C) >> 2)  + (((((A) & 0x1863) + ((B) & 0x1863) + ((C) & 0x1863) + ((D) & 0x1863)) >> 2) & 0x1863))
 
 #define supereagle_result(A, B, C, D) (((A) != (C) || (A) != (D)) - ((B) != (C) || (B) != (D)));
 
-#define supereagle_declare_variables(typename_t, in, nextline) \
+#define supereagle_declare_variables(typename_t, in, prevline, nextline, nextline2) \
          typename_t product1a, product1b, product2a, product2b; \
-         const typename_t colorB1 = *(in - nextline + 0); \
-         const typename_t colorB2 = *(in - nextline + 1); \
+         const typename_t colorB1 = *(in - prevline + 0); \
+         const typename_t colorB2 = *(in - prevline + 1); \
          const typename_t color4  = *(in - 1); \
          const typename_t color5  = *(in + 0); \
          const typename_t color6  = *(in + 1); \
@@ -126,8 +143,8 @@ static void supereagle_generic_destroy(void *data)
          const typename_t color2  = *(in + nextline + 0); \
          const typename_t color3  = *(in + nextline + 1); \
          const typename_t colorS1 = *(in + nextline + 2); \
-         const typename_t colorA1 = *(in + nextline + nextline + 0); \
-         const typename_t colorA2 = *(in + nextline + nextline + 1)
+         const typename_t colorA1 = *(in + nextline2 + 0); \
+         const typename_t colorA2 = *(in + nextline2 + 1)
 
 #ifndef supereagle_function
 #define supereagle_function(result_cb, interpolate_cb, interpolate2_cb) \
@@ -215,51 +232,267 @@ static void supereagle_generic_destroy(void *data)
          out += 2
 #endif
 
-static void supereagle_generic_xrgb8888(unsigned width, unsigned height,
-      int first, int last, uint32_t *src, 
-      unsigned src_stride, uint32_t *dst, unsigned dst_stride)
+/* Indices of the rows from one above to two below row y of a packet.
+ * Packets can read the rows of their neighbours, but rows past the
+ * top or bottom of the frame repeat the edge row. */
+static void supereagle_clamp_rows(int *rows, unsigned y, unsigned height,
+      int first, int last)
 {
-   unsigned finish, nextline;
-   nextline = (last) ? 0 : src_stride;
+   int k;
+   for (k = 0; k < 4; k++)
+   {
+      int row = (int)y + k - 1;
+      if (row < -first)
+         row = -first;
+      if (last && row > (int)height - 1)
+         row = height - 1;
+      rows[k] = row;
+   }
+}
 
-   for (; height; height--)
+static void supereagle_span_xrgb8888(const uint32_t *in,
+      unsigned prevline, unsigned nextline, unsigned nextline2,
+      unsigned width, uint32_t *out, unsigned dst_stride)
+{
+   for (; width; width--)
    {
-      uint32_t *in  = (uint32_t*)src;
-      uint32_t *out = (uint32_t*)dst;
+      supereagle_declare_variables(uint32_t, in, prevline, nextline, nextline2);
 
-      for (finish = width; finish; finish -= 1)
-      {
-         supereagle_declare_variables(uint32_t, in, nextline);
+      supereagle_function(supereagle_result, supereagle_interpolate_xrgb8888, supereagle_interpolate2_xrgb8888);
+   }
+}
 
-         supereagle_function(supereagle_result, supereagle_interpolate_xrgb8888, supereagle_interpolate2_xrgb8888);
-      }
+static void supereagle_span_rgb565(const uint16_t *in,
+      unsigned prevline, unsigned nextline, unsigned nextline2,
+      unsigned width, uint16_t *out, unsigned dst_stride)
+{
+   for (; width; width--)
+   {
+      supereagle_declare_variables(uint16_t, in, prevline, nextline, nextline2);
 
-      src += src_stride;
-      dst += 2 * dst_stride;
+      supereagle_function(supereagle_result, supereagle_interpolate_rgb565, supereagle_interpolate2_rgb565);
    }
 }
 
-static void supereagle_generic_rgb565(unsigned width, unsigned height,
-      int first, int last, uint16_t *src, 
-      unsigned src_stride, uint16_t *dst, unsigned dst_stride)
+#define supereagle_row_lines(rows, src_stride) \
+   unsigned prevline  = (rows[1] - rows[0]) * src_stride; \
+   unsigned nextline  = (rows[2] - rows[1]) * src_stride; \
+   unsigned nextline2 = (rows[3] - rows[1]) * src_stride
+
+static void supereagle_row_xrgb8888_C(const uint32_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint32_t *dst, unsigned dst_stride)
+{
+   supereagle_row_lines(rows, src_stride);
+   supereagle_span_xrgb8888(src + rows[1] * (int)src_stride,
+         prevline, nextline, nextline2, width, dst, dst_stride);
+}
+
+static void supereagle_row_rgb565_C(const uint16_t *src,
+      unsigned src_stride, const int *rows, unsigned width,
+      uint16_t *dst, unsigned dst_stride)
+{
+   supereagle_row_lines(rows, src_stride);
+   supereagle_span_rgb565(src + rows[1] * (int)src_stride,
+         prevline, nextline, nextline2, width, dst, dst_stride);
+}
+
+#if defined(__GNUC__) && \
+   (__SSE2__ || defined(HAVE_RETRO_TARGET_X86) || defined(__ARM_NEON__))
+#define SUPEREAGLE_SIMD
+
+/* The vector kernels run supereagle_function on a vector of pixels
+ * at once, with its branches turned into lane selects. They are
+ * written with GCC vector extensions and built for each instruction
+ * set. */
+#define supereagle_select(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+#define supereagle_vector_result(mask_t, A, B, C, D) \
+   ((mask_t)(((B) != (C)) | ((B) != (D))) - (mask_t)(((A) != (C)) | ((A) != (D))))
+
+#define supereagle_vector_load(color, ptr) memcpy(&(color), (ptr), sizeof(color))
+
+#define supereagle_vector_declare_variables(vec_t, in, prevline, nextline, nextline2) \
+         vec_t product1a, product1b, product2a, product2b; \
+         vec_t colorB1, colorB2, color4, color5, color6, colorS2; \
+         vec_t color1, color2, color3, colorS1, colorA1, colorA2; \
+         supereagle_vector_load(colorB1, in - prevline + 0); \
+         supereagle_vector_load(colorB2, in - prevline + 1); \
+         supereagle_vector_load(color4,  in - 1); \
+         supereagle_vector_load(color5,  in + 0); \
+         supereagle_vector_load(color6,  in + 1); \
+         supereagle_vector_load(colorS2, in + 2); \
+         supereagle_vector_load(color1,  in + nextline - 1); \
+         supereagle_vector_load(color2,  in + nextline + 0); \
+         supereagle_vector_load(color3,  in + nextline + 1); \
+         supereagle_vector_load(colorS1, in + nextline + 2); \
+         supereagle_vector_load(colorA1, in + nextline2 + 0); \
+         supereagle_vector_load(colorA2, in + nextline2 + 1)
+
+/* m26 and m53 are the first two branches of supereagle_function,
+ * pos and neg split the third one on the sign of r, and m3 is
+ * the whole third branch. */
+#define supereagle_vector_function(vec_t, mask_t, interpolate_cb, interpolate2_cb) \
+         { \
+            const vec_t c26 = (vec_t)(color2 == color6); \
+            const vec_t c53 = (vec_t)(color5 == color3); \
+            const vec_t m26 = c26 & ~c53; \
+            const vec_t m53 = c53 & ~c26; \
+            const vec_t m3  = c26 & c53; \
+            const mask_t r = \
+               supereagle_vector_result(mask_t, color6, color5, color1, colorA1) + \
+               supereagle_vector_result(mask_t, color6, color5, color4, colorB1) + \
+               supereagle_vector_result(mask_t, color6, color5, colorA2, colorS1) + \
+               supereagle_vector_result(mask_t, color6, color5, colorB2, colorS2); \
+            const vec_t pos = m3 & (vec_t)(r > 0); \
+            const vec_t neg = m3 & (vec_t)(r < 0); \
+            const vec_t i56 = interpolate_cb(color5, color6); \
+            const vec_t i23 = interpolate_cb(color2, color3); \
+            const vec_t i26 = interpolate_cb(color2, color6); \
+            const vec_t i53 = interpolate_cb(color5, color3); \
+            product1a = supereagle_select(m26, \
+                  supereagle_select((vec_t)((color1 == color2) | (color6 == colorB2)), \
+                     interpolate_cb(color2, interpolate_cb(color2, color5)), i56), \
+                  supereagle_select(m53, color5, \
+                  supereagle_select(pos, i56, \
+                  supereagle_select(m3, color5, \
+                  interpolate2_cb(color5, color5, color5, i26))))); \
+            product1b = supereagle_select(m26, color2, \
+                  supereagle_select(m53, \
+                     supereagle_select((vec_t)((colorB1 == color5) | (color3 == colorS1)), \
+                        interpolate_cb(color5, i56), i56), \
+                  supereagle_select(neg, i56, \
+                  supereagle_select(m3, color2, \
+                  interpolate2_cb(color6, color6, color6, i53))))); \
+            product2a = supereagle_select(m26, color2, \
+                  supereagle_select(m53, \
+                     supereagle_select((vec_t)((color3 == colorA2) | (color4 == color5)), \
+                        interpolate_cb(color5, interpolate_cb(color5, color2)), i23), \
+                  supereagle_select(neg, i56, \
+                  supereagle_select(m3, color2, \
+                  interpolate2_cb(color2, color2, color2, i53))))); \
+            product2b = supereagle_select(m26, \
+                  supereagle_select((vec_t)((color6 == colorS2) | (color2 == colorA1)), \
+                     interpolate_cb(color2, i23), i23), \
+                  supereagle_select(m53, color5, \
+                  supereagle_select(pos, i56, \
+                  supereagle_select(m3, color5, \
+                  interpolate2_cb(color3, color3, color3, i26))))); \
+         }
+
+#define SUPEREAGLE_ROW_KERNEL(isa, attr, fmt, typename_t, vec_t, mask_t) \
+static attr void supereagle_row_##fmt##_##isa(const typename_t *src, \
+      unsigned src_stride, const int *rows, unsigned width, \
+      typename_t *dst, unsigned dst_stride) \
+{ \
+   unsigned x, lane; \
+   const unsigned lanes = sizeof(vec_t) / sizeof(typename_t); \
+   const typename_t *in = src + rows[1] * (int)src_stride; \
+   typename_t *out = dst; \
+   supereagle_row_lines(rows, src_stride); \
+   for (x = 0; x + lanes <= width; x += lanes) \
+   { \
+      supereagle_vector_declare_variables(vec_t, in, prevline, nextline, nextline2); \
+      supereagle_vector_function(vec_t, mask_t, \
+            supereagle_interpolate_##fmt, supereagle_interpolate2_##fmt); \
+      for (lane = 0; lane < lanes; lane++) \
+      { \
+         out[2 * lane] = product1a[lane]; \
+         out[2 * lane + 1] = product1b[lane]; \
+         out[dst_stride + 2 * lane] = product2a[lane]; \
+         out[dst_stride + 2 * lane + 1] = product2b[lane]; \
+      } \
+      in += lanes; \
+      out += 2 * lanes; \
+   } \
+   supereagle_span_##fmt(in, prevline, nextline, nextline2, \
+         width - x, out, dst_stride); \
+}
+
+#define SUPEREAGLE_KERNELS(isa, attr, size) \
+typedef uint16_t supereagle_u16v_##isa __attribute__((vector_size(size))); \
+typedef int16_t supereagle_s16v_##isa __attribute__((vector_size(size))); \
+typedef uint32_t supereagle_u32v_##isa __attribute__((vector_size(size))); \
+typedef int32_t supereagle_s32v_##isa __attribute__((vector_size(size))); \
+SUPEREAGLE_ROW_KERNEL(isa, attr, rgb565, uint16_t, \
+      supereagle_u16v_##isa, supereagle_s16v_##isa) \
+SUPEREAGLE_ROW_KERNEL(isa, attr, xrgb8888, uint32_t, \
+      supereagle_u32v_##isa, supereagle_s32v_##isa)
+
+#if __SSE2__
+SUPEREAGLE_KERNELS(SSE2, , 16)
+#endif
+
+#ifdef HAVE_RETRO_TARGET_X86
+SUPEREAGLE_KERNELS(AVX2, RETRO_TARGET("avx2"), 32)
+#endif
+
+#ifdef __ARM_NEON__
+SUPEREAGLE_KERNELS(NEON, , 16)
+#endif
+#endif
+
+static void supereagle_init_kernels(struct filter_data *filt,
+      softfilter_simd_mask_t simd)
+{
+   (void)simd;
+
+   filt->row_rgb565   = supereagle_row_rgb565_C;
+   filt->row_xrgb8888 = supereagle_row_xrgb8888_C;
+
+#ifdef SUPEREAGLE_SIMD
+#if __SSE2__
+   filt->row_rgb565   = supereagle_row_rgb565_SSE2;
+   filt->row_xrgb8888 = supereagle_row_xrgb8888_SSE2;
+#endif
+#ifdef HAVE_RETRO_TARGET_X86
+   if (simd & SOFTFILTER_SIMD_AVX2)
+   {
+      filt->row_rgb565   = supereagle_row_rgb565_AVX2;
+      filt->row_xrgb8888 = supereagle_row_xrgb8888_AVX2;
+   }
+#endif
+#ifdef __ARM_NEON__
+   if (simd & SOFTFILTER_SIMD_NEON)
+   {
+      filt->row_rgb565   = supereagle_row_rgb565_NEON;
+      filt->row_xrgb8888 = supereagle_row_xrgb8888_NEON;
+   }
+#endif
+#endif
+}
+
+static void supereagle_generic_xrgb8888(struct filter_data *filt,
+      unsigned width, unsigned height,
+      int first, int last, uint32_t *src, 
+      unsigned src_stride, uint32_t *dst, unsigned dst_stride)
 {
-   unsigned nextline, finish;
-   nextline = (last) ? 0 : src_stride;
+   unsigned y;
 
-   for (; height; height--)
+   for (y = 0; y < height; y++)
    {
-      uint16_t *in  = (uint16_t*)src;
-      uint16_t *out = (uint16_t*)dst;
+      int rows[4];
 
-      for (finish = width; finish; finish -= 1)
-      {
-         supereagle_declare_variables(uint16_t, in, nextline);
+      supereagle_clamp_rows(rows, y, height, first, last);
+      filt->row_xrgb8888(src, src_stride, rows, width,
+            dst + 2 * y * dst_stride, dst_stride);
+   }
+}
 
-         supereagle_function(supereagle_result, supereagle_interpolate_rgb565, supereagle_interpolate2_rgb565);
-      }
+static void supereagle_generic_rgb565(struct filter_data *filt,
+      unsigned width, unsigned height,
+      int first, int last, uint16_t *src, 
+      unsigned src_stride, uint16_t *dst, unsigned dst_stride)
+{
+   unsigned y;
+
+   for (y = 0; y < height; y++)
+   {
+      int rows[4];
 
-      src += src_stride;
-      dst += 2 * dst_stride;
+      supereagle_clamp_rows(rows, y, height, first, last);
+      filt->row_rgb565(src, src_stride, rows, width,
+            dst + 2 * y * dst_stride, dst_stride);
    }
 }
 
@@ -271,7 +504,7 @@ static void supereagle_work_cb_rgb565(void *data, void *thread_data)
    unsigned width = thr->width;
    unsigned height = thr->height;
 
-   supereagle_generic_rgb565(width, height,
+   supereagle_generic_rgb565((struct filter_data*)data, width, height,
          thr->first, thr->last, input, thr->in_pitch / SOFTFILTER_BPP_RGB565, output, thr->out_pitch / SOFTFILTER_BPP_RGB565);
 }
 
@@ -283,7 +516,7 @@ static void supereagle_work_cb_xrgb8888(void *data, void *thread_data)
    unsigned width = thr->width;
    unsigned height = thr->height;
 
-   supereagle_generic_xrgb8888(width, height,
+   supereagle_generic_xrgb8888((struct filter_data*)data, width, height,
          thr->first, thr->last, input, thr->in_pitch / SOFTFILTER_BPP_XRGB8888, output, thr->out_pitch / SOFTFILTER_BPP_XRGB8888);
 }
 
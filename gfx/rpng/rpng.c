@@ -25,8 +25,15 @@
 #include <malloc.h>
 #endif
 
+#ifdef HAVE_THREADS
+#include <rthreads/rpool.h>
+#endif
+
+#include <retro_simd.h>
+
 #ifdef RARCH_INTERNAL
 #include "../../hash.h"
+#include "../../performance.h"
 #else
 static inline uint32_t crc32_calculate(const uint8_t *data, size_t length)
 {
@@ -34,6 +41,13 @@ static inline uint32_t crc32_calculate(const uint8_t *data, size_t length)
 }
 #endif
 
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #undef GOTO_END_ERROR
 #define GOTO_END_ERROR() do { \
    fprintf(stderr, "[RPNG]: Error in line %d.\n", __LINE__); \
@@ -53,7 +67,7 @@ struct png_chunk
 {
    uint32_t size;
    char type[4];
-   uint8_t *data;
+   const uint8_t *data;
 };
 
 struct png_ihdr
@@ -82,20 +96,6 @@ static uint32_t dword_be(const uint8_t *buf)
    return (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | (buf[3] << 0);
 }
 
-static bool read_chunk_header(FILE *file, struct png_chunk *chunk)
-{
-   uint8_t dword[4] = {0};
-   if (fread(dword, 1, 4, file) != 4)
-      return false;
-
-   chunk->size = dword_be(dword);
-
-   if (fread(chunk->type, 1, 4, file) != 4)
-      return false;
-
-   return true;
-}
-
 struct
 {
    const char *id;
@@ -107,12 +107,6 @@ struct
    { "PLTE", PNG_CHUNK_PLTE },
 };
 
-struct idat_buffer
-{
-   uint8_t *data;
-   size_t size;
-};
-
 static enum png_chunk_type png_chunk_type(const struct png_chunk *chunk)
 {
    unsigned i;
@@ -125,40 +119,34 @@ static enum png_chunk_type png_chunk_type(const struct png_chunk *chunk)
    return PNG_CHUNK_NOOP;
 }
 
-static bool png_read_chunk(FILE *file, struct png_chunk *chunk)
+/* Points chunk at the next chunk in the file,
+ * and moves *ptr past it. */
+static bool png_read_chunk(const uint8_t **ptr, const uint8_t *end,
+      struct png_chunk *chunk)
 {
-   free(chunk->data);
-   chunk->data = (uint8_t*)calloc(1, chunk->size + sizeof(uint32_t)); /* CRC32 */
-   if (!chunk->data)
+   size_t left = end - *ptr;
+   if (left < 2 * sizeof(uint32_t))
       return false;
 
-   if (fread(chunk->data, 1, chunk->size + 
-            sizeof(uint32_t), file) != (chunk->size + sizeof(uint32_t)))
-   {
-      free(chunk->data);
+   chunk->size = dword_be(*ptr);
+   memcpy(chunk->type, *ptr + sizeof(uint32_t), 4);
+   left -= 2 * sizeof(uint32_t);
+
+   if (chunk->size > left || left - chunk->size < sizeof(uint32_t))
       return false;
-   }
+
+   chunk->data = *ptr + 2 * sizeof(uint32_t);
 
    /* Ignore CRC. */
+   *ptr = chunk->data + chunk->size + sizeof(uint32_t);
    return true;
 }
 
-static void png_free_chunk(struct png_chunk *chunk)
-{
-   if (!chunk)
-      return;
-
-   free(chunk->data);
-   chunk->data = NULL;
-}
-
-static bool png_parse_ihdr(FILE *file,
-      struct png_chunk *chunk, struct png_ihdr *ihdr)
+static bool png_parse_ihdr(const struct png_chunk *chunk,
+      struct png_ihdr *ihdr)
 {
    unsigned i;
    bool ret = true;
-   if (!png_read_chunk(file, chunk))
-      return false;
 
    if (chunk->size != 13)
       GOTO_END_ERROR();
@@ -231,7 +219,6 @@ static bool png_parse_ihdr(FILE *file,
    //   GOTO_END_ERROR();
 
 end:
-   png_free_chunk(chunk);
    return ret;
 }
 
@@ -349,144 +336,305 @@ static inline void copy_line_plt(uint32_t *data,
    }
 }
 
-static void png_pass_geom(const struct png_ihdr *ihdr,
-      unsigned width, unsigned height,
-      unsigned *bpp_out, unsigned *pitch_out, size_t *pass_size)
+static void png_pass_geom(const struct png_ihdr *ihdr, unsigned width,
+      unsigned *bpp_out, unsigned *pitch_out)
 {
-   unsigned bpp;
-   unsigned pitch;
+   unsigned channels;
    switch (ihdr->color_type)
    {
       case 0:
-         bpp = (ihdr->depth + 7) / 8;
-         pitch = (ihdr->width * ihdr->depth + 7) / 8;
+      case 3:
+         channels = 1;
          break;
 
       case 2:
-         bpp = (ihdr->depth * 3 + 7) / 8;
-         pitch = (ihdr->width * ihdr->depth * 3 + 7) / 8;
-         break;
-
-      case 3:
-         bpp = (ihdr->depth + 7) / 8;
-         pitch = (ihdr->width * ihdr->depth + 7) / 8;
+         channels = 3;
          break;
 
       case 4:
-         bpp = (ihdr->depth * 2 + 7) / 8;
-         pitch = (ihdr->width * ihdr->depth * 2 + 7) / 8;
+         channels = 2;
          break;
 
       case 6:
-         bpp = (ihdr->depth * 4 + 7) / 8;
-         pitch = (ihdr->width * ihdr->depth * 4 + 7) / 8;
+         channels = 4;
          break;
 
       default:
-         bpp = 0;
-         pitch = 0;
+         channels = 0;
          break;
    }
 
-   if (pass_size)
-      *pass_size = (pitch + 1) * ihdr->height;
    if (bpp_out)
-      *bpp_out = bpp;
+      *bpp_out = (ihdr->depth * channels + 7) / 8;
    if (pitch_out)
-      *pitch_out = pitch;
+      *pitch_out = (width * ihdr->depth * channels + 7) / 8;
 }
 
+/* Lines are kept with this many zero bytes in front of them,
+ * which is what the filters see left of the first pixel. */
+#define RPNG_LINE_PAD 16
 
-static bool png_reverse_filter(uint32_t *data, const struct png_ihdr *ihdr,
-      const uint8_t *inflate_buf, size_t inflate_buf_size,
-      const uint32_t *palette)
+enum rpng_filter
 {
-   unsigned i, h;
-   bool ret = true;
+   RPNG_FILTER_NONE = 0,
+   RPNG_FILTER_SUB,
+   RPNG_FILTER_UP,
+   RPNG_FILTER_AVG,
+   RPNG_FILTER_PAETH,
 
-   unsigned bpp;
-   unsigned pitch;
-   size_t pass_size;
-   png_pass_geom(ihdr, ihdr->width, ihdr->height, &bpp, &pitch, &pass_size);
+   RPNG_FILTERS
+};
 
-   if (inflate_buf_size < pass_size)
-      return false;
+/* Undoes one filter method on size bytes of filtered into line.
+ * prev is the line above, or zeroes for the first line of a pass.
+ * Both may be written and read up to RPNG_LINE_PAD bytes past
+ * their end, and filtered may be read that far too. */
+typedef void (*rpng_unfilter_t)(uint8_t *line, const uint8_t *prev,
+      const uint8_t *filtered, unsigned size, unsigned bpp);
 
-   uint8_t *prev_scanline    = (uint8_t*)calloc(1, pitch);
-   uint8_t *decoded_scanline = (uint8_t*)calloc(1, pitch);
+/* Expands width pixels of a decoded line to ARGB. */
+typedef void (*rpng_copy_line_t)(uint32_t *data,
+      const uint8_t *decoded, unsigned width, unsigned depth);
 
-   if (!prev_scanline || !decoded_scanline)
-      GOTO_END_ERROR();
+static void rpng_unfilter_none(uint8_t *line, const uint8_t *prev,
+      const uint8_t *filtered, unsigned size, unsigned bpp)
+{
+   memcpy(line, filtered, size);
+}
+
+static void rpng_unfilter_sub_C(uint8_t *line, const uint8_t *prev,
+      const uint8_t *filtered, unsigned size, unsigned bpp)
+{
+   unsigned i;
+   const uint8_t *left = line - bpp;
 
-   for (h = 0; h < ihdr->height;
-         h++, inflate_buf += pitch, data += ihdr->width)
+   for (i = 0; i < size; i++)
+      line[i] = left[i] + filtered[i];
+}
+
+static void rpng_unfilter_up_C(uint8_t *line, const uint8_t *prev,
+      const uint8_t *filtered, unsigned size, unsigned bpp)
+{
+   unsigned i;
+   for (i = 0; i < size; i++)
+      line[i] = prev[i] + filtered[i];
+}
+
+static void rpng_unfilter_avg_C(uint8_t *line, const uint8_t *prev,
+      const uint8_t *filtered, unsigned size, unsigned bpp)
+{
+   unsigned i;
+   const uint8_t *left = line - bpp;
+
+   for (i = 0; i < size; i++)
+      line[i] = ((left[i] + prev[i]) >> 1) + filtered[i];
+}
+
+static void rpng_unfilter_paeth_C(uint8_t *line, const uint8_t *prev,
+      const uint8_t *filtered, unsigned size, unsigned bpp)
+{
+   unsigned i;
+   const uint8_t *left = line - bpp;
+   const uint8_t *up_left = prev - bpp;
+
+   for (i = 0; i < size; i++)
+      line[i] = paeth(left[i], prev[i], up_left[i]) + filtered[i];
+}
+
+#ifdef HAVE_ZLIB_DEFLATE
+/* Filters size bytes of line with every method into targets[],
+ * and adds the score of each to scores[]. Lower scores tend to
+ * deflate better. The unfiltered line is targets[RPNG_FILTER_NONE],
+ * and is not written to. */
+typedef void (*rpng_filter_line_t)(uint8_t * const *targets,
+      unsigned *scores, const uint8_t *line, const uint8_t *prev,
+      unsigned size, unsigned bpp);
+
+static void rpng_filter_span(uint8_t * const *targets, unsigned *scores,
+      const uint8_t *line, const uint8_t *prev,
+      unsigned start, unsigned size, unsigned bpp)
+{
+   unsigned i;
+   const uint8_t *left = line - bpp;
+   const uint8_t *up_left = prev - bpp;
+
+   for (i = start; i < size; i++)
    {
-      unsigned filter = *inflate_buf++;
-      switch (filter)
-      {
-         case 0: /* None */
-            memcpy(decoded_scanline, inflate_buf, pitch);
-            break;
+      int x = line[i];
+      int a = left[i];
+      int b = prev[i];
+      int c = up_left[i];
+
+      uint8_t sub   = x - a;
+      uint8_t up    = x - b;
+      uint8_t avg   = x - ((a + b) >> 1);
+      uint8_t pred  = x - paeth(a, b, c);
+
+      targets[RPNG_FILTER_SUB][i]   = sub;
+      targets[RPNG_FILTER_UP][i]    = up;
+      targets[RPNG_FILTER_AVG][i]   = avg;
+      targets[RPNG_FILTER_PAETH][i] = pred;
+
+      scores[RPNG_FILTER_NONE]  += abs((int8_t)x);
+      scores[RPNG_FILTER_SUB]   += abs((int8_t)sub);
+      scores[RPNG_FILTER_UP]    += abs((int8_t)up);
+      scores[RPNG_FILTER_AVG]   += abs((int8_t)avg);
+      scores[RPNG_FILTER_PAETH] += abs((int8_t)pred);
+   }
+}
 
-         case 1: /* Sub */
-            for (i = 0; i < bpp; i++)
-               decoded_scanline[i] = inflate_buf[i];
-            for (i = bpp; i < pitch; i++)
-               decoded_scanline[i] = decoded_scanline[i - bpp] + inflate_buf[i];
-            break;
+static void rpng_filter_line_C(uint8_t * const *targets, unsigned *scores,
+      const uint8_t *line, const uint8_t *prev, unsigned size, unsigned bpp)
+{
+   rpng_filter_span(targets, scores, line, prev, 0, size, bpp);
+}
+#endif
 
-         case 2: /* Up */
-            for (i = 0; i < pitch; i++)
-               decoded_scanline[i] = prev_scanline[i] + inflate_buf[i];
-            break;
+#if defined(__GNUC__) && (__GNUC__ >= 9 || defined(__clang__)) && \
+   (defined(__SSE2__) || defined(HAVE_RETRO_TARGET_X86) || defined(__ARM_NEON__))
+#define RPNG_HAVE_VECTOR
 
-         case 3: /* Average */
-            for (i = 0; i < bpp; i++)
-            {
-               uint8_t avg = prev_scanline[i] >> 1;
-               decoded_scanline[i] = avg + inflate_buf[i];
-            }
-            for (i = bpp; i < pitch; i++)
-            {
-               uint8_t avg = (decoded_scanline[i - bpp] + prev_scanline[i]) >> 1;
-               decoded_scanline[i] = avg + inflate_buf[i];
-            }
-            break;
+#if defined(__SSE2__)
+#define RPNG_ISA SSE2
+#define RPNG_TARGET
+#define RPNG_LANES 8
+#define RPNG_UNFILTER
+#include "rpng_vector.h"
+#endif
 
-         case 4: /* Paeth */
-            for (i = 0; i < bpp; i++)
-               decoded_scanline[i] = paeth(0, prev_scanline[i], 0) + inflate_buf[i];
-            for (i = bpp; i < pitch; i++)
-               decoded_scanline[i] = paeth(decoded_scanline[i - bpp],
-                     prev_scanline[i], prev_scanline[i - bpp]) + inflate_buf[i];
-            break;
+/* Decoding is bound by how fast one pixel follows another,
+ * so only encoding gains from the wider vectors. */
+#if defined(HAVE_RETRO_TARGET_X86) && defined(HAVE_ZLIB_DEFLATE)
+#define RPNG_ISA AVX2
+#define RPNG_TARGET RETRO_TARGET("avx2")
+#define RPNG_LANES 16
+#include "rpng_vector.h"
+#endif
 
-         default:
-            GOTO_END_ERROR();
-      }
+#if defined(__ARM_NEON__)
+#define RPNG_ISA NEON
+#define RPNG_TARGET
+#define RPNG_LANES 8
+#define RPNG_UNFILTER
+#include "rpng_vector.h"
+#endif
+#endif
 
-      if (ihdr->color_type == 0)
-         copy_line_bw(data, decoded_scanline, ihdr->width, ihdr->depth);
-      else if (ihdr->color_type == 2)
-         copy_line_rgb(data, decoded_scanline, ihdr->width, ihdr->depth);
-      else if (ihdr->color_type == 3)
-         copy_line_plt(data, decoded_scanline, ihdr->width,
-               ihdr->depth, palette);
-      else if (ihdr->color_type == 4)
-         copy_line_gray_alpha(data, decoded_scanline, ihdr->width,
-               ihdr->depth);
-      else if (ihdr->color_type == 6)
-         copy_line_rgba(data, decoded_scanline, ihdr->width, ihdr->depth);
-
-      memcpy(prev_scanline, decoded_scanline, pitch);
+static void rpng_find_unfilters(rpng_unfilter_t *unfilter, unsigned bpp)
+{
+   unfilter[RPNG_FILTER_NONE]  = rpng_unfilter_none;
+   unfilter[RPNG_FILTER_SUB]   = rpng_unfilter_sub_C;
+   unfilter[RPNG_FILTER_UP]    = rpng_unfilter_up_C;
+   unfilter[RPNG_FILTER_AVG]   = rpng_unfilter_avg_C;
+   unfilter[RPNG_FILTER_PAETH] = rpng_unfilter_paeth_C;
+
+#if defined(RPNG_HAVE_VECTOR) && defined(__SSE2__)
+   rpng_find_unfilters_SSE2(unfilter, bpp);
+#elif defined(RPNG_HAVE_VECTOR) && defined(__ARM_NEON__)
+   rpng_find_unfilters_NEON(unfilter, bpp);
+#endif
+}
+
+static rpng_copy_line_t rpng_find_copy_line(const struct png_ihdr *ihdr)
+{
+   switch (ihdr->color_type)
+   {
+      case 0:
+         return copy_line_bw;
+      case 2:
+         return copy_line_rgb;
+      case 4:
+         return copy_line_gray_alpha;
+      case 6:
+#if defined(RPNG_HAVE_VECTOR) && !defined(MSB_FIRST)
+#if defined(__SSE2__)
+         if (ihdr->depth == 8)
+            return rpng_copy_line_rgba_SSE2;
+#elif defined(__ARM_NEON__)
+         if (ihdr->depth == 8)
+            return rpng_copy_line_rgba_NEON;
+#endif
+#endif
+         return copy_line_rgba;
    }
 
-end:
-   free(decoded_scanline);
-   free(prev_scanline);
-   return ret;
+   /* Palettes are looked up by png_decoder_expand(). */
+   return NULL;
+}
+
+/* The whole file is looked at in place, so that IDAT chunks
+ * can be inflated straight from it. */
+struct rpng_file
+{
+   uint8_t *data;
+   size_t size;
+#ifdef HAVE_MMAP
+   int fd;
+#endif
+};
+
+#ifdef HAVE_MMAP
+static void rpng_file_close(struct rpng_file *file)
+{
+   if (file->data)
+      munmap(file->data, file->size);
+   if (file->fd >= 0)
+      close(file->fd);
 }
 
+static bool rpng_file_open(struct rpng_file *file, const char *path)
+{
+   struct stat fds;
+   void *data;
+
+   file->data = NULL;
+   file->size = 0;
+   file->fd   = open(path, O_RDONLY);
+   if (file->fd < 0)
+      return false;
+
+   if (fstat(file->fd, &fds) < 0 || fds.st_size <= 0)
+      return false;
+
+   data = mmap(NULL, fds.st_size, PROT_READ, MAP_SHARED, file->fd, 0);
+   if (data == MAP_FAILED)
+      return false;
+
+   file->data = (uint8_t*)data;
+   file->size = fds.st_size;
+   return true;
+}
+#else
+static void rpng_file_close(struct rpng_file *file)
+{
+   free(file->data);
+}
+
+static bool rpng_file_open(struct rpng_file *file, const char *path)
+{
+   long len;
+   FILE *f = fopen(path, "rb");
+
+   file->data = NULL;
+   file->size = 0;
+   if (!f)
+      return false;
+
+   fseek(f, 0, SEEK_END);
+   len = ftell(f);
+   rewind(f);
+
+   if (len > 0)
+      file->data = (uint8_t*)malloc(len);
+
+   if (file->data && fread(file->data, 1, len, f) == (size_t)len)
+      file->size = len;
+   fclose(f);
+
+   return file->size != 0;
+}
+#endif
+
 struct adam7_pass
 {
    unsigned x;
@@ -495,176 +643,309 @@ struct adam7_pass
    unsigned stride_y;
 };
 
-static void deinterlace_pass(uint32_t *data, const struct png_ihdr *ihdr,
-      const uint32_t *input, unsigned pass_width, unsigned pass_height,
-      const struct adam7_pass *pass)
+static const struct adam7_pass png_passes_adam7[] = {
+   { 0, 0, 8, 8 },
+   { 4, 0, 8, 8 },
+   { 0, 4, 4, 8 },
+   { 2, 0, 4, 4 },
+   { 0, 2, 2, 4 },
+   { 1, 0, 2, 2 },
+   { 0, 1, 1, 2 },
+};
+
+/* Images which are not interlaced are decoded as one pass. */
+static const struct adam7_pass png_passes_progressive[] = {
+   { 0, 0, 1, 1 },
+};
+
+/* Inflates IDAT data as it comes, and decodes each line
+ * into the image as soon as all of it is there. */
+struct png_decoder
 {
-   unsigned x, y;
-   data += pass->y * ihdr->width + pass->x;
-   for (y = 0; y < pass_height;
-         y++, data += ihdr->width * pass->stride_y, input += pass_width)
+   const struct png_ihdr *ihdr;
+   const uint32_t *palette;
+
+   z_stream stream;
+   bool stream_init;
+
+   rpng_unfilter_t unfilter[RPNG_FILTERS];
+   rpng_copy_line_t copy_line;
+
+   const struct adam7_pass *passes;
+   unsigned num_passes;
+   unsigned pass;
+   unsigned pass_width;
+   unsigned pass_height;
+   unsigned y;
+   unsigned bpp;
+   unsigned pitch;
+   bool done;
+
+   /* Inflated bytes which have not been decoded yet. */
+   uint8_t *raw;
+   size_t raw_size;
+   size_t raw_fill;
+
+   uint8_t *lines;
+   uint8_t *line;
+   uint8_t *prev;
+
+   /* One line of an interlaced pass, before it is spread out. */
+   uint32_t *pass_line;
+
+   uint32_t *data;
+};
+
+/* Inflated data is decoded in batches of about this size. */
+#define RPNG_INFLATE_SIZE (32 * 1024)
+
+static void png_decoder_next_pass(struct png_decoder *dec)
+{
+   const struct png_ihdr *ihdr = dec->ihdr;
+
+   for (; dec->pass < dec->num_passes; dec->pass++)
    {
-      uint32_t *out = data;
-      for (x = 0; x < pass_width; x++, out += pass->stride_x)
-         *out = input[x];
+      const struct adam7_pass *pass = &dec->passes[dec->pass];
+
+      if (ihdr->width <= pass->x || ihdr->height <= pass->y) /* Empty pass */
+         continue;
+
+      dec->pass_width  = (ihdr->width - pass->x +
+            pass->stride_x - 1) / pass->stride_x;
+      dec->pass_height = (ihdr->height - pass->y +
+            pass->stride_y - 1) / pass->stride_y;
+      dec->y           = 0;
+
+      png_pass_geom(ihdr, dec->pass_width, NULL, &dec->pitch);
+      memset(dec->prev, 0, dec->pitch);
+      return;
    }
+
+   dec->done = true;
 }
 
-static bool png_reverse_filter_adam7(uint32_t *data,
-      const struct png_ihdr *ihdr,
-      const uint8_t *inflate_buf, size_t inflate_buf_size,
-      const uint32_t *palette)
+static bool png_decoder_init(struct png_decoder *dec,
+      const struct png_ihdr *ihdr, const uint32_t *palette)
 {
-   unsigned pass;
-   static const struct adam7_pass passes[] = {
-      { 0, 0, 8, 8 },
-      { 4, 0, 8, 8 },
-      { 0, 4, 4, 8 },
-      { 2, 0, 4, 4 },
-      { 0, 2, 2, 4 },
-      { 1, 0, 2, 2 },
-      { 0, 1, 1, 2 },
-   };
+   unsigned pitch;
+   size_t pixels = (size_t)ihdr->width * ihdr->height;
 
-   for (pass = 0; pass < ARRAY_SIZE(passes); pass++)
-   {
-      if (ihdr->width <= passes[pass].x ||
-            ihdr->height <= passes[pass].y) /* Empty pass */
-         continue;
+   dec->ihdr    = ihdr;
+   dec->palette = palette;
 
-      unsigned pass_width  = (ihdr->width - 
-            passes[pass].x + passes[pass].stride_x - 1) / passes[pass].stride_x;
-      unsigned pass_height = (ihdr->height - passes[pass].y + 
-            passes[pass].stride_y - 1) / passes[pass].stride_y;
+   /* A line is at most 64 bits per pixel, and its size in
+    * bytes has to fit the pitch. */
+   if (ihdr->width > (0xffffffffu - 7) / 64 ||
+         pixels / ihdr->width != ihdr->height ||
+         pixels > (size_t)-1 / sizeof(uint32_t))
+      return false;
 
-      uint32_t *tmp_data = (uint32_t*)
-         malloc(pass_width * pass_height * sizeof(uint32_t));
+   if (inflateInit(&dec->stream) != Z_OK)
+      return false;
+   dec->stream_init = true;
 
-      if (!tmp_data)
-         return false;
+   png_pass_geom(ihdr, ihdr->width, &dec->bpp, &pitch);
+   rpng_find_unfilters(dec->unfilter, dec->bpp);
+   dec->copy_line = rpng_find_copy_line(ihdr);
 
-      struct png_ihdr tmp_ihdr = *ihdr;
-      tmp_ihdr.width = pass_width;
-      tmp_ihdr.height = pass_height;
+   dec->raw_size = pitch + 1;
+   if (dec->raw_size < RPNG_INFLATE_SIZE)
+      dec->raw_size = RPNG_INFLATE_SIZE;
 
-      size_t pass_size;
-      png_pass_geom(&tmp_ihdr, pass_width,
-            pass_height, NULL, NULL, &pass_size);
+   dec->raw   = (uint8_t*)malloc(dec->raw_size + RPNG_LINE_PAD);
+   dec->lines = (uint8_t*)calloc(2, pitch + 2 * RPNG_LINE_PAD);
+   if (!dec->raw || !dec->lines)
+      return false;
 
-      if (pass_size > inflate_buf_size)
-      {
-         free(tmp_data);
-         return false;
-      }
+   dec->line = dec->lines + RPNG_LINE_PAD;
+   dec->prev = dec->line + pitch + 2 * RPNG_LINE_PAD;
 
-      if (!png_reverse_filter(tmp_data,
-               &tmp_ihdr, inflate_buf, pass_size, palette))
-      {
-         free(tmp_data);
+   if (ihdr->interlace == 1)
+   {
+      dec->passes     = png_passes_adam7;
+      dec->num_passes = ARRAY_SIZE(png_passes_adam7);
+      dec->pass_line  = (uint32_t*)malloc(
+            (ihdr->width + 1) / 2 * sizeof(uint32_t));
+      if (!dec->pass_line)
          return false;
-      }
+   }
+   else
+   {
+      dec->passes     = png_passes_progressive;
+      dec->num_passes = ARRAY_SIZE(png_passes_progressive);
+   }
 
-      inflate_buf += pass_size;
-      inflate_buf_size -= pass_size;
+#ifdef GEKKO
+   /* we often use these in textures, make sure they're 32-byte aligned */
+   dec->data = (uint32_t*)memalign(32, pixels * sizeof(uint32_t));
+#else
+   dec->data = (uint32_t*)malloc(pixels * sizeof(uint32_t));
+#endif
+   if (!dec->data)
+      return false;
 
-      deinterlace_pass(data,
-            ihdr, tmp_data, pass_width, pass_height, &passes[pass]);
-      free(tmp_data);
+   png_decoder_next_pass(dec);
+   return true;
+}
+
+static void png_decoder_free(struct png_decoder *dec)
+{
+   if (dec->stream_init)
+      inflateEnd(&dec->stream);
+   free(dec->raw);
+   free(dec->lines);
+   free(dec->pass_line);
+   free(dec->data);
+}
+
+static void png_decoder_expand(const struct png_decoder *dec,
+      uint32_t *data, unsigned width)
+{
+   if (dec->copy_line)
+      dec->copy_line(data, dec->line, width, dec->ihdr->depth);
+   else
+      copy_line_plt(data, dec->line, width,
+            dec->ihdr->depth, dec->palette);
+}
+
+/* Decodes one line of the current pass. raw is the filter
+ * method followed by the filtered line. */
+static bool png_decoder_line(struct png_decoder *dec, const uint8_t *raw)
+{
+   unsigned x;
+   uint8_t *tmp;
+   const struct adam7_pass *pass = &dec->passes[dec->pass];
+   uint32_t *data = dec->data + pass->x +
+      (size_t)(pass->y + dec->y * pass->stride_y) * dec->ihdr->width;
+
+   if (raw[0] >= RPNG_FILTERS)
+      return false;
+
+   dec->unfilter[raw[0]](dec->line, dec->prev, raw + 1, dec->pitch, dec->bpp);
+
+   if (pass->stride_x == 1)
+      png_decoder_expand(dec, data, dec->pass_width);
+   else
+   {
+      png_decoder_expand(dec, dec->pass_line, dec->pass_width);
+      for (x = 0; x < dec->pass_width; x++)
+         data[x * pass->stride_x] = dec->pass_line[x];
+   }
+
+   tmp       = dec->prev;
+   dec->prev = dec->line;
+   dec->line = tmp;
+
+   if (++dec->y == dec->pass_height)
+   {
+      dec->pass++;
+      png_decoder_next_pass(dec);
    }
 
    return true;
 }
 
-static bool png_append_idat(FILE *file,
-      const struct png_chunk *chunk, struct idat_buffer *buf)
+static bool png_decoder_feed(struct png_decoder *dec,
+      const uint8_t *data, size_t size)
 {
-   uint8_t *new_buffer = (uint8_t*)realloc(buf->data, buf->size + chunk->size);
-   if (!new_buffer)
-      return false;
+   dec->stream.next_in  = (Bytef*)data;
+   dec->stream.avail_in = size;
+
+   while (!dec->done && dec->stream.avail_in)
+   {
+      size_t pos = 0;
+      int zret;
+
+      dec->stream.next_out  = dec->raw + dec->raw_fill;
+      dec->stream.avail_out = dec->raw_size - dec->raw_fill;
+
+      zret = inflate(&dec->stream, Z_NO_FLUSH);
+      if (zret != Z_OK && zret != Z_STREAM_END)
+         return false;
+
+      dec->raw_fill = dec->raw_size - dec->stream.avail_out;
+
+      while (!dec->done && dec->raw_fill - pos > dec->pitch)
+      {
+         size_t line_size = dec->pitch + 1;
+         if (!png_decoder_line(dec, dec->raw + pos))
+            return false;
+         pos += line_size;
+      }
+
+      /* Keep what there is of the next line. */
+      memmove(dec->raw, dec->raw + pos, dec->raw_fill - pos);
+      dec->raw_fill -= pos;
+
+      if (zret == Z_STREAM_END)
+         break;
+   }
 
-   buf->data  = new_buffer;
-   if (fread(buf->data + buf->size, 1, chunk->size, file) != chunk->size)
-      return false;
-   if (fseek(file, sizeof(uint32_t), SEEK_CUR) < 0)
-      return false;
-   buf->size += chunk->size;
    return true;
 }
 
-static bool png_read_plte(FILE *file, uint32_t *buffer, unsigned entries)
+static bool png_read_plte(const uint8_t *data,
+      uint32_t *buffer, unsigned entries)
 {
    unsigned i;
    if (entries > 256)
       return false;
 
-   uint8_t buf[256 * 3];
-   if (fread(buf, 3, entries, file) != entries)
-      return false;
-
    for (i = 0; i < entries; i++)
    {
-      uint32_t r = buf[3 * i + 0];
-      uint32_t g = buf[3 * i + 1];
-      uint32_t b = buf[3 * i + 2];
+      uint32_t r = data[3 * i + 0];
+      uint32_t g = data[3 * i + 1];
+      uint32_t b = data[3 * i + 2];
       buffer[i] = (r << 16) | (g << 8) | (b << 0) | (0xffu << 24);
    }
 
-   if (fseek(file, sizeof(uint32_t), SEEK_CUR) < 0)
-      return false;
-
    return true;
 }
 
 bool rpng_load_image_argb(const char *path, uint32_t **data,
       unsigned *width, unsigned *height)
 {
-   long pos;
+   const uint8_t *ptr, *end;
    *data   = NULL;
    *width  = 0;
    *height = 0;
 
    bool ret = true;
-   FILE *file = fopen(path, "rb");
-   if (!file)
+   struct rpng_file file;
+   if (!rpng_file_open(&file, path))
+   {
+      rpng_file_close(&file);
       return false;
-
-   fseek(file, 0, SEEK_END);
-   long file_len = ftell(file);
-   rewind(file);
+   }
 
    bool has_ihdr = false;
    bool has_idat = false;
    bool has_iend = false;
    bool has_plte = false;
-   uint8_t *inflate_buf = NULL;
-   size_t inflate_buf_size = 0;
-   z_stream stream = {0};
 
-   struct idat_buffer idat_buf = {0};
+   struct png_decoder dec = {0};
    struct png_ihdr ihdr = {0};
    uint32_t palette[256] = {0};
 
-   char header[8];
-   if (fread(header, 1, sizeof(header), file) != sizeof(header))
+   ptr = file.data;
+   end = file.data + file.size;
+
+   if (file.size < sizeof(png_magic))
       GOTO_END_ERROR();
 
-   if (memcmp(header, png_magic, sizeof(png_magic)) != 0)
+   if (memcmp(ptr, png_magic, sizeof(png_magic)) != 0)
       GOTO_END_ERROR();
 
-   /* feof() apparently isn't triggered after a seek (IEND). */
-   for (pos = ftell(file); 
-         pos < file_len && pos >= 0; pos = ftell(file))
+   for (ptr += sizeof(png_magic); ptr < end; )
    {
       struct png_chunk chunk = {0};
-      if (!read_chunk_header(file, &chunk))
+      if (!png_read_chunk(&ptr, end, &chunk))
          GOTO_END_ERROR();
 
       switch (png_chunk_type(&chunk))
       {
          case PNG_CHUNK_NOOP:
          default:
-            if (fseek(file, chunk.size + sizeof(uint32_t), SEEK_CUR) < 0)
-               GOTO_END_ERROR();
             break;
 
          case PNG_CHUNK_ERROR:
@@ -674,7 +955,7 @@ bool rpng_load_image_argb(const char *path, uint32_t **data,
             if (has_ihdr || has_idat || has_iend)
                GOTO_END_ERROR();
 
-            if (!png_parse_ihdr(file, &chunk, &ihdr))
+            if (!png_parse_ihdr(&chunk, &ihdr))
                GOTO_END_ERROR();
 
             has_ihdr = true;
@@ -687,7 +968,7 @@ bool rpng_load_image_argb(const char *path, uint32_t **data,
             if (chunk.size % 3)
                GOTO_END_ERROR();
 
-            if (!png_read_plte(file, palette, chunk.size / 3))
+            if (!png_read_plte(chunk.data, palette, chunk.size / 3))
                GOTO_END_ERROR();
 
             has_plte = true;
@@ -697,7 +978,10 @@ bool rpng_load_image_argb(const char *path, uint32_t **data,
             if (!has_ihdr || has_iend || (ihdr.color_type == 3 && !has_plte))
                GOTO_END_ERROR();
 
-            if (!png_append_idat(file, &chunk, &idat_buf))
+            if (!has_idat && !png_decoder_init(&dec, &ihdr, palette))
+               GOTO_END_ERROR();
+
+            if (!png_decoder_feed(&dec, chunk.data, chunk.size))
                GOTO_END_ERROR();
 
             has_idat = true;
@@ -707,68 +991,22 @@ bool rpng_load_image_argb(const char *path, uint32_t **data,
             if (!has_ihdr || !has_idat)
                GOTO_END_ERROR();
 
-            if (fseek(file, sizeof(uint32_t), SEEK_CUR) < 0)
-               GOTO_END_ERROR();
-
             has_iend = true;
             break;
       }
    }
 
-   if (!has_ihdr || !has_idat || !has_iend)
-      GOTO_END_ERROR();
-
-   if (inflateInit(&stream) != Z_OK)
-      GOTO_END_ERROR();
-
-   png_pass_geom(&ihdr, ihdr.width, ihdr.height, NULL, NULL, &inflate_buf_size);
-   if (ihdr.interlace == 1) /* To be sure. */
-      inflate_buf_size *= 2;
-
-   inflate_buf = (uint8_t*)malloc(inflate_buf_size);
-   if (!inflate_buf)
-      GOTO_END_ERROR();
-
-   stream.next_in   = idat_buf.data;
-   stream.avail_in  = idat_buf.size;
-   stream.avail_out = inflate_buf_size;
-   stream.next_out  = inflate_buf;
-
-   if (inflate(&stream, Z_FINISH) != Z_STREAM_END)
-   {
-      inflateEnd(&stream);
+   if (!has_ihdr || !has_idat || !has_iend || !dec.done)
       GOTO_END_ERROR();
-   }
-   inflateEnd(&stream);
 
-   *width  = ihdr.width;
-   *height = ihdr.height;
-#ifdef GEKKO
-   /* we often use these in textures, make sure they're 32-byte aligned */
-   *data = (uint32_t*)memalign(32, ihdr.width * ihdr.height * sizeof(uint32_t));
-#else
-   *data = (uint32_t*)malloc(ihdr.width * ihdr.height * sizeof(uint32_t));
-#endif
-   if (!*data)
-      GOTO_END_ERROR();
-
-   if (ihdr.interlace == 1)
-   {
-      if (!png_reverse_filter_adam7(*data,
-               &ihdr, inflate_buf, stream.total_out, palette))
-         GOTO_END_ERROR();
-   }
-   else if (!png_reverse_filter(*data,
-            &ihdr, inflate_buf, stream.total_out, palette))
-      GOTO_END_ERROR();
+   *width   = ihdr.width;
+   *height  = ihdr.height;
+   *data    = dec.data;
+   dec.data = NULL;
 
 end:
-   if (file)
-      fclose(file);
-   if (!ret)
-      free(*data);
-   free(idat_buf.data);
-   free(inflate_buf);
+   png_decoder_free(&dec);
+   rpng_file_close(&file);
    return ret;
 }
 
@@ -870,86 +1108,265 @@ static void copy_bgr24_line(uint8_t *dst, const uint8_t *src, unsigned width)
    }
 }
 
-static unsigned count_sad(const uint8_t *data, size_t size)
+/* Filtered lines are deflated in strips of about this size,
+ * each of which can be done by a thread of its own. */
+#define RPNG_STRIP_SIZE (128 * 1024)
+
+/* The deflate window. Every strip after the first is primed
+ * with this much of what comes before it. */
+#define RPNG_WINDOW_SIZE (32 * 1024)
+
+static bool rpng_has_avx2(void)
 {
-   size_t i;
-   unsigned cnt = 0;
-   for (i = 0; i < size; i++)
-      cnt += abs((int8_t)data[i]);
-   return cnt;
+#if defined(RARCH_INTERNAL)
+   return rarch_get_cpu_features() & RETRO_SIMD_AVX2;
+#elif defined(HAVE_RETRO_TARGET_X86)
+   __builtin_cpu_init();
+   return __builtin_cpu_supports("avx2");
+#else
+   return false;
+#endif
 }
 
-static unsigned filter_up(uint8_t *target, const uint8_t *line,
-      const uint8_t *prev, unsigned width, unsigned bpp)
+static rpng_filter_line_t rpng_find_filter_line(void)
 {
-   unsigned i;
-   width *= bpp;
-   for (i = 0; i < width; i++)
-      target[i] = line[i] - prev[i];
+#ifdef RPNG_HAVE_VECTOR
+#if defined(HAVE_RETRO_TARGET_X86)
+   if (rpng_has_avx2())
+      return rpng_filter_line_AVX2;
+#endif
+#if defined(__SSE2__)
+   return rpng_filter_line_SSE2;
+#elif defined(__ARM_NEON__)
+   return rpng_filter_line_NEON;
+#endif
+#endif
+   (void)rpng_has_avx2;
+   return rpng_filter_line_C;
+}
+
+struct rpng_strip
+{
+   unsigned first_line;
+   unsigned lines;
+
+   /* Where the strip starts in the filtered image, and how long it is. */
+   size_t offset;
+   size_t size;
+
+   uint8_t *deflated;
+   size_t deflated_size;
+   uLong adler;
+   bool ok;
+};
+
+struct rpng_encoder
+{
+   const uint8_t *data;
+   unsigned width;
+   unsigned height;
+   unsigned pitch;
+   unsigned bpp;
+   int level;
+   rpng_filter_line_t filter_line;
+
+   /* Every line with its filter type byte in front. */
+   uint8_t *filtered;
+   size_t line_size;
+
+   struct rpng_strip *strips;
+   unsigned num_strips;
+};
+
+static const int rpng_zlib_levels[] = {
+   1, /* RPNG_SAVE_FASTEST */
+   3, /* RPNG_SAVE_FAST */
+   6, /* RPNG_SAVE_DEFAULT */
+   9, /* RPNG_SAVE_SMALLEST */
+};
 
-   return count_sad(target, width);
+static void rpng_copy_line(const struct rpng_encoder *enc,
+      uint8_t *dst, unsigned line)
+{
+   const uint8_t *src = enc->data + line * enc->pitch;
+
+   if (enc->bpp == sizeof(uint32_t))
+      copy_argb_line(dst, (const uint32_t*)src, enc->width);
+   else
+      copy_bgr24_line(dst, src, enc->width);
 }
 
-static unsigned filter_sub(uint8_t *target, const uint8_t *line,
-      unsigned width, unsigned bpp)
+/* Filters every line of a strip with the method which scores lowest.
+ * The line above the strip is converted again, so that strips can
+ * be filtered in any order. */
+static void rpng_filter_strip(void *data, unsigned index)
 {
-   unsigned i;
-   width *= bpp;
-   for (i = 0; i < bpp; i++)
-      target[i] = line[i];
-   for (i = bpp; i < width; i++)
-      target[i] = line[i] - line[i - bpp];
+   unsigned h, i;
+   struct rpng_encoder *enc = (struct rpng_encoder*)data;
+   struct rpng_strip *strip = &enc->strips[index];
+   size_t size = enc->line_size - 1;
+   size_t padded = size + RPNG_LINE_PAD;
+
+   uint8_t *buf = (uint8_t*)calloc(RPNG_FILTERS + 1, padded);
+   uint8_t *prev = buf + RPNG_LINE_PAD;
+   uint8_t *line = prev + padded;
+   uint8_t *targets[RPNG_FILTERS];
+
+   if (!buf)
+      return;
+
+   for (i = RPNG_FILTER_SUB; i < RPNG_FILTERS; i++)
+      targets[i] = line + i * padded;
 
-   return count_sad(target, width);
+   if (strip->first_line)
+      rpng_copy_line(enc, prev, strip->first_line - 1);
+
+   for (h = 0; h < strip->lines; h++)
+   {
+      unsigned filter = RPNG_FILTER_NONE;
+      unsigned scores[RPNG_FILTERS] = {0};
+      uint8_t *out = enc->filtered + strip->offset + h * enc->line_size;
+
+      rpng_copy_line(enc, line, strip->first_line + h);
+      targets[RPNG_FILTER_NONE] = line;
+      enc->filter_line(targets, scores, line, prev, size, enc->bpp);
+
+      /* Try every filtering method, and choose the method
+       * which has most entries as zero.
+       *
+       * This is probably not very optimal, but it's very 
+       * simple to implement.
+       */
+      for (i = RPNG_FILTER_SUB; i < RPNG_FILTERS; i++)
+         if (scores[i] < scores[filter])
+            filter = i;
+
+      out[0] = filter;
+      memcpy(out + 1, targets[filter], size);
+      memcpy(prev, line, size);
+   }
+
+   free(buf);
+   strip->ok = true;
 }
 
-static unsigned filter_avg(uint8_t *target, const uint8_t *line,
-      const uint8_t *prev, unsigned width, unsigned bpp)
+/* Deflates a strip on its own, as raw deflate data which ends
+ * on a byte boundary, so that the strips can simply be joined. */
+static void rpng_deflate_strip(void *data, unsigned index)
+{
+   int ret;
+   size_t dict;
+   z_stream stream = {0};
+   struct rpng_encoder *enc = (struct rpng_encoder*)data;
+   struct rpng_strip *strip = &enc->strips[index];
+   bool last = index == enc->num_strips - 1;
+   const uint8_t *in = enc->filtered + strip->offset;
+
+   strip->ok = false;
+   strip->adler = adler32(adler32(0, NULL, 0), in, strip->size);
+
+   if (deflateInit2(&stream, enc->level, Z_DEFLATED, -15,
+            8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return;
+
+   dict = strip->offset < RPNG_WINDOW_SIZE ? strip->offset : RPNG_WINDOW_SIZE;
+   if (dict && deflateSetDictionary(&stream, in - dict, dict) != Z_OK)
+      goto end;
+
+   /* A sync flush ends with an empty stored block. */
+   strip->deflated_size = deflateBound(&stream, strip->size) + 16;
+   strip->deflated = (uint8_t*)malloc(strip->deflated_size);
+   if (!strip->deflated)
+      goto end;
+
+   stream.next_in   = (Bytef*)in;
+   stream.avail_in  = strip->size;
+   stream.next_out  = strip->deflated;
+   stream.avail_out = strip->deflated_size;
+
+   ret = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+   if (ret != (last ? Z_STREAM_END : Z_OK) || stream.avail_in)
+      goto end;
+
+   strip->deflated_size = stream.total_out;
+   strip->ok = true;
+
+end:
+   deflateEnd(&stream);
+}
+
+static bool rpng_run_strips(struct rpng_encoder *enc, rpool_t *pool,
+      void (*task)(void*, unsigned))
 {
    unsigned i;
-   width *= bpp;
-   for (i = 0; i < bpp; i++)
-      target[i] = line[i] - (prev[i] >> 1);
-   for (i = bpp; i < width; i++)
-      target[i] = line[i] - ((line[i - bpp] + prev[i]) >> 1);
 
-   return count_sad(target, width);
+#ifdef HAVE_THREADS
+   rpool_parallel_for(pool, enc->num_strips, task, enc);
+#else
+   (void)pool;
+   for (i = 0; i < enc->num_strips; i++)
+      task(enc, i);
+#endif
+
+   for (i = 0; i < enc->num_strips; i++)
+      if (!enc->strips[i].ok)
+         return false;
+   return true;
 }
 
-static unsigned filter_paeth(uint8_t *target,
-      const uint8_t *line, const uint8_t *prev,
-      unsigned width, unsigned bpp)
+/* Joins the strips into a single zlib stream, in an IDAT chunk. */
+static bool rpng_write_strips(FILE *file, const struct rpng_encoder *enc)
 {
    unsigned i;
-   width *= bpp;
-   for (i = 0; i < bpp; i++)
-      target[i] = line[i] - paeth(0, prev[i], 0);
-   for (i = bpp; i < width; i++)
-      target[i] = line[i] - paeth(line[i - bpp], prev[i], prev[i - bpp]);
+   bool ret = true;
+   uint8_t *idat, *out;
+   size_t size = 2 + 4;
+   uLong adler = enc->strips[0].adler;
+   /* Tells how hard the encoder tried, and checks the header. */
+   unsigned flevel = enc->level < 2 ? 0 : enc->level < 6 ? 1 :
+      enc->level == 6 ? 2 : 3;
+   unsigned cmf = 0x78;
+   unsigned flg = flevel << 6;
+
+   flg += 31 - (cmf * 256 + flg) % 31;
+
+   for (i = 0; i < enc->num_strips; i++)
+      size += enc->strips[i].deflated_size;
+
+   idat = (uint8_t*)malloc(size + 8);
+   if (!idat)
+      return false;
+
+   out = idat + 8;
+   *out++ = cmf;
+   *out++ = flg;
+   for (i = 0; i < enc->num_strips; i++)
+   {
+      const struct rpng_strip *strip = &enc->strips[i];
+      memcpy(out, strip->deflated, strip->deflated_size);
+      out += strip->deflated_size;
+      if (i)
+         adler = adler32_combine(adler, strip->adler, strip->size);
+   }
+   dword_write_be(out, adler);
+
+   dword_write_be(idat + 0, size);
+   memcpy(idat + 4, "IDAT", 4);
+   ret = png_write_idat(file, idat, size + 8);
 
-   return count_sad(target, width);
+   free(idat);
+   return ret;
 }
 
 static bool rpng_save_image(const char *path,
       const uint8_t *data,
-      unsigned width, unsigned height, unsigned pitch, unsigned bpp)
+      unsigned width, unsigned height, unsigned pitch, unsigned bpp,
+      enum rpng_save_level level, rpool_t *pool)
 {
-   unsigned h;
+   unsigned i, lines_per_strip;
    bool ret = true;
    struct png_ihdr ihdr = {0};
-
-   size_t encode_buf_size  = 0;
-   uint8_t *encode_buf     = NULL;
-   uint8_t *deflate_buf    = NULL;
-   uint8_t *rgba_line      = NULL;
-   uint8_t *up_filtered    = NULL;
-   uint8_t *sub_filtered   = NULL;
-   uint8_t *avg_filtered   = NULL;
-   uint8_t *paeth_filtered = NULL;
-   uint8_t *prev_encoded   = NULL;
-   uint8_t *encode_target  = NULL;
-
-   z_stream stream = {0};
+   struct rpng_encoder enc = {0};
 
    FILE *file = fopen(path, "wb");
    if (!file)
@@ -965,102 +1382,51 @@ static bool rpng_save_image(const char *path,
    if (!png_write_ihdr(file, &ihdr))
       GOTO_END_ERROR();
 
-   encode_buf_size = (width * bpp + 1) * height;
-   encode_buf = (uint8_t*)malloc(encode_buf_size);
-   if (!encode_buf)
+   enc.data        = data;
+   enc.width       = width;
+   enc.height      = height;
+   enc.pitch       = pitch;
+   enc.bpp         = bpp;
+   enc.level       = rpng_zlib_levels[level < ARRAY_SIZE(rpng_zlib_levels) ?
+      level : RPNG_SAVE_SMALLEST];
+   enc.filter_line = rpng_find_filter_line();
+   enc.line_size   = width * bpp + 1;
+
+   enc.filtered = (uint8_t*)malloc(enc.line_size * height);
+   if (!enc.filtered)
       GOTO_END_ERROR();
 
-   prev_encoded = (uint8_t*)calloc(1, width * bpp);
-   if (!prev_encoded)
-      GOTO_END_ERROR();
+   /* The strips only depend on the image, so that the file
+    * comes out the same however many threads there are. */
+   lines_per_strip = RPNG_STRIP_SIZE / enc.line_size;
+   if (!lines_per_strip)
+      lines_per_strip = 1;
+   enc.num_strips = (height + lines_per_strip - 1) / lines_per_strip;
 
-   rgba_line      = (uint8_t*)malloc(width * bpp);
-   up_filtered    = (uint8_t*)malloc(width * bpp);
-   sub_filtered   = (uint8_t*)malloc(width * bpp);
-   avg_filtered   = (uint8_t*)malloc(width * bpp);
-   paeth_filtered = (uint8_t*)malloc(width * bpp);
-   if (!rgba_line || !up_filtered || !sub_filtered || !avg_filtered || !paeth_filtered)
+   enc.strips = (struct rpng_strip*)calloc(enc.num_strips, sizeof(*enc.strips));
+   if (!enc.strips)
       GOTO_END_ERROR();
 
-   encode_target = encode_buf;
-   for (h = 0; h < height;
-         h++, encode_target += width * bpp, data += pitch)
+   for (i = 0; i < enc.num_strips; i++)
    {
-      if (bpp == sizeof(uint32_t))
-         copy_argb_line(rgba_line, (const uint32_t*)data, width);
-      else
-         copy_bgr24_line(rgba_line, data, width);
-
-      /* Try every filtering method, and choose the method
-       * which has most entries as zero.
-       *
-       * This is probably not very optimal, but it's very 
-       * simple to implement.
-       */
-      unsigned none_score  = count_sad(rgba_line, width * bpp);
-      unsigned up_score    = filter_up(up_filtered, rgba_line, prev_encoded, width, bpp);
-      unsigned sub_score   = filter_sub(sub_filtered, rgba_line, width, bpp);
-      unsigned avg_score   = filter_avg(avg_filtered, rgba_line, prev_encoded, width, bpp);
-      unsigned paeth_score = filter_paeth(paeth_filtered, rgba_line, prev_encoded, width, bpp);
-
-      uint8_t filter = 0;
-      unsigned min_sad = none_score;
-      const uint8_t *chosen_filtered = rgba_line;
-
-      if (sub_score < min_sad)
-      {
-         filter = 1;
-         chosen_filtered = sub_filtered;
-         min_sad = sub_score;
-      }
-
-      if (up_score < min_sad)
-      {
-         filter = 2;
-         chosen_filtered = up_filtered;
-         min_sad = up_score;
-      }
-
-      if (avg_score < min_sad)
-      {
-         filter = 3;
-         chosen_filtered = avg_filtered;
-         min_sad = avg_score;
-      }
-
-      if (paeth_score < min_sad)
-      {
-         filter = 4;
-         chosen_filtered = paeth_filtered;
-         min_sad = paeth_score;
-      }
-
-      *encode_target++ = filter;
-      memcpy(encode_target, chosen_filtered, width * bpp);
-
-      memcpy(prev_encoded, rgba_line, width * bpp);
+      struct rpng_strip *strip = &enc.strips[i];
+      strip->first_line = i * lines_per_strip;
+      strip->lines      = height - strip->first_line;
+      if (strip->lines > lines_per_strip)
+         strip->lines = lines_per_strip;
+      strip->offset     = strip->first_line * enc.line_size;
+      strip->size       = strip->lines * enc.line_size;
    }
 
-   deflate_buf = (uint8_t*)malloc(encode_buf_size * 2); /* Just to be sure. */
-   if (!deflate_buf)
+   /* Deflating a strip looks back into the one before it,
+    * so every strip is filtered first. */
+   if (!rpng_run_strips(&enc, pool, rpng_filter_strip))
       GOTO_END_ERROR();
 
-   stream.next_in   = encode_buf;
-   stream.avail_in  = encode_buf_size;
-   stream.next_out  = deflate_buf + 8;
-   stream.avail_out = encode_buf_size * 2;
-
-   deflateInit(&stream, 9);
-   if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
-   {
-      deflateEnd(&stream);
+   if (!rpng_run_strips(&enc, pool, rpng_deflate_strip))
       GOTO_END_ERROR();
-   }
-   deflateEnd(&stream);
 
-   memcpy(deflate_buf + 4, "IDAT", 4);
-   dword_write_be(deflate_buf + 0, stream.total_out);
-   if (!png_write_idat(file, deflate_buf, stream.total_out + 8))
+   if (!rpng_write_strips(file, &enc))
       GOTO_END_ERROR();
 
    if (!png_write_iend(file))
@@ -1069,14 +1435,13 @@ static bool rpng_save_image(const char *path,
 end:
    if (file)
       fclose(file);
-   free(encode_buf);
-   free(deflate_buf);
-   free(rgba_line);
-   free(prev_encoded);
-   free(up_filtered);
-   free(sub_filtered);
-   free(avg_filtered);
-   free(paeth_filtered);
+   if (enc.strips)
+   {
+      for (i = 0; i < enc.num_strips; i++)
+         free(enc.strips[i].deflated);
+   }
+   free(enc.strips);
+   free(enc.filtered);
    return ret;
 }
 
@@ -1084,15 +1449,30 @@ bool rpng_save_image_argb(const char *path, const uint32_t *data,
       unsigned width, unsigned height, unsigned pitch)
 {
    return rpng_save_image(path, (const uint8_t*)data,
-         width, height, pitch, sizeof(uint32_t));
+         width, height, pitch, sizeof(uint32_t), RPNG_SAVE_SMALLEST, NULL);
 }
 
 bool rpng_save_image_bgr24(const char *path, const uint8_t *data,
       unsigned width, unsigned height, unsigned pitch)
 {
    return rpng_save_image(path, (const uint8_t*)data,
-         width, height, pitch, 3);
+         width, height, pitch, 3, RPNG_SAVE_SMALLEST, NULL);
 }
 
-#endif
+bool rpng_save_image_argb_level(const char *path, const uint32_t *data,
+      unsigned width, unsigned height, unsigned pitch,
+      enum rpng_save_level level, rpool_t *pool)
+{
+   return rpng_save_image(path, (const uint8_t*)data,
+         width, height, pitch, sizeof(uint32_t), level, pool);
+}
 
+bool rpng_save_image_bgr24_level(const char *path, const uint8_t *data,
+      unsigned width, unsigned height, unsigned pitch,
+      enum rpng_save_level level, rpool_t *pool)
+{
+   return rpng_save_image(path, (const uint8_t*)data,
+         width, height, pitch, 3, level, pool);
+}
+
+#endif
@@ -19,6 +19,7 @@
 #include <stdint.h>
 
 #include <boolean.h>
+#include <rthreads/rpool.h>
 
 #ifdef HAVE_CONFIG_H
 #include "../../config.h"
@@ -32,10 +33,28 @@ bool rpng_load_image_argb(const char *path, uint32_t **data,
       unsigned *width, unsigned *height);
 
 #ifdef HAVE_ZLIB_DEFLATE
+/* Trades file size for speed when saving. */
+enum rpng_save_level
+{
+   RPNG_SAVE_FASTEST = 0,
+   RPNG_SAVE_FAST,
+   RPNG_SAVE_DEFAULT,
+   RPNG_SAVE_SMALLEST
+};
+
 bool rpng_save_image_argb(const char *path, const uint32_t *data,
       unsigned width, unsigned height, unsigned pitch);
 bool rpng_save_image_bgr24(const char *path, const uint8_t *data,
       unsigned width, unsigned height, unsigned pitch);
+
+/* The workers of pool help encode the image, if not NULL. 
+ * The file is the same for any number of them. */
+bool rpng_save_image_argb_level(const char *path, const uint32_t *data,
+      unsigned width, unsigned height, unsigned pitch,
+      enum rpng_save_level level, rpool_t *pool);
+bool rpng_save_image_bgr24_level(const char *path, const uint8_t *data,
+      unsigned width, unsigned height, unsigned pitch,
+      enum rpng_save_level level, rpool_t *pool);
 #endif
 
 #ifdef __cplusplus
@@ -20,6 +20,64 @@
 #include <string.h>
 #include <Imlib2.h>
 
+// Every level and thread count has to give back the image,
+// and the thread count must not change the file.
+static bool test_save_levels(void)
+{
+   const unsigned width = 640, height = 480;
+   bool ret = true;
+   uint32_t *image = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+   if (!image)
+      return false;
+
+   srand(1);
+   for (unsigned y = 0; y < height; y++)
+      for (unsigned x = 0; x < width; x++)
+         image[y * width + x] = (rand() % 7 ? 0xff000000 : (unsigned)rand() << 24) |
+            ((x / 8) ^ (y / 8)) * 0x030507 | (rand() % 16 ? 0 : rand());
+
+   rpool_t *pool = NULL;
+#ifdef HAVE_THREADS
+   pool = rpool_new(3);
+#endif
+
+   for (unsigned level = RPNG_SAVE_FASTEST; level <= RPNG_SAVE_SMALLEST && ret; level++)
+   {
+      long sizes[2] = {0};
+      for (unsigned i = 0; i < 2 && ret; i++)
+      {
+         uint32_t *data = NULL;
+         unsigned w = 0, h = 0;
+         FILE *file;
+
+         ret = rpng_save_image_argb_level("/tmp/test-level.png", image,
+               width, height, width * sizeof(uint32_t),
+               (enum rpng_save_level)level, i ? pool : NULL) &&
+            rpng_load_image_argb("/tmp/test-level.png", &data, &w, &h) &&
+            w == width && h == height &&
+            !memcmp(data, image, width * height * sizeof(uint32_t));
+         free(data);
+
+         if ((file = fopen("/tmp/test-level.png", "rb")))
+         {
+            fseek(file, 0, SEEK_END);
+            sizes[i] = ftell(file);
+            fclose(file);
+         }
+      }
+
+      fprintf(stderr, "Level %u: %ld bytes.\n", level, sizes[0]);
+      ret = ret && sizes[0] == sizes[1];
+   }
+
+#ifdef HAVE_THREADS
+   if (pool)
+      rpool_free(pool);
+#endif
+   free(image);
+   return ret;
+}
+
 int main(int argc, char *argv[])
 {
    if (argc > 2)
@@ -44,6 +102,12 @@ int main(int argc, char *argv[])
    if (!rpng_save_image_argb("/tmp/test.png", test_data, 4, 4, 16))
       return 1;
 
+   if (!test_save_levels())
+   {
+      fprintf(stderr, "Saving at every level failed!\n");
+      return 6;
+   }
+
    uint32_t *data = NULL;
    unsigned width = 0;
    unsigned height = 0;
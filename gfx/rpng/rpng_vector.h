@@ -0,0 +1,293 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Vector kernels for rpng, included once per instruction set.
+ *
+ * RPNG_ISA is appended to every name, RPNG_TARGET goes in front
+ * of every function, and RPNG_LANES is how many bytes are worked
+ * on at once. Bytes are widened to 16 bits, so that the Paeth
+ * predictor can be done without overflow.
+ *
+ * The decoder kernels are only included with RPNG_UNFILTER. */
+
+#define RPNG_CAT_(a, b) a##_##b
+#define RPNG_CAT(a, b) RPNG_CAT_(a, b)
+#define RPNG_FN(name) RPNG_CAT(name, RPNG_ISA)
+
+#define rpng_u8v  RPNG_FN(rpng_u8v)
+#define rpng_s16v RPNG_FN(rpng_s16v)
+#define rpng_u16v RPNG_FN(rpng_u16v)
+
+typedef uint8_t rpng_u8v __attribute__((vector_size(RPNG_LANES)));
+typedef int16_t rpng_s16v __attribute__((vector_size(RPNG_LANES * 2)));
+typedef uint16_t rpng_u16v __attribute__((vector_size(RPNG_LANES * 2)));
+
+#ifdef HAVE_ZLIB_DEFLATE
+RETRO_SIMD_INLINE RPNG_TARGET rpng_s16v RPNG_FN(rpng_load)(const uint8_t *ptr)
+{
+   rpng_u8v v;
+   memcpy(&v, ptr, sizeof(v));
+   return __builtin_convertvector(v, rpng_s16v);
+}
+
+RETRO_SIMD_INLINE RPNG_TARGET void RPNG_FN(rpng_store)(uint8_t *ptr, rpng_s16v v)
+{
+   rpng_u8v out = __builtin_convertvector(v, rpng_u8v);
+   memcpy(ptr, &out, sizeof(out));
+}
+
+RETRO_SIMD_INLINE RPNG_TARGET rpng_s16v RPNG_FN(rpng_select)(rpng_s16v mask,
+      rpng_s16v a, rpng_s16v b)
+{
+   return (mask & a) | (~mask & b);
+}
+
+RETRO_SIMD_INLINE RPNG_TARGET rpng_s16v RPNG_FN(rpng_abs)(rpng_s16v v)
+{
+   rpng_s16v sign = v >> 15;
+   return (v ^ sign) - sign;
+}
+
+/* The score of a filtered byte is its magnitude as a signed byte. */
+RETRO_SIMD_INLINE RPNG_TARGET rpng_u16v RPNG_FN(rpng_score)(rpng_s16v v)
+{
+   return (rpng_u16v)RPNG_FN(rpng_abs)(((v + 128) & 0xff) - 128);
+}
+
+static RPNG_TARGET void RPNG_FN(rpng_filter_line)(uint8_t * const *targets,
+      unsigned *scores, const uint8_t *line, const uint8_t *prev,
+      unsigned size, unsigned bpp)
+{
+   unsigned i = 0, j, k;
+
+   while (i + RPNG_LANES <= size)
+   {
+      /* A lane adds up to 128 per step, so the 16-bit
+       * sums are folded every 256 steps at the latest. */
+      unsigned end = i + 256 * RPNG_LANES;
+      rpng_u16v sums[RPNG_FILTERS];
+
+      memset(sums, 0, sizeof(sums));
+      if (end > size)
+         end = size;
+
+      for (; i + RPNG_LANES <= end; i += RPNG_LANES)
+      {
+         rpng_s16v x = RPNG_FN(rpng_load)(line + i);
+         rpng_s16v a = RPNG_FN(rpng_load)(line + i - bpp);
+         rpng_s16v b = RPNG_FN(rpng_load)(prev + i);
+         rpng_s16v c = RPNG_FN(rpng_load)(prev + i - bpp);
+
+         rpng_s16v pa = RPNG_FN(rpng_abs)(b - c);
+         rpng_s16v pb = RPNG_FN(rpng_abs)(a - c);
+         rpng_s16v pc = RPNG_FN(rpng_abs)(a + b - c - c);
+         rpng_s16v pred = RPNG_FN(rpng_select)((pa <= pb) & (pa <= pc), a,
+               RPNG_FN(rpng_select)(pb <= pc, b, c));
+
+         rpng_s16v sub   = x - a;
+         rpng_s16v up    = x - b;
+         rpng_s16v avg   = x - ((a + b) >> 1);
+         rpng_s16v paeth = x - pred;
+
+         RPNG_FN(rpng_store)(targets[RPNG_FILTER_SUB] + i, sub);
+         RPNG_FN(rpng_store)(targets[RPNG_FILTER_UP] + i, up);
+         RPNG_FN(rpng_store)(targets[RPNG_FILTER_AVG] + i, avg);
+         RPNG_FN(rpng_store)(targets[RPNG_FILTER_PAETH] + i, paeth);
+
+         sums[RPNG_FILTER_NONE]  += RPNG_FN(rpng_score)(x);
+         sums[RPNG_FILTER_SUB]   += RPNG_FN(rpng_score)(sub);
+         sums[RPNG_FILTER_UP]    += RPNG_FN(rpng_score)(up);
+         sums[RPNG_FILTER_AVG]   += RPNG_FN(rpng_score)(avg);
+         sums[RPNG_FILTER_PAETH] += RPNG_FN(rpng_score)(paeth);
+      }
+
+      for (j = 0; j < RPNG_FILTERS; j++)
+         for (k = 0; k < RPNG_LANES; k++)
+            scores[j] += sums[j][k];
+   }
+
+   rpng_filter_span(targets, scores, line, prev, i, size, bpp);
+}
+
+#endif
+
+#ifdef RPNG_UNFILTER
+/* Every pixel is unfiltered from the one left of it, so these go
+ * one pixel of three or four bytes at a time. A whole vector is
+ * loaded and stored regardless, the line padding takes the rest. */
+
+#define rpng_pixel8v  RPNG_FN(rpng_pixel8v)
+#define rpng_pixel16v RPNG_FN(rpng_pixel16v)
+#define rpng_bytes16v RPNG_FN(rpng_bytes16v)
+#define rpng_argbv    RPNG_FN(rpng_argbv)
+
+typedef uint8_t rpng_pixel8v __attribute__((vector_size(4)));
+typedef int16_t rpng_pixel16v __attribute__((vector_size(8)));
+typedef uint8_t rpng_bytes16v __attribute__((vector_size(16)));
+typedef uint32_t rpng_argbv __attribute__((vector_size(16)));
+
+RETRO_SIMD_INLINE RPNG_TARGET rpng_pixel16v RPNG_FN(rpng_load_pixel)(
+      const uint8_t *ptr)
+{
+   rpng_pixel8v v;
+   memcpy(&v, ptr, sizeof(v));
+   return __builtin_convertvector(v, rpng_pixel16v);
+}
+
+RETRO_SIMD_INLINE RPNG_TARGET void RPNG_FN(rpng_store_pixel)(uint8_t *ptr,
+      rpng_pixel16v v)
+{
+   rpng_pixel8v out = __builtin_convertvector(v, rpng_pixel8v);
+   memcpy(ptr, &out, sizeof(out));
+}
+
+RETRO_SIMD_INLINE RPNG_TARGET rpng_pixel16v RPNG_FN(rpng_abs_pixel)(
+      rpng_pixel16v v)
+{
+   rpng_pixel16v sign = v >> 15;
+   return (v ^ sign) - sign;
+}
+
+static RPNG_TARGET void RPNG_FN(rpng_unfilter_sub)(uint8_t *line,
+      const uint8_t *prev, const uint8_t *filtered,
+      unsigned size, unsigned bpp)
+{
+   unsigned i;
+   rpng_pixel8v a = {0};
+
+   for (i = 0; i < size; i += bpp)
+   {
+      rpng_pixel8v x;
+      memcpy(&x, filtered + i, sizeof(x));
+      a += x;
+      memcpy(line + i, &a, sizeof(a));
+   }
+}
+
+static RPNG_TARGET void RPNG_FN(rpng_unfilter_up)(uint8_t *line,
+      const uint8_t *prev, const uint8_t *filtered,
+      unsigned size, unsigned bpp)
+{
+   unsigned i;
+
+   for (i = 0; i < size; i += sizeof(rpng_bytes16v))
+   {
+      rpng_bytes16v x, b;
+      memcpy(&x, filtered + i, sizeof(x));
+      memcpy(&b, prev + i, sizeof(b));
+      x += b;
+      memcpy(line + i, &x, sizeof(x));
+   }
+}
+
+static RPNG_TARGET void RPNG_FN(rpng_unfilter_avg)(uint8_t *line,
+      const uint8_t *prev, const uint8_t *filtered,
+      unsigned size, unsigned bpp)
+{
+   unsigned i;
+   rpng_pixel16v a = {0};
+
+   for (i = 0; i < size; i += bpp)
+   {
+      rpng_pixel16v x = RPNG_FN(rpng_load_pixel)(filtered + i);
+      rpng_pixel16v b = RPNG_FN(rpng_load_pixel)(prev + i);
+
+      a = (x + ((a + b) >> 1)) & 0xff;
+      RPNG_FN(rpng_store_pixel)(line + i, a);
+   }
+}
+
+static RPNG_TARGET void RPNG_FN(rpng_unfilter_paeth)(uint8_t *line,
+      const uint8_t *prev, const uint8_t *filtered,
+      unsigned size, unsigned bpp)
+{
+   unsigned i;
+   rpng_pixel16v a = {0};
+   rpng_pixel16v c = {0};
+
+   for (i = 0; i < size; i += bpp)
+   {
+      rpng_pixel16v x = RPNG_FN(rpng_load_pixel)(filtered + i);
+      rpng_pixel16v b = RPNG_FN(rpng_load_pixel)(prev + i);
+
+      rpng_pixel16v pa = RPNG_FN(rpng_abs_pixel)(b - c);
+      rpng_pixel16v pb = RPNG_FN(rpng_abs_pixel)(a - c);
+      rpng_pixel16v pc = RPNG_FN(rpng_abs_pixel)(a + b - c - c);
+      rpng_pixel16v use_a = (pa <= pb) & (pa <= pc);
+      rpng_pixel16v use_b = pb <= pc;
+      rpng_pixel16v pred = (use_a & a) |
+         (~use_a & ((use_b & b) | (~use_b & c)));
+
+      a = (x + pred) & 0xff;
+      c = b;
+      RPNG_FN(rpng_store_pixel)(line + i, a);
+   }
+}
+
+/* Up works on any line, the others only on whole pixels of
+ * eight bit RGB(A). Whatever is not covered stays as it is. */
+static void RPNG_FN(rpng_find_unfilters)(rpng_unfilter_t *unfilter,
+      unsigned bpp)
+{
+   unfilter[RPNG_FILTER_UP] = RPNG_FN(rpng_unfilter_up);
+
+   if (bpp != 3 && bpp != 4)
+      return;
+
+   unfilter[RPNG_FILTER_SUB]   = RPNG_FN(rpng_unfilter_sub);
+   unfilter[RPNG_FILTER_AVG]   = RPNG_FN(rpng_unfilter_avg);
+   unfilter[RPNG_FILTER_PAETH] = RPNG_FN(rpng_unfilter_paeth);
+}
+
+#ifndef MSB_FIRST
+/* Eight bit RGBA to ARGB, which in memory is swapping R and B. */
+static RPNG_TARGET void RPNG_FN(rpng_copy_line_rgba)(uint32_t *data,
+      const uint8_t *decoded, unsigned width, unsigned depth)
+{
+   unsigned i = 0;
+
+   for (; i + 4 <= width; i += 4)
+   {
+      rpng_argbv v;
+      memcpy(&v, decoded + i * 4, sizeof(v));
+      v = (v & 0xff00ff00) | ((v >> 16) & 0xff) | ((v & 0xff) << 16);
+      memcpy(data + i, &v, sizeof(v));
+   }
+
+   for (; i < width; i++)
+   {
+      uint32_t v;
+      memcpy(&v, decoded + i * 4, sizeof(v));
+      data[i] = (v & 0xff00ff00) | ((v >> 16) & 0xff) | ((v & 0xff) << 16);
+   }
+}
+#endif
+
+#undef rpng_pixel8v
+#undef rpng_pixel16v
+#undef rpng_bytes16v
+#undef rpng_argbv
+#endif
+
+#undef rpng_u8v
+#undef rpng_s16v
+#undef rpng_u16v
+#undef RPNG_FN
+#undef RPNG_CAT
+#undef RPNG_CAT_
+#undef RPNG_ISA
+#undef RPNG_TARGET
+#undef RPNG_LANES
+#undef RPNG_UNFILTER
@@ -0,0 +1,487 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs every .filt in gfx/filters through rarch_softfilter_new() the way the
+// frontend does, on synthetic frames of common core sizes and on captured ones.
+// Prints one CSV row per configuration to stdout, so runs can be compared across
+// devices and commits. Every SIMD level the CPU has is run at 1..N threads, and
+// the first output of each run must match the golden hash bit for bit.
+// Exits with 1 if any output does not.
+
+// The softfilters are built in, the way griffin does it.
+#define RARCH_INTERNAL
+#include "../filters/2xsai.c"
+#include "../filters/super2xsai.c"
+#include "../filters/supereagle.c"
+#include "../filters/2xbr.c"
+#include "../filters/darken.c"
+#include "../filters/epx.c"
+#include "../filters/scale2x.c"
+#include "../filters/normal2x.c"
+#include "../filters/blargg_ntsc_snes.c"
+#include "../filters/lq2x.c"
+#include "../filters/phosphor2x.c"
+
+#include "../filter.h"
+#include "../../performance.h"
+#include "../rpng/rpng.h"
+#include <file/config_file.h>
+#include <file/dir_list.h>
+#include <file/file_path.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Rows of zeroes around the input, as some filters read a row past the frame.
+#define BENCH_GUARD 4
+
+struct bench_simd
+{
+   const char *ident;
+   unsigned mask;
+};
+
+struct bench_size
+{
+   unsigned width;
+   unsigned height;
+};
+
+struct bench_frame
+{
+   char name[64];
+   unsigned width;
+   unsigned height;
+   uint16_t *rgb565;
+   uint32_t *xrgb8888;
+};
+
+struct bench_format
+{
+   const char *ident;
+   enum retro_pixel_format fmt;
+   unsigned bpp;
+};
+
+static const struct bench_size bench_sizes[] = {
+   { 256, 224 }, // SNES, Genesis in H32
+   { 320, 240 }, // PlayStation, Genesis in H40
+   { 512, 448 }, // SNES hires and interlaced
+};
+
+static const struct bench_format bench_formats[] = {
+   { "rgb565", RETRO_PIXEL_FORMAT_RGB565, sizeof(uint16_t) },
+   { "xrgb8888", RETRO_PIXEL_FORMAT_XRGB8888, sizeof(uint32_t) },
+};
+
+static bool bench_quick;
+static bool bench_update;
+static double bench_min_time;
+static const char *bench_filter;
+static const char *bench_golden_path = "golden.cfg";
+static const char *bench_filters_dir = "../filters";
+static unsigned bench_max_threads;
+static unsigned bench_failures;
+
+static struct bench_simd bench_simd_levels[8];
+static unsigned bench_num_simd_levels;
+static unsigned bench_simd_mask;
+
+static struct bench_frame bench_frames[16];
+static unsigned bench_num_frames;
+
+// filter.c asks the CPU for these, the bench picks them instead.
+uint64_t rarch_get_cpu_features(void)
+{
+   return bench_simd_mask;
+}
+
+unsigned rarch_get_cpu_cores(void)
+{
+   return bench_max_threads;
+}
+
+static double bench_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1e9;
+}
+
+// SIMD levels are cumulative, the first one is plain code.
+// Only the levels the filters have kernels for are run.
+static void bench_find_simd_levels(void)
+{
+   unsigned mask = 0;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "none", 0 };
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   __builtin_cpu_init();
+   if (!__builtin_cpu_supports("sse2"))
+      return;
+   mask |= SOFTFILTER_SIMD_SSE | SOFTFILTER_SIMD_SSE2;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "sse2", mask };
+
+   if (!__builtin_cpu_supports("avx2"))
+      return;
+   mask |= SOFTFILTER_SIMD_SSE3 | SOFTFILTER_SIMD_SSSE3 | SOFTFILTER_SIMD_SSE4 |
+      SOFTFILTER_SIMD_SSE42 | SOFTFILTER_SIMD_AVX | SOFTFILTER_SIMD_AVX2;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "avx2", mask };
+#elif defined(__ARM_NEON__)
+   mask |= SOFTFILTER_SIMD_NEON;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "neon", mask };
+#endif
+   (void)mask;
+}
+
+static bool bench_selected(const char *ident)
+{
+   return !bench_filter || strstr(ident, bench_filter);
+}
+
+static uint16_t bench_to_rgb565(uint32_t c)
+{
+   return ((c >> 8) & 0xf800) | ((c >> 5) & 0x07e0) | ((c >> 3) & 0x001f);
+}
+
+static bool bench_frame_alloc(struct bench_frame *frame,
+      const char *name, unsigned width, unsigned height)
+{
+   size_t pixels = width * (height + 2 * BENCH_GUARD);
+
+   snprintf(frame->name, sizeof(frame->name), "%s", name);
+   frame->width = width;
+   frame->height = height;
+   frame->rgb565 = (uint16_t*)calloc(pixels, sizeof(uint16_t));
+   frame->xrgb8888 = (uint32_t*)calloc(pixels, sizeof(uint32_t));
+   return frame->rgb565 && frame->xrgb8888;
+}
+
+static void bench_frame_set(struct bench_frame *frame,
+      unsigned x, unsigned y, uint32_t c)
+{
+   size_t i = (y + BENCH_GUARD) * frame->width + x;
+   frame->xrgb8888[i] = c & 0xffffff;
+   frame->rgb565[i] = bench_to_rgb565(c);
+}
+
+// Looks like a game more than noise does, so that the edge detecting
+// filters take all their paths: a tiled background, thin diagonals,
+// a round sprite, a smooth gradient for the status bar, and some noise.
+static bool bench_frame_synthetic(struct bench_frame *frame,
+      unsigned width, unsigned height)
+{
+   static const uint32_t palette[16] = {
+      0x000000, 0xffffff, 0x880000, 0xaaffee,
+      0xcc44cc, 0x00cc55, 0x0000aa, 0xeeee77,
+      0xdd8855, 0x664400, 0xff7777, 0x333333,
+      0x777777, 0xaaff66, 0x0088ff, 0xbbbbbb,
+   };
+   char name[64];
+   unsigned x, y;
+   int cx = width / 2, cy = height / 2 - height / 8, r = height / 6;
+
+   snprintf(name, sizeof(name), "synthetic_%ux%u", width, height);
+   if (!bench_frame_alloc(frame, name, width, height))
+      return false;
+
+   srand(7);
+   for (y = 0; y < height; y++)
+   {
+      for (x = 0; x < width; x++)
+      {
+         uint32_t c;
+         int dx = (int)x - cx, dy = (int)y - cy;
+         unsigned tile = ((x / 16) ^ (y / 16)) & 3;
+
+         if (y > height * 3 / 4)
+            c = ((x * 255 / width) << 16) | (((y * 4) & 0xff) << 8) | 0x40;
+         else if ((x + y) % 23 < 3)
+            c = palette[1];
+         else if (dx * dx + dy * dy < r * r)
+            c = palette[4 + ((x / 3 + y / 5) & 1)];
+         else
+            c = palette[tile * 3 + (x * 7 + y * 3) / 11 % 2];
+
+         if (rand() % 50 == 0)
+            c = palette[rand() % 16];
+
+         bench_frame_set(frame, x, y, c);
+      }
+   }
+
+   return true;
+}
+
+// A screenshot taken in RetroArch, or any PNG, at its own size.
+static bool bench_frame_captured(struct bench_frame *frame, const char *path)
+{
+   char name[64];
+   uint32_t *data = NULL;
+   unsigned width, height, x, y;
+
+   if (!rpng_load_image_argb(path, &data, &width, &height))
+   {
+      fprintf(stderr, "Failed to load %s.\n", path);
+      return false;
+   }
+
+   snprintf(name, sizeof(name), "%s", path_basename(path));
+   path_remove_extension(name);
+
+   bool ret = bench_frame_alloc(frame, name, width, height);
+   if (ret)
+   {
+      for (y = 0; y < height; y++)
+         for (x = 0; x < width; x++)
+            bench_frame_set(frame, x, y, data[y * width + x]);
+   }
+
+   free(data);
+   return ret;
+}
+
+// FNV-1a of the visible output.
+static uint32_t bench_hash(const uint8_t *data, unsigned width_bytes,
+      unsigned height, size_t pitch)
+{
+   uint32_t hash = 2166136261u;
+   for (unsigned y = 0; y < height; y++, data += pitch)
+      for (unsigned x = 0; x < width_bytes; x++)
+         hash = (hash ^ data[x]) * 16777619u;
+   return hash;
+}
+
+// Runs one filter at one SIMD level and thread count.
+// The first frame of a fresh instance is the one hashed,
+// as some filters, like the NTSC ones, change from frame to frame.
+static bool bench_run(const char *path, const struct bench_frame *frame,
+      const struct bench_format *format, unsigned threads,
+      uint32_t *hash, double *us_per_frame)
+{
+   unsigned out_width, out_height, out_bpp, frames = 0;
+   rarch_softfilter_t *filt = rarch_softfilter_new(path, threads,
+         format->fmt, frame->width, frame->height);
+   if (!filt)
+      return false;
+
+   rarch_softfilter_get_output_size(filt, &out_width, &out_height,
+         frame->width, frame->height);
+   out_bpp = rarch_softfilter_get_output_format(filt) ==
+      RETRO_PIXEL_FORMAT_XRGB8888 ? sizeof(uint32_t) : sizeof(uint16_t);
+
+   size_t in_pitch = frame->width * format->bpp;
+   size_t out_pitch = out_width * out_bpp;
+   const uint8_t *in = format->bpp == sizeof(uint16_t) ?
+      (const uint8_t*)frame->rgb565 : (const uint8_t*)frame->xrgb8888;
+   uint8_t *out = (uint8_t*)calloc(out_height, out_pitch);
+   if (!out)
+   {
+      rarch_softfilter_free(filt);
+      return false;
+   }
+
+   in += BENCH_GUARD * in_pitch;
+   rarch_softfilter_process(filt, out, out_pitch,
+         in, frame->width, frame->height, in_pitch);
+   *hash = bench_hash(out, out_width * out_bpp, out_height, out_pitch);
+
+   double start = bench_time(), elapsed;
+   do
+   {
+      rarch_softfilter_process(filt, out, out_pitch,
+            in, frame->width, frame->height, in_pitch);
+      frames++;
+      elapsed = bench_time() - start;
+   } while (elapsed < bench_min_time);
+
+   *us_per_frame = 1e6 * elapsed / frames;
+
+   free(out);
+   rarch_softfilter_free(filt);
+   return true;
+}
+
+static void bench_filter_frame(config_file_t *golden, const char *path,
+      const char *name, const struct bench_frame *frame,
+      const struct bench_format *format)
+{
+   char key[256];
+   unsigned expected = 0;
+
+   snprintf(key, sizeof(key), "%s_%s_%s", name, frame->name, format->ident);
+   bool has_expected = !bench_update && config_get_hex(golden, key, &expected);
+
+   for (unsigned s = 0; s < bench_num_simd_levels; s++)
+   {
+      const struct bench_simd *simd = &bench_simd_levels[s];
+      bench_simd_mask = simd->mask;
+
+      for (unsigned threads = 1; threads <= bench_max_threads; threads++)
+      {
+         uint32_t hash;
+         double us_per_frame;
+         const char *check = "ok";
+
+         if (!bench_run(path, frame, format, threads, &hash, &us_per_frame))
+         {
+            fprintf(stderr, "Failed to run %s on %s.\n", name, frame->name);
+            bench_failures++;
+            return;
+         }
+
+         // Without a golden hash, every run has to match the plain one.
+         if (!has_expected)
+         {
+            expected = hash;
+            has_expected = true;
+            check = "new";
+            if (bench_update)
+               config_set_hex(golden, key, hash);
+         }
+         else if (hash != expected)
+         {
+            check = "FAIL";
+            bench_failures++;
+         }
+
+         printf("%s,%s,%s,%s,%u,%.1f,%08x,%s\n", name, frame->name,
+               format->ident, simd->ident, threads, us_per_frame, hash, check);
+         fflush(stdout);
+      }
+   }
+}
+
+// The NTSC filters and EPX only take RGB565, the frontend
+// does not run them on cores with other formats either.
+static bool bench_supports(const char *path, const struct bench_format *format)
+{
+   rarch_softfilter_t *filt = rarch_softfilter_new(path, 1, format->fmt,
+         bench_sizes[0].width, bench_sizes[0].height);
+   if (!filt)
+      return false;
+
+   rarch_softfilter_free(filt);
+   return true;
+}
+
+static void bench_filter_config(config_file_t *golden, const char *path)
+{
+   char name[64];
+   snprintf(name, sizeof(name), "%s", path_basename(path));
+   path_remove_extension(name);
+
+   if (!bench_selected(name))
+      return;
+
+   for (unsigned f = 0; f < sizeof(bench_formats) / sizeof(bench_formats[0]); f++)
+   {
+      if (!bench_supports(path, &bench_formats[f]))
+         continue;
+
+      for (unsigned i = 0; i < bench_num_frames; i++)
+         bench_filter_frame(golden, path, name, &bench_frames[i], &bench_formats[f]);
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   int opt;
+   while ((opt = getopt(argc, argv, "qut:g:d:c:")) != -1)
+   {
+      switch (opt)
+      {
+         case 'q':
+            bench_quick = true;
+            break;
+         case 'u':
+            bench_update = true;
+            break;
+         case 't':
+            bench_max_threads = strtoul(optarg, NULL, 0);
+            break;
+         case 'g':
+            bench_golden_path = optarg;
+            break;
+         case 'd':
+            bench_filters_dir = optarg;
+            break;
+         case 'c':
+            if (bench_num_frames >= sizeof(bench_frames) / sizeof(bench_frames[0]) ||
+                  !bench_frame_captured(&bench_frames[bench_num_frames++], optarg))
+               return 1;
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [-q] [-u] [-t threads] [-g golden] [-d dir] [-c png]... [name]\n", argv[0]);
+            fprintf(stderr, "   -q: Quick run, with only the smallest frame and shorter timings.\n");
+            fprintf(stderr, "   -u: Update the golden hashes with the plain single threaded output.\n");
+            fprintf(stderr, "   -t: Run 1 to this many threads, defaults to the number of cores.\n");
+            fprintf(stderr, "   -g: Golden hashes, defaults to golden.cfg.\n");
+            fprintf(stderr, "   -d: Directory of .filt files, defaults to ../filters.\n");
+            fprintf(stderr, "   -c: Captured frame to run as well, can be given more than once.\n");
+            fprintf(stderr, "   name: Only run filters with this in their name.\n");
+            return 1;
+      }
+   }
+   if (optind < argc)
+      bench_filter = argv[optind];
+
+   if (!bench_max_threads)
+   {
+      long cores = sysconf(_SC_NPROCESSORS_ONLN);
+      bench_max_threads = cores > 0 ? cores : 1;
+   }
+
+   bench_min_time = bench_quick ? 0.02 : 0.25;
+   bench_find_simd_levels();
+
+   unsigned num_sizes = bench_quick ? 1 : sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+   for (unsigned i = 0; i < num_sizes; i++)
+   {
+      if (!bench_frame_synthetic(&bench_frames[bench_num_frames++],
+               bench_sizes[i].width, bench_sizes[i].height))
+         return 1;
+   }
+
+   config_file_t *golden = config_file_new(bench_golden_path);
+   if (!golden)
+      golden = config_file_new(NULL);
+   struct string_list *filters = dir_list_new(bench_filters_dir, "filt", false);
+   if (!golden || !filters)
+      return 1;
+   dir_list_sort(filters, false);
+
+   puts("filter,frame,format,simd,threads,us_per_frame,hash,check");
+
+   for (unsigned i = 0; i < filters->size; i++)
+      bench_filter_config(golden, filters->elems[i].data);
+
+   if (bench_update && !config_file_write(golden, bench_golden_path))
+      bench_failures++;
+
+   if (bench_failures)
+      fprintf(stderr, "%u runs did not match.\n", bench_failures);
+
+   dir_list_free(filters);
+   config_file_free(golden);
+   for (unsigned i = 0; i < bench_num_frames; i++)
+   {
+      free(bench_frames[i].rgb565);
+      free(bench_frames[i].xrgb8888);
+   }
+   return bench_failures ? 1 : 0;
+}
@@ -0,0 +1,285 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Runs every pixel format conversion of the scaler's pixconv at every SIMD
+// level the CPU has, on frames of common core sizes and on an odd sized one.
+// Prints one CSV row per configuration to stdout, so runs can be compared across
+// devices and commits. The output of every level must match the plain C one
+// bit for bit, and nothing past the end of a line may be written.
+// Exits with 1 if any output does not.
+
+#include "../../libretro.h"
+#include <gfx/scaler/pixconv.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bytes after every line of output, which must be left alone.
+#define BENCH_GUARD 64
+#define BENCH_GUARD_BYTE 0xa5
+
+typedef void (*bench_conv_t)(void *output, const void *input,
+      int width, int height, int out_stride, int in_stride);
+
+struct bench_simd
+{
+   const char *ident;
+   uint64_t mask;
+};
+
+struct bench_size
+{
+   unsigned width;
+   unsigned height;
+};
+
+struct bench_conv
+{
+   const char *ident;
+   bench_conv_t conv;
+   unsigned in_bpp;
+   unsigned out_bpp;
+};
+
+static const struct bench_size bench_sizes[] = {
+   { 301, 7 },    // Odd, so that every converter finishes lines in C
+   { 256, 224 },  // SNES, Genesis in H32
+   { 320, 240 },  // PlayStation, Genesis in H40
+   { 640, 480 },  // Recording and screenshots of the above at 2x
+   { 1920, 1080 }, // Recording at 1080p
+};
+
+static const struct bench_conv bench_convs[] = {
+   { "0rgb1555_rgb565",   conv_0rgb1555_rgb565,   2, 2 }, // video_frame() of older cores
+   { "0rgb1555_argb8888", conv_0rgb1555_argb8888, 2, 4 },
+   { "rgb565_0rgb1555",   conv_rgb565_0rgb1555,   2, 2 },
+   { "rgb565_argb8888",   conv_rgb565_argb8888,   2, 4 },
+   { "rgba4444_argb8888", conv_rgba4444_argb8888, 2, 4 },
+   { "bgr24_argb8888",    conv_bgr24_argb8888,    3, 4 },
+   { "argb8888_0rgb1555", conv_argb8888_0rgb1555, 4, 2 },
+   { "argb8888_rgb565",   conv_argb8888_rgb565,   4, 2 },
+   { "argb8888_bgr24",    conv_argb8888_bgr24,    4, 3 }, // Screenshots, recording
+   { "argb8888_abgr8888", conv_argb8888_abgr8888, 4, 4 },
+   { "0rgb1555_bgr24",    conv_0rgb1555_bgr24,    2, 3 },
+   { "rgb565_bgr24",      conv_rgb565_bgr24,      2, 3 },
+   { "yuyv_argb8888",     conv_yuyv_argb8888,     2, 4 }, // Camera
+};
+
+static bool bench_quick;
+static double bench_min_time;
+static const char *bench_filter;
+static unsigned bench_failures;
+
+static struct bench_simd bench_simd_levels[8];
+static unsigned bench_num_simd_levels;
+
+static double bench_time(void)
+{
+   struct timespec tv;
+   clock_gettime(CLOCK_MONOTONIC, &tv);
+   return tv.tv_sec + tv.tv_nsec / 1e9;
+}
+
+// SIMD levels are cumulative, the first one is plain code.
+static void bench_find_simd_levels(void)
+{
+   uint64_t mask = 0;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "none", 0 };
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+   __builtin_cpu_init();
+   if (!__builtin_cpu_supports("sse2"))
+      return;
+   mask |= RETRO_SIMD_SSE | RETRO_SIMD_SSE2;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "sse2", mask };
+
+   if (!__builtin_cpu_supports("ssse3"))
+      return;
+   mask |= RETRO_SIMD_SSE3 | RETRO_SIMD_SSSE3;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "ssse3", mask };
+
+   if (!__builtin_cpu_supports("avx2"))
+      return;
+   mask |= RETRO_SIMD_SSE4 | RETRO_SIMD_SSE42 | RETRO_SIMD_AVX | RETRO_SIMD_AVX2;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "avx2", mask };
+#elif defined(__ARM_NEON__)
+   mask |= RETRO_SIMD_NEON;
+   bench_simd_levels[bench_num_simd_levels++] = (struct bench_simd){ "neon", mask };
+#endif
+   (void)mask;
+}
+
+static bool bench_selected(const char *ident)
+{
+   return !bench_filter || strstr(ident, bench_filter);
+}
+
+// Converts the whole frame once, then again until enough time has passed.
+static double bench_run(const struct bench_conv *conv,
+      uint8_t *out, const uint8_t *in,
+      unsigned width, unsigned height, int out_stride, int in_stride)
+{
+   unsigned frames = 0;
+   double start, elapsed;
+
+   conv->conv(out, in, width, height, out_stride, in_stride);
+
+   start = bench_time();
+   do
+   {
+      conv->conv(out, in, width, height, out_stride, in_stride);
+      frames++;
+      elapsed = bench_time() - start;
+   } while (elapsed < bench_min_time);
+
+   return 1e9 * elapsed / (frames * (double)width * height);
+}
+
+static bool bench_check(const uint8_t *out, const uint8_t *expected,
+      unsigned height, size_t line_size, int out_stride)
+{
+   unsigned y, i;
+
+   for (y = 0; y < height; y++)
+   {
+      const uint8_t *line = out + y * out_stride;
+
+      if (memcmp(line, expected + y * out_stride, line_size))
+         return false;
+      for (i = 0; i < BENCH_GUARD; i++)
+         if (line[line_size + i] != BENCH_GUARD_BYTE)
+            return false;
+   }
+
+   return true;
+}
+
+static bool bench_conv_size(const struct bench_conv *conv,
+      const struct bench_size *size)
+{
+   unsigned s;
+   size_t i;
+   double plain_ns = 0.0;
+   unsigned width = size->width, height = size->height;
+
+   // YUYV comes in pairs of pixels.
+   if (conv->conv == conv_yuyv_argb8888)
+      width &= ~1;
+
+   // Strides are not a multiple of any vector size.
+   int in_stride = width * conv->in_bpp + 12;
+   int out_stride = width * conv->out_bpp + BENCH_GUARD;
+   size_t in_size = (size_t)in_stride * height;
+   size_t out_size = (size_t)out_stride * height;
+
+   uint8_t *in = (uint8_t*)malloc(in_size);
+   uint8_t *out = (uint8_t*)malloc(out_size);
+   uint8_t *expected = (uint8_t*)malloc(out_size);
+   if (!in || !out || !expected)
+   {
+      free(in);
+      free(out);
+      free(expected);
+      return false;
+   }
+
+   srand(width * height);
+   for (i = 0; i < in_size; i++)
+      in[i] = rand();
+
+   for (s = 0; s < bench_num_simd_levels; s++)
+   {
+      const struct bench_simd *simd = &bench_simd_levels[s];
+      const char *ident = conv_init(simd->mask);
+      const char *check = "ok";
+      double ns;
+
+      memset(out, BENCH_GUARD_BYTE, out_size);
+      ns = bench_run(conv, out, in, width, height, out_stride, in_stride);
+
+      if (s == 0)
+      {
+         plain_ns = ns;
+         memcpy(expected, out, out_size);
+      }
+      else if (!bench_check(out, expected, height,
+               width * conv->out_bpp, out_stride))
+      {
+         check = "FAIL";
+         bench_failures++;
+      }
+
+      printf("%s,%ux%u,%s,%s,%.3f,%.1f,%.2f,%s\n", conv->ident,
+            width, height, simd->ident, ident, ns, 1e3 / ns,
+            plain_ns / ns, check);
+      fflush(stdout);
+   }
+
+   free(in);
+   free(out);
+   free(expected);
+   return true;
+}
+
+int main(int argc, char *argv[])
+{
+   int opt;
+   while ((opt = getopt(argc, argv, "q")) != -1)
+   {
+      switch (opt)
+      {
+         case 'q':
+            bench_quick = true;
+            break;
+         default:
+            fprintf(stderr, "Usage: %s [-q] [name]\n", argv[0]);
+            fprintf(stderr, "   -q: Quick run, with only the two smallest frames and shorter timings.\n");
+            fprintf(stderr, "   name: Only run conversions with this in their name.\n");
+            return 1;
+      }
+   }
+   if (optind < argc)
+      bench_filter = argv[optind];
+
+   bench_min_time = bench_quick ? 0.01 : 0.1;
+   bench_find_simd_levels();
+
+   unsigned num_sizes = bench_quick ? 2 : sizeof(bench_sizes) / sizeof(bench_sizes[0]);
+
+   puts("conversion,frame,simd,kernels,ns_per_pixel,mpixels_per_s,speedup,check");
+
+   for (unsigned c = 0; c < sizeof(bench_convs) / sizeof(bench_convs[0]); c++)
+   {
+      if (!bench_selected(bench_convs[c].ident))
+         continue;
+
+      for (unsigned i = 0; i < num_sizes; i++)
+      {
+         if (!bench_conv_size(&bench_convs[c], &bench_sizes[i]))
+         {
+            fprintf(stderr, "Out of memory.\n");
+            return 1;
+         }
+      }
+   }
+
+   if (bench_failures)
+      fprintf(stderr, "%u runs did not match.\n", bench_failures);
+
+   return bench_failures ? 1 : 0;
+}
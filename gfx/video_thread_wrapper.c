@@ -96,7 +96,17 @@ static void thread_loop(void *data)
       while (thr->send_cmd == CMD_NONE && !thr->frame.updated)
          scond_wait(thr->cond_thread, thr->lock);
       if (thr->frame.updated)
+      {
+         /* Take the latest frame, leaving our old buffer 
+          * for the frontend to fill. */
+         unsigned swap = thr->frame.read;
+         thr->frame.read = thr->frame.ready;
+         thr->frame.ready = swap;
+         thr->frame.updated = false;
+         thr->frame.drawing = true;
+         scond_signal(thr->cond_cmd);
          updated = true;
+      }
 
       /* To avoid race condition where send_cmd is updated 
        * right after the switch is checked. */
@@ -296,9 +306,16 @@ static void thread_loop(void *data)
          struct rarch_viewport vp = {0};
 
          if (thr->driver && thr->driver->frame)
+         {
+            const char *msg = thr->frame.buffers[thr->frame.read].msg;
             ret = thr->driver->frame(thr->driver_data,
-               thr->frame.buffer, thr->frame.width, thr->frame.height,
-               thr->frame.pitch, *thr->frame.msg ? thr->frame.msg : NULL);
+               thr->frame.buffers[thr->frame.read].dupe ?
+               NULL : thr->frame.buffers[thr->frame.read].buffer,
+               thr->frame.buffers[thr->frame.read].width,
+               thr->frame.buffers[thr->frame.read].height,
+               thr->frame.buffers[thr->frame.read].pitch,
+               *msg ? msg : NULL);
+         }
 
          slock_unlock(thr->frame.lock);
 
@@ -318,8 +335,8 @@ static void thread_loop(void *data)
          thr->alive = alive;
          thr->focus = focus;
          thr->has_windowed = has_windowed;
-         thr->frame.updated = false;
          thr->vp = vp;
+         thr->frame.drawing = false;
          scond_signal(thr->cond_cmd);
          slock_unlock(thr->lock);
       }
@@ -397,13 +414,34 @@ static bool thread_frame(void *data, const void *frame_,
    }
 
    RARCH_PERFORMANCE_INIT(thr_frame);
+   RARCH_PERFORMANCE_INIT(thr_frame_hit);
+   RARCH_PERFORMANCE_INIT(thr_frame_miss);
    RARCH_PERFORMANCE_START(thr_frame);
 
    unsigned copy_stride = width * (thr->info.rgb32 ?
          sizeof(uint32_t) : sizeof(uint16_t));
 
+   /* buffers[write] is ours alone, so copy without holding the lock. */
    const uint8_t *src = (const uint8_t*)frame_;
-   uint8_t *dst = thr->frame.buffer;
+   uint8_t *dst = thr->frame.buffers[thr->frame.write].buffer;
+
+   if (src)
+   {
+      unsigned h;
+      for (h = 0; h < height; h++, src += pitch, dst += copy_stride)
+         memcpy(dst, src, copy_stride);
+   }
+
+   thr->frame.buffers[thr->frame.write].dupe   = !frame_;
+   thr->frame.buffers[thr->frame.write].width  = width;
+   thr->frame.buffers[thr->frame.write].height = height;
+   thr->frame.buffers[thr->frame.write].pitch  = copy_stride;
+
+   if (msg)
+      strlcpy(thr->frame.buffers[thr->frame.write].msg, msg,
+            sizeof(thr->frame.buffers[thr->frame.write].msg));
+   else
+      *thr->frame.buffers[thr->frame.write].msg = '\0';
 
    slock_lock(thr->lock);
 
@@ -427,43 +465,42 @@ static bool thread_frame(void *data, const void *frame_,
       }
    }
 
-   /* Drop frame if updated flag is still set, as thread is 
-    * still working on last frame. */
-   if (!thr->frame.updated)
-   {
-      if (src)
-      {
-         unsigned h;
-         for (h = 0; h < height; h++, src += pitch, dst += copy_stride)
-            memcpy(dst, src, copy_stride);
-      }
+   /* If the thread is still working on the last frame, 
+    * the frame waiting in the mailbox is dropped for this one. */
+   struct retro_perf_counter *handoff = thr->frame.updated ?
+      &thr_frame_miss : &thr_frame_hit;
+   rarch_perf_start(handoff);
 
-      thr->frame.updated = true;
-      thr->frame.width  = width;
-      thr->frame.height = height;
-      thr->frame.pitch  = copy_stride;
+   if (thr->frame.updated)
+      thr->miss_count++;
+   else
+      thr->hit_count++;
 
-      if (msg)
-         strlcpy(thr->frame.msg, msg, sizeof(thr->frame.msg));
-      else
-         *thr->frame.msg = '\0';
+   /* A dupe must not replace a frame still waiting in the mailbox, 
+    * or that frame would never be shown. */
+   if (frame_ || !thr->frame.updated)
+   {
+      unsigned swap = thr->frame.write;
+      thr->frame.write = thr->frame.ready;
+      thr->frame.ready = swap;
+      thr->frame.updated = true;
+   }
 
-      scond_signal(thr->cond_thread);
+   scond_signal(thr->cond_thread);
 
 #if defined(HAVE_MENU)
-      if (thr->texture.enable)
-      {
-         while (thr->frame.updated)
-            scond_wait(thr->cond_cmd, thr->lock);
-      }
-#endif
-      thr->hit_count++;
+   /* Waits until the frame is on screen, not just taken. */
+   if (thr->texture.enable)
+   {
+      while (thr->frame.updated || thr->frame.drawing)
+         scond_wait(thr->cond_cmd, thr->lock);
    }
-   else
-      thr->miss_count++;
+#endif
 
    slock_unlock(thr->lock);
 
+   rarch_perf_stop(handoff);
+
    RARCH_PERFORMANCE_STOP(thr_frame);
 
    thr->last_time = rarch_get_time_usec();
@@ -494,11 +531,20 @@ static bool thread_init(thread_video_t *thr, const video_info_t *info,
    size_t max_size = info->input_scale * RARCH_SCALE_BASE;
    max_size *= max_size;
    max_size *= info->rgb32 ? sizeof(uint32_t) : sizeof(uint16_t);
-   thr->frame.buffer = (uint8_t*)malloc(max_size);
-   if (!thr->frame.buffer)
-      return false;
 
-   memset(thr->frame.buffer, 0x80, max_size);
+   unsigned i;
+   for (i = 0; i < ARRAY_SIZE(thr->frame.buffers); i++)
+   {
+      thr->frame.buffers[i].buffer = (uint8_t*)malloc(max_size);
+      if (!thr->frame.buffers[i].buffer)
+         return false;
+
+      memset(thr->frame.buffers[i].buffer, 0x80, max_size);
+   }
+
+   thr->frame.write = 0;
+   thr->frame.ready = 1;
+   thr->frame.read  = 2;
 
    thr->last_time = rarch_get_time_usec();
 
@@ -571,7 +617,9 @@ static void thread_free(void *data)
 #if defined(HAVE_MENU)
    free(thr->texture.frame);
 #endif
-   free(thr->frame.buffer);
+   unsigned i;
+   for (i = 0; i < ARRAY_SIZE(thr->frame.buffers); i++)
+      free(thr->frame.buffers[i].buffer);
    slock_free(thr->frame.lock);
    slock_free(thr->lock);
    scond_free(thr->cond_cmd);
@@ -164,16 +164,31 @@ typedef struct thread_video
    struct rarch_viewport vp;
    struct rarch_viewport read_vp; /* Last viewport reported to caller. */
 
+   /* Triple-buffered mailbox. The frontend fills buffers[write], 
+    * the driver thread renders buffers[read], and the two are 
+    * handed over by swapping indices with buffers[ready] under lock. 
+    * updated is set while buffers[ready] holds a frame not yet 
+    * taken by the driver thread, drawing while the driver thread 
+    * renders the one it took. A dupe buffer holds no pixels, 
+    * the driver is handed NULL to show its last frame again. */
    struct
    {
       slock_t *lock;
-      uint8_t *buffer;
-      unsigned width;
-      unsigned height;
-      unsigned pitch;
+      struct
+      {
+         uint8_t *buffer;
+         unsigned width;
+         unsigned height;
+         unsigned pitch;
+         bool dupe;
+         char msg[PATH_MAX];
+      } buffers[3];
+      unsigned write;
+      unsigned ready;
+      unsigned read;
       bool updated;
+      bool drawing;
       bool within_thread;
-      char msg[PATH_MAX];
    } frame;
 
    video_driver_t video_thread;
@@ -381,6 +381,7 @@ STATE TRACKER
 FIFO BUFFER
 ============================================================ */
 #include "../fifo_buffer.c"
+#include "../spsc_buffer.c"
 
 /*============================================================
 AUDIO RESAMPLER
@@ -507,6 +508,7 @@ FILTERS
 #include "../audio/filters/phaser.c"
 #include "../audio/filters/reverb.c"
 #include "../audio/filters/wahwah.c"
+#include "../audio/filters/convolution.c"
 #endif
 /*============================================================
 DYNAMIC
@@ -606,6 +608,7 @@ THREAD
 #include "../thread/xenon_sdl_threads.c"
 #elif defined(HAVE_THREADS)
 #include "../libretro-sdk/rthreads/rthreads.c"
+#include "../libretro-sdk/rthreads/rpool.c"
 #include "../gfx/video_thread_wrapper.c"
 #include "../audio/audio_thread_wrapper.c"
 #include "../autosave.c"
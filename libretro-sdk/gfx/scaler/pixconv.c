@@ -21,6 +21,7 @@
  */
 
 #include <gfx/scaler/pixconv.h>
+#include <retro_simd.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,14 +29,53 @@
 
 #ifdef SCALER_NO_SIMD
 #undef __SSE2__
+#undef __ARM_NEON__
+#undef HAVE_RETRO_TARGET_X86
 #endif
 
 #if defined(__SSE2__)
 #include <emmintrin.h>
 #endif
 
-#if defined(__SSE2_)
-void conv_rgb565_0rgb1555(void *output_, const void *input_,
+/* Bits of the RETRO_SIMD_* mask from libretro.h. */
+#define PIXCONV_SIMD_SSE2  (1 << 1)
+#define PIXCONV_SIMD_NEON  (1 << 5)
+#define PIXCONV_SIMD_AVX   (1 << 4)
+#define PIXCONV_SIMD_SSSE3 (1 << 7)
+#define PIXCONV_SIMD_AVX2  (1 << 12)
+
+typedef void (*pixconv_func_t)(void *output, const void *input,
+      int width, int height,
+      int out_stride, int in_stride);
+
+/* One converter per conversion, for one instruction set. */
+struct pixconv_funcs
+{
+   pixconv_func_t conv_0rgb1555_argb8888;
+   pixconv_func_t conv_0rgb1555_rgb565;
+   pixconv_func_t conv_rgb565_0rgb1555;
+   pixconv_func_t conv_rgb565_argb8888;
+   pixconv_func_t conv_rgba4444_argb8888;
+   pixconv_func_t conv_bgr24_argb8888;
+   pixconv_func_t conv_argb8888_0rgb1555;
+   pixconv_func_t conv_argb8888_rgb565;
+   pixconv_func_t conv_argb8888_bgr24;
+   pixconv_func_t conv_argb8888_abgr8888;
+   pixconv_func_t conv_0rgb1555_bgr24;
+   pixconv_func_t conv_rgb565_bgr24;
+   pixconv_func_t conv_yuyv_argb8888;
+   const char *ident;
+};
+
+#define YUV_SHIFT 6
+#define YUV_OFFSET (1 << (YUV_SHIFT - 1))
+#define YUV_MAT_Y (1 << 6)
+#define YUV_MAT_U_G (-22)
+#define YUV_MAT_U_B (113)
+#define YUV_MAT_V_R (90)
+#define YUV_MAT_V_G (-46)
+
+static void conv_rgb565_0rgb1555_C(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -43,23 +83,10 @@ void conv_rgb565_0rgb1555(void *output_, const void *input_,
    const uint16_t *input = (const uint16_t*)input_;
    uint16_t *output = (uint16_t*)output_;
 
-   int max_width = width - 7;
-
-   const __m128i hi_mask   = _mm_set1_epi16(0x7fe0);
-   const __m128i lo_mask   = _mm_set1_epi16(0x1f);
-
    for (h = 0; h < height;
          h++, output += out_stride >> 1, input += in_stride >> 1)
    {
-      for (w = 0; w < max_width; w += 8)
-      {
-         const __m128i in = _mm_loadu_si128((const __m128i*)(input + w));
-         __m128i hi = _mm_and_si128(_mm_slli_epi16(in, 1), hi_mask);
-         __m128i lo = _mm_and_si128(in, lo_mask);
-         _mm_storeu_si128((__m128i*)(output + w), _mm_or_si128(hi, lo));
-      }
-
-      for (; w < width; w++)
+      for (w = 0; w < width; w++)
       {
          uint16_t col = input[w];
          uint16_t hi = (col >> 1) & 0x7fe0;
@@ -68,8 +95,9 @@ void conv_rgb565_0rgb1555(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_rgb565_0rgb1555(void *output_, const void *input_,
+
+
+static void conv_0rgb1555_rgb565_C(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -83,17 +111,297 @@ void conv_rgb565_0rgb1555(void *output_, const void *input_,
       for (w = 0; w < width; w++)
       {
          uint16_t col = input[w];
-         uint16_t hi = (col >> 1) & 0x7fe0;
-         uint16_t lo = col & 0x1f;
-         output[w] = hi | lo;
+         uint16_t rg = (col << 1) & ((0x1f << 11) | (0x1f << 6));
+         uint16_t b = col & 0x1f;
+         uint16_t glow = (col >> 4) & (1 << 5);
+         output[w] = rg | b | glow;
       }
    }
 }
 
-#endif
+static void conv_0rgb1555_argb8888_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t r = (col >> 10) & 0x1f;
+         uint32_t g = (col >>  5) & 0x1f;
+         uint32_t b = (col >>  0) & 0x1f;
+         r = (r << 3) | (r >> 2);
+         g = (g << 3) | (g >> 2);
+         b = (b << 3) | (b >> 2);
+
+         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
+      }
+   }
+}
+
+static void conv_rgb565_argb8888_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t r = (col >> 11) & 0x1f;
+         uint32_t g = (col >>  5) & 0x3f;
+         uint32_t b = (col >>  0) & 0x1f;
+         r = (r << 3) | (r >> 2);
+         g = (g << 2) | (g >> 4);
+         b = (b << 3) | (b >> 2);
+
+         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
+      }
+   }
+}
+
+static void conv_rgba4444_argb8888_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint16_t *input = (const uint16_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 2, input += in_stride >> 1)
+   {
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t r = (col >> 12) & 0xf;
+         uint32_t g = (col >>  8) & 0xf;
+         uint32_t b = (col >>  4) & 0xf;
+         uint32_t a = (col >>  0) & 0xf;
+         r = (r << 4) | r;
+         g = (g << 4) | g;
+         b = (b << 4) | b;
+         a = (a << 4) | a;
+
+         output[w] = (a << 24) | (r << 16) | (g << 8) | (b << 0);
+      }
+   }
+}
+
+static void conv_0rgb1555_bgr24_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint16_t *input = (const uint16_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride, input += in_stride >> 1)
+   {
+      uint8_t *out = output;
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t b = (col >>  0) & 0x1f;
+         uint32_t g = (col >>  5) & 0x1f;
+         uint32_t r = (col >> 10) & 0x1f;
+         b = (b << 3) | (b >> 2);
+         g = (g << 3) | (g >> 2);
+         r = (r << 3) | (r >> 2);
+
+         *out++ = b;
+         *out++ = g;
+         *out++ = r;
+      }
+   }
+}
+
+static void conv_rgb565_bgr24_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint16_t *input = (const uint16_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride, input += in_stride >> 1)
+   {
+      uint8_t *out = output;
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint32_t b = (col >>  0) & 0x1f;
+         uint32_t g = (col >>  5) & 0x3f;
+         uint32_t r = (col >> 11) & 0x1f;
+         b = (b << 3) | (b >> 2);
+         g = (g << 2) | (g >> 4);
+         r = (r << 3) | (r >> 2);
+
+         *out++ = b;
+         *out++ = g;
+         *out++ = r;
+      }
+   }
+}
+
+static void conv_bgr24_argb8888_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint8_t *input = (const uint8_t*)input_;
+   uint32_t *output     = (uint32_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 2, input += in_stride)
+   {
+      const uint8_t *inp = input;
+      for (w = 0; w < width; w++)
+      {
+         uint32_t b = *inp++;
+         uint32_t g = *inp++;
+         uint32_t r = *inp++;
+         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
+      }
+   }
+}
+
+static void conv_argb8888_0rgb1555_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint32_t *input = (const uint32_t*)input_;
+   uint16_t *output      = (uint16_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 1, input += in_stride >> 2)
+   {
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint16_t r = (col >> 19) & 0x1f;
+         uint16_t g = (col >> 11) & 0x1f;
+         uint16_t b = (col >>  3) & 0x1f;
+         output[w] = (r << 10) | (g << 5) | (b << 0);
+      }
+   }
+}
+
+static void conv_argb8888_rgb565_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint32_t *input = (const uint32_t*)input_;
+   uint16_t *output      = (uint16_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 1, input += in_stride >> 2)
+   {
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         uint16_t r = (col >> 19) & 0x1f;
+         uint16_t g = (col >> 10) & 0x3f;
+         uint16_t b = (col >>  3) & 0x1f;
+         output[w] = (r << 11) | (g << 5) | (b << 0);
+      }
+   }
+}
+
+static void conv_argb8888_bgr24_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint32_t *input = (const uint32_t*)input_;
+   uint8_t *output       = (uint8_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride, input += in_stride >> 2)
+   {
+      uint8_t *out = output;
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         *out++ = (uint8_t)(col >>  0);
+         *out++ = (uint8_t)(col >>  8);
+         *out++ = (uint8_t)(col >> 16);
+      }
+   }
+}
+
+static void conv_argb8888_abgr8888_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint32_t *input = (const uint32_t*)input_;
+   uint32_t *output      = (uint32_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 2, input += in_stride >> 2)
+   {
+      for (w = 0; w < width; w++)
+      {
+         uint32_t col = input[w];
+         output[w] = ((col << 16) & 0xff0000) | 
+            ((col >> 16) & 0xff) | (col & 0xff00ff00);
+      }
+   }
+}
+
+static void conv_yuyv_argb8888_C(void *output_, const void *input_,
+      int width, int height,
+      int out_stride, int in_stride)
+{
+   int h, w;
+   const uint8_t *input = (const uint8_t*)input_;
+   uint32_t *output     = (uint32_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride >> 2, input += in_stride)
+   {
+      const uint8_t *src = input;
+      uint32_t *dst = output;
+
+      for (w = 0; w < width; w += 2, src += 4, dst += 2)
+      {
+         int _y0 = src[0];
+         int  u = src[1] - 128;
+         int _y1 = src[2];
+         int  v = src[3] - 128;
+
+         uint8_t r0 = clamp_8bit((YUV_MAT_Y * _y0 +                   YUV_MAT_V_R * v + YUV_OFFSET) >> YUV_SHIFT);
+         uint8_t g0 = clamp_8bit((YUV_MAT_Y * _y0 + YUV_MAT_U_G * u + YUV_MAT_V_G * v + YUV_OFFSET) >> YUV_SHIFT);
+         uint8_t b0 = clamp_8bit((YUV_MAT_Y * _y0 + YUV_MAT_U_B * u                   + YUV_OFFSET) >> YUV_SHIFT);
+
+         uint8_t r1 = clamp_8bit((YUV_MAT_Y * _y1 +                   YUV_MAT_V_R * v + YUV_OFFSET) >> YUV_SHIFT);
+         uint8_t g1 = clamp_8bit((YUV_MAT_Y * _y1 + YUV_MAT_U_G * u + YUV_MAT_V_G * v + YUV_OFFSET) >> YUV_SHIFT);
+         uint8_t b1 = clamp_8bit((YUV_MAT_Y * _y1 + YUV_MAT_U_B * u                   + YUV_OFFSET) >> YUV_SHIFT);
+
+         dst[0] = 0xff000000u | (r0 << 16) | (g0 << 8) | (b0 << 0);
+         dst[1] = 0xff000000u | (r1 << 16) | (g1 << 8) | (b1 << 0);
+      }
+   }
+}
 
 #if defined(__SSE2__)
-void conv_0rgb1555_rgb565(void *output_, const void *input_,
+static void conv_rgb565_0rgb1555_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -103,10 +411,8 @@ void conv_0rgb1555_rgb565(void *output_, const void *input_,
 
    int max_width = width - 7;
 
-   const __m128i hi_mask   = _mm_set1_epi16(
-         (int16_t)((0x1f << 11) | (0x1f << 6)));
+   const __m128i hi_mask   = _mm_set1_epi16(0x7fe0);
    const __m128i lo_mask   = _mm_set1_epi16(0x1f);
-   const __m128i glow_mask = _mm_set1_epi16(1 << 5);
 
    for (h = 0; h < height;
          h++, output += out_stride >> 1, input += in_stride >> 1)
@@ -114,25 +420,21 @@ void conv_0rgb1555_rgb565(void *output_, const void *input_,
       for (w = 0; w < max_width; w += 8)
       {
          const __m128i in = _mm_loadu_si128((const __m128i*)(input + w));
-         __m128i rg   = _mm_and_si128(_mm_slli_epi16(in, 1), hi_mask);
-         __m128i b    = _mm_and_si128(in, lo_mask);
-         __m128i glow = _mm_and_si128(_mm_srli_epi16(in, 4), glow_mask);
-         _mm_storeu_si128((__m128i*)(output + w),
-               _mm_or_si128(rg, _mm_or_si128(b, glow)));
+         __m128i hi = _mm_and_si128(_mm_srli_epi16(in, 1), hi_mask);
+         __m128i lo = _mm_and_si128(in, lo_mask);
+         _mm_storeu_si128((__m128i*)(output + w), _mm_or_si128(hi, lo));
       }
 
       for (; w < width; w++)
       {
          uint16_t col = input[w];
-         uint16_t rg = (col << 1) & ((0x1f << 11) | (0x1f << 6));
-         uint16_t b = col & 0x1f;
-         uint16_t glow = (col >> 4) & (1 << 5);
-         output[w] = rg | b | glow;
+         uint16_t hi = (col >> 1) & 0x7fe0;
+         uint16_t lo = col & 0x1f;
+         output[w] = hi | lo;
       }
    }
 }
-#else
-void conv_0rgb1555_rgb565(void *output_, const void *input_,
+static void conv_0rgb1555_rgb565_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -140,10 +442,27 @@ void conv_0rgb1555_rgb565(void *output_, const void *input_,
    const uint16_t *input = (const uint16_t*)input_;
    uint16_t *output = (uint16_t*)output_;
 
+   int max_width = width - 7;
+
+   const __m128i hi_mask   = _mm_set1_epi16(
+         (int16_t)((0x1f << 11) | (0x1f << 6)));
+   const __m128i lo_mask   = _mm_set1_epi16(0x1f);
+   const __m128i glow_mask = _mm_set1_epi16(1 << 5);
+
    for (h = 0; h < height;
          h++, output += out_stride >> 1, input += in_stride >> 1)
    {
-      for (w = 0; w < width; w++)
+      for (w = 0; w < max_width; w += 8)
+      {
+         const __m128i in = _mm_loadu_si128((const __m128i*)(input + w));
+         __m128i rg   = _mm_and_si128(_mm_slli_epi16(in, 1), hi_mask);
+         __m128i b    = _mm_and_si128(in, lo_mask);
+         __m128i glow = _mm_and_si128(_mm_srli_epi16(in, 4), glow_mask);
+         _mm_storeu_si128((__m128i*)(output + w),
+               _mm_or_si128(rg, _mm_or_si128(b, glow)));
+      }
+
+      for (; w < width; w++)
       {
          uint16_t col = input[w];
          uint16_t rg = (col << 1) & ((0x1f << 11) | (0x1f << 6));
@@ -153,10 +472,7 @@ void conv_0rgb1555_rgb565(void *output_, const void *input_,
       }
    }
 }
-#endif
-
-#if defined(__SSE2__)
-void conv_0rgb1555_argb8888(void *output_, const void *input_,
+static void conv_0rgb1555_argb8888_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -214,36 +530,7 @@ void conv_0rgb1555_argb8888(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_0rgb1555_argb8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint16_t *input = (const uint16_t*)input_;
-   uint32_t *output      = (uint32_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride >> 2, input += in_stride >> 1)
-   {
-      for (w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint32_t r = (col >> 10) & 0x1f;
-         uint32_t g = (col >>  5) & 0x1f;
-         uint32_t b = (col >>  0) & 0x1f;
-         r = (r << 3) | (r >> 2);
-         g = (g << 3) | (g >> 2);
-         b = (b << 3) | (b >> 2);
-
-         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
-      }
-   }
-}
-#endif
-
-#if defined(__SSE2__)
-void conv_rgb565_argb8888(void *output_, const void *input_,
+static void conv_rgb565_argb8888_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -283,39 +570,13 @@ void conv_rgb565_argb8888(void *output_, const void *input_,
          __m128i res_lo = _mm_or_si128(res_lo_bg,
                _mm_slli_si128(res_lo_ra, 2));
          __m128i res_hi = _mm_or_si128(res_hi_bg,
-               _mm_slli_si128(res_hi_ra, 2));
-
-         _mm_storeu_si128((__m128i*)(output + w + 0), res_lo);
-         _mm_storeu_si128((__m128i*)(output + w + 4), res_hi);
-      }
-
-      for (; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint32_t r = (col >> 11) & 0x1f;
-         uint32_t g = (col >>  5) & 0x3f;
-         uint32_t b = (col >>  0) & 0x1f;
-         r = (r << 3) | (r >> 2);
-         g = (g << 2) | (g >> 4);
-         b = (b << 3) | (b >> 2);
+               _mm_slli_si128(res_hi_ra, 2));
 
-         output[w] = (0xff << 24) | (r << 16) | (g << 8) | (b << 0);
+         _mm_storeu_si128((__m128i*)(output + w + 0), res_lo);
+         _mm_storeu_si128((__m128i*)(output + w + 4), res_hi);
       }
-   }
-}
-#else
-void conv_rgb565_argb8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint16_t *input = (const uint16_t*)input_;
-   uint32_t *output      = (uint32_t*)output_;
 
-   for (h = 0; h < height;
-         h++, output += out_stride >> 2, input += in_stride >> 1)
-   {
-      for (w = 0; w < width; w++)
+      for (; w < width; w++)
       {
          uint32_t col = input[w];
          uint32_t r = (col >> 11) & 0x1f;
@@ -325,41 +586,10 @@ void conv_rgb565_argb8888(void *output_, const void *input_,
          g = (g << 2) | (g >> 4);
          b = (b << 3) | (b >> 2);
 
-         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
-      }
-   }
-}
-#endif
-
-void conv_rgba4444_argb8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint16_t *input = (const uint16_t*)input_;
-   uint32_t *output      = (uint32_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride >> 2, input += in_stride >> 1)
-   {
-      for (w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint32_t r = (col >> 12) & 0xf;
-         uint32_t g = (col >>  8) & 0xf;
-         uint32_t b = (col >>  4) & 0xf;
-         uint32_t a = (col >>  0) & 0xf;
-         r = (r << 4) | r;
-         g = (g << 4) | g;
-         b = (b << 4) | b;
-         a = (a << 4) | a;
-
-         output[w] = (a << 24) | (r << 16) | (g << 8) | (b << 0);
+         output[w] = (0xff << 24) | (r << 16) | (g << 8) | (b << 0);
       }
    }
 }
-
-#if defined(__SSE2__)
 /* :( TODO: Make this saner. */
 static inline void store_bgr24_sse2(void *output, __m128i a,
       __m128i b, __m128i c, __m128i d)
@@ -405,7 +635,7 @@ static inline void store_bgr24_sse2(void *output, __m128i a,
                   _mm_or_si128(c3, _mm_or_si128(c4, c5))))));
 }
 
-void conv_0rgb1555_bgr24(void *output_, const void *input_,
+static void conv_0rgb1555_bgr24_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -483,7 +713,7 @@ void conv_0rgb1555_bgr24(void *output_, const void *input_,
    }
 }
 
-void conv_rgb565_bgr24(void *output_, const void *input_,
+static void conv_rgb565_bgr24_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -560,112 +790,7 @@ void conv_rgb565_bgr24(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_0rgb1555_bgr24(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint16_t *input = (const uint16_t*)input_;
-   uint8_t *output       = (uint8_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride, input += in_stride >> 1)
-   {
-      uint8_t *out = output;
-      for (w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint32_t b = (col >>  0) & 0x1f;
-         uint32_t g = (col >>  5) & 0x1f;
-         uint32_t r = (col >> 10) & 0x1f;
-         b = (b << 3) | (b >> 2);
-         g = (g << 3) | (g >> 2);
-         r = (r << 3) | (r >> 2);
-
-         *out++ = b;
-         *out++ = g;
-         *out++ = r;
-      }
-   }
-}
-
-void conv_rgb565_bgr24(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint16_t *input = (const uint16_t*)input_;
-   uint8_t *output       = (uint8_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride, input += in_stride >> 1)
-   {
-      uint8_t *out = output;
-      for (w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint32_t b = (col >>  0) & 0x1f;
-         uint32_t g = (col >>  5) & 0x3f;
-         uint32_t r = (col >> 11) & 0x1f;
-         b = (b << 3) | (b >> 2);
-         g = (g << 2) | (g >> 4);
-         r = (r << 3) | (r >> 2);
-
-         *out++ = b;
-         *out++ = g;
-         *out++ = r;
-      }
-   }
-}
-#endif
-
-void conv_bgr24_argb8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint8_t *input = (const uint8_t*)input_;
-   uint32_t *output     = (uint32_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride >> 2, input += in_stride)
-   {
-      const uint8_t *inp = input;
-      for (w = 0; w < width; w++)
-      {
-         uint32_t b = *inp++;
-         uint32_t g = *inp++;
-         uint32_t r = *inp++;
-         output[w] = (0xffu << 24) | (r << 16) | (g << 8) | (b << 0);
-      }
-   }
-}
-
-void conv_argb8888_0rgb1555(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint32_t *input = (const uint32_t*)input_;
-   uint16_t *output      = (uint16_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride >> 1, input += in_stride >> 2)
-   {
-      for (w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         uint16_t r = (col >> 19) & 0x1f;
-         uint16_t g = (col >> 11) & 0x1f;
-         uint16_t b = (col >>  3) & 0x1f;
-         output[w] = (r << 10) | (g << 5) | (b << 0);
-      }
-   }
-}
-
-#if defined(__SSE2__)
-void conv_argb8888_bgr24(void *output_, const void *input_,
+static void conv_argb8888_bgr24_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -698,59 +823,7 @@ void conv_argb8888_bgr24(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_argb8888_bgr24(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint32_t *input = (const uint32_t*)input_;
-   uint8_t *output       = (uint8_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride, input += in_stride >> 2)
-   {
-      uint8_t *out = output;
-      for (w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         *out++ = (uint8_t)(col >>  0);
-         *out++ = (uint8_t)(col >>  8);
-         *out++ = (uint8_t)(col >> 16);
-      }
-   }
-}
-#endif
-
-void conv_argb8888_abgr8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint32_t *input = (const uint32_t*)input_;
-   uint32_t *output      = (uint32_t*)output_;
-
-   for (h = 0; h < height;
-         h++, output += out_stride >> 2, input += in_stride >> 2)
-   {
-      for (w = 0; w < width; w++)
-      {
-         uint32_t col = input[w];
-         output[w] = ((col << 16) & 0xff0000) | 
-            ((col >> 16) & 0xff) | (col & 0xff00ff00);
-      }
-   }
-}
-
-#define YUV_SHIFT 6
-#define YUV_OFFSET (1 << (YUV_SHIFT - 1))
-#define YUV_MAT_Y (1 << 6)
-#define YUV_MAT_U_G (-22)
-#define YUV_MAT_U_B (113)
-#define YUV_MAT_V_R (90)
-#define YUV_MAT_V_G (-46)
-#if defined(__SSE2__)
-void conv_yuyv_argb8888(void *output_, const void *input_,
+static void conv_yuyv_argb8888_SSE2(void *output_, const void *input_,
       int width, int height,
       int out_stride, int in_stride)
 {
@@ -877,42 +950,181 @@ void conv_yuyv_argb8888(void *output_, const void *input_,
       }
    }
 }
-#else
-void conv_yuyv_argb8888(void *output_, const void *input_,
-      int width, int height,
-      int out_stride, int in_stride)
-{
-   int h, w;
-   const uint8_t *input = (const uint8_t*)input_;
-   uint32_t *output     = (uint32_t*)output_;
+#endif
 
-   for (h = 0; h < height;
-         h++, output += out_stride >> 2, input += in_stride)
-   {
-      const uint8_t *src = input;
-      uint32_t *dst = output;
+#if defined(__GNUC__) && (__GNUC__ >= 9 || defined(__clang__))
+#if defined(HAVE_RETRO_TARGET_X86) && defined(__SSE2__)
+#define PIXCONV_HAVE_X86_VECTOR
 
-      for (w = 0; w < width; w += 2, src += 4, dst += 2)
-      {
-         int _y0 = src[0];
-         int  u = src[1] - 128;
-         int _y1 = src[2];
-         int  v = src[3] - 128;
+#define PIXCONV_ISA SSSE3
+#define PIXCONV_TARGET RETRO_TARGET("ssse3")
+#define PIXCONV_PIXELS 8
+#include "pixconv_vector.h"
 
-         uint8_t r0 = clamp_8bit((YUV_MAT_Y * _y0 +                   YUV_MAT_V_R * v + YUV_OFFSET) >> YUV_SHIFT);
-         uint8_t g0 = clamp_8bit((YUV_MAT_Y * _y0 + YUV_MAT_U_G * u + YUV_MAT_V_G * v + YUV_OFFSET) >> YUV_SHIFT);
-         uint8_t b0 = clamp_8bit((YUV_MAT_Y * _y0 + YUV_MAT_U_B * u                   + YUV_OFFSET) >> YUV_SHIFT);
+#define PIXCONV_ISA AVX2
+#define PIXCONV_TARGET RETRO_TARGET("avx2")
+#define PIXCONV_PIXELS 16
+#define PIXCONV_WIDEN
+#include "pixconv_vector.h"
+#endif
 
-         uint8_t r1 = clamp_8bit((YUV_MAT_Y * _y1 +                   YUV_MAT_V_R * v + YUV_OFFSET) >> YUV_SHIFT);
-         uint8_t g1 = clamp_8bit((YUV_MAT_Y * _y1 + YUV_MAT_U_G * u + YUV_MAT_V_G * v + YUV_OFFSET) >> YUV_SHIFT);
-         uint8_t b1 = clamp_8bit((YUV_MAT_Y * _y1 + YUV_MAT_U_B * u                   + YUV_OFFSET) >> YUV_SHIFT);
+#if defined(__ARM_NEON__)
+#define PIXCONV_HAVE_NEON_VECTOR
 
-         dst[0] = 0xff000000u | (r0 << 16) | (g0 << 8) | (b0 << 0);
-         dst[1] = 0xff000000u | (r1 << 16) | (g1 << 8) | (b1 << 0);
-      }
-   }
-}
+#define PIXCONV_ISA NEON
+#define PIXCONV_TARGET
+#define PIXCONV_PIXELS 8
+#define PIXCONV_WIDEN
+#include "pixconv_vector.h"
+#endif
+#endif
+
+static const struct pixconv_funcs pixconv_funcs_C = {
+   conv_0rgb1555_argb8888_C,
+   conv_0rgb1555_rgb565_C,
+   conv_rgb565_0rgb1555_C,
+   conv_rgb565_argb8888_C,
+   conv_rgba4444_argb8888_C,
+   conv_bgr24_argb8888_C,
+   conv_argb8888_0rgb1555_C,
+   conv_argb8888_rgb565_C,
+   conv_argb8888_bgr24_C,
+   conv_argb8888_abgr8888_C,
+   conv_0rgb1555_bgr24_C,
+   conv_rgb565_bgr24_C,
+   conv_yuyv_argb8888_C,
+   "C",
+};
+
+#if defined(__SSE2__)
+static const struct pixconv_funcs pixconv_funcs_SSE2 = {
+   conv_0rgb1555_argb8888_SSE2,
+   conv_0rgb1555_rgb565_SSE2,
+   conv_rgb565_0rgb1555_SSE2,
+   conv_rgb565_argb8888_SSE2,
+   conv_rgba4444_argb8888_C,
+   conv_bgr24_argb8888_C,
+   conv_argb8888_0rgb1555_C,
+   conv_argb8888_rgb565_C,
+   conv_argb8888_bgr24_SSE2,
+   conv_argb8888_abgr8888_C,
+   conv_0rgb1555_bgr24_SSE2,
+   conv_rgb565_bgr24_SSE2,
+   conv_yuyv_argb8888_SSE2,
+   "SSE2",
+};
+#endif
+
+#if defined(PIXCONV_HAVE_X86_VECTOR)
+static const struct pixconv_funcs pixconv_funcs_SSSE3 = {
+   conv_0rgb1555_argb8888_SSE2,
+   conv_0rgb1555_rgb565_SSSE3,
+   conv_rgb565_0rgb1555_SSSE3,
+   conv_rgb565_argb8888_SSE2,
+   conv_rgba4444_argb8888_SSSE3,
+   conv_bgr24_argb8888_SSSE3,
+   conv_argb8888_0rgb1555_SSSE3,
+   conv_argb8888_rgb565_SSSE3,
+   conv_argb8888_bgr24_SSSE3,
+   conv_argb8888_abgr8888_SSSE3,
+   conv_0rgb1555_bgr24_SSSE3,
+   conv_rgb565_bgr24_SSSE3,
+   conv_yuyv_argb8888_SSE2,
+   "SSSE3",
+};
+
+static const struct pixconv_funcs pixconv_funcs_AVX2 = {
+   conv_0rgb1555_argb8888_AVX2,
+   conv_0rgb1555_rgb565_AVX2,
+   conv_rgb565_0rgb1555_AVX2,
+   conv_rgb565_argb8888_AVX2,
+   conv_rgba4444_argb8888_AVX2,
+   conv_bgr24_argb8888_AVX2,
+   conv_argb8888_0rgb1555_AVX2,
+   conv_argb8888_rgb565_AVX2,
+   conv_argb8888_bgr24_AVX2,
+   conv_argb8888_abgr8888_AVX2,
+   conv_0rgb1555_bgr24_AVX2,
+   conv_rgb565_bgr24_AVX2,
+   conv_yuyv_argb8888_AVX2,
+   "AVX2",
+};
+#endif
+
+#if defined(PIXCONV_HAVE_NEON_VECTOR)
+static const struct pixconv_funcs pixconv_funcs_NEON = {
+   conv_0rgb1555_argb8888_NEON,
+   conv_0rgb1555_rgb565_NEON,
+   conv_rgb565_0rgb1555_NEON,
+   conv_rgb565_argb8888_NEON,
+   conv_rgba4444_argb8888_NEON,
+   conv_bgr24_argb8888_NEON,
+   conv_argb8888_0rgb1555_NEON,
+   conv_argb8888_rgb565_NEON,
+   conv_argb8888_bgr24_NEON,
+   conv_argb8888_abgr8888_NEON,
+   conv_0rgb1555_bgr24_NEON,
+   conv_rgb565_bgr24_NEON,
+   conv_yuyv_argb8888_NEON,
+   "NEON",
+};
+#endif
+
+/* Until conv_init() is called, whatever the build
+ * already assumes the CPU to have is used. */
+#if defined(PIXCONV_HAVE_NEON_VECTOR)
+static const struct pixconv_funcs *pixconv = &pixconv_funcs_NEON;
+#elif defined(__SSE2__)
+static const struct pixconv_funcs *pixconv = &pixconv_funcs_SSE2;
+#else
+static const struct pixconv_funcs *pixconv = &pixconv_funcs_C;
+#endif
+
+const char *conv_init(uint64_t simd_mask)
+{
+   pixconv = &pixconv_funcs_C;
+
+#if defined(__SSE2__)
+   if (simd_mask & PIXCONV_SIMD_SSE2)
+      pixconv = &pixconv_funcs_SSE2;
+#endif
+#if defined(PIXCONV_HAVE_X86_VECTOR)
+   if (simd_mask & PIXCONV_SIMD_SSSE3)
+      pixconv = &pixconv_funcs_SSSE3;
+   /* The AVX bit also says the OS saves the YMM registers. */
+   if ((simd_mask & (PIXCONV_SIMD_AVX | PIXCONV_SIMD_AVX2)) ==
+         (PIXCONV_SIMD_AVX | PIXCONV_SIMD_AVX2))
+      pixconv = &pixconv_funcs_AVX2;
 #endif
+#if defined(PIXCONV_HAVE_NEON_VECTOR)
+   if (simd_mask & PIXCONV_SIMD_NEON)
+      pixconv = &pixconv_funcs_NEON;
+#endif
+
+   return pixconv->ident;
+}
+
+#define PIXCONV_ENTRY(name) \
+void name(void *output, const void *input, \
+      int width, int height, \
+      int out_stride, int in_stride) \
+{ \
+   pixconv->name(output, input, width, height, out_stride, in_stride); \
+}
+
+PIXCONV_ENTRY(conv_0rgb1555_argb8888)
+PIXCONV_ENTRY(conv_0rgb1555_rgb565)
+PIXCONV_ENTRY(conv_rgb565_0rgb1555)
+PIXCONV_ENTRY(conv_rgb565_argb8888)
+PIXCONV_ENTRY(conv_rgba4444_argb8888)
+PIXCONV_ENTRY(conv_bgr24_argb8888)
+PIXCONV_ENTRY(conv_argb8888_0rgb1555)
+PIXCONV_ENTRY(conv_argb8888_rgb565)
+PIXCONV_ENTRY(conv_argb8888_bgr24)
+PIXCONV_ENTRY(conv_argb8888_abgr8888)
+PIXCONV_ENTRY(conv_0rgb1555_bgr24)
+PIXCONV_ENTRY(conv_rgb565_bgr24)
+PIXCONV_ENTRY(conv_yuyv_argb8888)
 
 void conv_copy(void *output_, const void *input_,
       int width, int height,
@@ -0,0 +1,370 @@
+/* Copyright  (C) 2010-2014 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (pixconv_vector.h).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Vector converters for pixconv, included once per instruction set.
+ *
+ * PIXCONV_ISA is appended to every name, PIXCONV_TARGET goes in
+ * front of every function, and PIXCONV_PIXELS is how many pixels
+ * are converted at once. 16-bit pixels are worked on in 16-bit
+ * lanes and only widened to ARGB at the end.
+ *
+ * 24-bit pixels always go 16 at a time, which is 48 bytes,
+ * in 16-byte blocks of four pixels that are shuffled into place.
+ *
+ * Pixels left over at the end of a line go through the C converter,
+ * so every result matches it bit for bit.
+ *
+ * The converters that only widen 16-bit pixels to ARGB are included
+ * with PIXCONV_WIDEN. At eight pixels a step, they lose to the SSE2
+ * ones, which do sixteen. */
+
+#define PIXCONV_CAT_(a, b) a##_##b
+#define PIXCONV_CAT(a, b) PIXCONV_CAT_(a, b)
+#define PIXCONV_FN(name) PIXCONV_CAT(name, PIXCONV_ISA)
+
+#define pixconv_u16v   PIXCONV_FN(pixconv_u16v)
+#define pixconv_s16v   PIXCONV_FN(pixconv_s16v)
+#define pixconv_u32v   PIXCONV_FN(pixconv_u32v)
+#define pixconv_pairv  PIXCONV_FN(pixconv_pairv)
+#define pixconv_bytesv PIXCONV_FN(pixconv_bytesv)
+
+typedef uint16_t pixconv_u16v __attribute__((vector_size(PIXCONV_PIXELS * 2)));
+typedef int16_t pixconv_s16v __attribute__((vector_size(PIXCONV_PIXELS * 2)));
+typedef uint32_t pixconv_u32v __attribute__((vector_size(PIXCONV_PIXELS * 4)));
+/* YUYV, one lane per two pixels. */
+typedef uint32_t pixconv_pairv __attribute__((vector_size(PIXCONV_PIXELS * 2)));
+typedef uint8_t pixconv_bytesv __attribute__((vector_size(16)));
+
+#if defined(__clang__)
+#define PIXCONV_SHUFFLE(a, ...) __builtin_shufflevector(a, a, __VA_ARGS__)
+#define PIXCONV_SHUFFLE2(a, b, ...) __builtin_shufflevector(a, b, __VA_ARGS__)
+#define PIXCONV_ZIP(a, b, ...) __builtin_shufflevector(a, b, __VA_ARGS__)
+#else
+#define PIXCONV_SHUFFLE(a, ...) \
+   __builtin_shuffle(a, (pixconv_bytesv){ __VA_ARGS__ })
+#define PIXCONV_SHUFFLE2(a, b, ...) \
+   __builtin_shuffle(a, b, (pixconv_bytesv){ __VA_ARGS__ })
+#define PIXCONV_ZIP(a, b, ...) \
+   __builtin_shuffle(a, b, (pixconv_u16v){ __VA_ARGS__ })
+#endif
+
+/* Lanes of the first and second half of two interleaved vectors. */
+#if PIXCONV_PIXELS == 8
+#define PIXCONV_ZIP_LO 0, 8, 1, 9, 2, 10, 3, 11
+#define PIXCONV_ZIP_HI 4, 12, 5, 13, 6, 14, 7, 15
+#elif PIXCONV_PIXELS == 16
+#define PIXCONV_ZIP_LO 0, 16, 1, 17, 2, 18, 3, 19, \
+   4, 20, 5, 21, 6, 22, 7, 23
+#define PIXCONV_ZIP_HI 8, 24, 9, 25, 10, 26, 11, 27, \
+   12, 28, 13, 29, 14, 30, 15, 31
+#endif
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_rows)(
+      void *output_, const void *input_,
+      int width, int height, int out_stride, int in_stride,
+      int out_bpp, int in_bpp, int step,
+      void (*convert)(uint8_t*, const uint8_t*),
+      void (*tail)(void*, const void*, int, int, int, int))
+{
+   int h, w;
+   const uint8_t *input = (const uint8_t*)input_;
+   uint8_t *output      = (uint8_t*)output_;
+
+   for (h = 0; h < height;
+         h++, output += out_stride, input += in_stride)
+   {
+      for (w = 0; w + step <= width; w += step)
+         convert(output + w * out_bpp, input + w * in_bpp);
+
+      if (w < width)
+         tail(output + w * out_bpp, input + w * in_bpp,
+               width - w, 1, out_stride, in_stride);
+   }
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET pixconv_u16v PIXCONV_FN(pixconv_load16)(
+      const uint8_t *ptr)
+{
+   pixconv_u16v v;
+   memcpy(&v, ptr, sizeof(v));
+   return v;
+}
+
+/* Puts bytes (b, g) and (r, a) of each pixel together. */
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_store_argb)(
+      uint8_t *ptr, pixconv_u16v bg, pixconv_u16v ra)
+{
+   pixconv_u16v lo = PIXCONV_ZIP(bg, ra, PIXCONV_ZIP_LO);
+   pixconv_u16v hi = PIXCONV_ZIP(bg, ra, PIXCONV_ZIP_HI);
+   memcpy(ptr, &lo, sizeof(lo));
+   memcpy(ptr + sizeof(lo), &hi, sizeof(hi));
+}
+
+/* 0RGB1555 and RGB565 to 8-bit (b, g) and (r, a) pairs.
+ * Channels are widened by repeating their top bits. */
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_expand_0rgb1555)(
+      pixconv_u16v x, pixconv_u16v *bg, pixconv_u16v *ra)
+{
+   pixconv_u16v r = ((x >> 7) & 0xf8) | ((x >> 12) & 0x07);
+   pixconv_u16v g = ((x << 6) & 0xf800) | ((x << 1) & 0x0700);
+   pixconv_u16v b = ((x << 3) & 0xf8) | ((x >> 2) & 0x07);
+   *bg = b | g;
+   *ra = r | 0xff00;
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_expand_rgb565)(
+      pixconv_u16v x, pixconv_u16v *bg, pixconv_u16v *ra)
+{
+   pixconv_u16v r = ((x >> 8) & 0xf8) | (x >> 13);
+   pixconv_u16v g = ((x << 5) & 0xfc00) | ((x >> 1) & 0x0300);
+   pixconv_u16v b = ((x << 3) & 0xf8) | ((x >> 2) & 0x07);
+   *bg = b | g;
+   *ra = r | 0xff00;
+}
+
+/* Sixteen ARGB pixels, in four blocks, to 48 bytes of BGR. */
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_store_bgr24)(
+      uint8_t *ptr, const uint8_t *argb)
+{
+   pixconv_bytesv a, b, c, d, out[3];
+
+   memcpy(&a, argb +  0, sizeof(a));
+   memcpy(&b, argb + 16, sizeof(b));
+   memcpy(&c, argb + 32, sizeof(c));
+   memcpy(&d, argb + 48, sizeof(d));
+
+   out[0] = PIXCONV_SHUFFLE2(a, b,
+         0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20);
+   out[1] = PIXCONV_SHUFFLE2(b, c,
+         5, 6, 8, 9, 10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25);
+   out[2] = PIXCONV_SHUFFLE2(c, d,
+         10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25, 26, 28, 29, 30);
+
+   memcpy(ptr, out, sizeof(out));
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_0rgb1555_argb8888)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u16v bg, ra;
+   PIXCONV_FN(pixconv_expand_0rgb1555)(PIXCONV_FN(pixconv_load16)(in), &bg, &ra);
+   PIXCONV_FN(pixconv_store_argb)(out, bg, ra);
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_rgb565_argb8888)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u16v bg, ra;
+   PIXCONV_FN(pixconv_expand_rgb565)(PIXCONV_FN(pixconv_load16)(in), &bg, &ra);
+   PIXCONV_FN(pixconv_store_argb)(out, bg, ra);
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_0rgb1555_rgb565)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u16v x = PIXCONV_FN(pixconv_load16)(in);
+   x = ((x << 1) & 0xffc0) | ((x >> 4) & 0x0020) | (x & 0x001f);
+   memcpy(out, &x, sizeof(x));
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_rgb565_0rgb1555)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u16v x = PIXCONV_FN(pixconv_load16)(in);
+   x = ((x >> 1) & 0x7fe0) | (x & 0x001f);
+   memcpy(out, &x, sizeof(x));
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_rgba4444_argb8888)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u16v x  = PIXCONV_FN(pixconv_load16)(in);
+   pixconv_u16v bg = ((x >> 4) & 0x000f) | (x & 0x0f00);
+   pixconv_u16v ra = ((x >> 12) & 0x000f) | ((x << 8) & 0x0f00);
+   PIXCONV_FN(pixconv_store_argb)(out, bg | (bg << 4), ra | (ra << 4));
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_argb8888_0rgb1555)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u32v x;
+   pixconv_u16v v;
+
+   memcpy(&x, in, sizeof(x));
+   v = __builtin_convertvector(((x >> 9) & 0x7c00) |
+         ((x >> 6) & 0x03e0) | ((x >> 3) & 0x001f), pixconv_u16v);
+   memcpy(out, &v, sizeof(v));
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_argb8888_rgb565)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u32v x;
+   pixconv_u16v v;
+
+   memcpy(&x, in, sizeof(x));
+   v = __builtin_convertvector(((x >> 8) & 0xf800) |
+         ((x >> 5) & 0x07e0) | ((x >> 3) & 0x001f), pixconv_u16v);
+   memcpy(out, &v, sizeof(v));
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_argb8888_abgr8888)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_u32v x;
+
+   memcpy(&x, in, sizeof(x));
+   x = ((x << 16) & 0xff0000) | ((x >> 16) & 0xff) | (x & 0xff00ff00);
+   memcpy(out, &x, sizeof(x));
+}
+
+/* The last block is loaded from the end of the 48 bytes,
+ * so nothing past the input line is read. */
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_bgr24_argb8888)(
+      uint8_t *out, const uint8_t *in)
+{
+   unsigned i;
+   pixconv_bytesv v[4];
+   const pixconv_bytesv alpha = {
+      0, 0, 0, 0xff, 0, 0, 0, 0xff, 0, 0, 0, 0xff, 0, 0, 0, 0xff };
+
+   memcpy(&v[0], in +  0, sizeof(v[0]));
+   memcpy(&v[1], in + 12, sizeof(v[1]));
+   memcpy(&v[2], in + 24, sizeof(v[2]));
+   memcpy(&v[3], in + 32, sizeof(v[3]));
+
+   for (i = 0; i < 3; i++)
+      v[i] = PIXCONV_SHUFFLE(v[i],
+            0, 1, 2, 0, 3, 4, 5, 0, 6, 7, 8, 0, 9, 10, 11, 0) | alpha;
+   v[3] = PIXCONV_SHUFFLE(v[3],
+         4, 5, 6, 0, 7, 8, 9, 0, 10, 11, 12, 0, 13, 14, 15, 0) | alpha;
+
+   memcpy(out, v, sizeof(v));
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_argb8888_bgr24)(
+      uint8_t *out, const uint8_t *in)
+{
+   PIXCONV_FN(pixconv_store_bgr24)(out, in);
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_0rgb1555_bgr24)(
+      uint8_t *out, const uint8_t *in)
+{
+   unsigned i;
+   uint8_t argb[16 * 4];
+
+   for (i = 0; i < 16; i += PIXCONV_PIXELS)
+      PIXCONV_FN(pixconv_0rgb1555_argb8888)(argb + i * 4, in + i * 2);
+   PIXCONV_FN(pixconv_store_bgr24)(out, argb);
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_rgb565_bgr24)(
+      uint8_t *out, const uint8_t *in)
+{
+   unsigned i;
+   uint8_t argb[16 * 4];
+
+   for (i = 0; i < 16; i += PIXCONV_PIXELS)
+      PIXCONV_FN(pixconv_rgb565_argb8888)(argb + i * 4, in + i * 2);
+   PIXCONV_FN(pixconv_store_bgr24)(out, argb);
+}
+
+/* Same fixed point as the C converter. Nothing can overflow
+ * 16 bits on the way, so the results match it exactly. */
+RETRO_SIMD_INLINE PIXCONV_TARGET pixconv_s16v PIXCONV_FN(pixconv_yuv_channel)(
+      pixconv_s16v v)
+{
+   v = (v + YUV_OFFSET) >> YUV_SHIFT;
+   v &= ~(v >> 15);
+   return (v | ((255 - v) >> 15)) & 0xff;
+}
+
+RETRO_SIMD_INLINE PIXCONV_TARGET void PIXCONV_FN(pixconv_yuyv_argb8888)(
+      uint8_t *out, const uint8_t *in)
+{
+   pixconv_pairv yuyv, pair_u, pair_v;
+   pixconv_s16v y, u, v, r, g, b;
+
+   memcpy(&yuyv, in, sizeof(yuyv));
+
+   /* Each pair shares its U and V, spread over both 16-bit lanes. */
+   y = (pixconv_s16v)(yuyv & 0x00ff00ff);
+   pair_u = (yuyv >> 8) & 0xff;
+   pair_v = yuyv >> 24;
+   u = (pixconv_s16v)(pair_u | (pair_u << 16)) - 128;
+   v = (pixconv_s16v)(pair_v | (pair_v << 16)) - 128;
+   y *= YUV_MAT_Y;
+
+   r = PIXCONV_FN(pixconv_yuv_channel)(y + YUV_MAT_V_R * v);
+   g = PIXCONV_FN(pixconv_yuv_channel)(y + YUV_MAT_U_G * u + YUV_MAT_V_G * v);
+   b = PIXCONV_FN(pixconv_yuv_channel)(y + YUV_MAT_U_B * u);
+
+   PIXCONV_FN(pixconv_store_argb)(out, (pixconv_u16v)(b | (g << 8)),
+         (pixconv_u16v)r | 0xff00);
+}
+
+#define PIXCONV_CONVERTER(name, out_bpp, in_bpp, step) \
+static PIXCONV_TARGET void PIXCONV_FN(conv_##name)(void *output, \
+      const void *input, int width, int height, \
+      int out_stride, int in_stride) \
+{ \
+   PIXCONV_FN(pixconv_rows)(output, input, width, height, \
+         out_stride, in_stride, out_bpp, in_bpp, step, \
+         PIXCONV_FN(pixconv_##name), conv_##name##_C); \
+}
+
+#ifdef PIXCONV_WIDEN
+PIXCONV_CONVERTER(0rgb1555_argb8888, 4, 2, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(rgb565_argb8888,   4, 2, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(yuyv_argb8888,     4, 2, PIXCONV_PIXELS)
+#endif
+PIXCONV_CONVERTER(0rgb1555_rgb565,   2, 2, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(rgb565_0rgb1555,   2, 2, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(rgba4444_argb8888, 4, 2, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(bgr24_argb8888,    4, 3, 16)
+PIXCONV_CONVERTER(argb8888_0rgb1555, 2, 4, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(argb8888_rgb565,   2, 4, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(argb8888_bgr24,    3, 4, 16)
+PIXCONV_CONVERTER(argb8888_abgr8888, 4, 4, PIXCONV_PIXELS)
+PIXCONV_CONVERTER(0rgb1555_bgr24,    3, 2, 16)
+PIXCONV_CONVERTER(rgb565_bgr24,      3, 2, 16)
+
+
+#undef PIXCONV_CONVERTER
+#undef PIXCONV_SHUFFLE
+#undef PIXCONV_SHUFFLE2
+#undef PIXCONV_ZIP
+#undef PIXCONV_ZIP_LO
+#undef PIXCONV_ZIP_HI
+#undef pixconv_u16v
+#undef pixconv_s16v
+#undef pixconv_u32v
+#undef pixconv_pairv
+#undef pixconv_bytesv
+#undef PIXCONV_FN
+#undef PIXCONV_CAT
+#undef PIXCONV_CAT_
+#undef PIXCONV_ISA
+#undef PIXCONV_TARGET
+#undef PIXCONV_PIXELS
+#undef PIXCONV_WIDEN
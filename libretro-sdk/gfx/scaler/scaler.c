@@ -29,6 +29,32 @@
 #include <stdio.h>
 #include <math.h>
 
+#ifdef HAVE_THREADS
+#include <rthreads/rpool.h>
+#endif
+
+/* Output lines are scaled in bands of this many. Every pass
+ * runs over a band before the next band is started, so that
+ * the lines in between stay in cache. */
+#define SCALER_BAND_LINES 16
+
+/* Scratch lines of one task, each big enough for the
+ * lines of any band. */
+struct scaler_task
+{
+   uint32_t *input;  /* Input lines converted to ARGB8888. */
+   uint64_t *scaled; /* Input lines scaled horizontally. */
+   uint32_t *output; /* Output lines before conversion. */
+};
+
+/* What one call of scaler_ctx_scale() works on. */
+struct scaler_job
+{
+   const struct scaler_ctx *ctx;
+   void *output;
+   const void *input;
+};
+
 // In case aligned allocs are needed later ...
 void *scaler_alloc(size_t elem_size, size_t size)
 {
@@ -40,17 +66,111 @@ void scaler_free(void *ptr)
    free(ptr);
 }
 
-static bool allocate_frames(struct scaler_ctx *ctx)
+/* Horizontally scaled lines which output lines
+ * [first, last) are made from. */
+static void scaler_band_lines(const struct scaler_ctx *ctx,
+      int first, int last, int *in_first, int *in_last)
+{
+   int h;
+
+   *in_first = ctx->vert.filter_pos[first];
+   *in_last  = ctx->vert.filter_pos[first];
+
+   for (h = first + 1; h < last; h++)
+   {
+      if (ctx->vert.filter_pos[h] < *in_first)
+         *in_first = ctx->vert.filter_pos[h];
+      if (ctx->vert.filter_pos[h] > *in_last)
+         *in_last = ctx->vert.filter_pos[h];
+   }
+
+   *in_last += ctx->vert.filter_len;
+}
+
+static void set_num_tasks(struct scaler_ctx *ctx)
 {
+   unsigned bands = ctx->unscaled ? ctx->out_height :
+      (ctx->out_height + SCALER_BAND_LINES - 1) / SCALER_BAND_LINES;
+
+   ctx->num_tasks = ctx->threads ? ctx->threads : 1;
+
+   /* The special path scales whole frames at once. */
+   if (ctx->scaler_special)
+      ctx->num_tasks = 1;
+
+   if (ctx->num_tasks > bands)
+      ctx->num_tasks = bands;
+   if (ctx->num_tasks < 1)
+      ctx->num_tasks = 1;
+
+#ifdef HAVE_THREADS
+   if (ctx->num_tasks > 1)
+      ctx->pool = rpool_new(ctx->num_tasks - 1);
+   if (!ctx->pool)
+#endif
+      ctx->num_tasks = 1;
+}
+
+static bool allocate_tasks(struct scaler_ctx *ctx)
+{
+   unsigned i;
+   int h, lines = 0;
+
+   ctx->input.stride  = ((ctx->in_width + 7) & ~7) * sizeof(uint32_t);
    ctx->scaled.stride = ((ctx->out_width + 7) & ~7) * sizeof(uint64_t);
+   ctx->output.stride = ((ctx->out_width + 7) & ~7) * sizeof(uint32_t);
    ctx->scaled.width  = ctx->out_width;
-   ctx->scaled.height = ctx->in_height;
-   ctx->scaled.frame  = (uint64_t*)
-      scaler_alloc(sizeof(uint64_t),
-            (ctx->scaled.stride * ctx->scaled.height) >> 3);
-   if (!ctx->scaled.frame)
+
+   /* A band may start on any line, depending on
+    * where the slice of its task starts. */
+   for (h = 0; h < ctx->out_height; h++)
+   {
+      int in_first, in_last;
+      int last = h + SCALER_BAND_LINES;
+      if (last > ctx->out_height)
+         last = ctx->out_height;
+
+      scaler_band_lines(ctx, h, last, &in_first, &in_last);
+      if (in_last - in_first > lines)
+         lines = in_last - in_first;
+   }
+
+   ctx->tasks = (struct scaler_task*)
+      scaler_alloc(sizeof(struct scaler_task), ctx->num_tasks);
+   if (!ctx->tasks)
       return false;
 
+   for (i = 0; i < ctx->num_tasks; i++)
+   {
+      struct scaler_task *task = &ctx->tasks[i];
+
+      task->scaled = (uint64_t*)scaler_alloc(sizeof(uint64_t),
+            (ctx->scaled.stride * lines) >> 3);
+      if (!task->scaled)
+         return false;
+
+      if (ctx->in_fmt != SCALER_FMT_ARGB8888)
+      {
+         task->input = (uint32_t*)scaler_alloc(sizeof(uint32_t),
+               (ctx->input.stride * lines) >> 2);
+         if (!task->input)
+            return false;
+      }
+
+      if (ctx->out_fmt != SCALER_FMT_ARGB8888)
+      {
+         task->output = (uint32_t*)scaler_alloc(sizeof(uint32_t),
+               (ctx->output.stride * SCALER_BAND_LINES) >> 2);
+         if (!task->output)
+            return false;
+      }
+   }
+
+   return true;
+}
+
+static bool allocate_frames(struct scaler_ctx *ctx)
+{
    if (ctx->in_fmt != SCALER_FMT_ARGB8888)
    {
       ctx->input.stride = ((ctx->in_width + 7) & ~7) * sizeof(uint32_t);
@@ -177,16 +297,12 @@ bool scaler_ctx_gen_filter(struct scaler_ctx *ctx)
       ctx->unscaled = true; /* Only pixel format conversion ... */
    else
    {
-      ctx->scaler_horiz = scaler_argb8888_horiz;
-      ctx->scaler_vert  = scaler_argb8888_vert;
-      ctx->unscaled     = false;
+      scaler_argb8888_find(ctx);
+      ctx->unscaled = false;
    }
 
    ctx->scaler_special = NULL;
 
-   if (!allocate_frames(ctx))
-      return false;
-
    if (ctx->unscaled)
    {
       if (!set_direct_pix_conv(ctx))
@@ -201,19 +317,43 @@ bool scaler_ctx_gen_filter(struct scaler_ctx *ctx)
    if (!ctx->unscaled && !scaler_gen_filter(ctx))
       return false;
 
+   set_num_tasks(ctx);
+
+   if (ctx->scaler_special)
+      return allocate_frames(ctx);
+   if (!ctx->unscaled)
+      return allocate_tasks(ctx);
    return true;
 }
 
 void scaler_ctx_gen_reset(struct scaler_ctx *ctx)
 {
+   unsigned i;
+
+#ifdef HAVE_THREADS
+   if (ctx->pool)
+      rpool_free((rpool_t*)ctx->pool);
+#endif
+
+   for (i = 0; ctx->tasks && i < ctx->num_tasks; i++)
+   {
+      scaler_free(ctx->tasks[i].input);
+      scaler_free(ctx->tasks[i].scaled);
+      scaler_free(ctx->tasks[i].output);
+   }
+
+   scaler_free(ctx->tasks);
    scaler_free(ctx->horiz.filter);
    scaler_free(ctx->horiz.filter_pos);
    scaler_free(ctx->vert.filter);
    scaler_free(ctx->vert.filter_pos);
-   scaler_free(ctx->scaled.frame);
    scaler_free(ctx->input.frame);
    scaler_free(ctx->output.frame);
 
+   ctx->pool      = NULL;
+   ctx->tasks     = NULL;
+   ctx->num_tasks = 0;
+
    memset(&ctx->horiz, 0, sizeof(ctx->horiz));
    memset(&ctx->vert, 0, sizeof(ctx->vert));
    memset(&ctx->scaled, 0, sizeof(ctx->scaled));
@@ -221,15 +361,125 @@ void scaler_ctx_gen_reset(struct scaler_ctx *ctx)
    memset(&ctx->output, 0, sizeof(ctx->output));
 }
 
+/* Scales input lines [first, last) horizontally into scaled. */
+static void scaler_horiz_lines(const struct scaler_ctx *ctx,
+      const struct scaler_task *task, uint64_t *scaled,
+      const void *input, int first, int last)
+{
+   const uint8_t *in = (const uint8_t*)input + first * ctx->in_stride;
+
+   if (first >= last)
+      return;
+
+   if (ctx->in_fmt != SCALER_FMT_ARGB8888)
+   {
+      ctx->in_pixconv(task->input, in,
+            ctx->in_width, last - first,
+            ctx->input.stride, ctx->in_stride);
+
+      ctx->scaler_horiz(ctx, scaled, ctx->scaled.stride,
+            task->input, ctx->input.stride, last - first);
+   }
+   else
+      ctx->scaler_horiz(ctx, scaled, ctx->scaled.stride,
+            in, ctx->in_stride, last - first);
+}
+
+/* Scales the output lines of one task, band by band.
+ * Horizontally scaled lines which the last band made
+ * and the next one needs are kept. */
+static void scaler_scale_task(void *data, unsigned index)
+{
+   int h;
+   const struct scaler_job *job   = (const struct scaler_job*)data;
+   const struct scaler_ctx *ctx   = job->ctx;
+   const struct scaler_task *task = &ctx->tasks[index];
+   int first                      = ctx->out_height * index / ctx->num_tasks;
+   int last                       = ctx->out_height * (index + 1) / ctx->num_tasks;
+   int have_first                 = 0;
+   int have_last                  = 0;
+   int scaled_stride              = ctx->scaled.stride >> 3;
+
+   for (h = first; h < last; h += SCALER_BAND_LINES)
+   {
+      int in_first, in_last, from;
+      int lines   = last - h < SCALER_BAND_LINES ? last - h : SCALER_BAND_LINES;
+      uint8_t *out = (uint8_t*)job->output + h * ctx->out_stride;
+
+      scaler_band_lines(ctx, h, h + lines, &in_first, &in_last);
+
+      from = in_first;
+      if (in_first >= have_first && in_first < have_last)
+      {
+         from = have_last < in_last ? have_last : in_last;
+         memmove(task->scaled,
+               task->scaled + (in_first - have_first) * scaled_stride,
+               (from - in_first) * ctx->scaled.stride);
+      }
+
+      scaler_horiz_lines(ctx, task,
+            task->scaled + (from - in_first) * scaled_stride,
+            job->input, from, in_last);
+
+      have_first = in_first;
+      have_last  = in_last;
+
+      if (ctx->out_fmt != SCALER_FMT_ARGB8888)
+      {
+         ctx->scaler_vert(ctx, task->output, ctx->output.stride,
+               task->scaled, ctx->scaled.stride, in_first, h, lines);
+
+         ctx->out_pixconv(out, task->output,
+               ctx->out_width, lines,
+               ctx->out_stride, ctx->output.stride);
+      }
+      else
+         ctx->scaler_vert(ctx, out, ctx->out_stride,
+               task->scaled, ctx->scaled.stride, in_first, h, lines);
+   }
+}
+
+/* Converts one slice of the lines when not scaling. */
+static void scaler_convert_task(void *data, unsigned index)
+{
+   const struct scaler_job *job = (const struct scaler_job*)data;
+   const struct scaler_ctx *ctx = job->ctx;
+   int first                    = ctx->out_height * index / ctx->num_tasks;
+   int last                     = ctx->out_height * (index + 1) / ctx->num_tasks;
+
+   ctx->direct_pixconv((uint8_t*)job->output + first * ctx->out_stride,
+         (const uint8_t*)job->input + first * ctx->in_stride,
+         ctx->out_width, last - first,
+         ctx->out_stride, ctx->in_stride);
+}
+
+static void scaler_run_tasks(struct scaler_ctx *ctx,
+      void (*task)(void*, unsigned), void *output, const void *input)
+{
+   struct scaler_job job;
+
+   job.ctx    = ctx;
+   job.output = output;
+   job.input  = input;
+
+#ifdef HAVE_THREADS
+   if (ctx->pool)
+   {
+      rpool_parallel_for((rpool_t*)ctx->pool, ctx->num_tasks, task, &job);
+      return;
+   }
+#endif
+
+   task(&job, 0);
+}
+
 void scaler_ctx_scale(struct scaler_ctx *ctx,
       void *output, const void *input)
 {
    if (ctx->unscaled)
    {
       /* Just perform straight pixel conversion. */
-      ctx->direct_pixconv(output, input,
-            ctx->out_width, ctx->out_height,
-            ctx->out_stride, ctx->in_stride);
+      scaler_run_tasks(ctx, scaler_convert_task, output, input);
    }
    else if (ctx->scaler_special)
    {
@@ -271,28 +521,7 @@ void scaler_ctx_scale(struct scaler_ctx *ctx,
    }
    else
    {
-      /* Take generic filter path. */
-      if (ctx->in_fmt != SCALER_FMT_ARGB8888)
-      {
-         ctx->in_pixconv(ctx->input.frame, input,
-               ctx->in_width, ctx->in_height,
-               ctx->input.stride, ctx->in_stride);
-
-         ctx->scaler_horiz(ctx, ctx->input.frame, ctx->input.stride);
-      }
-      else
-         ctx->scaler_horiz(ctx, input, ctx->in_stride);
-
-      if (ctx->out_fmt != SCALER_FMT_ARGB8888)
-      {
-         ctx->scaler_vert(ctx, ctx->output.frame, ctx->output.stride);
-
-         ctx->out_pixconv(output, ctx->output.frame,
-               ctx->out_width, ctx->out_height,
-               ctx->out_stride, ctx->output.stride);
-      }
-      else
-         ctx->scaler_vert(ctx, output, ctx->out_stride);
+      /* Take generic filter path, in bands. */
+      scaler_run_tasks(ctx, scaler_scale_task, output, input);
    }
 }
-
@@ -21,9 +21,12 @@
  */
 
 #include <gfx/scaler/scaler_int.h>
+#include <retro_simd.h>
 
 #ifdef SCALER_NO_SIMD
 #undef __SSE2__
+#undef __ARM_NEON__
+#undef HAVE_RETRO_TARGET_X86
 #endif
 
 #if defined(__SSE2__)
@@ -33,6 +36,14 @@
 #endif
 #endif
 
+#if defined(HAVE_RETRO_TARGET_X86)
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 // ARGB8888 scaler is split in two:
 //
 // First, horizontal scaler is applied.
@@ -49,19 +60,23 @@
 // Scaling is now complete. Channels are shifted right by 3, and saturated into 8-bit values.
 //
 // The C version of scalers perform the exact same operations as the SIMD code for testing purposes.
+//
+// Both scalers work on a range of lines, so that a frame can be scaled in bands which stay in cache.
 
 #if defined(__SSE2__)
-void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int stride)
+void scaler_argb8888_vert(const struct scaler_ctx *ctx,
+      void *output_, int out_stride,
+      const uint64_t *input, int in_stride,
+      int input_first, int first, int lines)
 {
    int h, w, y;
-   const uint64_t *input = ctx->scaled.frame;
    uint32_t *output = (uint32_t*)output_;
 
-   const int16_t *filter_vert = ctx->vert.filter;
+   const int16_t *filter_vert = ctx->vert.filter + first * ctx->vert.filter_stride;
 
-   for (h = 0; h < ctx->out_height; h++, filter_vert += ctx->vert.filter_stride, output += stride >> 2)
+   for (h = first; h < first + lines; h++, filter_vert += ctx->vert.filter_stride, output += out_stride >> 2)
    {
-      const uint64_t *input_base = input + ctx->vert.filter_pos[h] * (ctx->scaled.stride >> 3);
+      const uint64_t *input_base = input + (ctx->vert.filter_pos[h] - input_first) * (in_stride >> 3);
 
       for (w = 0; w < ctx->out_width; w++)
       {
@@ -69,17 +84,17 @@ void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int strid
 
          const uint64_t *input_base_y = input_base + w;
 
-         for (y = 0; (y + 1) < ctx->vert.filter_len; y += 2, input_base_y += (ctx->scaled.stride >> 2))
+         for (y = 0; (y + 1) < ctx->vert.filter_len; y += 2, input_base_y += (in_stride >> 2))
          {
-            __m128i coeff = _mm_set_epi64x(filter_vert[y + 1] * 0x0001000100010001ll, filter_vert[y + 0] * 0x0001000100010001ll);
-            __m128i col   = _mm_set_epi64x(input_base_y[ctx->scaled.stride >> 3], input_base_y[0]);
+            __m128i coeff = _mm_set_epi64x((uint16_t)filter_vert[y + 1] * 0x0001000100010001ll, (uint16_t)filter_vert[y + 0] * 0x0001000100010001ll);
+            __m128i col   = _mm_set_epi64x(input_base_y[in_stride >> 3], input_base_y[0]);
 
             res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
          }
 
-         for (; y < ctx->vert.filter_len; y++, input_base_y += (ctx->scaled.stride >> 3))
+         for (; y < ctx->vert.filter_len; y++, input_base_y += (in_stride >> 3))
          {
-            __m128i coeff = _mm_set_epi64x(0, filter_vert[y] * 0x0001000100010001ll);
+            __m128i coeff = _mm_set_epi64x(0, (uint16_t)filter_vert[y] * 0x0001000100010001ll);
             __m128i col   = _mm_set_epi64x(0, input_base_y[0]);
 
             res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
@@ -95,17 +110,19 @@ void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int strid
    }
 }
 #else
-void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int stride)
+void scaler_argb8888_vert(const struct scaler_ctx *ctx,
+      void *output_, int out_stride,
+      const uint64_t *input, int in_stride,
+      int input_first, int first, int lines)
 {
    int h, w, y;
-   const uint64_t *input = ctx->scaled.frame;
    uint32_t *output = (uint32_t*)output_;
 
-   const int16_t *filter_vert = ctx->vert.filter;
+   const int16_t *filter_vert = ctx->vert.filter + first * ctx->vert.filter_stride;
 
-   for (h = 0; h < ctx->out_height; h++, filter_vert += ctx->vert.filter_stride, output += stride >> 2)
+   for (h = first; h < first + lines; h++, filter_vert += ctx->vert.filter_stride, output += out_stride >> 2)
    {
-      const uint64_t *input_base = input + ctx->vert.filter_pos[h] * (ctx->scaled.stride >> 3);
+      const uint64_t *input_base = input + (ctx->vert.filter_pos[h] - input_first) * (in_stride >> 3);
 
       for (w = 0; w < ctx->out_width; w++)
       {
@@ -115,7 +132,7 @@ void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int strid
          int16_t res_b = 0;
 
          const uint64_t *input_base_y = input_base + w;
-         for (y = 0; y < ctx->vert.filter_len; y++, input_base_y += (ctx->scaled.stride >> 3))
+         for (y = 0; y < ctx->vert.filter_len; y++, input_base_y += (in_stride >> 3))
          {
             uint64_t col = *input_base_y;
 
@@ -144,13 +161,14 @@ void scaler_argb8888_vert(const struct scaler_ctx *ctx, void *output_, int strid
 #endif
 
 #if defined(__SSE2__)
-void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int stride)
+void scaler_argb8888_horiz(const struct scaler_ctx *ctx,
+      uint64_t *output, int out_stride,
+      const void *input_, int in_stride, int lines)
 {
    int h, w, x;
    const uint32_t *input = (const uint32_t*)input_;
-   uint64_t *output      = ctx->scaled.frame;
 
-   for (h = 0; h < ctx->scaled.height; h++, input += stride >> 2, output += ctx->scaled.stride >> 3)
+   for (h = 0; h < lines; h++, input += in_stride >> 2, output += out_stride >> 3)
    {
       const int16_t *filter_horiz = ctx->horiz.filter;
 
@@ -162,7 +180,7 @@ void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int
 
          for (x = 0; (x + 1) < ctx->horiz.filter_len; x += 2)
          {
-            __m128i coeff = _mm_set_epi64x(filter_horiz[x + 1] * 0x0001000100010001ll, filter_horiz[x + 0] * 0x0001000100010001ll);
+            __m128i coeff = _mm_set_epi64x((uint16_t)filter_horiz[x + 1] * 0x0001000100010001ll, (uint16_t)filter_horiz[x + 0] * 0x0001000100010001ll);
 
             __m128i col = _mm_unpacklo_epi8(_mm_set_epi64x(0,
                      ((uint64_t)input_base_x[x + 1] << 32) | input_base_x[x + 0]), _mm_setzero_si128());
@@ -173,7 +191,7 @@ void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int
 
          for (; x < ctx->horiz.filter_len; x++)
          {
-            __m128i coeff = _mm_set_epi64x(0, filter_horiz[x] * 0x0001000100010001ll);
+            __m128i coeff = _mm_set_epi64x(0, (uint16_t)filter_horiz[x] * 0x0001000100010001ll);
             __m128i col   = _mm_unpacklo_epi8(_mm_set_epi32(0, 0, 0, input_base_x[x]), _mm_setzero_si128());
 
             col = _mm_slli_epi16(col, 7);
@@ -203,13 +221,14 @@ static inline uint64_t build_argb64(uint16_t a, uint16_t r, uint16_t g, uint16_t
    return ((uint64_t)a << 48) | ((uint64_t)r << 32) | ((uint64_t)g << 16) | ((uint64_t)b << 0);
 }
 
-void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int stride)
+void scaler_argb8888_horiz(const struct scaler_ctx *ctx,
+      uint64_t *output, int out_stride,
+      const void *input_, int in_stride, int lines)
 {
    int h, w, x;
-   const uint32_t *input = (uint32_t*)input_;
-   uint64_t *output      = ctx->scaled.frame;
+   const uint32_t *input = (const uint32_t*)input_;
 
-   for (h = 0; h < ctx->scaled.height; h++, input += stride >> 2, output += ctx->scaled.stride >> 3)
+   for (h = 0; h < lines; h++, input += in_stride >> 2, output += out_stride >> 3)
    {
       const int16_t *filter_horiz = ctx->horiz.filter;
 
@@ -245,6 +264,257 @@ void scaler_argb8888_horiz(const struct scaler_ctx *ctx, const void *input_, int
 }
 #endif
 
+#if defined(HAVE_RETRO_TARGET_X86)
+// AVX2 vertical scaler works on four output pixels at a time, which all share the coefficients.
+static RETRO_TARGET("avx2") void scaler_argb8888_vert_avx2(const struct scaler_ctx *ctx,
+      void *output_, int out_stride,
+      const uint64_t *input, int in_stride,
+      int input_first, int first, int lines)
+{
+   int h, w, y;
+   uint32_t *output = (uint32_t*)output_;
+
+   const int16_t *filter_vert = ctx->vert.filter + first * ctx->vert.filter_stride;
+
+   for (h = first; h < first + lines; h++, filter_vert += ctx->vert.filter_stride, output += out_stride >> 2)
+   {
+      const uint64_t *input_base = input + (ctx->vert.filter_pos[h] - input_first) * (in_stride >> 3);
+
+      for (w = 0; w + 4 <= ctx->out_width; w += 4)
+      {
+         __m256i res = _mm256_setzero_si256();
+
+         const uint64_t *input_base_y = input_base + w;
+
+         for (y = 0; y < ctx->vert.filter_len; y++, input_base_y += (in_stride >> 3))
+         {
+            __m256i coeff = _mm256_set1_epi16(filter_vert[y]);
+            __m256i col   = _mm256_loadu_si256((const __m256i*)input_base_y);
+
+            res = _mm256_adds_epi16(_mm256_mulhi_epi16(col, coeff), res);
+         }
+
+         res = _mm256_srai_epi16(res, (7 - 2 - 2));
+
+         // Packing works within 128-bit lanes, gather the pixels from both.
+         res = _mm256_permute4x64_epi64(_mm256_packus_epi16(res, res), 0x08);
+
+         _mm_storeu_si128((__m128i*)(output + w), _mm256_castsi256_si128(res));
+      }
+
+      for (; w < ctx->out_width; w++)
+      {
+         __m128i res = _mm_setzero_si128();
+
+         const uint64_t *input_base_y = input_base + w;
+
+         for (y = 0; y < ctx->vert.filter_len; y++, input_base_y += (in_stride >> 3))
+         {
+            __m128i coeff = _mm_set1_epi16(filter_vert[y]);
+            __m128i col   = _mm_loadl_epi64((const __m128i*)input_base_y);
+
+            res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+         }
+
+         res = _mm_srai_epi16(res, (7 - 2 - 2));
+
+         output[w] = _mm_cvtsi128_si32(_mm_packus_epi16(res, res));
+      }
+   }
+}
+
+// AVX2 horizontal scaler does four taps at a time, or two output pixels at a time for bilinear.
+static RETRO_TARGET("avx2") void scaler_argb8888_horiz_avx2(const struct scaler_ctx *ctx,
+      uint64_t *output, int out_stride,
+      const void *input_, int in_stride, int lines)
+{
+   int h, w, x;
+   const uint32_t *input = (const uint32_t*)input_;
+
+   // Spreads four 16-bit taps over the four channels of their pixel.
+   const __m256i spread = _mm256_setr_epi8(
+         0, 1, 0, 1, 0, 1, 0, 1, 2, 3, 2, 3, 2, 3, 2, 3,
+         4, 5, 4, 5, 4, 5, 4, 5, 6, 7, 6, 7, 6, 7, 6, 7);
+
+   for (h = 0; h < lines; h++, input += in_stride >> 2, output += out_stride >> 3)
+   {
+      const int16_t *filter_horiz = ctx->horiz.filter;
+
+      w = 0;
+
+      if (ctx->horiz.filter_len == 2 && ctx->horiz.filter_stride == 2)
+      {
+         for (; w + 2 <= ctx->scaled.width; w += 2, filter_horiz += 4)
+         {
+            const uint32_t *input_base_a = input + ctx->horiz.filter_pos[w + 0];
+            const uint32_t *input_base_b = input + ctx->horiz.filter_pos[w + 1];
+
+            __m128i pixels = _mm_unpacklo_epi64(
+                  _mm_loadl_epi64((const __m128i*)input_base_a),
+                  _mm_loadl_epi64((const __m128i*)input_base_b));
+
+            __m256i coeff = _mm256_shuffle_epi8(_mm256_broadcastq_epi64(
+                     _mm_loadl_epi64((const __m128i*)filter_horiz)), spread);
+            __m256i col   = _mm256_slli_epi16(_mm256_cvtepu8_epi16(pixels), 7);
+            __m256i res   = _mm256_mulhi_epi16(col, coeff);
+
+            res = _mm256_adds_epi16(_mm256_srli_si256(res, 8), res);
+            res = _mm256_permute4x64_epi64(res, 0x08);
+
+            _mm_storeu_si128((__m128i*)(output + w), _mm256_castsi256_si128(res));
+         }
+      }
+
+      for (; w < ctx->scaled.width; w++, filter_horiz += ctx->horiz.filter_stride)
+      {
+         __m256i res_wide = _mm256_setzero_si256();
+         __m128i res;
+
+         const uint32_t *input_base_x = input + ctx->horiz.filter_pos[w];
+
+         for (x = 0; (x + 3) < ctx->horiz.filter_len; x += 4)
+         {
+            __m256i coeff = _mm256_shuffle_epi8(_mm256_broadcastq_epi64(
+                     _mm_loadl_epi64((const __m128i*)(filter_horiz + x))), spread);
+            __m256i col   = _mm256_cvtepu8_epi16(
+                  _mm_loadu_si128((const __m128i*)(input_base_x + x)));
+
+            col      = _mm256_slli_epi16(col, 7);
+            res_wide = _mm256_adds_epi16(_mm256_mulhi_epi16(col, coeff), res_wide);
+         }
+
+         res = _mm_adds_epi16(_mm256_extracti128_si256(res_wide, 1),
+               _mm256_castsi256_si128(res_wide));
+
+         for (; x < ctx->horiz.filter_len; x++)
+         {
+            __m128i coeff = _mm_set1_epi16(filter_horiz[x]);
+            __m128i col   = _mm_unpacklo_epi8(_mm_cvtsi32_si128(input_base_x[x]), _mm_setzero_si128());
+
+            col = _mm_slli_epi16(col, 7);
+            res = _mm_adds_epi16(_mm_mulhi_epi16(col, coeff), res);
+         }
+
+         res = _mm_adds_epi16(_mm_srli_si128(res, 8), res);
+
+         _mm_storel_epi64((__m128i*)(output + w), res);
+      }
+   }
+}
+#endif
+
+#if defined(__ARM_NEON__)
+// NEON has no 16-bit mulhi. A widening multiply narrowed back by 16 does the same.
+static inline int16x4_t scaler_mulhi_neon(int16x4_t a, int16_t b)
+{
+   return vshrn_n_s32(vmull_n_s16(a, b), 16);
+}
+
+static void scaler_argb8888_vert_neon(const struct scaler_ctx *ctx,
+      void *output_, int out_stride,
+      const uint64_t *input, int in_stride,
+      int input_first, int first, int lines)
+{
+   int h, w, y;
+   uint32_t *output = (uint32_t*)output_;
+
+   const int16_t *filter_vert = ctx->vert.filter + first * ctx->vert.filter_stride;
+
+   for (h = first; h < first + lines; h++, filter_vert += ctx->vert.filter_stride, output += out_stride >> 2)
+   {
+      const uint64_t *input_base = input + (ctx->vert.filter_pos[h] - input_first) * (in_stride >> 3);
+
+      for (w = 0; w + 2 <= ctx->out_width; w += 2)
+      {
+         int16x8_t res = vdupq_n_s16(0);
+
+         const uint64_t *input_base_y = input_base + w;
+
+         for (y = 0; y < ctx->vert.filter_len; y++, input_base_y += (in_stride >> 3))
+         {
+            int16x8_t col = vld1q_s16((const int16_t*)input_base_y);
+
+            res = vqaddq_s16(vcombine_s16(
+                     scaler_mulhi_neon(vget_low_s16(col), filter_vert[y]),
+                     scaler_mulhi_neon(vget_high_s16(col), filter_vert[y])), res);
+         }
+
+         res = vshrq_n_s16(res, (7 - 2 - 2));
+
+         vst1_u8((uint8_t*)(output + w), vqmovun_s16(res));
+      }
+
+      for (; w < ctx->out_width; w++)
+      {
+         int16x4_t res = vdup_n_s16(0);
+
+         const uint64_t *input_base_y = input_base + w;
+
+         for (y = 0; y < ctx->vert.filter_len; y++, input_base_y += (in_stride >> 3))
+         {
+            int16x4_t col = vld1_s16((const int16_t*)input_base_y);
+
+            res = vqadd_s16(scaler_mulhi_neon(col, filter_vert[y]), res);
+         }
+
+         res = vshr_n_s16(res, (7 - 2 - 2));
+
+         vst1_lane_u32(output + w, vreinterpret_u32_u8(
+                  vqmovun_s16(vcombine_s16(res, res))), 0);
+      }
+   }
+}
+
+static void scaler_argb8888_horiz_neon(const struct scaler_ctx *ctx,
+      uint64_t *output, int out_stride,
+      const void *input_, int in_stride, int lines)
+{
+   int h, w, x;
+   const uint32_t *input = (const uint32_t*)input_;
+
+   for (h = 0; h < lines; h++, input += in_stride >> 2, output += out_stride >> 3)
+   {
+      const int16_t *filter_horiz = ctx->horiz.filter;
+
+      for (w = 0; w < ctx->scaled.width; w++, filter_horiz += ctx->horiz.filter_stride)
+      {
+         int16x4_t res = vdup_n_s16(0);
+
+         const uint32_t *input_base_x = input + ctx->horiz.filter_pos[w];
+
+         for (x = 0; x < ctx->horiz.filter_len; x++)
+         {
+            int16x4_t col = vreinterpret_s16_u16(vget_low_u16(
+                     vmovl_u8(vcreate_u8(input_base_x[x]))));
+
+            col = vshl_n_s16(col, 7);
+            res = vqadd_s16(scaler_mulhi_neon(col, filter_horiz[x]), res);
+         }
+
+         vst1_s16((int16_t*)(output + w), res);
+      }
+   }
+}
+#endif
+
+void scaler_argb8888_find(struct scaler_ctx *ctx)
+{
+   ctx->scaler_horiz = scaler_argb8888_horiz;
+   ctx->scaler_vert  = scaler_argb8888_vert;
+
+#if defined(HAVE_RETRO_TARGET_X86)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+   {
+      ctx->scaler_horiz = scaler_argb8888_horiz_avx2;
+      ctx->scaler_vert  = scaler_argb8888_vert_avx2;
+   }
+#elif defined(__ARM_NEON__)
+   ctx->scaler_horiz = scaler_argb8888_horiz_neon;
+   ctx->scaler_vert  = scaler_argb8888_vert_neon;
+#endif
+}
+
 void scaler_argb8888_point_special(const struct scaler_ctx *ctx,
       void *output_, const void *input_,
       int out_width, int out_height,
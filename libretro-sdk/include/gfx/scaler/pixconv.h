@@ -25,6 +25,13 @@
 
 #include <gfx/scaler/scaler_common.h>
 
+/* Picks the converters below for a mask of RETRO_SIMD_* CPU
+ * features, as returned by retro_get_cpu_features().
+ * Until it is called, only what the build already requires
+ * of the CPU is used. Returns the name of the instruction set.
+ * Not thread-safe, call it once at startup. */
+const char *conv_init(uint64_t simd_mask);
+
 void conv_0rgb1555_argb8888(void *output, const void *input,
       int width, int height,
       int out_stride, int in_stride);
@@ -57,6 +57,8 @@ struct scaler_filter
    int *filter_pos;
 };
 
+struct scaler_task;
+
 struct scaler_ctx
 {
    int in_width;
@@ -71,10 +73,18 @@ struct scaler_ctx
    enum scaler_pix_fmt out_fmt;
    enum scaler_type scaler_type;
 
+   /* Threads to scale with, including the calling one.
+    * 0 or 1 scales on the calling thread only. */
+   unsigned threads;
+
+   /* Scales lines of input horizontally into output. */
    void (*scaler_horiz)(const struct scaler_ctx*,
-         const void*, int);
+         uint64_t*, int, const void*, int, int);
+   /* Scales output lines [first, first + lines) vertically,
+    * from input which starts at line input_first of the
+    * horizontally scaled frame. */
    void (*scaler_vert)(const struct scaler_ctx*,
-         void*, int);
+         void*, int, const uint64_t*, int, int, int, int);
    void (*scaler_special)(const struct scaler_ctx*,
          void*, const void*, int, int, int, int, int, int);
 
@@ -85,6 +95,12 @@ struct scaler_ctx
    bool unscaled;
    struct scaler_filter horiz, vert;
 
+   /* Each task scales a slice of the output lines,
+    * with scratch lines of its own. */
+   struct scaler_task *tasks;
+   unsigned num_tasks;
+   void *pool;
+
    struct
    {
       uint32_t *frame;
@@ -93,9 +109,7 @@ struct scaler_ctx
 
    struct
    {
-      uint64_t *frame;
       int width;
-      int height;
       int stride;
    } scaled;
 
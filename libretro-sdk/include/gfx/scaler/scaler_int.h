@@ -26,10 +26,17 @@
 #include <gfx/scaler/scaler.h>
 
 void scaler_argb8888_vert(const struct scaler_ctx *ctx,
-      void *output, int stride);
+      void *output, int out_stride,
+      const uint64_t *input, int in_stride,
+      int input_first, int first, int lines);
 
 void scaler_argb8888_horiz(const struct scaler_ctx *ctx,
-      const void *input, int stride);
+      uint64_t *output, int out_stride,
+      const void *input, int in_stride, int lines);
+
+/* Points ctx at the fastest horizontal and vertical
+ * scalers this CPU can run. */
+void scaler_argb8888_find(struct scaler_ctx *ctx);
 
 void scaler_argb8888_point_special(const struct scaler_ctx *ctx,
       void *output, const void *input,
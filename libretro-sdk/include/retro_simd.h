@@ -0,0 +1,49 @@
+/* Copyright  (C) 2010-2014 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (retro_simd.h).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIBRETRO_SDK_SIMD_H
+#define __LIBRETRO_SDK_SIMD_H
+
+#if defined(__x86_64__) || defined(__i386__) || defined(__i486__) || defined(__i686__)
+#if defined(__clang__) || \
+   (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+/* Compiler can emit code for instruction sets above the
+ * -march baseline on a per-function basis.
+ * Such code must only run after a runtime check of
+ * the RETRO_SIMD_* feature mask. */
+#define HAVE_RETRO_TARGET_X86
+#define RETRO_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+/* Used for generic kernel bodies which take their inner
+ * primitives as function pointers. Forcing the inline makes
+ * the compiler specialize the body once per instruction set. */
+#if defined(__GNUC__)
+#define RETRO_SIMD_INLINE static inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define RETRO_SIMD_INLINE static __forceinline
+#else
+#define RETRO_SIMD_INLINE static inline
+#endif
+
+#endif
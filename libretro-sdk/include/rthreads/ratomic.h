@@ -0,0 +1,163 @@
+/* Copyright  (C) 2010-2014 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (ratomic.h).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIBRETRO_SDK_RATOMIC_H__
+#define __LIBRETRO_SDK_RATOMIC_H__
+
+#include <stddef.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#ifdef _XBOX360
+#include <PPCIntrinsics.h>
+#endif
+#endif
+
+/* Bare minimum needed for single-producer/single-consumer 
+ * structures: one thread publishes an index with a release store, 
+ * the other picks it up with an acquire load.
+ *
+ * ratomic_fence is a full barrier, for when a store must be 
+ * visible before a later load (i.e. checking a "sleeping" flag 
+ * after publishing an index).
+ *
+ * ratomic_add atomically adds to a counter shared by more than 
+ * two threads and returns the new value. It's a full barrier too.
+ *
+ * Platforms without any of these are assumed to be single-core, 
+ * where a compiler barrier through volatile is enough. */
+
+#if defined(__clang__) || \
+   (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+
+static inline size_t ratomic_load_acquire(const volatile size_t *ptr)
+{
+   return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline void ratomic_store_release(volatile size_t *ptr, size_t val)
+{
+   __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+static inline void ratomic_fence(void)
+{
+   __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline size_t ratomic_add(volatile size_t *ptr, size_t val)
+{
+   return __atomic_add_fetch(ptr, val, __ATOMIC_SEQ_CST);
+}
+
+#elif defined(__GNUC__)
+
+static inline size_t ratomic_load_acquire(const volatile size_t *ptr)
+{
+   size_t val = *ptr;
+   __sync_synchronize();
+   return val;
+}
+
+static inline void ratomic_store_release(volatile size_t *ptr, size_t val)
+{
+   __sync_synchronize();
+   *ptr = val;
+}
+
+static inline void ratomic_fence(void)
+{
+   __sync_synchronize();
+}
+
+static inline size_t ratomic_add(volatile size_t *ptr, size_t val)
+{
+   return __sync_add_and_fetch(ptr, val);
+}
+
+#elif defined(_MSC_VER)
+
+#ifdef _XBOX360
+#define RATOMIC_BARRIER() __lwsync()
+#else
+#define RATOMIC_BARRIER() _ReadWriteBarrier()
+#endif
+
+static __inline size_t ratomic_load_acquire(const volatile size_t *ptr)
+{
+   size_t val = *ptr;
+   RATOMIC_BARRIER();
+   return val;
+}
+
+static __inline void ratomic_store_release(volatile size_t *ptr, size_t val)
+{
+   RATOMIC_BARRIER();
+   *ptr = val;
+}
+
+static __inline void ratomic_fence(void)
+{
+#ifdef _XBOX360
+   __sync();
+#else
+   /* Interlocked operations are full barriers. */
+   volatile long dummy = 0;
+   _InterlockedExchange(&dummy, 0);
+#endif
+}
+
+static __inline size_t ratomic_add(volatile size_t *ptr, size_t val)
+{
+#ifdef _WIN64
+   return (size_t)_InterlockedExchangeAdd64(
+         (volatile __int64*)ptr, (__int64)val) + val;
+#else
+   return (size_t)_InterlockedExchangeAdd(
+         (volatile long*)ptr, (long)val) + val;
+#endif
+}
+
+#else
+
+static inline size_t ratomic_load_acquire(const volatile size_t *ptr)
+{
+   return *ptr;
+}
+
+static inline void ratomic_store_release(volatile size_t *ptr, size_t val)
+{
+   *ptr = val;
+}
+
+static inline void ratomic_fence(void)
+{
+}
+
+static inline size_t ratomic_add(volatile size_t *ptr, size_t val)
+{
+   return *ptr += val;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+/* Copyright  (C) 2010-2014 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (rpool.h).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef __LIBRETRO_SDK_RPOOL_H__
+#define __LIBRETRO_SDK_RPOOL_H__
+
+#include <stddef.h>
+#include <boolean.h>
+
+#if defined(__cplusplus) && !defined(MSC_VER)
+extern "C" {
+#endif
+
+/* Work-stealing thread pool.
+ *
+ * Every worker has its own queue, and submitted tasks are spread 
+ * over all of them. Workers run their own queue newest first and 
+ * steal the oldest tasks from the others before going to sleep.
+ *
+ * A thread waiting for its tasks runs queued tasks itself 
+ * meanwhile, so nesting and pools without workers work fine. */
+
+typedef struct rpool rpool_t;
+
+typedef void (*rpool_task_t)(void *userdata, unsigned index);
+
+/* Tracks a set of submitted tasks. Zero before first use. */
+typedef struct rpool_wait
+{
+   volatile size_t remaining;
+} rpool_wait_t;
+
+/* threads may be 0, in which case tasks only run while waiting. */
+rpool_t *rpool_new(unsigned threads);
+
+/* Tasks still queued are dropped. */
+void rpool_free(rpool_t *pool);
+
+unsigned rpool_num_threads(rpool_t *pool);
+
+/* Queues task(userdata, index) for index in [first, first + count). */
+void rpool_submit(rpool_t *pool, rpool_task_t task, void *userdata,
+      unsigned first, unsigned count, rpool_wait_t *wait);
+
+/* Returns once every task submitted with wait has run. */
+void rpool_wait(rpool_t *pool, rpool_wait_t *wait);
+
+/* Runs task(userdata, index) for index in [0, count) 
+ * and waits for them. pool may be NULL, running everything 
+ * on the calling thread. */
+void rpool_parallel_for(rpool_t *pool, unsigned count,
+      rpool_task_t task, void *userdata);
+
+/* Process-wide pool, created on first acquire with the given 
+ * number of workers and freed on the last release. 
+ * Acquire and release from one thread only. */
+rpool_t *rpool_shared_acquire(unsigned threads);
+
+void rpool_shared_release(void);
+
+#if defined(__cplusplus) && !defined(MSC_VER)
+}
+#endif
+
+#endif
@@ -0,0 +1,396 @@
+/* Copyright  (C) 2010-2014 The RetroArch team
+ *
+ * ---------------------------------------------------------------------------------------
+ * The following license statement only applies to this file (rpool.c).
+ * ---------------------------------------------------------------------------------------
+ *
+ * Permission is hereby granted, free of charge,
+ * to any person obtaining a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+ * INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rthreads/rthreads.h>
+#include <rthreads/ratomic.h>
+#include <rthreads/rpool.h>
+
+struct rpool_job
+{
+   rpool_task_t task;
+   void *userdata;
+   unsigned index;
+   rpool_wait_t *wait;
+};
+
+/* Ring of jobs. The owner pops from the back, thieves from the front. */
+struct rpool_queue
+{
+   slock_t *lock;
+   struct rpool_job *jobs;
+   unsigned capacity;
+   unsigned head;
+   unsigned count;
+   /* Queues are hammered by different threads. */
+   uint8_t pad[64];
+};
+
+struct rpool_worker
+{
+   rpool_t *pool;
+   unsigned index;
+   sthread_t *thread;
+};
+
+struct rpool
+{
+   struct rpool_queue *queues;
+   unsigned num_queues;
+
+   struct rpool_worker *workers;
+   unsigned num_threads;
+
+   /* Jobs queued and not taken yet. */
+   volatile size_t queued;
+   volatile size_t sleepers;
+   volatile size_t next_queue;
+
+   slock_t *lock;
+   /* Signalled when jobs are queued or when quitting. */
+   scond_t *cond;
+   /* Signalled when a wait is done. */
+   scond_t *done_cond;
+   bool quit;
+};
+
+static bool rpool_queue_push(struct rpool_queue *queue,
+      const struct rpool_job *job)
+{
+   slock_lock(queue->lock);
+
+   if (queue->count == queue->capacity)
+   {
+      unsigned i;
+      unsigned capacity = queue->capacity ? queue->capacity * 2 : 64;
+      struct rpool_job *jobs = (struct rpool_job*)
+         malloc(capacity * sizeof(*jobs));
+
+      if (!jobs)
+      {
+         slock_unlock(queue->lock);
+         return false;
+      }
+
+      for (i = 0; i < queue->count; i++)
+         jobs[i] = queue->jobs[(queue->head + i) & (queue->capacity - 1)];
+
+      free(queue->jobs);
+      queue->jobs = jobs;
+      queue->capacity = capacity;
+      queue->head = 0;
+   }
+
+   queue->jobs[(queue->head + queue->count) & (queue->capacity - 1)] = *job;
+   queue->count++;
+
+   slock_unlock(queue->lock);
+   return true;
+}
+
+static bool rpool_queue_pop(struct rpool_queue *queue,
+      struct rpool_job *job, bool steal)
+{
+   bool ret = false;
+
+   slock_lock(queue->lock);
+   if (queue->count)
+   {
+      if (steal)
+      {
+         *job = queue->jobs[queue->head];
+         queue->head = (queue->head + 1) & (queue->capacity - 1);
+      }
+      else
+         *job = queue->jobs[(queue->head + queue->count - 1) &
+            (queue->capacity - 1)];
+
+      queue->count--;
+      ret = true;
+   }
+   slock_unlock(queue->lock);
+
+   return ret;
+}
+
+/* Takes a job from queue home, or steals one. */
+static bool rpool_take(rpool_t *pool, unsigned home, struct rpool_job *job)
+{
+   unsigned i;
+
+   if (!ratomic_load_acquire(&pool->queued))
+      return false;
+
+   for (i = 0; i < pool->num_queues; i++)
+   {
+      unsigned index = (home + i) % pool->num_queues;
+      if (rpool_queue_pop(&pool->queues[index], job, i != 0))
+      {
+         ratomic_add(&pool->queued, (size_t)-1);
+         return true;
+      }
+   }
+
+   return false;
+}
+
+static void rpool_run(rpool_t *pool, const struct rpool_job *job)
+{
+   job->task(job->userdata, job->index);
+
+   /* The waiter may return as soon as remaining drops to zero, 
+    * so don't touch the wait afterwards. */
+   if (ratomic_add(&job->wait->remaining, (size_t)-1) == 0)
+   {
+      slock_lock(pool->lock);
+      scond_broadcast(pool->done_cond);
+      slock_unlock(pool->lock);
+   }
+}
+
+static void rpool_worker_loop(void *data)
+{
+   struct rpool_worker *worker = (struct rpool_worker*)data;
+   rpool_t *pool = worker->pool;
+
+   for (;;)
+   {
+      struct rpool_job job;
+      bool quit;
+
+      if (rpool_take(pool, worker->index, &job))
+      {
+         rpool_run(pool, &job);
+         continue;
+      }
+
+      slock_lock(pool->lock);
+      /* Full barrier, pairs with the one in rpool_submit. */
+      ratomic_add(&pool->sleepers, 1);
+      while (!ratomic_load_acquire(&pool->queued) && !pool->quit)
+         scond_wait(pool->cond, pool->lock);
+      ratomic_add(&pool->sleepers, (size_t)-1);
+      quit = pool->quit;
+      slock_unlock(pool->lock);
+
+      if (quit)
+         break;
+   }
+}
+
+rpool_t *rpool_new(unsigned threads)
+{
+   unsigned i;
+   rpool_t *pool = (rpool_t*)calloc(1, sizeof(*pool));
+   if (!pool)
+      return NULL;
+
+   pool->num_queues = threads ? threads : 1;
+   pool->queues = (struct rpool_queue*)
+      calloc(pool->num_queues, sizeof(*pool->queues));
+   pool->workers = (struct rpool_worker*)
+      calloc(threads ? threads : 1, sizeof(*pool->workers));
+   pool->lock = slock_new();
+   pool->cond = scond_new();
+   pool->done_cond = scond_new();
+
+   if (!pool->queues || !pool->workers || !pool->lock ||
+         !pool->cond || !pool->done_cond)
+      goto error;
+
+   for (i = 0; i < pool->num_queues; i++)
+   {
+      pool->queues[i].lock = slock_new();
+      if (!pool->queues[i].lock)
+         goto error;
+   }
+
+   for (i = 0; i < threads; i++)
+   {
+      pool->workers[i].pool = pool;
+      pool->workers[i].index = i;
+      pool->workers[i].thread = sthread_create(rpool_worker_loop,
+            &pool->workers[i]);
+      if (!pool->workers[i].thread)
+         goto error;
+      pool->num_threads++;
+   }
+
+   return pool;
+
+error:
+   rpool_free(pool);
+   return NULL;
+}
+
+void rpool_free(rpool_t *pool)
+{
+   unsigned i;
+
+   if (!pool)
+      return;
+
+   if (pool->num_threads)
+   {
+      slock_lock(pool->lock);
+      pool->quit = true;
+      scond_broadcast(pool->cond);
+      slock_unlock(pool->lock);
+
+      for (i = 0; i < pool->num_threads; i++)
+         sthread_join(pool->workers[i].thread);
+   }
+
+   if (pool->queues)
+   {
+      for (i = 0; i < pool->num_queues; i++)
+      {
+         if (pool->queues[i].lock)
+            slock_free(pool->queues[i].lock);
+         free(pool->queues[i].jobs);
+      }
+   }
+
+   if (pool->lock)
+      slock_free(pool->lock);
+   if (pool->cond)
+      scond_free(pool->cond);
+   if (pool->done_cond)
+      scond_free(pool->done_cond);
+
+   free(pool->queues);
+   free(pool->workers);
+   free(pool);
+}
+
+unsigned rpool_num_threads(rpool_t *pool)
+{
+   return pool ? pool->num_threads : 0;
+}
+
+void rpool_submit(rpool_t *pool, rpool_task_t task, void *userdata,
+      unsigned first, unsigned count, rpool_wait_t *wait)
+{
+   unsigned i;
+   unsigned queue;
+
+   if (!count)
+      return;
+
+   ratomic_add(&wait->remaining, count);
+   queue = ratomic_add(&pool->next_queue, count) - count;
+
+   for (i = 0; i < count; i++)
+   {
+      struct rpool_job job;
+      job.task = task;
+      job.userdata = userdata;
+      job.index = first + i;
+      job.wait = wait;
+
+      if (!rpool_queue_push(&pool->queues[(queue + i) % pool->num_queues],
+               &job))
+      {
+         /* Out of memory, run it right away. */
+         rpool_run(pool, &job);
+         continue;
+      }
+
+      ratomic_add(&pool->queued, 1);
+   }
+
+   /* Either a sleeping worker sees the new jobs, or we see it sleeping. */
+   if (ratomic_load_acquire(&pool->sleepers))
+   {
+      slock_lock(pool->lock);
+      scond_broadcast(pool->cond);
+      slock_unlock(pool->lock);
+   }
+}
+
+void rpool_wait(rpool_t *pool, rpool_wait_t *wait)
+{
+   unsigned home = 0;
+
+   while (ratomic_load_acquire(&wait->remaining))
+   {
+      struct rpool_job job;
+
+      /* Help out instead of sleeping. */
+      if (rpool_take(pool, home++ % pool->num_queues, &job))
+      {
+         rpool_run(pool, &job);
+         continue;
+      }
+
+      slock_lock(pool->lock);
+      if (ratomic_load_acquire(&wait->remaining) &&
+            !ratomic_load_acquire(&pool->queued))
+         scond_wait(pool->done_cond, pool->lock);
+      slock_unlock(pool->lock);
+   }
+}
+
+void rpool_parallel_for(rpool_t *pool, unsigned count,
+      rpool_task_t task, void *userdata)
+{
+   rpool_wait_t wait = {0};
+
+   if (!pool)
+   {
+      unsigned i;
+      for (i = 0; i < count; i++)
+         task(userdata, i);
+      return;
+   }
+
+   rpool_submit(pool, task, userdata, 0, count, &wait);
+   rpool_wait(pool, &wait);
+}
+
+static rpool_t *rpool_shared;
+static unsigned rpool_shared_refs;
+
+rpool_t *rpool_shared_acquire(unsigned threads)
+{
+   if (!rpool_shared)
+   {
+      rpool_shared = rpool_new(threads);
+      if (!rpool_shared)
+         return NULL;
+   }
+
+   rpool_shared_refs++;
+   return rpool_shared;
+}
+
+void rpool_shared_release(void)
+{
+   if (!rpool_shared_refs || --rpool_shared_refs)
+      return;
+
+   rpool_free(rpool_shared);
+   rpool_shared = NULL;
+}
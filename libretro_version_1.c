@@ -111,35 +111,177 @@ static void video_frame(const void *data, unsigned width,
       driver.video_active = false;
 }
 
+/* Driver buffer fill (as a fraction) under which we count an underrun,
+ * and the range the adaptive target fill may move in. */
+#define AUDIO_UNDERRUN_FILL     (1.0f / 32.0f)
+#define AUDIO_TARGET_FILL_MIN   (1.0f / 8.0f)
+#define AUDIO_TARGET_FILL_MAX   (3.0f / 4.0f)
+#define AUDIO_TARGET_FILL_GROW  (1.0f / 8.0f)
+/* Calls between attempts to lower the target fill. */
+#define AUDIO_ADAPT_WINDOW      256
+
+/* Moves the target fill towards how far the buffer dipped below
+ * its average over the last window of buffer_free_samples, plus
+ * a safety margin. Only ever lowers it, underruns raise it. */
+static void adapt_audio_latency(void)
+{
+   unsigned i, max_avail = 0;
+   uint64_t accum = 0;
+   float avg_fill, min_fill, wanted;
+   uint64_t count = g_extern.measure_data.buffer_free_samples_count;
+   size_t size = g_extern.audio_data.driver_buffer_size;
+
+   for (i = 0; i < AUDIO_ADAPT_WINDOW; i++)
+   {
+      unsigned avail = g_extern.measure_data.buffer_free_samples[
+         (count - 1 - i) & (AUDIO_BUFFER_FREE_SAMPLES_COUNT - 1)];
+      accum += avail;
+      if (avail > max_avail)
+         max_avail = avail;
+   }
+
+   avg_fill = 1.0f - (float)accum / AUDIO_ADAPT_WINDOW / size;
+   min_fill = 1.0f - (float)max_avail / size;
+   wanted   = avg_fill - min_fill + 2.0f * AUDIO_UNDERRUN_FILL;
+   if (wanted < AUDIO_TARGET_FILL_MIN)
+      wanted = AUDIO_TARGET_FILL_MIN;
+
+   if (wanted < g_extern.audio_data.target_fill)
+      g_extern.audio_data.target_fill -=
+         (g_extern.audio_data.target_fill - wanted) / 4.0f;
+}
+
+/* PI controller on the driver buffer fill.
+ * The proportional term is what plain rate control always did,
+ * the integral term converges on the skew between the audio
+ * clock and the content, so the buffer sits at the target
+ * instead of wherever the skew puts it. */
 static void readjust_audio_input_rate(void)
 {
    int avail = driver.audio->write_avail(driver.audio_data);
+   size_t size = g_extern.audio_data.driver_buffer_size;
 
    //RARCH_LOG_OUTPUT("Audio buffer is %u%% full\n",
    //      (unsigned)(100 - (avail * 100) / g_extern.audio_data.driver_buffer_size));
 
    unsigned write_idx = g_extern.measure_data.buffer_free_samples_count++ &
       (AUDIO_BUFFER_FREE_SAMPLES_COUNT - 1);
-   int      half_size   = g_extern.audio_data.driver_buffer_size / 2;
-   int      delta_mid   = avail - half_size;
-   double   direction   = (double)delta_mid / half_size;
-   double   adjust      = 1.0 + g_settings.audio.rate_control_delta *
-      direction;
+   double   delta       = g_settings.audio.rate_control_delta;
+   float    fill        = 1.0f - (float)avail / size;
+   double   error       = g_extern.audio_data.target_fill - fill;
+   double   correction;
 
    g_extern.measure_data.buffer_free_samples[write_idx] = avail;
-   g_extern.audio_data.src_ratio = g_extern.audio_data.orig_src_ratio * adjust;
+
+   /* Fast forward drops audio, the fill level means nothing then. 
+    * Keep the rate and the skew estimate as they were before it. */
+   if (driver.nonblock_state)
+      return;
+
+   if (g_settings.audio.latency_adaptive)
+   {
+      if (fill < AUDIO_UNDERRUN_FILL)
+      {
+         if (!g_extern.audio_data.underrun)
+         {
+            g_extern.audio_data.underruns++;
+            g_extern.audio_data.target_fill += AUDIO_TARGET_FILL_GROW;
+            if (g_extern.audio_data.target_fill > AUDIO_TARGET_FILL_MAX)
+               g_extern.audio_data.target_fill = AUDIO_TARGET_FILL_MAX;
+            g_extern.audio_data.adapt_count = 0;
+         }
+         g_extern.audio_data.underrun = true;
+      }
+      else
+         g_extern.audio_data.underrun = false;
+
+      if (++g_extern.audio_data.adapt_count >= AUDIO_ADAPT_WINDOW)
+      {
+         adapt_audio_latency();
+         g_extern.audio_data.adapt_count = 0;
+      }
+   }
+
+   g_extern.audio_data.rate_integral += 2.0 * delta * error /
+      AUDIO_ADAPT_WINDOW;
+   if (g_extern.audio_data.rate_integral > delta)
+      g_extern.audio_data.rate_integral = delta;
+   else if (g_extern.audio_data.rate_integral < -delta)
+      g_extern.audio_data.rate_integral = -delta;
+
+   correction = 2.0 * delta * error + g_extern.audio_data.rate_integral;
+   if (correction > delta)
+      correction = delta;
+   else if (correction < -delta)
+      correction = -delta;
+
+   g_extern.audio_data.src_ratio = g_extern.audio_data.orig_src_ratio *
+      (1.0 + correction);
 
    //RARCH_LOG_OUTPUT("New rate: %lf, Orig rate: %lf\n",
    //      g_extern.audio_data.src_ratio, g_extern.audio_data.orig_src_ratio);
 }
 
+/* Resamples DSP output in pieces no larger than a tile, so that
+ * output always fits in the scratch space. Block based DSP filters
+ * may return several tiles worth of frames at once. */
+static size_t audio_flush_resample(const float *in, size_t frames,
+      size_t output_frames, double ratio)
+{
+   float *tile_out = g_extern.audio_data.data + AUDIO_TILE_FRAMES * 2;
+
+   RARCH_PERFORMANCE_INIT(resampler_proc);
+   RARCH_PERFORMANCE_INIT(audio_convert_float);
+
+   while (frames)
+   {
+      struct resampler_data src_data = {0};
+      size_t in_frames = frames < AUDIO_TILE_FRAMES ?
+         frames : AUDIO_TILE_FRAMES;
+
+      src_data.data_in      = in;
+      src_data.input_frames = in_frames;
+      src_data.ratio        = ratio;
+      src_data.data_out     = g_extern.audio_data.use_float ?
+         g_extern.audio_data.outsamples + output_frames * 2 : tile_out;
+
+      RARCH_PERFORMANCE_START(resampler_proc);
+      rarch_resampler_process(driver.resampler,
+            driver.resampler_data, &src_data);
+      RARCH_PERFORMANCE_STOP(resampler_proc);
+
+      if (!g_extern.audio_data.use_float)
+      {
+         RARCH_PERFORMANCE_START(audio_convert_float);
+         audio_convert_float_to_s16(g_extern.audio_data.outsamples_s16 +
+               output_frames * 2, tile_out, src_data.output_frames * 2);
+         RARCH_PERFORMANCE_STOP(audio_convert_float);
+      }
+
+      output_frames += src_data.output_frames;
+      in            += in_frames * 2;
+      frames        -= in_frames;
+   }
+
+   return output_frames;
+}
+
+/* Runs conversion, DSP and resampling tile by tile, rather than
+ * one pass over the whole chunk per stage.
+ *
+ * Volume gain is applied by the s16 to float kernel itself.
+ * The DSP chain and the resampler are plugins that only take
+ * float buffers, so they can't be fused into the conversions.
+ * Instead, every stage of a tile works on data that the previous
+ * stage has just left in cache. */
 static bool audio_flush(const int16_t *data, size_t samples)
 {
-   const void *output_data        = NULL;
-   unsigned output_frames         = 0;
-   size_t   output_size           = sizeof(float);
-   struct resampler_data src_data = {0};
-   struct rarch_dsp_data dsp_data = {0};
+   const void *output_data = NULL;
+   size_t output_frames    = 0;
+   size_t output_size      = sizeof(float);
+   size_t frames           = samples >> 1;
+   float *tile_in          = NULL;
+   double ratio;
 
    if (driver.recording_data)
    {
@@ -157,54 +299,54 @@ static bool audio_flush(const int16_t *data, size_t samples)
       return false;
 
    RARCH_PERFORMANCE_INIT(audio_convert_s16);
-   RARCH_PERFORMANCE_START(audio_convert_s16);
-   audio_convert_s16_to_float(g_extern.audio_data.data, data, samples,
-         g_extern.audio_data.volume_gain);
-   RARCH_PERFORMANCE_STOP(audio_convert_s16);
+   RARCH_PERFORMANCE_INIT(audio_dsp);
+
+   if (g_extern.audio_data.rate_control)
+      readjust_audio_input_rate();
+
+   ratio = g_extern.audio_data.src_ratio;
+   if (g_extern.is_slowmotion)
+      ratio *= g_settings.slowmotion_ratio;
 
-   dsp_data.input                 = g_extern.audio_data.data;
-   dsp_data.input_frames          = samples >> 1;
+   tile_in = g_extern.audio_data.data;
 
-   if (g_extern.audio_data.dsp)
+   while (frames)
    {
-      RARCH_PERFORMANCE_INIT(audio_dsp);
-      RARCH_PERFORMANCE_START(audio_dsp);
-      rarch_dsp_filter_process(g_extern.audio_data.dsp, &dsp_data);
-      RARCH_PERFORMANCE_STOP(audio_dsp);
-   }
+      struct rarch_dsp_data dsp_data = {0};
+      size_t tile_frames = frames < AUDIO_TILE_FRAMES ?
+         frames : AUDIO_TILE_FRAMES;
 
-   src_data.data_in      = dsp_data.output ?
-      dsp_data.output : g_extern.audio_data.data;
-   src_data.input_frames = dsp_data.output ?
-      dsp_data.output_frames : (samples >> 1);
+      RARCH_PERFORMANCE_START(audio_convert_s16);
+      audio_convert_s16_to_float(tile_in, data, tile_frames * 2,
+            g_extern.audio_data.volume_gain);
+      RARCH_PERFORMANCE_STOP(audio_convert_s16);
 
-   src_data.data_out = g_extern.audio_data.outsamples;
+      dsp_data.input        = tile_in;
+      dsp_data.input_frames = tile_frames;
 
-   if (g_extern.audio_data.rate_control)
-      readjust_audio_input_rate();
+      if (g_extern.audio_data.dsp)
+      {
+         RARCH_PERFORMANCE_START(audio_dsp);
+         rarch_dsp_filter_process(g_extern.audio_data.dsp, &dsp_data);
+         RARCH_PERFORMANCE_STOP(audio_dsp);
+      }
 
-   src_data.ratio = g_extern.audio_data.src_ratio;
-   if (g_extern.is_slowmotion)
-      src_data.ratio *= g_settings.slowmotion_ratio;
+      if (dsp_data.output)
+         output_frames = audio_flush_resample(dsp_data.output,
+               dsp_data.output_frames, output_frames, ratio);
+      else
+         output_frames = audio_flush_resample(tile_in,
+               tile_frames, output_frames, ratio);
 
-   RARCH_PERFORMANCE_INIT(resampler_proc);
-   RARCH_PERFORMANCE_START(resampler_proc);
-   rarch_resampler_process(driver.resampler,
-         driver.resampler_data, &src_data);
-   RARCH_PERFORMANCE_STOP(resampler_proc);
+      data   += tile_frames * 2;
+      frames -= tile_frames;
+   }
 
-   output_data   = g_extern.audio_data.outsamples;
-   output_frames = src_data.output_frames;
+   output_data = g_extern.audio_data.outsamples;
 
    if (!g_extern.audio_data.use_float)
    {
-      RARCH_PERFORMANCE_INIT(audio_convert_float);
-      RARCH_PERFORMANCE_START(audio_convert_float);
-      audio_convert_float_to_s16(g_extern.audio_data.conv_outsamples,
-            (const float*)output_data, output_frames * 2);
-      RARCH_PERFORMANCE_STOP(audio_convert_float);
-
-      output_data = g_extern.audio_data.conv_outsamples;
+      output_data = g_extern.audio_data.outsamples_s16;
       output_size = sizeof(int16_t);
    }
 
@@ -23,15 +23,22 @@
 #include "autosave.h"
 #include "dynamic.h"
 #include "message_queue.h"
+#include "performance.h"
+#include "spsc_buffer.h"
+#include <rthreads/ratomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+
+#ifdef HAVE_THREADS
+#include <rthreads/rthreads.h>
+#endif
 
-/* Checks if input port/index is controlled by netplay or not. */
 static bool netplay_is_alive(netplay_t *netplay);
 
 static bool netplay_poll(netplay_t *netplay);
 
-static int16_t netplay_input_state(netplay_t *netplay, bool port,
+static int16_t netplay_input_state(netplay_t *netplay, unsigned port,
       unsigned device, unsigned idx, unsigned id);
 
 /* If we're fast-forward replaying to resync, check if we 
@@ -42,94 +49,229 @@ static bool netplay_can_poll(netplay_t *netplay);
 
 static void netplay_set_spectate_input(netplay_t *netplay, int16_t input);
 
-static bool netplay_send_cmd(netplay_t *netplay, uint32_t cmd,
-      const void *data, size_t size);
+struct netplay_peer;
+
+static bool netplay_send_cmd(netplay_t *netplay, struct netplay_peer *peer,
+      uint32_t cmd, const void *data, size_t size);
+
+static bool netplay_handle_cmd(netplay_t *netplay, struct netplay_peer *peer,
+      uint32_t cmd, const void *data, size_t size);
 
-static bool netplay_get_cmd(netplay_t *netplay);
+static bool netplay_io_init(netplay_t *netplay);
 
-#define PREV_PTR(x) ((x) == 0 ? netplay->buffer_size - 1 : (x) - 1)
-#define NEXT_PTR(x) ((x + 1) % netplay->buffer_size)
+static void netplay_io_deinit(netplay_t *netplay);
+
+#define NETPLAY_ANALOG_AXES 4
+#define NETPLAY_INPUT_WORDS 3
+
+/* Input of one player on one frame. */
+struct netplay_input
+{
+   uint32_t buttons;
+   /* Left X, left Y, right X, right Y. */
+   int16_t analog[NETPLAY_ANALOG_AXES];
+};
 
 struct delta_frame
 {
+   /* Frame this slot currently holds. */
+   uint32_t frame;
+
+   /* State right before the frame ran. Only taken for frames 
+    * which ran on predicted input, since those are the only 
+    * ones we can ever have to roll back to. */
    void *state;
+   bool have_state;
+
+   struct netplay_input real_input[MAX_PLAYERS];
+   struct netplay_input simulated_input[MAX_PLAYERS];
+   /* Players whose real input has arrived. */
+   uint32_t have_real;
+   /* Players whose input was predicted the last time the frame ran. */
+   uint32_t simulated;
+};
 
-   uint16_t real_input_state;
-   uint16_t simulated_input_state;
-   uint16_t self_state;
+/* Every packet repeats all input the other side has not 
+ * acknowledged yet, up to this many frames per player, 
+ * so a lost packet is made up for by the next one. */
+#define NETPLAY_PACKET_FRAMES 16
+#define NETPLAY_PACKET_WORDS (1 + MAX_PLAYERS + MAX_PLAYERS * \
+      (3 + NETPLAY_PACKET_FRAMES * NETPLAY_INPUT_WORDS))
 
-   bool is_simulated;
-   bool used_real;
-};
+#define NETPLAY_MAX_FRAMES 60
+#define NETPLAY_NO_ROLLBACK ((uint32_t)-1)
 
-#define UDP_FRAME_PACKETS 16
 #define MAX_SPECTATORS 16
 
 #define NETPLAY_CMD_ACK 0
 #define NETPLAY_CMD_NAK 1
 #define NETPLAY_CMD_FLIP_PLAYERS 2
 
+/* Queued towards a TCP connection. Commands are tiny, spectators 
+ * get their save state header on top of this. */
+#define NETPLAY_CONN_BUFFER (64 * 1024)
+#define NETPLAY_CONN_CHUNK 4096
+#define NETPLAY_CONN_IN 256
+
+enum netplay_conn_state
+{
+   /* Emulation side owns the slot. */
+   NETPLAY_CONN_FREE = 0,
+   /* Transport reads the spectator's nick. */
+   NETPLAY_CONN_HANDSHAKE,
+   /* Streaming once the emulation side has accepted it. */
+   NETPLAY_CONN_READY,
+   /* Closed by the transport, to be freed by the emulation side. */
+   NETPLAY_CONN_DEAD
+};
+
+/* A TCP connection. Only the transport reads or writes the socket; 
+ * the emulation side queues data in out. */
+struct netplay_conn
+{
+   int fd;
+   /* Moved on by the transport, except DEAD -> FREE. */
+   volatile size_t state;
+   /* Set by the emulation side once out holds the stream header. */
+   volatile size_t accepted;
+   /* Set by the emulation side to have the connection dropped. */
+   volatile size_t closing;
+   struct sockaddr_storage addr;
+   socklen_t addr_len;
+
+   spsc_buffer_t *out;
+   /* What was taken out of out, but not sent yet. */
+   uint8_t pending[NETPLAY_CONN_CHUNK];
+   size_t pending_pos;
+   size_t pending_size;
+
+   /* Incomplete incoming message. */
+   uint8_t in[NETPLAY_CONN_IN];
+   size_t in_size;
+};
+
+enum netplay_event_type
+{
+   NETPLAY_EVENT_INPUT = 0,
+   NETPLAY_EVENT_CMD,
+   NETPLAY_EVENT_HANGUP,
+   NETPLAY_EVENT_SPECTATOR,
+   NETPLAY_EVENT_SPECTATOR_GONE
+};
+
+/* Passed from the transport to the emulation side, 
+ * followed by size bytes of data. */
+struct netplay_event
+{
+   uint32_t type;
+   /* Peer or spectator slot. */
+   uint32_t conn;
+   uint32_t cmd;
+   uint32_t size;
+   struct sockaddr_storage addr;
+   socklen_t addr_len;
+};
+
+#define NETPLAY_EVENTS_SIZE (256 * 1024)
+/* Input packets queued for one peer. Only the latest is sent, 
+ * as it repeats everything the older ones had. */
+#define NETPLAY_OUTBOX_SIZE (4 * NETPLAY_PACKET_WORDS * sizeof(uint32_t))
+
+struct netplay_peer
+{
+   /* TCP connection for the handshake and commands. */
+   struct netplay_conn conn;
+   spsc_buffer_t *outbox;
+   char nick[32];
+   /* Player controlled by the peer. The host is always player 0. */
+   unsigned player;
+
+   struct sockaddr_storage addr;
+   socklen_t addr_len;
+   bool has_addr;
+
+   /* Peer has all input of player i up to, but not including, ack[i]. */
+   uint32_t ack[MAX_PLAYERS];
+};
+
 struct netplay
 {
    char nick[32];
    char other_nick[32];
-   struct sockaddr_storage other_addr;
 
    struct retro_callbacks cbs;
-   /* TCP connection for state sending, etc. Also used for commands */
+   /* TCP connection for state sending, etc. 
+    * The host listens on it until every player has joined. */
    int fd;
    /* UDP connection for game state updates. */
    int udp_fd;
-   /* Which port is governed by netplay (other player)? */
-   unsigned port;
    bool has_connection;
 
-   struct delta_frame *buffer;
-   size_t buffer_size;
+   /* Transport. Runs on its own thread if we have threads, 
+    * and inline whenever we poll otherwise. */
+   spsc_buffer_t *events;
+#ifdef HAVE_THREADS
+   sthread_t *io_thread;
+   slock_t *io_lock;
+   scond_t *io_cond;
+   /* Loopback socket the transport listens on to be woken up. */
+   int wake_fd;
+   struct sockaddr_in wake_addr;
+   volatile bool io_quit;
+#endif
 
-   /* Pointer where we are now. */
-   size_t self_ptr; 
-   /* Points to the last reliable state that self ever had. */
-   size_t other_ptr;
-   /* Pointer to where we are reading. 
-    * Generally, other_ptr <= read_ptr <= self_ptr. */
-   size_t read_ptr;
-   /* A temporary pointer used on replay. */
-   size_t tmp_ptr;
+   /* Which player we are, out of how many. */
+   unsigned player;
+   unsigned players;
 
+   /* The host exchanges input with every client, 
+    * clients only with the host. */
+   struct netplay_peer peers[MAX_PLAYERS - 1];
+   unsigned num_peers;
+
+   /* Local input is applied input_delay frames after it is read. 
+    * Up to rollback_frames frames may run on predicted input 
+    * before we have to wait for the slowest player. */
+   unsigned input_delay;
+   unsigned rollback_frames;
+
+   struct delta_frame *buffer;
+   size_t buffer_size;
    size_t state_size;
 
+   /* Frame we are about to run, or running. */
+   uint32_t frame_count;
+   /* We have all input of player i up to, but not including, 
+    * read_frame[i]. */
+   uint32_t read_frame[MAX_PLAYERS];
+   /* Latest real input of each player, which is what we predict. */
+   struct netplay_input last_input[MAX_PLAYERS];
+   /* Earliest frame known to have run on a wrong prediction. */
+   uint32_t rollback_frame;
+
    /* Are we replaying old frames? */
    bool is_replay;
+   uint32_t replay_frame;
    /* We don't want to poll several times on a frame. */
    bool can_poll;
 
-   /* To compat UDP packet loss we also send 
-    * old data along with the packets. */
-   uint32_t packet_buffer[UDP_FRAME_PACKETS * 2];
-   uint32_t frame_count;
-   uint32_t read_frame_count;
-   uint32_t other_frame_count;
-   uint32_t tmp_frame_count;
    struct addrinfo *addr;
-   struct sockaddr_storage their_addr;
-   bool has_client_addr;
 
    unsigned timeout_cnt;
 
    /* Spectating. */
    bool spectate;
    bool spectate_client;
-   int spectate_fds[MAX_SPECTATORS];
+   struct netplay_conn spectators[MAX_SPECTATORS];
    uint16_t *spectate_input;
    size_t spectate_input_ptr;
    size_t spectate_input_size;
 
    /* Player flipping
-    * Flipping state. If ptr >= flip_frame, we apply the flip.
+    * Flipping state. If frame >= flip_frame, we apply the flip.
     * If not, we apply the opposite, effectively creating a trigger point.
-    * To avoid collition we need to make sure our client/host is synced up 
-    * well after flip_frame before allowing another flip. */
+    * To avoid collition we need to make sure all clients and the host 
+    * are synced up well after flip_frame before allowing another flip. */
    bool flip;
    uint32_t flip_frame;
 };
@@ -265,8 +407,7 @@ static void log_connection(const struct sockaddr_storage *their_addr,
 #endif
 
 static int init_tcp_connection(const struct addrinfo *res,
-      bool server, bool spectate,
-      struct sockaddr *other_addr, socklen_t addr_size)
+      bool server, bool spectate)
 {
    bool ret = true;
    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
@@ -284,39 +425,19 @@ static int init_tcp_connection(const struct addrinfo *res,
          goto end;
       }
    }
-   else if (spectate)
-   {
-      int yes = 1;
-      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, CONST_CAST &yes, sizeof(int));
-
-      if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
-            listen(fd, MAX_SPECTATORS) < 0)
-      {
-         ret = false;
-         goto end;
-      }
-   }
    else
    {
+      /* Players are accepted in netplay_new, spectators 
+       * as they come in. */
       int yes = 1;
       setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, CONST_CAST &yes, sizeof(int));
 
       if (bind(fd, res->ai_addr, res->ai_addrlen) < 0 ||
-            listen(fd, 1) < 0)
-      {
-         ret = false;
-         goto end;
-      }
-
-      int new_fd = accept(fd, other_addr, &addr_size);
-      if (new_fd < 0)
+            listen(fd, spectate ? MAX_SPECTATORS : MAX_PLAYERS) < 0)
       {
          ret = false;
          goto end;
       }
-
-      close(fd);
-      fd = new_fd;
    }
 
 end:
@@ -360,9 +481,8 @@ static bool init_tcp_socket(netplay_t *netplay, const char *server,
    while (tmp_info)
    {
       int fd;
-      if ((fd = init_tcp_connection(tmp_info, server, netplay->spectate,
-               (struct sockaddr*)&netplay->other_addr,
-               sizeof(netplay->other_addr))) >= 0)
+      if ((fd = init_tcp_connection(tmp_info, server,
+                  netplay->spectate)) >= 0)
       {
          ret = true;
          netplay->fd = fd;
@@ -553,6 +673,9 @@ static bool get_nickname(netplay_t *netplay, int fd)
       return false;
    }
 
+   /* Sent without terminator, and the buffer is reused per peer. */
+   netplay->other_nick[nick_size] = '\0';
+
    return true;
 }
 
@@ -594,14 +717,49 @@ static bool send_info(netplay_t *netplay)
    RARCH_LOG("%s\n", msg);
    msg_queue_push(g_extern.msg_queue, msg, 1, 180);
 
+   /* Arrives once every player has joined. */
+   uint32_t config[4];
+   if (!recv_all(netplay->fd, config, sizeof(config)))
+   {
+      RARCH_ERR("Failed to receive session setup from host.\n");
+      return false;
+   }
+
+   netplay->player          = ntohl(config[0]);
+   netplay->players         = ntohl(config[1]);
+   netplay->input_delay     = ntohl(config[2]);
+   netplay->rollback_frames = ntohl(config[3]);
+
+   if (netplay->players > MAX_PLAYERS ||
+         netplay->player == 0 || netplay->player >= netplay->players ||
+         netplay->input_delay > NETPLAY_MAX_FRAMES ||
+         netplay->rollback_frames > NETPLAY_MAX_FRAMES)
+   {
+      RARCH_ERR("Received invalid session setup from host.\n");
+      return false;
+   }
+
+   struct netplay_peer *peer = &netplay->peers[0];
+   peer->conn.fd = netplay->fd;
+   peer->player = 0;
+   strlcpy(peer->nick, netplay->other_nick, sizeof(peer->nick));
+   memcpy(&peer->addr, netplay->addr->ai_addr, netplay->addr->ai_addrlen);
+   peer->addr_len = netplay->addr->ai_addrlen;
+   peer->has_addr = true;
+   netplay->num_peers = 1;
+   netplay->fd = -1;
+
+   RARCH_LOG("Playing as player %u of %u.\n",
+         netplay->player + 1, netplay->players);
+
    return true;
 }
 
-static bool get_info(netplay_t *netplay)
+static bool get_info(netplay_t *netplay, struct netplay_peer *peer)
 {
    uint32_t header[3];
 
-   if (!recv_all(netplay->fd, header, sizeof(header)))
+   if (!recv_all(peer->conn.fd, header, sizeof(header)))
    {
       RARCH_ERR("Failed to receive header from client.\n");
       return false;
@@ -625,31 +783,82 @@ static bool get_info(netplay_t *netplay)
       return false;
    }
 
-   if (!get_nickname(netplay, netplay->fd))
+   if (!get_nickname(netplay, peer->conn.fd))
    {
       RARCH_ERR("Failed to get nickname from client.\n");
       return false;
    }
+   strlcpy(peer->nick, netplay->other_nick, sizeof(peer->nick));
 
-   /* Send SRAM data to our Player 2. */
+   /* Send SRAM data to the new player. */
    const void *sram = pretro_get_memory_data(RETRO_MEMORY_SAVE_RAM);
    unsigned sram_size = pretro_get_memory_size(RETRO_MEMORY_SAVE_RAM);
-   if (!send_all(netplay->fd, sram, sram_size))
+   if (!send_all(peer->conn.fd, sram, sram_size))
    {
       RARCH_ERR("Failed to send SRAM data to client.\n");
       return false;
    }
 
-   if (!send_nickname(netplay, netplay->fd))
+   if (!send_nickname(netplay, peer->conn.fd))
    {
       RARCH_ERR("Failed to send nickname to client.\n");
       return false;
    }
 
+   return true;
+}
+
+/* Waits for every other player to join, then tells all of 
+ * them who they are and how the session is set up. */
+static bool accept_players(netplay_t *netplay)
+{
+   unsigned i;
+
+   for (i = 0; i < netplay->players - 1; i++)
+   {
+      struct netplay_peer *peer = &netplay->peers[i];
+      struct sockaddr_storage their_addr;
+      socklen_t addr_size = sizeof(their_addr);
+
+      RARCH_LOG("Waiting for player %u of %u ...\n", i + 2, netplay->players);
+
+      peer->conn.fd = accept(netplay->fd, (struct sockaddr*)&their_addr,
+            &addr_size);
+      if (peer->conn.fd < 0)
+      {
+         RARCH_ERR("Failed to accept incoming player.\n");
+         return false;
+      }
+
+      peer->player = i + 1;
+      netplay->num_peers++;
+
+      if (!get_info(netplay, peer))
+         return false;
+
 #ifndef HAVE_SOCKET_LEGACY
-   log_connection(&netplay->other_addr, 0, netplay->other_nick);
+      log_connection(&their_addr, peer->player, peer->nick);
 #endif
+   }
+
+   for (i = 0; i < netplay->num_peers; i++)
+   {
+      uint32_t config[4] = {
+         htonl(netplay->peers[i].player),
+         htonl(netplay->players),
+         htonl(netplay->input_delay),
+         htonl(netplay->rollback_frames)
+      };
 
+      if (!send_all(netplay->peers[i].conn.fd, config, sizeof(config)))
+      {
+         RARCH_ERR("Failed to send session setup to client.\n");
+         return false;
+      }
+   }
+
+   close(netplay->fd);
+   netplay->fd = -1;
    return true;
 }
 
@@ -770,9 +979,29 @@ static bool get_info_spectate(netplay_t *netplay)
    return ret;
 }
 
+static struct delta_frame *netplay_delta(netplay_t *netplay, uint32_t frame)
+{
+   struct delta_frame *delta = &netplay->buffer[frame % netplay->buffer_size];
+
+   if (delta->frame != frame)
+   {
+      delta->frame = frame;
+      delta->have_state = false;
+      delta->have_real = 0;
+      delta->simulated = 0;
+   }
+
+   return delta;
+}
+
 static bool init_buffers(netplay_t *netplay)
 {
-   unsigned i;
+   unsigned i, j;
+
+   /* Room for the frames we may run ahead of the slowest player, 
+    * plus the frames the other players may run ahead of us. */
+   netplay->buffer_size = 2 *
+      (netplay->rollback_frames + netplay->input_delay) + 2;
    netplay->buffer = (struct delta_frame*)calloc(netplay->buffer_size,
          sizeof(*netplay->buffer));
    
@@ -788,20 +1017,39 @@ static bool init_buffers(netplay_t *netplay)
       if (!netplay->buffer[i].state)
          return false;
 
-      netplay->buffer[i].is_simulated = true;
+      netplay->buffer[i].frame = i;
    }
 
+   /* Nobody has any input for the first input_delay frames. */
+   for (i = 0; i < netplay->input_delay; i++)
+      netplay->buffer[i].have_real = (1 << netplay->players) - 1;
+
+   for (i = 0; i < netplay->players; i++)
+   {
+      netplay->read_frame[i] = netplay->input_delay;
+      for (j = 0; j < netplay->num_peers; j++)
+         netplay->peers[j].ack[i] = netplay->input_delay;
+   }
+
+   netplay->rollback_frame = NETPLAY_NO_ROLLBACK;
+
    return true;
 }
 
 netplay_t *netplay_new(const char *server, uint16_t port,
-      unsigned frames, const struct retro_callbacks *cb,
-      bool spectate,
+      unsigned frames, unsigned delay, unsigned players,
+      const struct retro_callbacks *cb, bool spectate,
       const char *nick)
 {
    unsigned i;
-   if (frames > UDP_FRAME_PACKETS)
-      frames = UDP_FRAME_PACKETS;
+   if (frames > NETPLAY_MAX_FRAMES)
+      frames = NETPLAY_MAX_FRAMES;
+   if (delay > NETPLAY_MAX_FRAMES)
+      delay = NETPLAY_MAX_FRAMES;
+   if (players < 2)
+      players = 2;
+   if (players > MAX_PLAYERS)
+      players = MAX_PLAYERS;
 
    netplay_t *netplay = (netplay_t*)calloc(1, sizeof(*netplay));
    if (!netplay)
@@ -809,12 +1057,22 @@ netplay_t *netplay_new(const char *server, uint16_t port,
 
    netplay->fd = -1;
    netplay->udp_fd = -1;
+#ifdef HAVE_THREADS
+   netplay->wake_fd = -1;
+#endif
    netplay->cbs = *cb;
-   netplay->port = server ? 0 : 1;
    netplay->spectate = spectate;
    netplay->spectate_client = server != NULL;
+   netplay->players = players;
+   netplay->input_delay = delay;
+   netplay->rollback_frames = frames;
    strlcpy(netplay->nick, nick, sizeof(netplay->nick));
 
+   for (i = 0; i < MAX_PLAYERS - 1; i++)
+      netplay->peers[i].conn.fd = -1;
+   for (i = 0; i < MAX_SPECTATORS; i++)
+      netplay->spectators[i].fd = -1;
+
    if (!init_socket(netplay, server, port))
    {
       free(netplay);
@@ -828,9 +1086,8 @@ netplay_t *netplay_new(const char *server, uint16_t port,
          if (!get_info_spectate(netplay))
             goto error;
       }
-
-      for (i = 0; i < MAX_SPECTATORS; i++)
-         netplay->spectate_fds[i] = -1;
+      else if (!netplay_io_init(netplay))
+         goto error;
    }
    else
    {
@@ -841,13 +1098,11 @@ netplay_t *netplay_new(const char *server, uint16_t port,
       }
       else
       {
-         if (!get_info(netplay))
+         if (!accept_players(netplay))
             goto error;
       }
 
-      netplay->buffer_size = frames + 1;
-
-      if (!init_buffers(netplay))
+      if (!init_buffers(netplay) || !netplay_io_init(netplay))
          goto error;
 
       netplay->has_connection = true;
@@ -856,10 +1111,24 @@ netplay_t *netplay_new(const char *server, uint16_t port,
    return netplay;
 
 error:
+   netplay_io_deinit(netplay);
+
    if (netplay->fd >= 0)
       close(netplay->fd);
    if (netplay->udp_fd >= 0)
       close(netplay->udp_fd);
+   for (i = 0; i < netplay->num_peers; i++)
+      close(netplay->peers[i].conn.fd);
+
+   if (netplay->buffer)
+   {
+      for (i = 0; i < netplay->buffer_size; i++)
+         free(netplay->buffer[i].state);
+      free(netplay->buffer);
+   }
+
+   if (netplay->addr)
+      freeaddrinfo(netplay->addr);
 
    free(netplay);
    return NULL;
@@ -873,306 +1142,1159 @@ static bool netplay_is_alive(netplay_t *netplay)
    return false;
 }
 
-static bool send_chunk(netplay_t *netplay)
+/* First frame we do not have everybody's input for yet. */
+static uint32_t netplay_confirmed_frame(netplay_t *netplay)
 {
-   const struct sockaddr *addr = NULL;
-   if (netplay->addr)
-      addr = netplay->addr->ai_addr;
-   else if (netplay->has_client_addr)
-      addr = (const struct sockaddr*)&netplay->their_addr;
+   unsigned i;
+   uint32_t frame = netplay->read_frame[0];
 
-   if (addr)
-   {
-      if (sendto(netplay->udp_fd, CONST_CAST netplay->packet_buffer,
-               sizeof(netplay->packet_buffer), 0, addr,
-               sizeof(struct sockaddr)) != sizeof(netplay->packet_buffer))
-      {
-         warn_hangup();
-         netplay->has_connection = false;
-         return false;
-      }
-   }
-   return true;
-}
+   for (i = 1; i < netplay->players; i++)
+      if (netplay->read_frame[i] < frame)
+         frame = netplay->read_frame[i];
 
-#define MAX_RETRIES 16
-#define RETRY_MS 500
+   return frame;
+}
 
-static int poll_input(netplay_t *netplay, bool block)
+/* Latest frame at or before frame we have a state for. */
+static struct delta_frame *netplay_find_state(netplay_t *netplay,
+      uint32_t frame)
 {
-   int max_fd = (netplay->fd > netplay->udp_fd ? netplay->fd : netplay->udp_fd) + 1;
-
-   struct timeval tv = {0};
-   tv.tv_sec = 0;
-   tv.tv_usec = block ? (RETRY_MS * 1000) : 0;
+   for (;;)
+   {
+      struct delta_frame *delta =
+         &netplay->buffer[frame % netplay->buffer_size];
 
-   do
-   { 
-      netplay->timeout_cnt++;
+      if (delta->frame == frame && delta->have_state)
+         return delta;
+      if (frame == 0 ||
+            netplay->frame_count - frame >= netplay->buffer_size)
+         return NULL;
 
-      /* select() does not take pointer to const struct timeval.
-       * Technically possible for select() to modify tmp_tv, so 
-       * we go paranoia mode. */
-      struct timeval tmp_tv = tv;
+      frame--;
+   }
+}
 
-      fd_set fds;
-      FD_ZERO(&fds);
-      FD_SET(netplay->udp_fd, &fds);
-      FD_SET(netplay->fd, &fds);
+/* Clients only know first hand about their own input, 
+ * the host passes on everybody's. */
+static bool netplay_sends_player(netplay_t *netplay,
+      const struct netplay_peer *peer, unsigned player)
+{
+   if (player == peer->player)
+      return false;
+   return netplay->player == 0 || player == netplay->player;
+}
 
-      if (select(max_fd, &fds, NULL, NULL, &tmp_tv) < 0)
-         return -1;
+/* Oldest frame we must not throw away yet, either because we 
+ * may roll back to it or because a peer still needs its input. */
+static uint32_t netplay_oldest_frame(netplay_t *netplay)
+{
+   unsigned i, j;
+   uint32_t frame = netplay_confirmed_frame(netplay);
 
-      /* Somewhat hacky,
-       * but we aren't using the TCP connection for anything useful atm. */
-      if (FD_ISSET(netplay->fd, &fds) && !netplay_get_cmd(netplay))
-         return -1; 
+   /* A rollback we have yet to do needs its state as well. */
+   if (netplay->rollback_frame < frame)
+      frame = netplay->rollback_frame;
 
-      if (FD_ISSET(netplay->udp_fd, &fds))
-         return 1;
+   if (frame >= netplay->frame_count)
+      frame = netplay->frame_count;
+   else
+   {
+      const struct delta_frame *delta = netplay_find_state(netplay, frame);
+      if (delta)
+         frame = delta->frame;
+   }
 
-      if (block && !send_chunk(netplay))
+   for (i = 0; i < netplay->num_peers; i++)
+   {
+      for (j = 0; j < netplay->players; j++)
       {
-         warn_hangup();
-         netplay->has_connection = false;
-         return -1;
+         const struct netplay_peer *peer = &netplay->peers[i];
+         if (netplay_sends_player(netplay, peer, j) && peer->ack[j] < frame)
+            frame = peer->ack[j];
       }
+   }
 
-      if (block)
-      {
-         RARCH_LOG("Network is stalling, resending packet... Count %u of %d ...\n",
-               netplay->timeout_cnt, MAX_RETRIES);
-      }
-   } while ((netplay->timeout_cnt < MAX_RETRIES) && block);
+   return frame;
+}
 
-   if (block)
-      return -1;
-   return 0;
+static void netplay_set_input(netplay_t *netplay, unsigned player,
+      uint32_t frame, const struct netplay_input *input)
+{
+   struct delta_frame *delta = netplay_delta(netplay, frame);
+
+   delta->real_input[player] = *input;
+   delta->have_real |= 1 << player;
+   netplay->last_input[player] = *input;
+   netplay->read_frame[player] = frame + 1;
+
+   /* Already ran this frame on a guess, and got it wrong. */
+   if (frame < netplay->frame_count && (delta->simulated & (1 << player)) &&
+         memcmp(&delta->simulated_input[player], input, sizeof(*input)) &&
+         frame < netplay->rollback_frame)
+      netplay->rollback_frame = frame;
 }
 
-/* Grab our own input state and send this over the network. */
-static bool get_self_input_state(netplay_t *netplay)
+/* Prediction is simply that everybody keeps doing what they 
+ * were last seen doing. */
+static void netplay_simulate_input(netplay_t *netplay,
+      struct delta_frame *delta)
 {
    unsigned i;
-   struct delta_frame *ptr = &netplay->buffer[netplay->self_ptr];
 
-   uint32_t state = 0;
-   if (!driver.block_libretro_input && netplay->frame_count > 0)
+   delta->simulated = 0;
+   for (i = 0; i < netplay->players; i++)
    {
-      /* First frame we always give zero input since relying on 
-       * input from first frame screws up when we use -F 0. */
-      retro_input_state_t cb = netplay->cbs.state_cb;
-      for (i = 0; i < RARCH_FIRST_META_KEY; i++)
-      {
-         int16_t tmp = cb(g_settings.input.netplay_client_swap_input ?
-               0 : !netplay->port,
-               RETRO_DEVICE_JOYPAD, 0, i);
-         state |= tmp ? 1 << i : 0;
-      }
-   }
-
-   memmove(netplay->packet_buffer, netplay->packet_buffer + 2,
-         sizeof (netplay->packet_buffer) - 2 * sizeof(uint32_t));
-   netplay->packet_buffer[(UDP_FRAME_PACKETS - 1) * 2] = htonl(netplay->frame_count); 
-   netplay->packet_buffer[(UDP_FRAME_PACKETS - 1) * 2 + 1] = htonl(state);
+      if (delta->have_real & (1 << i))
+         continue;
 
-   if (!send_chunk(netplay))
-   {
-      warn_hangup();
-      netplay->has_connection = false;
-      return false;
+      delta->simulated_input[i] = netplay->last_input[i];
+      delta->simulated |= 1 << i;
    }
-
-   ptr->self_state = state;
-   netplay->self_ptr = NEXT_PTR(netplay->self_ptr);
-   return true;
 }
 
-/* TODO: Somewhat better prediction. :P */
-static void simulate_input(netplay_t *netplay)
+static void netplay_pack_input(uint32_t *out,
+      const struct netplay_input *input)
 {
-   size_t ptr = PREV_PTR(netplay->self_ptr);
-   size_t prev = PREV_PTR(netplay->read_ptr);
-
-   netplay->buffer[ptr].simulated_input_state = 
-      netplay->buffer[prev].real_input_state;
-   netplay->buffer[ptr].is_simulated = true;
-   netplay->buffer[ptr].used_real = false;
+   out[0] = htonl(input->buttons);
+   out[1] = htonl((uint16_t)input->analog[0] |
+         ((uint32_t)(uint16_t)input->analog[1] << 16));
+   out[2] = htonl((uint16_t)input->analog[2] |
+         ((uint32_t)(uint16_t)input->analog[3] << 16));
 }
 
-static void parse_packet(netplay_t *netplay, uint32_t *buffer, unsigned size)
+static void netplay_unpack_input(struct netplay_input *input,
+      const uint32_t *in)
 {
-   unsigned i;
-   for (i = 0; i < size * 2; i++)
-      buffer[i] = ntohl(buffer[i]);
+   uint32_t left = ntohl(in[1]);
+   uint32_t right = ntohl(in[2]);
+
+   input->buttons   = ntohl(in[0]);
+   input->analog[0] = (int16_t)(left & 0xffff);
+   input->analog[1] = (int16_t)(left >> 16);
+   input->analog[2] = (int16_t)(right & 0xffff);
+   input->analog[3] = (int16_t)(right >> 16);
+}
 
-   for (i = 0; i < size && netplay->read_frame_count <= netplay->frame_count; i++)
-   {
-      uint32_t frame = buffer[2 * i + 0];
-      uint32_t state = buffer[2 * i + 1];
+/* Transport.
+ *
+ * Once the session is set up every socket is non-blocking, and only 
+ * netplay_io_run touches them. The emulation side queues what it 
+ * wants sent and picks up events for what arrived, so a slow or 
+ * stalled peer never holds up a frame. */
 
-      if (frame == netplay->read_frame_count)
-      {
-         netplay->buffer[netplay->read_ptr].is_simulated = false;
-         netplay->buffer[netplay->read_ptr].real_input_state = state;
-         netplay->read_ptr = NEXT_PTR(netplay->read_ptr);
-         netplay->read_frame_count++;
-         netplay->timeout_cnt = 0;
-      }
-   }
-}
+/* Queued input packet, addressed by the emulation side. */
+struct netplay_outgoing
+{
+   struct sockaddr_storage addr;
+   socklen_t addr_len;
+};
 
-static bool receive_data(netplay_t *netplay, uint32_t *buffer, size_t size)
+static bool netplay_nonblock(int fd)
 {
-   socklen_t addrlen = sizeof(netplay->their_addr);
-   if (recvfrom(netplay->udp_fd, NONCONST_CAST buffer, size, 0,
-            (struct sockaddr*)&netplay->their_addr, &addrlen) != (ssize_t)size)
-      return false;
-   netplay->has_client_addr = true;
-   return true;
+#ifdef _WIN32
+   u_long mode = 1;
+   return ioctlsocket(fd, FIONBIO, &mode) == 0;
+#elif defined(__CELLOS_LV2__) && !defined(__PSL1GHT__)
+   int mode = 1;
+   return setsockopt(fd, SOL_SOCKET, SO_NBIO, &mode, sizeof(mode)) == 0;
+#else
+   return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0;
+#endif
 }
 
-/* Poll network to see if we have anything new. If our 
- * network buffer is full, we simply have to block for new input data. */
+static bool netplay_would_block(void)
+{
+#ifdef _WIN32
+   return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+   return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
 
-static bool netplay_poll(netplay_t *netplay)
+/* Makes the transport thread pick up what was just queued. */
+static void netplay_io_wake(netplay_t *netplay)
 {
-   if (!netplay->has_connection)
-      return false;
+#ifdef HAVE_THREADS
+   static const uint8_t wake = 0;
 
-   netplay->can_poll = false;
+   if (netplay->io_thread)
+      sendto(netplay->wake_fd, CONST_CAST &wake, sizeof(wake), 0,
+            (const struct sockaddr*)&netplay->wake_addr,
+            sizeof(netplay->wake_addr));
+#endif
+}
+
+static bool netplay_post_event(netplay_t *netplay, uint32_t type,
+      unsigned conn, uint32_t cmd, const void *data, size_t size,
+      const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+   struct netplay_event *event = (struct netplay_event*)
+      spsc_reserve(netplay->events, sizeof(*event) + size);
 
-   if (!get_self_input_state(netplay))
+   if (!event)
       return false;
 
-   /* We skip reading the first frame so the host has a chance to grab 
-    * our host info so we don't block forever :') */
-   if (netplay->frame_count == 0)
+   event->type = type;
+   event->conn = conn;
+   event->cmd = cmd;
+   event->size = size;
+   event->addr_len = 0;
+   if (addr)
    {
-      netplay->buffer[0].used_real = true;
-      netplay->buffer[0].is_simulated = false;
-      netplay->buffer[0].real_input_state = 0;
-      netplay->read_ptr = NEXT_PTR(netplay->read_ptr);
-      netplay->read_frame_count++;
-      return true;
+      memcpy(&event->addr, addr, addr_len);
+      event->addr_len = addr_len;
    }
+   if (size)
+      memcpy(event + 1, data, size);
 
-   /* We might have reached the end of the buffer, where we 
-    * simply have to block. */
-   int res = poll_input(netplay, netplay->other_ptr == netplay->self_ptr);
-   if (res == -1)
-   {
-      netplay->has_connection = false;
-      warn_hangup();
-      return false;
-   }
+   spsc_commit(netplay->events, sizeof(*event) + size);
+   return true;
+}
 
-   if (res == 1)
+/* Sends as much of the queued data as the socket takes. 
+ * Returns false if the connection is gone. */
+static bool netplay_conn_flush(struct netplay_conn *conn)
+{
+   for (;;)
    {
-      uint32_t first_read = netplay->read_frame_count;
-      do 
-      {
-         uint32_t buffer[UDP_FRAME_PACKETS * 2];
-         if (!receive_data(netplay, buffer, sizeof(buffer)))
-         {
-            warn_hangup();
-            netplay->has_connection = false;
-            return false;
-         }
-         parse_packet(netplay, buffer, UDP_FRAME_PACKETS);
+      ssize_t ret;
 
-      } while ((netplay->read_frame_count <= netplay->frame_count) && 
-            poll_input(netplay, (netplay->other_ptr == netplay->self_ptr) && 
-               (first_read == netplay->read_frame_count)) == 1);
-   }
-   else
-   {
-      /* Cannot allow this. Should not happen though. */
-      if (netplay->self_ptr == netplay->other_ptr)
+      if (conn->pending_pos == conn->pending_size)
       {
-         warn_hangup();
-         return false;
+         size_t avail = spsc_read_avail(conn->out);
+         if (!avail)
+            return true;
+         if (avail > sizeof(conn->pending))
+            avail = sizeof(conn->pending);
+
+         spsc_read(conn->out, conn->pending, avail);
+         conn->pending_pos = 0;
+         conn->pending_size = avail;
       }
-   }
 
-   if (netplay->read_ptr != netplay->self_ptr)
-      simulate_input(netplay);
-   else
-      netplay->buffer[PREV_PTR(netplay->self_ptr)].used_real = true;
+      ret = send(conn->fd, CONST_CAST (conn->pending + conn->pending_pos),
+            conn->pending_size - conn->pending_pos, 0);
+      if (ret < 0)
+         return netplay_would_block();
 
-   return true;
+      conn->pending_pos += ret;
+   }
 }
 
-static bool netplay_send_cmd(netplay_t *netplay, uint32_t cmd,
-      const void *data, size_t size)
+static bool netplay_conn_pending(struct netplay_conn *conn)
 {
-   cmd = (cmd << 16) | (size & 0xffff);
-   cmd = htonl(cmd);
+   return conn->pending_pos != conn->pending_size ||
+      spsc_read_avail(conn->out);
+}
 
-   if (!send_all(netplay->fd, &cmd, sizeof(cmd)))
-      return false;
+/* Reads whatever arrived. Returns false if the connection is gone. */
+static bool netplay_conn_receive(struct netplay_conn *conn)
+{
+   while (conn->in_size < sizeof(conn->in))
+   {
+      ssize_t ret = recv(conn->fd, NONCONST_CAST (conn->in + conn->in_size),
+            sizeof(conn->in) - conn->in_size, 0);
+      if (ret == 0)
+         return false;
+      if (ret < 0)
+         return netplay_would_block();
 
-   if (!send_all(netplay->fd, data, size))
-      return false;
+      conn->in_size += ret;
+   }
 
    return true;
 }
 
-static bool netplay_cmd_ack(netplay_t *netplay)
+static void netplay_conn_consume(struct netplay_conn *conn, size_t size)
 {
-   uint32_t cmd = htonl(NETPLAY_CMD_ACK);
-   return send_all(netplay->fd, &cmd, sizeof(cmd));
+   memmove(conn->in, conn->in + size, conn->in_size - size);
+   conn->in_size -= size;
 }
 
-static bool netplay_cmd_nak(netplay_t *netplay)
+/* Turns complete commands from a peer into events. */
+static bool netplay_io_parse_cmds(netplay_t *netplay, unsigned idx)
 {
-   uint32_t cmd = htonl(NETPLAY_CMD_NAK);
-   return send_all(netplay->fd, &cmd, sizeof(cmd));
+   struct netplay_conn *conn = &netplay->peers[idx].conn;
+
+   while (conn->in_size >= sizeof(uint32_t))
+   {
+      uint32_t cmd;
+      size_t size;
+
+      memcpy(&cmd, conn->in, sizeof(cmd));
+      cmd = ntohl(cmd);
+      size = cmd & 0xffff;
+
+      if (sizeof(cmd) + size > sizeof(conn->in))
+         return false;
+      if (conn->in_size < sizeof(cmd) + size)
+         break;
+
+      /* No room for it yet, try again next time around. */
+      if (!netplay_post_event(netplay, NETPLAY_EVENT_CMD, idx, cmd >> 16,
+               conn->in + sizeof(cmd), size, NULL, 0))
+         break;
+
+      netplay_conn_consume(conn, sizeof(cmd) + size);
+   }
+
+   return true;
 }
 
-static bool netplay_get_response(netplay_t *netplay)
+static void netplay_io_hangup(netplay_t *netplay, unsigned idx)
 {
-   uint32_t response;
-   if (!recv_all(netplay->fd, &response, sizeof(response)))
-      return false;
+   struct netplay_conn *conn = &netplay->peers[idx].conn;
 
-   return ntohl(response) == NETPLAY_CMD_ACK;
+   close(conn->fd);
+   conn->fd = -1;
+   netplay_post_event(netplay, NETPLAY_EVENT_HANGUP, idx, 0, NULL, 0,
+         NULL, 0);
 }
 
-static bool netplay_get_cmd(netplay_t *netplay)
+static void netplay_io_drop_spectator(netplay_t *netplay, unsigned idx)
 {
-   uint32_t cmd;
-   if (!recv_all(netplay->fd, &cmd, sizeof(cmd)))
-      return false;
+   struct netplay_conn *conn = &netplay->spectators[idx];
 
-   cmd = ntohl(cmd);
-
-   size_t cmd_size = cmd & 0xffff;
-   cmd = cmd >> 16;
+   close(conn->fd);
+   conn->fd = -1;
+   ratomic_store_release(&conn->state, NETPLAY_CONN_DEAD);
+   netplay_post_event(netplay, NETPLAY_EVENT_SPECTATOR_GONE, idx, 0,
+         NULL, 0, NULL, 0);
+}
 
-   switch (cmd)
+static void netplay_io_accept_spectators(netplay_t *netplay)
+{
+   for (;;)
    {
-      case NETPLAY_CMD_FLIP_PLAYERS:
-      {
-         uint32_t flip_frame;
+      unsigned i;
+      struct sockaddr_storage their_addr;
+      socklen_t addr_size = sizeof(their_addr);
+      int new_fd = accept(netplay->fd, (struct sockaddr*)&their_addr,
+            &addr_size);
+      struct netplay_conn *conn = NULL;
+
+      if (new_fd < 0)
+         return;
 
-         if (cmd_size != sizeof(uint32_t))
+      for (i = 0; i < MAX_SPECTATORS; i++)
+      {
+         if (ratomic_load_acquire(&netplay->spectators[i].state) ==
+               NETPLAY_CONN_FREE)
          {
-            RARCH_ERR("CMD_FLIP_PLAYERS has unexpected command size.\n");
-            return netplay_cmd_nak(netplay);
+            conn = &netplay->spectators[i];
+            break;
          }
+      }
+
+      /* No vacant client streams :( */
+      if (!conn || !netplay_nonblock(new_fd))
+      {
+         close(new_fd);
+         continue;
+      }
+
+      conn->fd = new_fd;
+      conn->in_size = 0;
+      conn->pending_pos = conn->pending_size = 0;
+
+      memcpy(&conn->addr, &their_addr, addr_size);
+      conn->addr_len = addr_size;
+      ratomic_store_release(&conn->state, NETPLAY_CONN_HANDSHAKE);
+   }
+}
+
+/* The spectator speaks first, sending its nick. See get_info_spectate. */
+static void netplay_io_spectator_handshake(netplay_t *netplay, unsigned idx)
+{
+   struct netplay_conn *conn = &netplay->spectators[idx];
+   size_t nick_size;
+
+   if (conn->in_size < 1)
+      return;
+
+   nick_size = conn->in[0];
+   if (nick_size >= sizeof(netplay->nick))
+   {
+      netplay_io_drop_spectator(netplay, idx);
+      return;
+   }
+
+   if (conn->in_size < 1 + nick_size ||
+         !netplay_post_event(netplay, NETPLAY_EVENT_SPECTATOR, idx, 0,
+            conn->in + 1, nick_size, &conn->addr, conn->addr_len))
+      return;
+
+   conn->in_size = 0;
+   ratomic_store_release(&conn->state, NETPLAY_CONN_READY);
+}
+
+/* Input goes over UDP, so there is nothing to do if sending fails; 
+ * the next packet repeats it anyway. */
+static void netplay_io_send_input(netplay_t *netplay,
+      struct netplay_peer *peer)
+{
+   struct
+   {
+      struct netplay_outgoing header;
+      uint32_t packet[NETPLAY_PACKET_WORDS];
+   } latest;
+   size_t latest_size = 0;
+   size_t size;
+   const void *data;
+
+   /* Every packet supersedes the ones before it. */
+   while ((data = spsc_peek(peer->outbox, &size)))
+   {
+      memcpy(&latest, data, size);
+      latest_size = size;
+      spsc_release(peer->outbox);
+   }
+
+   if (!latest_size)
+      return;
+
+   sendto(netplay->udp_fd, CONST_CAST latest.packet,
+         latest_size - sizeof(latest.header), 0,
+         (const struct sockaddr*)&latest.header.addr,
+         latest.header.addr_len);
+}
+
+static void netplay_io_send(netplay_t *netplay)
+{
+   unsigned i;
+
+   for (i = 0; i < netplay->num_peers; i++)
+   {
+      struct netplay_peer *peer = &netplay->peers[i];
+
+      if (peer->conn.fd < 0)
+         continue;
+
+      netplay_io_send_input(netplay, peer);
+      if (!netplay_conn_flush(&peer->conn))
+         netplay_io_hangup(netplay, i);
+   }
+
+   for (i = 0; i < MAX_SPECTATORS; i++)
+   {
+      struct netplay_conn *conn = &netplay->spectators[i];
+      size_t state = ratomic_load_acquire(&conn->state);
+
+      if (state == NETPLAY_CONN_FREE || state == NETPLAY_CONN_DEAD)
+         continue;
+
+      if (ratomic_load_acquire(&conn->closing) ||
+            (ratomic_load_acquire(&conn->accepted) &&
+             !netplay_conn_flush(conn)))
+         netplay_io_drop_spectator(netplay, i);
+   }
+}
+
+/* One round of the transport. Sends whatever is queued, then waits 
+ * up to timeout_ms for traffic and turns it into events. */
+static void netplay_io_run(netplay_t *netplay, unsigned timeout_ms)
+{
+   unsigned i;
+   int max_fd = -1;
+   fd_set read_fds, write_fds;
+   struct timeval tv = {0};
+
+   netplay_io_send(netplay);
+
+   FD_ZERO(&read_fds);
+   FD_ZERO(&write_fds);
+
+#define NETPLAY_FD_SET(fd, set) \
+   do { \
+      FD_SET(fd, set); \
+      if ((fd) > max_fd) \
+         max_fd = (fd); \
+   } while (0)
+
+   if (netplay->udp_fd >= 0)
+      NETPLAY_FD_SET(netplay->udp_fd, &read_fds);
+   if (netplay->spectate && netplay->fd >= 0)
+      NETPLAY_FD_SET(netplay->fd, &read_fds);
+#ifdef HAVE_THREADS
+   if (netplay->io_thread)
+      NETPLAY_FD_SET(netplay->wake_fd, &read_fds);
+#endif
+
+   for (i = 0; i < netplay->num_peers; i++)
+   {
+      struct netplay_conn *conn = &netplay->peers[i].conn;
+      if (conn->fd < 0)
+         continue;
+
+      if (conn->in_size < sizeof(conn->in))
+         NETPLAY_FD_SET(conn->fd, &read_fds);
+      if (netplay_conn_pending(conn))
+         NETPLAY_FD_SET(conn->fd, &write_fds);
+   }
+
+   for (i = 0; i < MAX_SPECTATORS; i++)
+   {
+      struct netplay_conn *conn = &netplay->spectators[i];
+      size_t state = ratomic_load_acquire(&conn->state);
+
+      if (state == NETPLAY_CONN_FREE || state == NETPLAY_CONN_DEAD)
+         continue;
+
+      NETPLAY_FD_SET(conn->fd, &read_fds);
+      if (ratomic_load_acquire(&conn->accepted) &&
+            netplay_conn_pending(conn))
+         NETPLAY_FD_SET(conn->fd, &write_fds);
+   }
+
+#undef NETPLAY_FD_SET
+
+   tv.tv_sec = timeout_ms / 1000;
+   tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+   if (max_fd < 0 || select(max_fd + 1, &read_fds, &write_fds,
+            NULL, &tv) <= 0)
+      return;
+
+#ifdef HAVE_THREADS
+   if (netplay->io_thread && FD_ISSET(netplay->wake_fd, &read_fds))
+   {
+      uint8_t wake[64];
+      while (recv(netplay->wake_fd, NONCONST_CAST wake, sizeof(wake), 0) > 0);
+   }
+#endif
+
+   if (netplay->udp_fd >= 0 && FD_ISSET(netplay->udp_fd, &read_fds))
+   {
+      for (;;)
+      {
+         uint32_t packet[NETPLAY_PACKET_WORDS];
+         struct sockaddr_storage their_addr;
+         socklen_t addrlen = sizeof(their_addr);
+         ssize_t ret = recvfrom(netplay->udp_fd, NONCONST_CAST packet,
+               sizeof(packet), 0, (struct sockaddr*)&their_addr, &addrlen);
+
+         if (ret < 0)
+            break;
+
+         /* If there is no room, the packet is lost like any other. */
+         netplay_post_event(netplay, NETPLAY_EVENT_INPUT, 0, 0,
+               packet, ret, &their_addr, addrlen);
+      }
+   }
+
+   if (netplay->spectate && netplay->fd >= 0 &&
+         FD_ISSET(netplay->fd, &read_fds))
+      netplay_io_accept_spectators(netplay);
+
+   for (i = 0; i < netplay->num_peers; i++)
+   {
+      struct netplay_conn *conn = &netplay->peers[i].conn;
+
+      if (conn->fd < 0 || !FD_ISSET(conn->fd, &read_fds))
+         continue;
+
+      if (!netplay_conn_receive(conn) || !netplay_io_parse_cmds(netplay, i))
+         netplay_io_hangup(netplay, i);
+   }
+
+   for (i = 0; i < MAX_SPECTATORS; i++)
+   {
+      struct netplay_conn *conn = &netplay->spectators[i];
+      size_t state = ratomic_load_acquire(&conn->state);
+
+      if (state == NETPLAY_CONN_FREE || state == NETPLAY_CONN_DEAD ||
+            !FD_ISSET(conn->fd, &read_fds))
+         continue;
+
+      if (!netplay_conn_receive(conn))
+         netplay_io_drop_spectator(netplay, i);
+      else if (state == NETPLAY_CONN_HANDSHAKE)
+         netplay_io_spectator_handshake(netplay, i);
+      else
+         conn->in_size = 0;
+   }
+
+   netplay_io_send(netplay);
+
+#ifdef HAVE_THREADS
+   if (netplay->io_thread && spsc_read_avail(netplay->events))
+   {
+      slock_lock(netplay->io_lock);
+      scond_signal(netplay->io_cond);
+      slock_unlock(netplay->io_lock);
+   }
+#endif
+}
+
+/* Packet layout, all 32-bit words in network order:
+ * sender player, then read_frame of every player as acknowledgement,
+ * then any number of (player, first frame, count, input[count]). */
+static void send_input(netplay_t *netplay, struct netplay_peer *peer)
+{
+   unsigned i;
+   struct netplay_outgoing *header;
+   uint32_t *packet;
+   size_t words = 0;
+
+   /* The host only learns where a client is from its first packet. */
+   if (!peer->has_addr)
+      return;
+
+   /* If the transport is behind, it has older packets to send. */
+   header = (struct netplay_outgoing*)spsc_reserve(peer->outbox,
+         sizeof(*header) + NETPLAY_PACKET_WORDS * sizeof(uint32_t));
+   if (!header)
+      return;
+
+   memcpy(&header->addr, &peer->addr, peer->addr_len);
+   header->addr_len = peer->addr_len;
+   packet = (uint32_t*)(header + 1);
+
+   packet[words++] = htonl(netplay->player);
+   for (i = 0; i < netplay->players; i++)
+      packet[words++] = htonl(netplay->read_frame[i]);
+
+   for (i = 0; i < netplay->players; i++)
+   {
+      uint32_t frame, count;
+      uint32_t first = peer->ack[i];
+
+      if (!netplay_sends_player(netplay, peer, i) ||
+            first >= netplay->read_frame[i])
+         continue;
 
-         if (!recv_all(netplay->fd, &flip_frame, sizeof(flip_frame)))
+      count = netplay->read_frame[i] - first;
+      if (count > NETPLAY_PACKET_FRAMES)
+         count = NETPLAY_PACKET_FRAMES;
+
+      packet[words++] = htonl(i);
+      packet[words++] = htonl(first);
+      packet[words++] = htonl(count);
+
+      for (frame = first; frame < first + count; frame++)
+      {
+         netplay_pack_input(packet + words,
+               &netplay->buffer[frame % netplay->buffer_size].real_input[i]);
+         words += NETPLAY_INPUT_WORDS;
+      }
+   }
+
+   spsc_commit(peer->outbox, sizeof(*header) + words * sizeof(uint32_t));
+}
+
+static void send_input_all(netplay_t *netplay)
+{
+   unsigned i;
+
+   for (i = 0; i < netplay->num_peers; i++)
+      send_input(netplay, &netplay->peers[i]);
+
+   netplay_io_wake(netplay);
+}
+
+static struct netplay_peer *netplay_find_peer(netplay_t *netplay,
+      unsigned player)
+{
+   unsigned i;
+
+   for (i = 0; i < netplay->num_peers; i++)
+      if (netplay->peers[i].player == player)
+         return &netplay->peers[i];
+
+   return NULL;
+}
+
+static void receive_input(netplay_t *netplay, const uint32_t *packet,
+      size_t size, const struct sockaddr_storage *their_addr,
+      socklen_t addrlen)
+{
+   unsigned i;
+   size_t words, pos;
+   uint32_t limit;
+   struct netplay_peer *peer;
+
+   /* Anything malformed is dropped, the next packet repeats it. */
+   words = size / sizeof(uint32_t);
+   if (words < 1 + netplay->players)
+      return;
+
+   peer = netplay_find_peer(netplay, ntohl(packet[0]));
+   if (!peer)
+      return;
+
+   if (!peer->has_addr)
+   {
+      memcpy(&peer->addr, their_addr, addrlen);
+      peer->addr_len = addrlen;
+      peer->has_addr = true;
+   }
+
+   for (i = 0; i < netplay->players; i++)
+   {
+      uint32_t ack = ntohl(packet[1 + i]);
+      if (ack > peer->ack[i])
+         peer->ack[i] = ack;
+   }
+
+   /* Input too far ahead would overwrite frames we still need. */
+   limit = netplay_oldest_frame(netplay) + netplay->buffer_size;
+
+   pos = 1 + netplay->players;
+   while (pos + 3 <= words)
+   {
+      uint32_t frame;
+      unsigned player = ntohl(packet[pos + 0]);
+      uint32_t first  = ntohl(packet[pos + 1]);
+      uint32_t count  = ntohl(packet[pos + 2]);
+      const uint32_t *input = packet + pos + 3;
+
+      if (player >= netplay->players || player == netplay->player ||
+            count > NETPLAY_PACKET_FRAMES)
+         break;
+
+      pos += 3 + count * NETPLAY_INPUT_WORDS;
+      if (pos > words)
+         break;
+
+      for (frame = first; frame < first + count && frame < limit;
+            frame++, input += NETPLAY_INPUT_WORDS)
+      {
+         struct netplay_input in;
+
+         if (frame != netplay->read_frame[player])
+            continue;
+
+         netplay_unpack_input(&in, input);
+         netplay_set_input(netplay, player, frame, &in);
+
+         /* A misprediction holds on to an older state. */
+         limit = netplay_oldest_frame(netplay) + netplay->buffer_size;
+      }
+   }
+
+}
+
+#define MAX_RETRIES 16
+#define RETRY_MS 500
+
+#ifdef HAVE_THREADS
+static void netplay_io_thread(void *data)
+{
+   netplay_t *netplay = (netplay_t*)data;
+
+   while (!netplay->io_quit)
+      netplay_io_run(netplay, RETRY_MS);
+}
+
+static bool netplay_io_init_thread(netplay_t *netplay)
+{
+   socklen_t addr_len = sizeof(netplay->wake_addr);
+
+   netplay->wake_fd = socket(AF_INET, SOCK_DGRAM, 0);
+   if (netplay->wake_fd < 0)
+      return false;
+
+   memset(&netplay->wake_addr, 0, sizeof(netplay->wake_addr));
+   netplay->wake_addr.sin_family = AF_INET;
+   netplay->wake_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+   if (bind(netplay->wake_fd, (struct sockaddr*)&netplay->wake_addr,
+            sizeof(netplay->wake_addr)) < 0 ||
+         getsockname(netplay->wake_fd, (struct sockaddr*)&netplay->wake_addr,
+            &addr_len) < 0 ||
+         !netplay_nonblock(netplay->wake_fd))
+      return false;
+
+   netplay->io_lock = slock_new();
+   netplay->io_cond = scond_new();
+   if (!netplay->io_lock || !netplay->io_cond)
+      return false;
+
+   netplay->io_thread = sthread_create(netplay_io_thread, netplay);
+   return netplay->io_thread != NULL;
+}
+
+static void netplay_io_deinit_thread(netplay_t *netplay)
+{
+   if (netplay->io_thread)
+   {
+      netplay->io_quit = true;
+      netplay_io_wake(netplay);
+      sthread_join(netplay->io_thread);
+      netplay->io_thread = NULL;
+   }
+
+   if (netplay->io_cond)
+      scond_free(netplay->io_cond);
+   if (netplay->io_lock)
+      slock_free(netplay->io_lock);
+   if (netplay->wake_fd >= 0)
+      close(netplay->wake_fd);
+
+   netplay->io_cond = NULL;
+   netplay->io_lock = NULL;
+   netplay->wake_fd = -1;
+}
+#endif
+
+/* Hands every socket over to the transport. */
+static bool netplay_io_init(netplay_t *netplay)
+{
+   unsigned i;
+
+   netplay->events = spsc_new(NETPLAY_EVENTS_SIZE);
+   if (!netplay->events)
+      return false;
+
+   if (netplay->udp_fd >= 0 && !netplay_nonblock(netplay->udp_fd))
+      return false;
+   if (netplay->spectate && !netplay_nonblock(netplay->fd))
+      return false;
+
+   for (i = 0; i < netplay->num_peers; i++)
+   {
+      struct netplay_peer *peer = &netplay->peers[i];
+
+      peer->outbox = spsc_new(NETPLAY_OUTBOX_SIZE);
+      peer->conn.out = spsc_new(NETPLAY_CONN_BUFFER);
+      if (!peer->outbox || !peer->conn.out ||
+            !netplay_nonblock(peer->conn.fd))
+         return false;
+   }
+
+#ifdef HAVE_THREADS
+   /* We can still run the transport inline if this fails. */
+   if (!netplay_io_init_thread(netplay))
+   {
+      RARCH_WARN("Failed to start netplay thread, polling inline.\n");
+      netplay_io_deinit_thread(netplay);
+   }
+#endif
+
+   return true;
+}
+
+static void netplay_io_deinit(netplay_t *netplay)
+{
+   unsigned i;
+
+#ifdef HAVE_THREADS
+   netplay_io_deinit_thread(netplay);
+#endif
+
+   for (i = 0; i < netplay->num_peers; i++)
+   {
+      spsc_free(netplay->peers[i].outbox);
+      spsc_free(netplay->peers[i].conn.out);
+      netplay->peers[i].outbox = NULL;
+      netplay->peers[i].conn.out = NULL;
+   }
+
+   spsc_free(netplay->events);
+   netplay->events = NULL;
+}
+
+static void netplay_add_spectator(netplay_t *netplay, unsigned idx,
+      const struct netplay_event *event)
+{
+   struct netplay_conn *conn = &netplay->spectators[idx];
+   uint8_t nick_size = strlen(netplay->nick);
+   char nick[32] = {0};
+   size_t header_size;
+   uint32_t *header = bsv_header_generate(&header_size,
+         implementation_magic_value());
+
+   if (!header)
+   {
+      RARCH_ERR("Failed to generate BSV header.\n");
+      ratomic_store_release(&conn->closing, true);
+      return;
+   }
+
+   conn->out = spsc_new(sizeof(nick_size) + nick_size + header_size +
+         NETPLAY_CONN_BUFFER);
+   if (!conn->out)
+   {
+      free(header);
+      ratomic_store_release(&conn->closing, true);
+      return;
+   }
+
+   spsc_write(conn->out, &nick_size, sizeof(nick_size));
+   spsc_write(conn->out, netplay->nick, nick_size);
+   spsc_write(conn->out, header, header_size);
+   free(header);
+
+   ratomic_store_release(&conn->accepted, true);
+   netplay_io_wake(netplay);
+
+   memcpy(nick, event + 1, event->size);
+#ifndef HAVE_SOCKET_LEGACY
+   log_connection(&event->addr, idx, nick);
+#endif
+}
+
+static void netplay_remove_spectator(netplay_t *netplay, unsigned idx)
+{
+   struct netplay_conn *conn = &netplay->spectators[idx];
+   char msg[512];
+
+   if (conn->out)
+   {
+      RARCH_LOG("Client (#%u) disconnected ...\n", idx);
+      snprintf(msg, sizeof(msg), "Client (#%u) disconnected.", idx);
+      msg_queue_push(g_extern.msg_queue, msg, 1, 180);
+   }
+
+   spsc_free(conn->out);
+   conn->out = NULL;
+   conn->accepted = false;
+   conn->closing = false;
+   ratomic_store_release(&conn->state, NETPLAY_CONN_FREE);
+}
+
+/* Returns how many input packets came in, or -1 if a peer is gone. */
+static int netplay_handle_events(netplay_t *netplay)
+{
+   int received = 0;
+   size_t size;
+   const struct netplay_event *event;
+
+   while ((event = (const struct netplay_event*)
+            spsc_peek(netplay->events, &size)))
+   {
+      const void *data = event + 1;
+      bool hangup = false;
+
+      switch (event->type)
+      {
+         case NETPLAY_EVENT_INPUT:
+            receive_input(netplay, (const uint32_t*)data, event->size,
+                  &event->addr, event->addr_len);
+            received++;
+            break;
+
+         case NETPLAY_EVENT_CMD:
+            if (!netplay_handle_cmd(netplay, &netplay->peers[event->conn],
+                     event->cmd, data, event->size))
+               hangup = true;
+            break;
+
+         case NETPLAY_EVENT_HANGUP:
+            hangup = true;
+            break;
+
+         case NETPLAY_EVENT_SPECTATOR:
+            netplay_add_spectator(netplay, event->conn, event);
+            break;
+
+         case NETPLAY_EVENT_SPECTATOR_GONE:
+            netplay_remove_spectator(netplay, event->conn);
+            break;
+      }
+
+      spsc_release(netplay->events);
+      if (hangup)
+         return -1;
+   }
+
+   return received;
+}
+
+/* Handles whatever arrives within timeout_ms. 
+ * Returns 1 if a packet arrived, 0 on timeout and -1 on error. */
+static int poll_input(netplay_t *netplay, unsigned timeout_ms)
+{
+   int res;
+
+#ifdef HAVE_THREADS
+   if (netplay->io_thread)
+   {
+      size_t size;
+
+      res = netplay_handle_events(netplay);
+      if (res != 0 || !timeout_ms)
+         return res > 0 ? 1 : res;
+
+      slock_lock(netplay->io_lock);
+      if (!spsc_peek(netplay->events, &size))
+         scond_wait_timeout(netplay->io_cond, netplay->io_lock,
+               (int64_t)timeout_ms * 1000);
+      slock_unlock(netplay->io_lock);
+   }
+   else
+#endif
+      netplay_io_run(netplay, timeout_ms);
+
+   res = netplay_handle_events(netplay);
+   return res > 0 ? 1 : res;
+}
+/* Grab our own input state for input_delay frames from now. */
+static void get_self_input_state(netplay_t *netplay,
+      struct netplay_input *input)
+{
+   unsigned i;
+   retro_input_state_t cb = netplay->cbs.state_cb;
+   unsigned port = g_settings.input.netplay_client_swap_input ?
+      0 : netplay->player;
+
+   memset(input, 0, sizeof(*input));
+
+   /* First frame we always give zero input since relying on 
+    * input from first frame screws up when we use -F 0. */
+   if (driver.block_libretro_input || netplay->frame_count == 0)
+      return;
+
+   for (i = 0; i < RARCH_FIRST_META_KEY; i++)
+      input->buttons |= cb(port, RETRO_DEVICE_JOYPAD, 0, i) ? 1 << i : 0;
+
+   for (i = 0; i < NETPLAY_ANALOG_AXES; i++)
+      input->analog[i] = cb(port, RETRO_DEVICE_ANALOG, i / 2, i % 2);
+}
+
+/* Out of room to keep the frames we, or the others, still need. */
+static bool netplay_out_of_room(netplay_t *netplay)
+{
+   return netplay->frame_count + netplay->input_delay >=
+      netplay_oldest_frame(netplay) + netplay->buffer_size;
+}
+
+/* Out of frames we may run on predicted input. */
+static bool netplay_out_of_frames(netplay_t *netplay)
+{
+   return netplay_confirmed_frame(netplay) + netplay->rollback_frames <=
+      netplay->frame_count;
+}
+
+/* Blocks, resending our input now and then, until must_wait 
+ * no longer holds. */
+static bool wait_for_input(netplay_t *netplay,
+      bool (*must_wait)(netplay_t*))
+{
+   retro_time_t resend = rarch_get_time_usec() + RETRY_MS * 1000;
+
+   netplay->timeout_cnt = 0;
+
+   while (must_wait(netplay))
+   {
+      retro_time_t now;
+      int res = poll_input(netplay, RETRY_MS);
+      if (res < 0)
+         return false;
+
+      if (res > 0)
+         netplay->timeout_cnt = 0;
+      else if (++netplay->timeout_cnt >= MAX_RETRIES)
+         return false;
+
+      /* Whoever we wait for may have lost our last packet, 
+       * even while the others keep us busy. */
+      now = rarch_get_time_usec();
+      if (now < resend)
+         continue;
+
+      send_input_all(netplay);
+      resend = now + RETRY_MS * 1000;
+
+      if (res == 0)
+         RARCH_LOG("Network is stalling, resending packet... Count %u of %d ...\n",
+               netplay->timeout_cnt, MAX_RETRIES);
+   }
+
+   return true;
+}
+
+/* Exchange input with the other players. We only block when we 
+ * have run out of frames to predict, or of room to keep them. */
+static bool netplay_poll(netplay_t *netplay)
+{
+   int res;
+   struct netplay_input input;
+
+   if (!netplay->has_connection)
+      return false;
+
+   netplay->can_poll = false;
+
+   if (!wait_for_input(netplay, netplay_out_of_room))
+      goto hangup;
+
+   get_self_input_state(netplay, &input);
+   netplay_set_input(netplay, netplay->player,
+         netplay->frame_count + netplay->input_delay, &input);
+
+   send_input_all(netplay);
+
+   while ((res = poll_input(netplay, 0)) > 0);
+   if (res < 0)
+      goto hangup;
+
+   if (!wait_for_input(netplay, netplay_out_of_frames))
+      goto hangup;
+
+   return true;
+
+hangup:
+   warn_hangup();
+   netplay->has_connection = false;
+   return false;
+}
+
+/* Queues a command for the transport to send. */
+static bool netplay_send_cmd(netplay_t *netplay, struct netplay_peer *peer,
+      uint32_t cmd, const void *data, size_t size)
+{
+   uint32_t header = htonl((cmd << 16) | (size & 0xffff));
+
+   if (spsc_write_avail(peer->conn.out) < sizeof(header) + size)
+      return false;
+
+   spsc_write(peer->conn.out, &header, sizeof(header));
+   spsc_write(peer->conn.out, data, size);
+   netplay_io_wake(netplay);
+   return true;
+}
+
+static bool netplay_cmd_ack(netplay_t *netplay, struct netplay_peer *peer)
+{
+   return netplay_send_cmd(netplay, peer, NETPLAY_CMD_ACK, NULL, 0);
+}
+
+static bool netplay_cmd_nak(netplay_t *netplay, struct netplay_peer *peer)
+{
+   return netplay_send_cmd(netplay, peer, NETPLAY_CMD_NAK, NULL, 0);
+}
+
+/* Called for every command the transport received from a peer. */
+static bool netplay_handle_cmd(netplay_t *netplay, struct netplay_peer *peer,
+      uint32_t cmd, const void *data, size_t size)
+{
+   switch (cmd)
+   {
+      case NETPLAY_CMD_ACK:
+         return true;
+
+      case NETPLAY_CMD_NAK:
+         RARCH_WARN("Failed to flip players.\n");
+         msg_queue_push(g_extern.msg_queue, "Failed to flip players.", 1, 180);
+         return true;
+
+      case NETPLAY_CMD_FLIP_PLAYERS:
+      {
+         uint32_t flip_frame;
+
+         if (size != sizeof(uint32_t))
          {
-            RARCH_ERR("Failed to receive CMD_FLIP_PLAYERS argument.\n");
-            return netplay_cmd_nak(netplay);
+            RARCH_ERR("CMD_FLIP_PLAYERS has unexpected command size.\n");
+            return netplay_cmd_nak(netplay, peer);
          }
 
+         memcpy(&flip_frame, data, sizeof(flip_frame));
          flip_frame = ntohl(flip_frame);
          if (flip_frame < netplay->flip_frame)
          {
             RARCH_ERR("Host asked us to flip players in the past. Not possible ...\n");
-            return netplay_cmd_nak(netplay);
+            return netplay_cmd_nak(netplay, peer);
          }
 
          netplay->flip ^= true;
@@ -1181,18 +2303,22 @@ static bool netplay_get_cmd(netplay_t *netplay)
          RARCH_LOG("Netplay players are flipped.\n");
          msg_queue_push(g_extern.msg_queue, "Netplay players are flipped.", 1, 180);
 
-         return netplay_cmd_ack(netplay);
+         return netplay_cmd_ack(netplay, peer);
       }
 
       default:
          RARCH_ERR("Unknown netplay command received.\n");
-         return netplay_cmd_nak(netplay);
+         return netplay_cmd_nak(netplay, peer);
    }
 }
 
+/* Swaps players 1 and 2. The answers come in through poll_input, 
+ * the flip frame is far enough ahead that we need not wait for them. */
 void netplay_flip_players(netplay_t *netplay)
 {
-   uint32_t flip_frame = netplay->frame_count + 2 * UDP_FRAME_PACKETS;
+   unsigned i;
+   /* Far enough ahead that nobody can have run it yet. */
+   uint32_t flip_frame = netplay->frame_count + 2 * netplay->buffer_size;
    uint32_t flip_frame_net = htonl(flip_frame);
    const char *msg = NULL;
 
@@ -1202,36 +2328,37 @@ void netplay_flip_players(netplay_t *netplay)
       goto error;
    }
 
-   if (netplay->port == 0)
+   if (netplay->player != 0)
    {
       msg = "Cannot flip players if you're not the host.";
       goto error;
    }
 
-   /* Make sure both clients are definitely synced up. */
-   if (netplay->frame_count < (netplay->flip_frame + 2 * UDP_FRAME_PACKETS))
+   /* Make sure everybody is definitely synced up. */
+   if (netplay->frame_count < (netplay->flip_frame + 2 * netplay->buffer_size))
    {
       msg = "Cannot flip players yet. Wait a second or two before attempting flip.";
       goto error;
    }
 
-   if (netplay_send_cmd(netplay, NETPLAY_CMD_FLIP_PLAYERS,
-            &flip_frame_net, sizeof(flip_frame_net))
-         && netplay_get_response(netplay))
-   {
-      RARCH_LOG("Netplay players are flipped.\n");
-      msg_queue_push(g_extern.msg_queue, "Netplay players are flipped.", 1, 180);
-
-      /* Queue up a flip well enough in the future. */
-      netplay->flip ^= true;
-      netplay->flip_frame = flip_frame;
-   }
-   else
+   for (i = 0; i < netplay->num_peers; i++)
    {
-      msg = "Failed to flip players.";
-      goto error;
+      if (!netplay_send_cmd(netplay, &netplay->peers[i],
+               NETPLAY_CMD_FLIP_PLAYERS,
+               &flip_frame_net, sizeof(flip_frame_net)))
+      {
+         msg = "Failed to flip players.";
+         goto error;
+      }
    }
 
+   RARCH_LOG("Netplay players are flipped.\n");
+   msg_queue_push(g_extern.msg_queue, "Netplay players are flipped.", 1, 180);
+
+   /* Queue up a flip well enough in the future. */
+   netplay->flip ^= true;
+   netplay->flip_frame = flip_frame;
+
    return;
 
 error:
@@ -1239,45 +2366,61 @@ error:
    msg_queue_push(g_extern.msg_queue, msg, 1, 180);
 }
 
-static bool netplay_flip_port(netplay_t *netplay, bool port)
+static unsigned netplay_flip_port(netplay_t *netplay, unsigned port,
+      uint32_t frame)
 {
-   if (netplay->flip_frame == 0)
+   if (netplay->flip_frame == 0 || port > 1)
       return port;
 
-   size_t frame = netplay->is_replay ?
-      netplay->tmp_frame_count : netplay->frame_count;
-
    return port ^ netplay->flip ^ (frame < netplay->flip_frame);
 }
 
-int16_t netplay_input_state(netplay_t *netplay, bool port, unsigned device,
-      unsigned idx, unsigned id)
+static int16_t netplay_input_state(netplay_t *netplay, unsigned port,
+      unsigned device, unsigned idx, unsigned id)
 {
-   size_t ptr = netplay->is_replay ? 
-      netplay->tmp_ptr : PREV_PTR(netplay->self_ptr);
-   uint16_t curr_input_state = netplay->buffer[ptr].self_state;
-
-   if (netplay->port == (netplay_flip_port(netplay, port) ? 1 : 0))
-   {
-      if (netplay->buffer[ptr].is_simulated)
-         curr_input_state = netplay->buffer[ptr].simulated_input_state;
-      else
-         curr_input_state = netplay->buffer[ptr].real_input_state;
+   uint32_t frame = netplay->is_replay ?
+      netplay->replay_frame : netplay->frame_count;
+   const struct delta_frame *delta =
+      &netplay->buffer[frame % netplay->buffer_size];
+   const struct netplay_input *input;
+   unsigned player = netplay_flip_port(netplay, port, frame);
+
+   if (player >= netplay->players)
+      return 0;
+
+   input = (delta->have_real & (1 << player)) ?
+      &delta->real_input[player] : &delta->simulated_input[player];
+
+   switch (device & RETRO_DEVICE_MASK)
+   {
+      case RETRO_DEVICE_JOYPAD:
+         return id < 32 ? (input->buttons >> id) & 1 : 0;
+      case RETRO_DEVICE_ANALOG:
+         if (idx < 2 && id < 2)
+            return input->analog[idx * 2 + id];
+         return 0;
+      default:
+         return 0;
    }
-
-   return ((1 << id) & curr_input_state) ? 1 : 0;
 }
 
 void netplay_free(netplay_t *netplay)
 {
    unsigned i;
-   close(netplay->fd);
+
+   netplay_io_deinit(netplay);
+
+   if (netplay->fd >= 0)
+      close(netplay->fd);
 
    if (netplay->spectate)
    {
       for (i = 0; i < MAX_SPECTATORS; i++)
-         if (netplay->spectate_fds[i] >= 0)
-            close(netplay->spectate_fds[i]);
+      {
+         if (netplay->spectators[i].fd >= 0)
+            close(netplay->spectators[i].fd);
+         spsc_free(netplay->spectators[i].out);
+      }
 
       free(netplay->spectate_input);
    }
@@ -1285,6 +2428,10 @@ void netplay_free(netplay_t *netplay)
    {
       close(netplay->udp_fd);
 
+      for (i = 0; i < netplay->num_peers; i++)
+         if (netplay->peers[i].conn.fd >= 0)
+            close(netplay->peers[i].conn.fd);
+
       for (i = 0; i < netplay->buffer_size; i++)
          free(netplay->buffer[i].state);
 
@@ -1304,13 +2451,80 @@ static bool netplay_should_skip(netplay_t *netplay)
    return false;
 }
 
+/* Rolls back to before the earliest wrong prediction and runs 
+ * forward again with the input we know now. */
+static void netplay_rollback(netplay_t *netplay)
+{
+   uint32_t frame, resume;
+   uint32_t mispredicted = netplay->rollback_frame;
+   struct delta_frame *delta;
+
+   if (mispredicted >= netplay->frame_count)
+      return;
+
+   netplay->rollback_frame = NETPLAY_NO_ROLLBACK;
+
+   delta = netplay_find_state(netplay, mispredicted);
+   if (!delta)
+   {
+      RARCH_ERR("Netplay has no state to roll back to. Players may desync.\n");
+      return;
+   }
+
+   /* Next rollback can not go back further than the first frame 
+    * still missing input, so that is the only state worth taking 
+    * along the way. The states we pass were made with old 
+    * predictions and are dropped. */
+   resume = netplay_confirmed_frame(netplay);
+
+   pretro_unserialize(delta->state, netplay->state_size);
+
+   netplay->is_replay = true;
+   for (frame = delta->frame; frame < netplay->frame_count; frame++)
+   {
+      struct delta_frame *replay = netplay_delta(netplay, frame);
+
+      if (replay != delta)
+      {
+         replay->have_state = false;
+         if (frame == resume)
+            replay->have_state = pretro_serialize(replay->state,
+                  netplay->state_size);
+      }
+
+      netplay_simulate_input(netplay, replay);
+      netplay->replay_frame = frame;
+
+#if defined(HAVE_THREADS) && !defined(RARCH_CONSOLE)
+      lock_autosave();
+#endif
+      pretro_run();
+#if defined(HAVE_THREADS) && !defined(RARCH_CONSOLE)
+      unlock_autosave();
+#endif
+   }
+   netplay->is_replay = false;
+}
+
 static void netplay_pre_frame_net(netplay_t *netplay)
 {
-   pretro_serialize(netplay->buffer[netplay->self_ptr].state,
-         netplay->state_size);
-   netplay->can_poll = true;
+   struct delta_frame *delta;
 
+   netplay->can_poll = true;
    input_poll_net();
+
+   if (!netplay->has_connection)
+      return;
+
+   netplay_rollback(netplay);
+
+   delta = netplay_delta(netplay, netplay->frame_count);
+   netplay_simulate_input(netplay, delta);
+
+   /* Frames everybody's input is in for never roll back. */
+   if (delta->simulated)
+      delta->have_state = pretro_serialize(delta->state,
+            netplay->state_size);
 }
 
 static void netplay_set_spectate_input(netplay_t *netplay, int16_t input)
@@ -1361,92 +2575,13 @@ int16_t input_state_spectate_client(unsigned port, unsigned device,
          device, idx, id);
 }
 
+/* Spectators are taken in and sent their header by the transport. */
 static void netplay_pre_frame_spectate(netplay_t *netplay)
 {
-   unsigned i;
    if (netplay->spectate_client)
       return;
 
-   fd_set fds;
-   FD_ZERO(&fds);
-   FD_SET(netplay->fd, &fds);
-
-   struct timeval tmp_tv = {0};
-   if (select(netplay->fd + 1, &fds, NULL, NULL, &tmp_tv) <= 0)
-      return;
-
-   if (!FD_ISSET(netplay->fd, &fds))
-      return;
-
-   struct sockaddr_storage their_addr;
-   socklen_t addr_size = sizeof(their_addr);
-   int new_fd = accept(netplay->fd, (struct sockaddr*)&their_addr, &addr_size);
-   if (new_fd < 0)
-   {
-      RARCH_ERR("Failed to accept incoming spectator.\n");
-      return;
-   }
-
-   int idx = -1;
-   for (i = 0; i < MAX_SPECTATORS; i++)
-   {
-      if (netplay->spectate_fds[i] == -1)
-      {
-         idx = i;
-         break;
-      }
-   }
-
-   /* No vacant client streams :( */
-   if (idx == -1)
-   {
-      close(new_fd);
-      return;
-   }
-
-   if (!get_nickname(netplay, new_fd))
-   {
-      RARCH_ERR("Failed to get nickname from client.\n");
-      close(new_fd);
-      return;
-   }
-
-   if (!send_nickname(netplay, new_fd))
-   {
-      RARCH_ERR("Failed to send nickname to client.\n");
-      close(new_fd);
-      return;
-   }
-
-   size_t header_size;
-   uint32_t *header = bsv_header_generate(&header_size,
-         implementation_magic_value());
-
-   if (!header)
-   {
-      RARCH_ERR("Failed to generate BSV header.\n");
-      close(new_fd);
-      return;
-   }
-
-   int bufsize = header_size;
-   setsockopt(new_fd, SOL_SOCKET, SO_SNDBUF, CONST_CAST &bufsize,
-         sizeof(int));
-
-   if (!send_all(new_fd, header, header_size))
-   {
-      RARCH_ERR("Failed to send header to client.\n");
-      close(new_fd);
-      free(header);
-      return;
-   }
-
-   free(header);
-   netplay->spectate_fds[idx] = new_fd;
-
-#ifndef HAVE_SOCKET_LEGACY
-   log_connection(&their_addr, idx, netplay->other_nick);
-#endif
+   poll_input(netplay, 0);
 }
 
 void netplay_pre_frame(netplay_t *netplay)
@@ -1460,53 +2595,6 @@ void netplay_pre_frame(netplay_t *netplay)
 static void netplay_post_frame_net(netplay_t *netplay)
 {
    netplay->frame_count++;
-
-   /* Nothing to do... */
-   if (netplay->other_frame_count == netplay->read_frame_count)
-      return;
-
-   /* Skip ahead if we predicted correctly.
-    * Skip until our simulation failed. */
-   while (netplay->other_frame_count < netplay->read_frame_count)
-   {
-      const struct delta_frame *ptr = &netplay->buffer[netplay->other_ptr];
-      if ((ptr->simulated_input_state != ptr->real_input_state)
-            && !ptr->used_real)
-         break;
-      netplay->other_ptr = NEXT_PTR(netplay->other_ptr);
-      netplay->other_frame_count++;
-   }
-
-   if (netplay->other_frame_count < netplay->read_frame_count)
-   {
-      /* Replay frames. */
-      netplay->is_replay = true;
-      netplay->tmp_ptr = netplay->other_ptr;
-      netplay->tmp_frame_count = netplay->other_frame_count;
-
-      pretro_unserialize(netplay->buffer[netplay->other_ptr].state,
-            netplay->state_size);
-      bool first = true;
-      while (first || (netplay->tmp_ptr != netplay->self_ptr))
-      {
-         pretro_serialize(netplay->buffer[netplay->tmp_ptr].state,
-               netplay->state_size);
-#if defined(HAVE_THREADS) && !defined(RARCH_CONSOLE)
-         lock_autosave();
-#endif
-         pretro_run();
-#if defined(HAVE_THREADS) && !defined(RARCH_CONSOLE)
-         unlock_autosave();
-#endif
-         netplay->tmp_ptr = NEXT_PTR(netplay->tmp_ptr);
-         netplay->tmp_frame_count++;
-         first = false;
-      }
-
-      netplay->other_ptr = netplay->read_ptr;
-      netplay->other_frame_count = netplay->read_frame_count;
-      netplay->is_replay = false;
-   }
 }
 
 static void netplay_post_frame_spectate(netplay_t *netplay)
@@ -1517,25 +2605,25 @@ static void netplay_post_frame_spectate(netplay_t *netplay)
 
    for (i = 0; i < MAX_SPECTATORS; i++)
    {
-      if (netplay->spectate_fds[i] == -1)
+      struct netplay_conn *conn = &netplay->spectators[i];
+      size_t size = netplay->spectate_input_ptr * sizeof(int16_t);
+
+      if (!conn->out || conn->closing)
          continue;
 
-      if (!send_all(netplay->spectate_fds[i],
-               netplay->spectate_input,
-               netplay->spectate_input_ptr * sizeof(int16_t)))
+      /* Rather than hold up the frame, drop a spectator 
+       * that cannot keep up. */
+      if (spsc_write_avail(conn->out) < size)
       {
-         RARCH_LOG("Client (#%u) disconnected ...\n", i);
-
-         char msg[512];
-         snprintf(msg, sizeof(msg), "Client (#%u) disconnected.", i);
-         msg_queue_push(g_extern.msg_queue, msg, 1, 180);
-
-         close(netplay->spectate_fds[i]);
-         netplay->spectate_fds[i] = -1;
-         break;
+         RARCH_WARN("Client (#%u) is too slow, dropping it.\n", i);
+         ratomic_store_release(&conn->closing, true);
+         continue;
       }
+
+      spsc_write(conn->out, netplay->spectate_input, size);
    }
 
+   netplay_io_wake(netplay);
    netplay->spectate_input_ptr = 0;
 }
 
@@ -46,15 +46,20 @@ typedef struct netplay netplay_t;
 bool netplay_init_network(void);
 
 /* Creates a new netplay handle. A NULL host means we're 
- * hosting (player 1). :) */
+ * hosting (player 1), and waiting for players - 1 others to join. :)
+ *
+ * Local input takes effect delay frames after it was read. Up to 
+ * frames frames may run ahead on predicted input of the others, 
+ * and are rolled back when the prediction turns out wrong. 
+ * Clients get players, delay and frames from the host. */
 netplay_t *netplay_new(const char *server,
-      uint16_t port, unsigned frames,
+      uint16_t port, unsigned frames, unsigned delay, unsigned players,
       const struct retro_callbacks *cb, bool spectate,
       const char *nick);
 
 void netplay_free(netplay_t *handle);
 
-/* On regular netplay, flip who controls player 1 and 2. */
+/* On regular netplay, flip who controls player 1 and 2. Host only. */
 void netplay_flip_players(netplay_t *handle);
 
 /* Call this before running retro_run(). */
@@ -414,7 +414,8 @@ uint64_t rarch_get_cpu_features(void)
          && ((xgetbv_x86(0) & 0x6) == 0x6))
       cpu |= RETRO_SIMD_AVX;
 
-   if (max_flag >= 7)
+   /* AVX2 needs the same OS support for YMM registers as AVX. */
+   if ((cpu & RETRO_SIMD_AVX) && max_flag >= 7)
    {
       x86_cpuid(7, flags);
       if (flags[1] & (1 << 5))
@@ -43,9 +43,11 @@ extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <boolean.h>
-#include "../fifo_buffer.h"
+#include "../spsc_buffer.h"
 #include <rthreads/rthreads.h>
+#include <rthreads/ratomic.h>
 #include "../general.h"
+#include "../performance.h"
 #include <gfx/scaler/scaler.h>
 #include <file/config_file.h>
 #include "../audio/utils.h"
@@ -67,7 +69,7 @@ struct ff_video_info
    AVCodec *encoder;
 
    AVFrame *conv_frame;
-   uint8_t *conv_frame_buf;
+   size_t conv_size;
    int64_t frame_cnt;
 
    uint8_t *outbuf;
@@ -162,6 +164,33 @@ struct ff_config_param
    AVDictionary *audio_opts;
 };
 
+/* Converted frame, followed by the picture. */
+struct ff_picture
+{
+   /* Times the frame is repeated after it. */
+   unsigned dupes;
+};
+
+/* Encoded packet, followed by its data. */
+struct ff_packet
+{
+   int64_t pts;
+   int64_t dts;
+   int flags;
+   int stream_index;
+   int size;
+};
+
+/* One side of the pipeline, and what it sleeps on. */
+struct ff_stage
+{
+   sthread_t *thread;
+   scond_t *cond;
+   volatile size_t asleep;
+   /* Set once the stage has passed on all it ever will. */
+   volatile size_t done;
+};
+
 typedef struct ffmpeg
 {
    struct ff_video_info video;
@@ -171,16 +200,34 @@ typedef struct ffmpeg
    
    struct ffemu_params params;
 
-   scond_t *cond;
+   /* Recording is a pipeline, with a thread for each stage:
+    *
+    * push_video -> video_fifo -> convert -> conv_fifo -> video_enc
+    *    -> vpkt_fifo -> mux
+    * push_audio -> audio_fifo -> audio_enc -> apkt_fifo -> mux
+    *
+    * Raw frames are queued as packets holding a struct ffemu_video_data 
+    * followed by the tightly packed image, converted frames as 
+    * struct ff_picture and encoded ones as struct ff_packet. 
+    * Audio is queued as a byte stream. None of the queues needs 
+    * locking; the lock is only used to sleep, and a stage only 
+    * wakes its neighbours if they are asleep. */
    slock_t *cond_lock;
-   slock_t *lock;
-   fifo_buffer_t *audio_fifo;
-   fifo_buffer_t *video_fifo;
-   fifo_buffer_t *attr_fifo;
-   sthread_t *thread;
+   spsc_buffer_t *audio_fifo;
+   spsc_buffer_t *video_fifo;
+   spsc_buffer_t *conv_fifo;
+   spsc_buffer_t *vpkt_fifo;
+   spsc_buffer_t *apkt_fifo;
+
+   struct ff_stage producer;
+   struct ff_stage convert;
+   struct ff_stage video_enc;
+   struct ff_stage audio_enc;
+   struct ff_stage mux;
 
    volatile bool alive;
-   volatile bool can_sleep;
+   /* Set by finalize. Stages finish what is queued, then quit. */
+   volatile size_t draining;
 } ffmpeg_t;
 
 static bool ffmpeg_codec_has_sample_format(enum AVSampleFormat fmt,
@@ -477,14 +524,13 @@ static bool ffmpeg_init_video(ffmpeg_t *handle)
 
    video->frame_drop_ratio = params->frame_drop_ratio;
 
-   size_t size = avpicture_get_size(video->pix_fmt, param->out_width,
+   /* Converted frames live in conv_fifo, conv_frame just points 
+    * at the one being encoded. */
+   video->conv_size = avpicture_get_size(video->pix_fmt, param->out_width,
          param->out_height);
-   video->conv_frame_buf = (uint8_t*)av_malloc(size);
    video->conv_frame = av_frame_alloc();
-   avpicture_fill((AVPicture*)video->conv_frame, video->conv_frame_buf,
-         video->pix_fmt, param->out_width, param->out_height);
 
-   return true;
+   return video->conv_frame != NULL;
 }
 
 static bool ffmpeg_init_config(struct ff_config_param *params,
@@ -610,79 +656,187 @@ static bool ffmpeg_init_muxer_post(ffmpeg_t *handle)
 }
 
 #define MAX_FRAMES 32
+/* Converted frames are big, only keep enough to cover for hiccups. */
+#define MAX_CONV_FRAMES 4
+#define MAX_AUDIO_PACKETS 64
 
-static void ffmpeg_thread(void *data);
+/* Scalers may read a bit past the end of the image. */
+#define VIDEO_PADDING 64
+
+static struct retro_perf_counter ffmpeg_convert = {"ffmpeg_convert"};
+static struct retro_perf_counter ffmpeg_encode_video = {"ffmpeg_encode_video"};
+static struct retro_perf_counter ffmpeg_encode_audio = {"ffmpeg_encode_audio"};
+static struct retro_perf_counter ffmpeg_mux = {"ffmpeg_mux"};
+
+static void ffmpeg_convert_thread(void *data);
+static void ffmpeg_video_thread(void *data);
+static void ffmpeg_audio_thread(void *data);
+static void ffmpeg_mux_thread(void *data);
+
+static size_t ffmpeg_video_packet_size(ffmpeg_t *handle)
+{
+   return sizeof(struct ffemu_video_data) + handle->params.fb_width *
+      handle->params.fb_height * handle->video.pix_size + VIDEO_PADDING;
+}
+
+static size_t ffmpeg_conv_packet_size(ffmpeg_t *handle)
+{
+   return sizeof(struct ff_picture) + handle->video.conv_size;
+}
+
+static bool init_stage(struct ff_stage *stage,
+      void (*thread_func)(void*), ffmpeg_t *handle)
+{
+   stage->cond = scond_new();
+   if (!stage->cond)
+      return false;
+
+   if (!thread_func)
+      return true;
+
+   stage->thread = sthread_create(thread_func, handle);
+   return stage->thread != NULL;
+}
 
 static bool init_thread(ffmpeg_t *handle)
 {
-   handle->lock = slock_new();
+   bool ret;
+
    handle->cond_lock = slock_new();
-   handle->cond = scond_new();
-   handle->audio_fifo = fifo_new(32000 * sizeof(int16_t) *
+   handle->audio_fifo = spsc_new(32000 * sizeof(int16_t) *
          handle->params.channels * MAX_FRAMES / 60); /* Some arbitrary max size. */
-   handle->attr_fifo = fifo_new(sizeof(struct ffemu_video_data) * MAX_FRAMES);
-   handle->video_fifo = fifo_new(handle->params.fb_width * handle->params.fb_height *
-            handle->video.pix_size * MAX_FRAMES);
+   handle->video_fifo = spsc_new((ffmpeg_video_packet_size(handle) +
+            2 * SPSC_ALIGN) * MAX_FRAMES);
+   handle->conv_fifo = spsc_new((ffmpeg_conv_packet_size(handle) +
+            2 * SPSC_ALIGN) * MAX_CONV_FRAMES);
+   /* Must hold at least the largest packet the encoders can give us. */
+   handle->vpkt_fifo = spsc_new(2 * (sizeof(struct ff_packet) +
+            handle->video.outbuf_size + 2 * SPSC_ALIGN));
+   handle->apkt_fifo = spsc_new((sizeof(struct ff_packet) +
+            handle->audio.outbuf_size + 2 * SPSC_ALIGN) * MAX_AUDIO_PACKETS);
+
+   assert(handle->cond_lock && handle->audio_fifo && handle->video_fifo &&
+         handle->conv_fifo && handle->vpkt_fifo && handle->apkt_fifo);
+
+   rarch_perf_register(&ffmpeg_convert);
+   rarch_perf_register(&ffmpeg_encode_video);
+   rarch_perf_register(&ffmpeg_encode_audio);
+   rarch_perf_register(&ffmpeg_mux);
 
    handle->alive = true;
-   handle->can_sleep = true;
-   handle->thread = sthread_create(ffmpeg_thread, handle);
+   if (!handle->config.audio_enable)
+      handle->audio_enc.done = true;
 
-   assert(handle->lock && handle->cond_lock &&
-      handle->cond && handle->audio_fifo &&
-      handle->attr_fifo && handle->video_fifo && handle->thread);
+   ret = init_stage(&handle->producer, NULL, handle) &&
+      init_stage(&handle->mux, ffmpeg_mux_thread, handle) &&
+      init_stage(&handle->video_enc, ffmpeg_video_thread, handle) &&
+      init_stage(&handle->convert, ffmpeg_convert_thread, handle) &&
+      (!handle->config.audio_enable ||
+       init_stage(&handle->audio_enc, ffmpeg_audio_thread, handle));
 
-   return true;
+   assert(ret);
+
+   return ret;
+}
+
+static void deinit_stage(struct ff_stage *stage)
+{
+   if (stage->thread)
+      sthread_join(stage->thread);
+   if (stage->cond)
+      scond_free(stage->cond);
+
+   stage->thread = NULL;
+   stage->cond = NULL;
 }
 
-static void deinit_thread(ffmpeg_t *handle)
+/* If drain is set, the stages first finish what was pushed. */
+static void deinit_thread(ffmpeg_t *handle, bool drain)
 {
-   if (!handle->thread)
+   struct ff_stage *stages[] = {
+      &handle->producer, &handle->convert, &handle->video_enc,
+      &handle->audio_enc, &handle->mux,
+   };
+   unsigned i;
+
+   if (!handle->cond_lock)
       return;
 
    slock_lock(handle->cond_lock);
-   handle->alive = false;
-   handle->can_sleep = false;
+   if (drain)
+      handle->draining = true;
+   else
+      handle->alive = false;
+   for (i = 0; i < ARRAY_SIZE(stages); i++)
+      if (stages[i]->cond)
+         scond_broadcast(stages[i]->cond);
    slock_unlock(handle->cond_lock);
 
-   scond_signal(handle->cond);
-   sthread_join(handle->thread);
+   /* Upstream first, so each stage sees the one before it done. */
+   for (i = 0; i < ARRAY_SIZE(stages); i++)
+      deinit_stage(stages[i]);
 
-   slock_free(handle->lock);
    slock_free(handle->cond_lock);
-   scond_free(handle->cond);
-
-   handle->thread = NULL;
+   handle->cond_lock = NULL;
 }
 
 static void deinit_thread_buf(ffmpeg_t *handle)
 {
-   if (handle->audio_fifo)
-   {
-      fifo_free(handle->audio_fifo);
-      handle->audio_fifo = NULL;
-   }
-   
-   if (handle->attr_fifo)
-   {
-      fifo_free(handle->attr_fifo);
-      handle->attr_fifo = NULL;
-   }
+   spsc_buffer_t **fifos[] = {
+      &handle->audio_fifo, &handle->video_fifo, &handle->conv_fifo,
+      &handle->vpkt_fifo, &handle->apkt_fifo,
+   };
+   unsigned i;
 
-   if (handle->video_fifo)
+   for (i = 0; i < ARRAY_SIZE(fifos); i++)
    {
-      fifo_free(handle->video_fifo);
-      handle->video_fifo = NULL;
+      spsc_free(*fifos[i]);
+      *fifos[i] = NULL;
    }
 }
 
+/* Called after publishing data (or space) to another stage. */
+static void ffmpeg_wake(ffmpeg_t *handle, struct ff_stage *stage)
+{
+   /* Pairs with the fence in ffmpeg_sleep. Either the other side 
+    * sees what was just published, or we see it's asleep. */
+   ratomic_fence();
+   if (!ratomic_load_acquire(&stage->asleep))
+      return;
+
+   slock_lock(handle->cond_lock);
+   scond_signal(stage->cond);
+   slock_unlock(handle->cond_lock);
+}
+
+/* Marks a stage as finished, and lets the next one know. */
+static void ffmpeg_stage_done(ffmpeg_t *handle, struct ff_stage *stage,
+      struct ff_stage *next)
+{
+   ratomic_store_release(&stage->done, true);
+   ffmpeg_wake(handle, next);
+}
+
+/* Sleeps until woken, unless ready() turns true in the meantime. */
+static void ffmpeg_sleep(ffmpeg_t *handle, struct ff_stage *stage,
+      bool (*ready)(ffmpeg_t*, size_t), size_t size)
+{
+   slock_lock(handle->cond_lock);
+   ratomic_store_release(&stage->asleep, 1);
+   ratomic_fence();
+   if (handle->alive && !ready(handle, size))
+      scond_wait(stage->cond, handle->cond_lock);
+   ratomic_store_release(&stage->asleep, 0);
+   slock_unlock(handle->cond_lock);
+}
+
 static void ffmpeg_free(void *data)
 {
    ffmpeg_t *handle = (ffmpeg_t*)data;
    if (!handle)
       return;
 
-   deinit_thread(handle);
+   deinit_thread(handle, false);
    deinit_thread_buf(handle);
 
    if (handle->audio.codec)
@@ -700,7 +854,6 @@ static void ffmpeg_free(void *data)
    }
 
    av_frame_free(&handle->video.conv_frame);
-   av_free(handle->video.conv_frame_buf);
 
    scaler_ctx_gen_reset(&handle->video.scaler);
 
@@ -761,6 +914,16 @@ error:
    return NULL;
 }
 
+static bool ffmpeg_video_writable(ffmpeg_t *handle, size_t size)
+{
+   return spsc_reserve(handle->video_fifo, size) != NULL;
+}
+
+static bool ffmpeg_audio_writable(ffmpeg_t *handle, size_t size)
+{
+   return spsc_write_avail(handle->audio_fifo) >= size;
+}
+
 static bool ffmpeg_push_video(void *data,
       const struct ffemu_video_data *video_data)
 {
@@ -779,33 +942,6 @@ static bool ffmpeg_push_video(void *data,
    if (drop_frame)
       return true;
 
-   for (;;)
-   {
-      slock_lock(handle->lock);
-      unsigned avail = fifo_write_avail(handle->attr_fifo);
-      slock_unlock(handle->lock);
-
-      if (!handle->alive)
-         return false;
-
-      if (avail >= sizeof(*video_data))
-         break;
-
-      slock_lock(handle->cond_lock);
-      if (handle->can_sleep)
-      {
-         handle->can_sleep = false;
-         scond_wait(handle->cond, handle->cond_lock);
-         handle->can_sleep = true;
-      }
-      else
-         scond_signal(handle->cond);
-
-      slock_unlock(handle->cond_lock);
-   }
-
-   slock_lock(handle->lock);
-
    /* Tightly pack our frame to conserve memory.
     * libretro tends to use a very large pitch.
     */
@@ -816,15 +952,33 @@ static bool ffmpeg_push_video(void *data,
    else
       attr_data.pitch = attr_data.width * handle->video.pix_size;
 
-   fifo_write(handle->attr_fifo, &attr_data, sizeof(attr_data));
+   size_t size = sizeof(attr_data) + attr_data.height * attr_data.pitch +
+      VIDEO_PADDING;
+   uint8_t *packet;
+
+   for (;;)
+   {
+      if (!handle->alive)
+         return false;
+
+      if ((packet = (uint8_t*)spsc_reserve(handle->video_fifo, size)))
+         break;
+
+      ffmpeg_sleep(handle, &handle->producer,
+            ffmpeg_video_writable, size);
+   }
+
+   /* The frame is packed straight into the queue. */
+   memcpy(packet, &attr_data, sizeof(attr_data));
 
-   int offset = 0;
-   for (y = 0; y < attr_data.height; y++, offset += video_data->pitch)
-      fifo_write(handle->video_fifo,
-            (const uint8_t*)video_data->data + offset, attr_data.pitch);
+   uint8_t *out = packet + sizeof(attr_data);
+   const uint8_t *in = (const uint8_t*)video_data->data;
+   for (y = 0; y < attr_data.height; y++, in += video_data->pitch,
+         out += attr_data.pitch)
+      memcpy(out, in, attr_data.pitch);
 
-   slock_unlock(handle->lock);
-   scond_signal(handle->cond);
+   spsc_commit(handle->video_fifo, size);
+   ffmpeg_wake(handle, &handle->convert);
 
    return true;
 }
@@ -840,37 +994,23 @@ static bool ffmpeg_push_audio(void *data,
    if (!handle->config.audio_enable)
       return true;
 
+   size_t size = audio_data->frames * handle->params.channels
+      * sizeof(int16_t);
+
    for (;;)
    {
-      slock_lock(handle->lock);
-      unsigned avail = fifo_write_avail(handle->audio_fifo);
-      slock_unlock(handle->lock);
-
       if (!handle->alive)
          return false;
 
-      if (avail >= audio_data->frames * handle->params.channels
-            * sizeof(int16_t))
+      if (ffmpeg_audio_writable(handle, size))
          break;
 
-      slock_lock(handle->cond_lock);
-      if (handle->can_sleep)
-      {
-         handle->can_sleep = false;
-         scond_wait(handle->cond, handle->cond_lock);
-         handle->can_sleep = true;
-      }
-      else
-         scond_signal(handle->cond);
-
-      slock_unlock(handle->cond_lock);
+      ffmpeg_sleep(handle, &handle->producer,
+            ffmpeg_audio_writable, size);
    }
 
-   slock_lock(handle->lock);
-   fifo_write(handle->audio_fifo, audio_data->data,
-         audio_data->frames * handle->params.channels * sizeof(int16_t));
-   slock_unlock(handle->lock);
-   scond_signal(handle->cond);
+   spsc_write(handle->audio_fifo, audio_data->data, size);
+   ffmpeg_wake(handle, &handle->audio_enc);
 
    return true;
 }
@@ -910,7 +1050,7 @@ static bool encode_video(ffmpeg_t *handle, AVPacket *pkt, AVFrame *frame)
 }
 
 static void ffmpeg_scale_input(ffmpeg_t *handle,
-      const struct ffemu_video_data *data)
+      const struct ffemu_video_data *data, AVPicture *out)
 {
    /* Attempt to preserve more information if we scale down. */
    bool shrunk = handle->params.out_width < data->width
@@ -926,8 +1066,7 @@ static void ffmpeg_scale_input(ffmpeg_t *handle,
 
       int linesize = data->pitch;
       sws_scale(handle->video.sws, (const uint8_t* const*)&data->data,
-            &linesize, 0, data->height, handle->video.conv_frame->data,
-            handle->video.conv_frame->linesize);
+            &linesize, 0, data->height, out->data, out->linesize);
    }
    else
    {
@@ -943,36 +1082,62 @@ static void ffmpeg_scale_input(ffmpeg_t *handle,
 
          handle->video.scaler.out_width  = handle->params.out_width;
          handle->video.scaler.out_height = handle->params.out_height;
-         handle->video.scaler.out_stride = 
-            handle->video.conv_frame->linesize[0];
+         handle->video.scaler.out_stride = out->linesize[0];
+         handle->video.scaler.threads    = handle->params.threads;
 
          scaler_ctx_gen_filter(&handle->video.scaler);
       }
 
-      scaler_ctx_scale(&handle->video.scaler,
-            handle->video.conv_frame->data[0], data->data);
+      scaler_ctx_scale(&handle->video.scaler, out->data[0], data->data);
    }
 }
 
-static bool ffmpeg_push_video_thread(ffmpeg_t *handle,
-      const struct ffemu_video_data *data)
+static bool ffmpeg_packet_writable(spsc_buffer_t *fifo, size_t size)
+{
+   return spsc_reserve(fifo, size) != NULL;
+}
+
+static bool ffmpeg_vpkt_writable(ffmpeg_t *handle, size_t size)
 {
-   if (!data->is_dupe)
-      ffmpeg_scale_input(handle, data);
+   return ffmpeg_packet_writable(handle->vpkt_fifo, size);
+}
 
-   handle->video.conv_frame->pts = handle->video.frame_cnt;
+static bool ffmpeg_apkt_writable(ffmpeg_t *handle, size_t size)
+{
+   return ffmpeg_packet_writable(handle->apkt_fifo, size);
+}
 
-   AVPacket pkt;
-   if (!encode_video(handle, &pkt, handle->video.conv_frame))
-      return false;
+/* Passes an encoded packet on to the muxer. */
+static bool ffmpeg_queue_packet(ffmpeg_t *handle, const AVPacket *pkt,
+      spsc_buffer_t *fifo, struct ff_stage *stage,
+      bool (*writable)(ffmpeg_t*, size_t))
+{
+   struct ff_packet *out;
+   size_t size = sizeof(*out) + pkt->size;
 
-   if (pkt.size)
+   if (!pkt->size)
+      return true;
+
+   for (;;)
    {
-      if (av_interleaved_write_frame(handle->muxer.ctx, &pkt) < 0)
+      if (!handle->alive)
          return false;
+
+      if ((out = (struct ff_packet*)spsc_reserve(fifo, size)))
+         break;
+
+      ffmpeg_sleep(handle, stage, writable, size);
    }
 
-   handle->video.frame_cnt++;
+   out->pts          = pkt->pts;
+   out->dts          = pkt->dts;
+   out->flags        = pkt->flags;
+   out->stream_index = pkt->stream_index;
+   out->size         = pkt->size;
+   memcpy(out + 1, pkt->data, pkt->size);
+
+   spsc_commit(fifo, size);
+   ffmpeg_wake(handle, &handle->mux);
    return true;
 }
 
@@ -1153,7 +1318,9 @@ static void ffmpeg_audio_resample(ffmpeg_t *handle,
 static bool ffmpeg_push_audio_thread(ffmpeg_t *handle,
       struct ffemu_audio_data *data, bool require_block)
 {
+   RARCH_PERFORMANCE_START(ffmpeg_encode_audio);
    ffmpeg_audio_resample(handle, data);
+   RARCH_PERFORMANCE_STOP(ffmpeg_encode_audio);
 
    size_t written_frames = 0;
    while (written_frames < data->frames)
@@ -1182,17 +1349,21 @@ static bool ffmpeg_push_audio_thread(ffmpeg_t *handle,
          break;
 
       AVPacket pkt;
-      if (!encode_audio(handle, &pkt, false))
+      bool encoded;
+
+      RARCH_PERFORMANCE_START(ffmpeg_encode_audio);
+      encoded = encode_audio(handle, &pkt, false);
+      RARCH_PERFORMANCE_STOP(ffmpeg_encode_audio);
+
+      if (!encoded)
          return false;
 
       handle->audio.frame_cnt       += handle->audio.frames_in_buffer;
       handle->audio.frames_in_buffer = 0;
 
-      if (pkt.size)
-      {
-         if (av_interleaved_write_frame(handle->muxer.ctx, &pkt) < 0)
-            return false;
-      }
+      if (!ffmpeg_queue_packet(handle, &pkt, handle->apkt_fifo,
+               &handle->audio_enc, ffmpeg_apkt_writable))
+         return false;
    }
 
    return true;
@@ -1201,10 +1372,10 @@ static bool ffmpeg_push_audio_thread(ffmpeg_t *handle,
 static void ffmpeg_flush_audio(ffmpeg_t *handle, void *audio_buf,
       size_t audio_buf_size)
 {
-   size_t avail = fifo_read_avail(handle->audio_fifo);
+   size_t avail = spsc_read_avail(handle->audio_fifo);
    if (avail)
    {
-      fifo_read(handle->audio_fifo, audio_buf, avail);
+      spsc_read(handle->audio_fifo, audio_buf, avail);
 
       struct ffemu_audio_data aud = {0};
       aud.frames = avail / (sizeof(int16_t) * handle->params.channels);
@@ -1217,7 +1388,8 @@ static void ffmpeg_flush_audio(ffmpeg_t *handle, void *audio_buf,
    {
       AVPacket pkt;
       if (!encode_audio(handle, &pkt, true) || !pkt.size ||
-            av_interleaved_write_frame(handle->muxer.ctx, &pkt) < 0)
+            !ffmpeg_queue_packet(handle, &pkt, handle->apkt_fifo,
+               &handle->audio_enc, ffmpeg_apkt_writable))
          break;
    }
 }
@@ -1228,162 +1400,307 @@ static void ffmpeg_flush_video(ffmpeg_t *handle)
    {
       AVPacket pkt;
       if (!encode_video(handle, &pkt, NULL) || !pkt.size ||
-            av_interleaved_write_frame(handle->muxer.ctx, &pkt) < 0)
+            !ffmpeg_queue_packet(handle, &pkt, handle->vpkt_fifo,
+               &handle->video_enc, ffmpeg_vpkt_writable))
          break;
    }
 }
 
-static void ffmpeg_flush_buffers(ffmpeg_t *handle)
+static bool ffmpeg_finalize(void *data)
+{
+   ffmpeg_t *handle = (ffmpeg_t*)data;
+
+   if (!handle)
+      return false;
+
+   /* Let the pipeline run dry. This flushes out data still in 
+    * buffers (internal, and FFmpeg internal). */
+   deinit_thread(handle, true);
+   deinit_thread_buf(handle);
+
+   /* Write final data. */
+   av_write_trailer(handle->muxer.ctx);
+
+   return true;
+}
+
+static bool ffmpeg_conv_writable(ffmpeg_t *handle, size_t size)
 {
-   void *video_buf = av_malloc(2 * handle->params.fb_width * 
-         handle->params.fb_height * handle->video.pix_size);
-   size_t audio_buf_size = handle->config.audio_enable ? 
-      (handle->audio.codec->frame_size * 
-       handle->params.channels * sizeof(int16_t)) : 0;
-   void *audio_buf = audio_buf_size ? av_malloc(audio_buf_size) : NULL;
+   return ffmpeg_packet_writable(handle->conv_fifo, size);
+}
 
-   /* Try pushing data in an interleaving pattern to 
-    * ease the work of the muxer a bit. */
-   bool did_work;
+static bool ffmpeg_convert_ready(ffmpeg_t *handle, size_t size)
+{
+   return spsc_peek(handle->video_fifo, &size) ||
+      ratomic_load_acquire(&handle->draining);
+}
 
-   do
+static struct ff_picture *ffmpeg_convert_reserve(ffmpeg_t *handle,
+      size_t size)
+{
+   for (;;)
    {
-      did_work = false;
+      struct ff_picture *picture;
 
-      if (handle->config.audio_enable)
-      {
-         if (fifo_read_avail(handle->audio_fifo) >= audio_buf_size)
-         {
-            fifo_read(handle->audio_fifo, audio_buf, audio_buf_size);
+      if (!handle->alive)
+         return NULL;
 
-            struct ffemu_audio_data aud = {0};
-            aud.frames = handle->audio.codec->frame_size;
-            aud.data = audio_buf;
+      if ((picture = (struct ff_picture*)
+               spsc_reserve(handle->conv_fifo, size)))
+         return picture;
 
-            ffmpeg_push_audio_thread(handle, &aud, true);
-            did_work = true;
-         }
-      }
+      ffmpeg_sleep(handle, &handle->convert, ffmpeg_conv_writable, size);
+   }
+}
+
+/* Converts and scales raw frames straight into conv_fifo. 
+ * The last frame is held back until the next one comes in, 
+ * so that dupes in between can go along as a repeat count. */
+static void ffmpeg_convert_thread(void *data)
+{
+   ffmpeg_t *ff = (ffmpeg_t*)data;
+   size_t conv_size = ffmpeg_conv_packet_size(ff);
+   struct ff_picture *held = NULL;
 
+   while (ff->alive)
+   {
+      size_t size;
+      AVPicture picture;
       struct ffemu_video_data attr_buf;
-      if (fifo_read_avail(handle->attr_fifo) >= sizeof(attr_buf))
+      const uint8_t *packet = (const uint8_t*)
+         spsc_peek(ff->video_fifo, &size);
+
+      if (!packet)
       {
-         fifo_read(handle->attr_fifo, &attr_buf, sizeof(attr_buf));
-         fifo_read(handle->video_fifo, video_buf, 
-               attr_buf.height * attr_buf.pitch);
-         attr_buf.data = video_buf;
-         ffmpeg_push_video_thread(handle, &attr_buf);
+         /* Everything was pushed before draining was set. */
+         if (ratomic_load_acquire(&ff->draining) &&
+               !spsc_peek(ff->video_fifo, &size))
+            break;
 
-         did_work = true;
+         ffmpeg_sleep(ff, &ff->convert, ffmpeg_convert_ready, 0);
+         continue;
       }
-   } while (did_work);
-
-   /* Flush out last audio. */
-   if (handle->config.audio_enable)
-      ffmpeg_flush_audio(handle, audio_buf, audio_buf_size);
-
-   /* Flush out last video. */
-   ffmpeg_flush_video(handle);
 
-   av_free(video_buf);
-   av_free(audio_buf);
-}
+      memcpy(&attr_buf, packet, sizeof(attr_buf));
+      attr_buf.data = packet + sizeof(attr_buf);
 
-static bool ffmpeg_finalize(void *data)
-{
-   ffmpeg_t *handle = (ffmpeg_t*)data;
+      if (attr_buf.is_dupe && held)
+         held->dupes++;
+      else
+      {
+         if (held)
+         {
+            spsc_commit(ff->conv_fifo, conv_size);
+            ffmpeg_wake(ff, &ff->video_enc);
+         }
 
-   if (!handle)
-      return false;
+         if (!(held = ffmpeg_convert_reserve(ff, conv_size)))
+            break;
 
-   deinit_thread(handle);
+         held->dupes = 0;
+         avpicture_fill(&picture, (uint8_t*)(held + 1), ff->video.pix_fmt,
+               ff->params.out_width, ff->params.out_height);
 
-   /* Flush out data still in buffers (internal, and FFmpeg internal). */
-   ffmpeg_flush_buffers(handle);
+         RARCH_PERFORMANCE_START(ffmpeg_convert);
+         /* Nothing to repeat yet. */
+         if (attr_buf.is_dupe)
+            memset(held + 1, 0, ff->video.conv_size);
+         else
+            ffmpeg_scale_input(ff, &attr_buf, &picture);
+         RARCH_PERFORMANCE_STOP(ffmpeg_convert);
+      }
 
-   deinit_thread_buf(handle);
+      spsc_release(ff->video_fifo);
+      ffmpeg_wake(ff, &ff->producer);
+   }
 
-   /* Write final data. */
-   av_write_trailer(handle->muxer.ctx);
+   if (held && ff->alive)
+      spsc_commit(ff->conv_fifo, conv_size);
 
-   return true;
+   ffmpeg_stage_done(ff, &ff->convert, &ff->video_enc);
 }
 
-static void ffmpeg_thread(void *data)
+static bool ffmpeg_video_ready(ffmpeg_t *handle, size_t size)
 {
-   ffmpeg_t *ff = (ffmpeg_t*)data;
+   return spsc_peek(handle->conv_fifo, &size) ||
+      ratomic_load_acquire(&handle->convert.done);
+}
 
-   /* For some reason, FFmpeg has a tendency to crash 
-    * if we don't overallocate a bit. */
-   void *video_buf = av_malloc(2 * ff->params.fb_width *
-         ff->params.fb_height * ff->video.pix_size);
-   assert(video_buf);
+static bool ffmpeg_encode_frame(ffmpeg_t *handle)
+{
+   AVPacket pkt;
+   bool encoded;
 
-   size_t audio_buf_size = ff->config.audio_enable ? 
-      (ff->audio.codec->frame_size * ff->params.channels * sizeof(int16_t)) : 0;
-   void *audio_buf = audio_buf_size ? av_malloc(audio_buf_size) : NULL;
+   handle->video.conv_frame->pts = handle->video.frame_cnt++;
 
-   while (ff->alive)
-   {
-      struct ffemu_video_data attr_buf;
+   RARCH_PERFORMANCE_START(ffmpeg_encode_video);
+   encoded = encode_video(handle, &pkt, handle->video.conv_frame);
+   RARCH_PERFORMANCE_STOP(ffmpeg_encode_video);
 
-      bool avail_video = false;
-      bool avail_audio = false;
+   return encoded && ffmpeg_queue_packet(handle, &pkt, handle->vpkt_fifo,
+         &handle->video_enc, ffmpeg_vpkt_writable);
+}
 
-      slock_lock(ff->lock);
-      if (fifo_read_avail(ff->attr_fifo) >= sizeof(attr_buf))
-         avail_video = true;
+/* Encodes converted frames in place. */
+static void ffmpeg_video_thread(void *data)
+{
+   ffmpeg_t *ff = (ffmpeg_t*)data;
 
-      if (ff->config.audio_enable)
-         if (fifo_read_avail(ff->audio_fifo) >= audio_buf_size)
-            avail_audio = true;
-      slock_unlock(ff->lock);
+   while (ff->alive)
+   {
+      unsigned i;
+      size_t size;
+      const struct ff_picture *picture = (const struct ff_picture*)
+         spsc_peek(ff->conv_fifo, &size);
 
-      if (!avail_video && !avail_audio)
+      if (!picture)
       {
-         slock_lock(ff->cond_lock);
-         if (ff->can_sleep)
+         if (ratomic_load_acquire(&ff->convert.done) &&
+               !spsc_peek(ff->conv_fifo, &size))
          {
-            ff->can_sleep = false;
-            scond_wait(ff->cond, ff->cond_lock);
-            ff->can_sleep = true;
+            /* Flush out last video. */
+            ffmpeg_flush_video(ff);
+            break;
          }
-         else
-            scond_signal(ff->cond);
 
-         slock_unlock(ff->cond_lock);
+         ffmpeg_sleep(ff, &ff->video_enc, ffmpeg_video_ready, 0);
+         continue;
       }
 
-      if (avail_video)
-      {
-         slock_lock(ff->lock);
-         fifo_read(ff->attr_fifo, &attr_buf, sizeof(attr_buf));
-         fifo_read(ff->video_fifo, video_buf,
-               attr_buf.height * attr_buf.pitch);
-         slock_unlock(ff->lock);
-         scond_signal(ff->cond);
-
-         attr_buf.data = video_buf;
-         ffmpeg_push_video_thread(ff, &attr_buf);
-      }
+      avpicture_fill((AVPicture*)ff->video.conv_frame,
+            (uint8_t*)(picture + 1), ff->video.pix_fmt,
+            ff->params.out_width, ff->params.out_height);
 
-      if (avail_audio)
-      {
-         slock_lock(ff->lock);
-         fifo_read(ff->audio_fifo, audio_buf, audio_buf_size);
-         slock_unlock(ff->lock);
-         scond_signal(ff->cond);
+      for (i = 0; i <= picture->dupes; i++)
+         if (!ffmpeg_encode_frame(ff))
+            break;
+
+      spsc_release(ff->conv_fifo);
+      ffmpeg_wake(ff, &ff->convert);
+   }
+
+   ffmpeg_stage_done(ff, &ff->video_enc, &ff->mux);
+}
+
+static bool ffmpeg_audio_ready(ffmpeg_t *handle, size_t audio_buf_size)
+{
+   return spsc_read_avail(handle->audio_fifo) >= audio_buf_size ||
+      ratomic_load_acquire(&handle->draining);
+}
+
+/* Resamples and encodes audio, codec frame by codec frame. */
+static void ffmpeg_audio_thread(void *data)
+{
+   ffmpeg_t *ff = (ffmpeg_t*)data;
+   size_t audio_buf_size = ff->audio.codec->frame_size *
+      ff->params.channels * sizeof(int16_t);
+   void *audio_buf = av_malloc(audio_buf_size);
 
+   while (ff->alive)
+   {
+      /* Everything was pushed before draining was set. */
+      bool draining = ratomic_load_acquire(&ff->draining);
+
+      if (spsc_read_avail(ff->audio_fifo) >= audio_buf_size)
+      {
          struct ffemu_audio_data aud = {0};
+
+         spsc_read(ff->audio_fifo, audio_buf, audio_buf_size);
+         ffmpeg_wake(ff, &ff->producer);
+
          aud.frames = ff->audio.codec->frame_size;
          aud.data = audio_buf;
 
          ffmpeg_push_audio_thread(ff, &aud, true);
+         continue;
+      }
+
+      if (draining)
+      {
+         /* Flush out last audio. */
+         ffmpeg_flush_audio(ff, audio_buf, audio_buf_size);
+         break;
       }
+
+      ffmpeg_sleep(ff, &ff->audio_enc, ffmpeg_audio_ready, audio_buf_size);
    }
 
-   av_free(video_buf);
    av_free(audio_buf);
+   ffmpeg_stage_done(ff, &ff->audio_enc, &ff->mux);
+}
+
+static bool ffmpeg_mux_ready(ffmpeg_t *handle, size_t size)
+{
+   return spsc_peek(handle->vpkt_fifo, &size) ||
+      spsc_peek(handle->apkt_fifo, &size) ||
+      (ratomic_load_acquire(&handle->video_enc.done) &&
+       ratomic_load_acquire(&handle->audio_enc.done));
+}
+
+/* Writes out the oldest packet in fifo, if any. 
+ * Returns false if there was none, or it failed to write. 
+ * A packet which failed is dropped all the same. */
+static bool ffmpeg_mux_packet(ffmpeg_t *handle, spsc_buffer_t *fifo,
+      struct ff_stage *from)
+{
+   size_t size;
+   int ret;
+   AVPacket pkt;
+   const struct ff_packet *packet = (const struct ff_packet*)
+      spsc_peek(fifo, &size);
+
+   if (!packet)
+      return false;
+
+   av_init_packet(&pkt);
+   pkt.data         = (uint8_t*)(packet + 1);
+   pkt.size         = packet->size;
+   pkt.pts          = packet->pts;
+   pkt.dts          = packet->dts;
+   pkt.flags        = packet->flags;
+   pkt.stream_index = packet->stream_index;
+
+   RARCH_PERFORMANCE_START(ffmpeg_mux);
+   ret = av_interleaved_write_frame(handle->muxer.ctx, &pkt);
+   RARCH_PERFORMANCE_STOP(ffmpeg_mux);
+
+   spsc_release(fifo);
+   ffmpeg_wake(handle, from);
+
+   if (ret < 0)
+   {
+      RARCH_ERR("[FFmpeg]: Failed to write packet of stream %d.\n",
+            pkt.stream_index);
+      return false;
+   }
+
+   return true;
+}
+
+static void ffmpeg_mux_thread(void *data)
+{
+   ffmpeg_t *ff = (ffmpeg_t*)data;
+
+   while (ff->alive)
+   {
+      size_t size;
+      /* Take turns to ease the work of the muxer a bit. */
+      bool did_work = ffmpeg_mux_packet(ff, ff->vpkt_fifo, &ff->video_enc);
+
+      if (ffmpeg_mux_packet(ff, ff->apkt_fifo, &ff->audio_enc))
+         did_work = true;
+
+      if (did_work)
+         continue;
+
+      if (ratomic_load_acquire(&ff->video_enc.done) &&
+            ratomic_load_acquire(&ff->audio_enc.done) &&
+            !spsc_peek(ff->vpkt_fifo, &size) &&
+            !spsc_peek(ff->apkt_fifo, &size))
+         break;
+
+      ffmpeg_sleep(ff, &ff->mux, ffmpeg_mux_ready, 0);
+   }
 }
 
 const ffemu_backend_t ffemu_ffmpeg = {
@@ -31,6 +31,7 @@
 #include <compat/strl.h>
 #include "screenshot.h"
 #include "performance.h"
+#include <gfx/scaler/pixconv.h>
 #include "cheats.h"
 #include <compat/getopt.h>
 #include <compat/posix_string.h>
@@ -64,7 +65,6 @@ static bool take_screenshot_viewport(void)
    char screenshot_path[PATH_MAX];
    const char *screenshot_dir = NULL;
    uint8_t *buffer = NULL;
-   bool retval = false;
    struct rarch_viewport vp = {0};
 
    if (driver.video && driver.video->viewport_info)
@@ -73,12 +73,13 @@ static bool take_screenshot_viewport(void)
    if (!vp.width || !vp.height)
       return false;
 
-   if (!(buffer = (uint8_t*)malloc(vp.width * vp.height * 3)))
+   if (!(buffer = (uint8_t*)screenshot_async_buffer(
+               vp.width * vp.height * 3)))
       return false;
 
    if (driver.video && driver.video->read_viewport)
       if (!driver.video->read_viewport(driver.video_data, buffer))
-         goto done;
+         return false;
 
    screenshot_dir = g_settings.screenshot_directory;
 
@@ -90,26 +91,22 @@ static bool take_screenshot_viewport(void)
    }
 
    /* Data read from viewport is in bottom-up order, suitable for BMP. */
-   if (!screenshot_dump(screenshot_dir, buffer, vp.width, vp.height,
-            vp.width * 3, true))
-      goto done;
-
-   retval = true;
-
-done:
-   if (buffer)
-      free(buffer);
-   return retval;
+   return screenshot_async_submit(screenshot_dir, buffer,
+         vp.width, vp.height, vp.width * 3, true);
 }
 
 static bool take_screenshot_raw(void)
 {
+   unsigned i;
    char screenshot_path[PATH_MAX];
-   const void *data           = g_extern.frame_cache.data;
+   const uint8_t *data        = (const uint8_t*)g_extern.frame_cache.data;
    unsigned width             = g_extern.frame_cache.width;
    unsigned height            = g_extern.frame_cache.height;
-   int pitch                  = g_extern.frame_cache.pitch;
+   size_t pitch               = g_extern.frame_cache.pitch;
+   size_t line_size           = width *
+      (g_extern.system.pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2);
    const char *screenshot_dir = g_settings.screenshot_directory;
+   uint8_t *buffer            = NULL;
 
    if (!*g_settings.screenshot_directory)
    {
@@ -118,19 +115,25 @@ static bool take_screenshot_raw(void)
       screenshot_dir = screenshot_path;
    }
 
+   /* The core may overwrite its frame as soon as we return. */
+   if (!(buffer = (uint8_t*)screenshot_async_buffer(line_size * height)))
+      return false;
+
+   for (i = 0; i < height; i++)
+      memcpy(buffer + i * line_size, data + i * pitch, line_size);
+
    /* Negative pitch is needed as screenshot takes bottom-up,
     * but we use top-down.
     */
-   return screenshot_dump(screenshot_dir,
-         (const uint8_t*)data + (height - 1) * pitch,
-         width, height, -pitch, false);
+   return screenshot_async_submit(screenshot_dir,
+         buffer + (height - 1) * line_size,
+         width, height, -(int)line_size, false);
 }
 
 static void take_screenshot(void)
 {
    bool viewport_read = false;
    bool ret = false;
-   const char *msg = NULL;
 
    /* No way to infer screenshot directory. */
    if ((!*g_settings.screenshot_directory) && (!*g_extern.basename))
@@ -165,19 +168,15 @@ static void take_screenshot(void)
    else
       RARCH_ERR(RETRO_LOG_TAKE_SCREENSHOT_ERROR);
 
-   if (ret)
-   {
-      RARCH_LOG(RETRO_LOG_TAKE_SCREENSHOT);
-      msg = RETRO_MSG_TAKE_SCREENSHOT;
-   }
-   else
+   /* Otherwise the message is posted once the screenshot
+    * is written, see screenshot_async_poll(). */
+   if (!ret)
    {
       RARCH_WARN(RETRO_LOG_TAKE_SCREENSHOT_FAILED);
-      msg = RETRO_MSG_TAKE_SCREENSHOT_FAILED;
+      msg_queue_push(g_extern.msg_queue, RETRO_MSG_TAKE_SCREENSHOT_FAILED,
+            1, g_extern.is_paused ? 1 : 180);
    }
 
-   msg_queue_push(g_extern.msg_queue, msg, 1, g_extern.is_paused ? 1 : 180);
-
    if (g_extern.is_paused)
       rarch_render_cached_frame();
 }
@@ -502,9 +501,11 @@ static void print_help(void)
 
 #ifdef HAVE_NETPLAY
    puts("\t-H/--host: Host netplay as player 1.");
-   puts("\t-C/--connect: Connect to netplay as player 2.");
+   puts("\t-C/--connect: Connect to netplay as player 2 or later.");
    puts("\t--port: Port used to netplay. Default is 55435.");
-   puts("\t-F/--frames: Sync frames when using netplay.");
+   puts("\t-F/--frames: Frames which may run ahead on predicted input when using netplay.");
+   puts("\t--input-delay: Frames local input is delayed by when hosting netplay.");
+   puts("\t--players: Number of players when hosting netplay. Default is 2.");
    puts("\t--spectate: Netplay will become spectating mode.");
    puts("\t\tHost can live stream the game content to players that connect.");
    puts("\t\tHowever, the client will not be able to play. Multiple clients can connect to the host.");
@@ -645,6 +646,8 @@ static void parse_input(int argc, char *argv[])
    g_extern.has_set_username = false;
    g_extern.has_set_netplay_ip_address = false;
    g_extern.has_set_netplay_delay_frames = false;
+   g_extern.has_set_netplay_input_delay = false;
+   g_extern.has_set_netplay_players = false;
    g_extern.has_set_netplay_ip_port = false;
 
    g_extern.ups_pref = false;
@@ -694,6 +697,8 @@ static void parse_input(int argc, char *argv[])
       { "frames", 1, NULL, 'F' },
       { "port", 1, &val, 'p' },
       { "spectate", 0, &val, 'S' },
+      { "input-delay", 1, &val, 'd' },
+      { "players", 1, &val, 'P' },
 #endif
       { "nick", 1, &val, 'N' },
 #if defined(HAVE_NETWORK_CMD) && defined(HAVE_NETPLAY)
@@ -927,6 +932,16 @@ static void parse_input(int argc, char *argv[])
                   g_extern.netplay_is_spectate = true;
                   break;
 
+               case 'd':
+                  g_extern.has_set_netplay_input_delay = true;
+                  g_extern.netplay_input_delay = strtoul(optarg, NULL, 0);
+                  break;
+
+               case 'P':
+                  g_extern.has_set_netplay_players = true;
+                  g_extern.netplay_players = strtoul(optarg, NULL, 0);
+                  break;
+
 #endif
                case 'N':
                   g_extern.has_set_username = true;
@@ -1151,16 +1166,31 @@ static void init_rewind(void)
          (unsigned)(g_settings.rewind_buffer_size / 1000000));
 
    g_extern.state_manager = state_manager_new(g_extern.state_size,
-         g_settings.rewind_buffer_size);
+         g_settings.rewind_buffer_size, g_settings.rewind_threaded,
+         g_settings.rewind_keyframe_interval, g_settings.rewind_archive_size);
 
    if (!g_extern.state_manager)
       RARCH_WARN(RETRO_LOG_REWIND_INIT_FAILED);
 
+   g_extern.rewind.buffer_size       = g_settings.rewind_buffer_size;
+   g_extern.rewind.threaded          = g_settings.rewind_threaded;
+   g_extern.rewind.keyframe_interval = g_settings.rewind_keyframe_interval;
+   g_extern.rewind.archive_size      = g_settings.rewind_archive_size;
+
    state_manager_push_where(g_extern.state_manager, &state);
    pretro_serialize(state, g_extern.state_size);
    state_manager_push_do(g_extern.state_manager);
 }
 
+static bool rewind_settings_changed(void)
+{
+   return g_extern.rewind.buffer_size != g_settings.rewind_buffer_size
+      || g_extern.rewind.threaded != g_settings.rewind_threaded
+      || g_extern.rewind.keyframe_interval != 
+      g_settings.rewind_keyframe_interval
+      || g_extern.rewind.archive_size != g_settings.rewind_archive_size;
+}
+
 static void init_movie(void)
 {
    if (g_extern.bsv.movie_start_playback)
@@ -1230,7 +1260,8 @@ static void init_netplay(void)
    driver.netplay_data = (netplay_t*)netplay_new(
          g_extern.netplay_is_client ? g_extern.netplay_server : NULL,
          g_extern.netplay_port ? g_extern.netplay_port : RARCH_DEFAULT_PORT,
-         g_extern.netplay_sync_frames, &cbs, g_extern.netplay_is_spectate,
+         g_extern.netplay_sync_frames, g_extern.netplay_input_delay,
+         g_extern.netplay_players, &cbs, g_extern.netplay_is_spectate,
          g_settings.username);
 
    if (!driver.netplay_data)
@@ -1961,6 +1992,8 @@ int rarch_main_init(int argc, char *argv[])
    }
 
    validate_cpu_features();
+   RARCH_LOG("Using %s pixel format conversions.\n",
+         conv_init(rarch_get_cpu_features()));
    config_load();
 
    init_libretro_sym(g_extern.libretro_dummy);
@@ -2295,10 +2328,13 @@ bool rarch_main_command(unsigned cmd)
          init_rewind();
          break;
       case RARCH_CMD_REWIND_TOGGLE:
+         /* Also used when rewind settings change. Recreating 
+          * the state manager drops the history, so only do it 
+          * when it was created with other settings. */
+         if (!g_settings.rewind_enable || rewind_settings_changed())
+            rarch_main_command(RARCH_CMD_REWIND_DEINIT);
          if (g_settings.rewind_enable)
             rarch_main_command(RARCH_CMD_REWIND_INIT);
-         else
-            rarch_main_command(RARCH_CMD_REWIND_DEINIT);
          break;
       case RARCH_CMD_AUTOSAVE_DEINIT:
 #ifdef HAVE_THREADS
@@ -2775,6 +2811,8 @@ bool rarch_main_command(unsigned cmd)
 
 void rarch_main_deinit(void)
 {
+   screenshot_async_deinit();
+
    rarch_main_command(RARCH_CMD_NETPLAY_DEINIT);
    rarch_main_command(RARCH_CMD_COMMAND_DEINIT);
 
@@ -17,6 +17,17 @@
 #define __STDC_LIMIT_MACROS
 #include "rewind.h"
 #include "performance.h"
+#include <retro_simd.h>
+#ifdef HAVE_THREADS
+#include <rthreads/rthreads.h>
+#include <rthreads/ratomic.h>
+#endif
+
+/* Keyframe archive needs someone to compress in the background. */
+#if defined(HAVE_THREADS) && defined(HAVE_ZLIB_DEFLATE)
+#define HAVE_REWIND_ARCHIVE
+#include <zlib.h>
+#endif
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
@@ -41,6 +52,7 @@
 /* Format per frame (pseudocode): */
 #if 0
 size nextstart;
+size frame; /* frame number of the newer state */
 repeat {
    uint16 numchanged; /* everything is counted in units of uint16 */
    if (numchanged)
@@ -93,6 +105,83 @@ static inline size_t read_size_t(const void *ptr)
    return ret;
 }
 
+/* find_change returns the number of leading uint16s which are 
+ * identical in a and b, find_same the number which differ. */
+typedef size_t (*state_manager_find_t)(const uint16_t *a, const uint16_t *b);
+
+/* Copies num uint16s, returns num. */
+typedef size_t (*state_manager_copy_t)(uint16_t *out,
+      const uint16_t *in, size_t num);
+
+/* Writes the patch which turns newb back into oldb to out.
+ * Returns the end of the written patch. */
+typedef uint8_t *(*state_manager_compress_t)(const uint8_t *oldb,
+      const uint8_t *newb, size_t blocksize, uint8_t *out);
+
+/* Applies a patch to out. Returns the end of the patch. */
+typedef const uint8_t *(*state_manager_decompress_t)(
+      const uint8_t *compressed, uint8_t *out);
+
+#ifdef HAVE_THREADS
+/* Blocks the frontend can serialize into while the worker 
+ * is still compressing earlier ones. */
+#define STATE_MANAGER_POOL_SIZE 3
+
+/* Total amount of blocks, including the one the worker 
+ * compresses against. */
+#define STATE_MANAGER_BLOCKS (STATE_MANAGER_POOL_SIZE + 1)
+
+/* Lock-free single-producer/single-consumer queue of blocks.
+ * Every block is owned by exactly one side at a time. */
+struct state_manager_queue
+{
+   uint8_t *slots[STATE_MANAGER_BLOCKS + 1];
+
+   /* Written by the consumer only. */
+   volatile size_t read;
+   /* Keep the two indices on separate cache lines. */
+   uint8_t pad[64];
+   /* Written by the producer only. */
+   volatile size_t write;
+};
+#endif
+
+#ifdef HAVE_REWIND_ARCHIVE
+/* zlib-compressed data, packed by the archive thread.
+ * Shared between keyframes and archived runs, hence refcounted. */
+struct state_manager_packed
+{
+   /* Input. Owned by the archive thread while pending. */
+   uint8_t *raw;
+   size_t raw_size;
+
+   uint8_t *data;
+   size_t size;
+
+   unsigned refs;
+   bool pending;
+   struct state_manager_packed *next;
+};
+
+struct state_manager_keyframe
+{
+   size_t frame;
+   struct state_manager_packed *state;
+};
+
+/* Frames [first, last] of a run which fell off the ring. 
+ * Restored by unpacking the keyframe at 'frame' and applying 
+ * the packed deltas, newest first. */
+struct state_manager_segment
+{
+   size_t first;
+   size_t last;
+   size_t frame;
+   struct state_manager_packed *keyframe;
+   struct state_manager_packed *deltas;
+};
+#endif
+
 struct state_manager
 {
    uint8_t *data;
@@ -108,211 +197,101 @@ struct state_manager
    /* This one is rounded up from reset::blocksize. */
    size_t blocksize;
 
-   /* size_t + (blocksize + 131071) / 131072 * 
+   /* size_t * 2 + (blocksize + 131071) / 131072 * 
     * (blocksize + u16 + u16) + u16 + u32 + size_t
     * (yes, the math is a bit ugly). */
    size_t maxcompsize;
 
    unsigned entries;
    bool thisblock_valid;
-};
-
-state_manager_t *state_manager_new(size_t state_size, size_t buffer_size)
-{
-   state_manager_t *state = (state_manager_t*)calloc(1, sizeof(*state));
-   if (!state)
-      return NULL;
 
-   size_t newblocksize = ((state_size - 1) | (sizeof(uint16_t) - 1)) + 1;
-   state->blocksize = newblocksize;
-
-   const int maxcblkcover = UINT16_MAX * sizeof(uint16_t);
-   const int maxcblks = (state->blocksize + maxcblkcover - 1) / maxcblkcover;
-   state->maxcompsize = state->blocksize + maxcblks * sizeof(uint16_t) * 2 +
-      sizeof(uint16_t) + sizeof(uint32_t) + sizeof(size_t) * 2;
-
-   state->data = (uint8_t*)malloc(buffer_size);
+   /* Frame number of the state in thisblock. 
+    * Counts pushes, and goes back down when popping. */
+   size_t frame;
+
+#ifdef HAVE_REWIND_ARCHIVE
+   /* Every keyframe_interval frames, the new state is packed 
+    * in the background. Once the oldest delta leading up to a 
+    * keyframe falls off the ring, the whole run is packed into 
+    * the archive, which is kept below archive_capacity bytes. */
+   unsigned keyframe_interval;
+   size_t archive_capacity;
+   bool archive_warned;
+
+   /* Keyframes within the ring, ascending. */
+   struct state_manager_keyframe *keyframes;
+   unsigned num_keyframes;
+   unsigned keyframes_size;
+
+   /* Archived runs, ascending. */
+   struct state_manager_segment *segments;
+   unsigned num_segments;
+   unsigned segments_size;
+
+   sthread_t *archive_thread;
+   slock_t *archive_lock;
+   /* Signalled when jobs are queued or when quitting. */
+   scond_t *archive_cond;
+   /* Signalled when a job is packed. */
+   scond_t *archive_done_cond;
+   struct state_manager_packed *jobs;
+   struct state_manager_packed *jobs_last;
+   bool archive_quit;
+#endif
 
-   state->thisblock = (uint8_t*)
-      calloc(state->blocksize + sizeof(uint16_t) * 4 + 16, 1);
-   state->nextblock = (uint8_t*)
-      calloc(state->blocksize + sizeof(uint16_t) * 4 + 16, 1);
-   if (!state->data || !state->thisblock || !state->nextblock)
-      goto error;
+   /* Delta kernels, picked at creation from the CPU features. */
+   state_manager_compress_t compress;
+   state_manager_decompress_t decompress;
 
-   /* Force in a different byte at the end, so we don't need to check 
-    * bounds in the innermost loop (it's expensive).
-    *
-    * There is also a large amount of data that's the same, to stop 
-    * the other scan.
-    *
-    * There is also some padding at the end. This is so we don't 
-    * read outside the buffer end if we're reading in large blocks;
+#ifdef HAVE_THREADS
+   /* Threaded mode. The frontend only serializes into blocks taken 
+    * from free_blocks, the worker generates the deltas and owns 
+    * everything above while it runs. 
     *
-    * It doesn't make any difference to us, but sacrificing 16 bytes to get 
-    * Valgrind happy is worth it. */
-   *(uint16_t*)(state->thisblock + state->blocksize + sizeof(uint16_t) * 3) =
-      0xFFFF;
-   *(uint16_t*)(state->nextblock + state->blocksize + sizeof(uint16_t) * 3) =
-      0x0000;
-
-   state->capacity = buffer_size;
-
-   state->head = state->data + sizeof(size_t);
-   state->tail = state->data + sizeof(size_t);
-
-   return state;
-
-error:
-   state_manager_free(state);
-   return NULL;
-}
-
-void state_manager_free(state_manager_t *state)
-{
-   if (!state)
-      return;
-
-   free(state->data);
-   free(state->thisblock);
-   free(state->nextblock);
-   free(state);
-}
-
-bool state_manager_pop(state_manager_t *state, const void **data)
-{
-   *data = NULL;
-
-   if (state->thisblock_valid)
-   {
-      state->thisblock_valid = false;
-      state->entries--;
-      *data = state->thisblock;
-      return true;
-   }
-
-   if (state->head == state->tail)
-      return false;
-
-   size_t start = read_size_t(state->head - sizeof(size_t));
-   state->head = state->data + start;
-
-   const uint8_t *compressed = state->data + start + sizeof(size_t);
-   uint8_t *out = state->thisblock;
-
-   /* Begin decompression code
-    * out is the last pushed (or returned) state */
-   const uint16_t *compressed16 = (const uint16_t*)compressed;
-   uint16_t *out16 = (uint16_t*)out;
-
-   for (;;)
-   {
-      uint16_t i;
-      uint16_t numchanged = *(compressed16++);
-      if (numchanged)
-      {
-         out16 += *compressed16++;
-
-         /* We could do memcpy, but it seems that memcpy has a 
-          * constant-per-call overhead that actually shows up.
-          *
-          * Our average size in here seems to be 8 or something.
-          * Therefore, we do something with lower overhead. */
-         for (i = 0; i < numchanged; i++)
-            out16[i] = compressed16[i];
-
-         compressed16 += numchanged;
-         out16 += numchanged;
-      }
-      else
-      {
-         uint32_t numunchanged = compressed16[0] | (compressed16[1] << 16);
-         if (!numunchanged)
-            break;
-         compressed16 += 2;
-         out16 += numunchanged;
-      }
-   }
-   /* End decompression code */
-
-   state->entries--;
-   *data = state->thisblock;
-   return true;
-}
-
-void state_manager_push_where(state_manager_t *state, void **data)
-{
-   /* We need to ensure we have an uncompressed copy of the last
-    * pushed state, or we could end up applying a 'patch' to wrong 
-    * savestate, and that'd blow up rather quickly. */
+    * Handing over a block takes no lock. Either side only locks 
+    * and signals when it sees the other one asleep, which it 
+    * only is while holding lock. */
+   bool threaded;
+   sthread_t *thread;
+   slock_t *lock;
+   /* Signalled by the frontend when pushing or quitting. */
+   scond_t *worker_cond;
+   /* Signalled by the worker when a block has been processed. */
+   scond_t *cond;
+   bool quit;
+   volatile size_t worker_asleep;
+   volatile size_t frontend_asleep;
+
+   struct state_manager_queue free_blocks;
+   struct state_manager_queue pushed_blocks;
+   /* Pool blocks allocated besides thisblock and nextblock. */
+   uint8_t *blocks[STATE_MANAGER_POOL_SIZE - 1];
+
+   /* Block returned by push_where, not yet pushed. */
+   uint8_t *pending;
+   /* Blocks pushed by the frontend / processed by the worker. 
+    * Each is only written by its own side. */
+   size_t pushed;
+   volatile size_t done;
+#endif
+};
 
-   if (!state->thisblock_valid) 
-   {
-      const void *ignored;
-      if (state_manager_pop(state, &ignored))
-      {
-         state->thisblock_valid = true;
-         state->entries++;
-      }
-   }
-   
-   *data = state->nextblock;
-}
+static struct retro_perf_counter gen_deltas = {"gen_deltas"};
 
-#if __SSE2__
-#if defined(__GNUC__)
-static inline int compat_ctz(unsigned x)
-{
-   return __builtin_ctz(x);
-}
-#else
+/* nextstart and frame. */
+#define STATE_MANAGER_ENTRY_HEADER (sizeof(size_t) * 2)
 
-/* Only checks at nibble granularity, 
- * because that's what we need. */
+/* Padding after each block. The vectorized scans read up to
+ * 32 bytes past the last difference they look at. */
+#define STATE_MANAGER_BLOCK_PADDING (sizeof(uint16_t) * 4 + 32)
 
-static inline int compat_ctz(unsigned x)
-{
-   if (x & 0x000f)
-      return 0;
-   if (x & 0x00f0)
-      return 4;
-   if (x & 0x0f00)
-      return 8;
-   if (x & 0xf000)
-      return 12;
-   return 16;
-}
-#endif
+/* Scalar kernels. These are the reference implementation;
+ * every other kernel must produce patches the scalar 
+ * decompressor understands. */
 
-#include <emmintrin.h>
 /* There's no equivalent in libc, you'd think so ...
  * std::mismatch exists, but it's not optimized at all. */
-
-static inline size_t find_change(const uint16_t *a, const uint16_t *b)
-{
-   const __m128i *a128 = (const __m128i*)a;
-   const __m128i *b128 = (const __m128i*)b;
-	
-   for (;;)
-   {
-      __m128i v0 = _mm_loadu_si128(a128);
-      __m128i v1 = _mm_loadu_si128(b128);
-      __m128i c = _mm_cmpeq_epi32(v0, v1);
-
-      uint32_t mask = _mm_movemask_epi8(c);
-      if (mask != 0xffff) /* Something has changed, figure out where. */
-      {
-         size_t ret = (((uint8_t*)a128 - (uint8_t*)a) |
-               (compat_ctz(~mask))) >> 1;
-			return ret | (a[ret] == b[ret]);
-      }
-
-      a128++;
-      b128++;
-   }
-}
-#else
-static inline size_t find_change(const uint16_t *a, const uint16_t *b)
+static inline size_t find_change_C(const uint16_t *a, const uint16_t *b)
 {
    const uint16_t *a_org = a;
 #ifdef NO_UNALIGNED_MEM
@@ -343,9 +322,8 @@ static inline size_t find_change(const uint16_t *a, const uint16_t *b)
    }
    return a - a_org;
 }
-#endif
 
-static inline size_t find_same(const uint16_t *a, const uint16_t *b)
+static inline size_t find_same_C(const uint16_t *a, const uint16_t *b)
 {
    const uint16_t *a_org = a;
 #ifdef NO_UNALIGNED_MEM
@@ -385,96 +363,1164 @@ static inline size_t find_same(const uint16_t *a, const uint16_t *b)
    return a - a_org;
 }
 
-void state_manager_push_do(state_manager_t *state)
+/* We could do memcpy, but it seems that memcpy has a 
+ * constant-per-call overhead that actually shows up.
+ *
+ * Our average size in here seems to be 8 or something.
+ * Therefore, we do something with lower overhead. */
+static inline size_t copy_C(uint16_t *out, const uint16_t *in, size_t num)
 {
-   if (state->thisblock_valid)
-   {
-      if (state->capacity < sizeof(size_t) + state->maxcompsize)
-         return;
+   size_t i;
+   for (i = 0; i < num; i++)
+      out[i] = in[i];
+   return num;
+}
 
-recheckcapacity:;
+/* The vectorized scans compare 32 bits at a time, relative to 
+ * the start of the scan, just like find_same_C() does, 
+ * so all kernels generate identical patches on x86. */
 
-      size_t headpos = state->head - state->data;
-      size_t tailpos = state->tail - state->data;
-      size_t remaining = (tailpos + state->capacity -
-            sizeof(size_t) - headpos - 1) % state->capacity + 1;
+#if defined(__GNUC__)
+#define compat_ctz(x) __builtin_ctz(x)
+#else
 
-      if (remaining <= state->maxcompsize)
-      {
-         state->tail = state->data + read_size_t(state->tail);
-         state->entries--;
-         goto recheckcapacity;
-      }
+/* Only checks at nibble granularity, 
+ * because that's what we need. */
 
-      RARCH_PERFORMANCE_INIT(gen_deltas);
-      RARCH_PERFORMANCE_START(gen_deltas);
+static inline int compat_ctz(unsigned x)
+{
+   if (x & 0x000f)
+      return 0;
+   if (x & 0x00f0)
+      return 4;
+   if (x & 0x0f00)
+      return 8;
+   if (x & 0xf000)
+      return 12;
+   return 16;
+}
+#endif
 
-      const uint8_t *oldb = state->thisblock;
-      const uint8_t *newb = state->nextblock;
-      uint8_t *compressed = state->head + sizeof(size_t);
+#if __SSE2__
+#include <emmintrin.h>
 
-      /* Begin compression code; 'compressed' will point to 
-       * the end of the compressed data (excluding the prev pointer). */
-      const uint16_t *old16 = (const uint16_t*)oldb;
-      const uint16_t *new16 = (const uint16_t*)newb;
-      uint16_t *compressed16 = (uint16_t*)compressed;
-      size_t num16s = state->blocksize / sizeof(uint16_t);
+static inline size_t find_change_SSE2(const uint16_t *a, const uint16_t *b)
+{
+   const __m128i *a128 = (const __m128i*)a;
+   const __m128i *b128 = (const __m128i*)b;
+	
+   for (;;)
+   {
+      __m128i v0 = _mm_loadu_si128(a128);
+      __m128i v1 = _mm_loadu_si128(b128);
+      __m128i c = _mm_cmpeq_epi32(v0, v1);
 
-      while (num16s)
+      uint32_t mask = _mm_movemask_epi8(c);
+      if (mask != 0xffff) /* Something has changed, figure out where. */
       {
-         size_t i;
-         size_t skip = find_change(old16, new16);
-
-         if (skip >= num16s)
-            break;
-
-         old16 += skip;
-         new16 += skip;
-         num16s -= skip;
+         size_t ret = (((uint8_t*)a128 - (uint8_t*)a) |
+               (compat_ctz(~mask))) >> 1;
+         return ret | (a[ret] == b[ret]);
+      }
 
-         if (skip > UINT16_MAX)
-         {
-            if (skip > UINT32_MAX)
-            {
-               /* This will make it scan the entire thing again, 
-                * but it only hits on 8GB unchanged data anyways,
-                * and if you're doing that, you've got bigger problems. */
-               skip = UINT32_MAX;
-            }
-            *compressed16++ = 0;
-            *compressed16++ = skip;
-            *compressed16++ = skip >> 16;
-            skip = 0;
-            continue;
-         }
+      a128++;
+      b128++;
+   }
+}
 
-         size_t changed = find_same(old16, new16);
-         if (changed > UINT16_MAX)
-            changed = UINT16_MAX;
+static inline size_t find_same_SSE2(const uint16_t *a, const uint16_t *b)
+{
+   const __m128i *a128 = (const __m128i*)a;
+   const __m128i *b128 = (const __m128i*)b;
 
-         *compressed16++ = changed;
-         *compressed16++ = skip;
+   for (;;)
+   {
+      __m128i v0 = _mm_loadu_si128(a128);
+      __m128i v1 = _mm_loadu_si128(b128);
+      __m128i c = _mm_cmpeq_epi32(v0, v1);
+
+      uint32_t mask = _mm_movemask_epi8(c);
+      if (mask) /* Found an identical 32-bit word. */
+      {
+         size_t ret = (((uint8_t*)a128 - (uint8_t*)a) |
+               (compat_ctz(mask))) >> 1;
+         return ret - (ret && a[ret - 1] == b[ret - 1]);
+      }
+
+      a128++;
+      b128++;
+   }
+}
+
+static inline size_t copy_SSE2(uint16_t *out, const uint16_t *in, size_t num)
+{
+   size_t i = 0;
+   for (; i + 8 <= num; i += 8)
+      _mm_storeu_si128((__m128i*)(out + i),
+            _mm_loadu_si128((const __m128i*)(in + i)));
+   for (; i < num; i++)
+      out[i] = in[i];
+   return num;
+}
+#endif
+
+#ifdef HAVE_RETRO_TARGET_X86
+#include <immintrin.h>
+
+static inline RETRO_TARGET("avx2") size_t find_change_AVX2(
+      const uint16_t *a, const uint16_t *b)
+{
+   const __m256i *a256 = (const __m256i*)a;
+   const __m256i *b256 = (const __m256i*)b;
+
+   for (;;)
+   {
+      __m256i v0 = _mm256_loadu_si256(a256);
+      __m256i v1 = _mm256_loadu_si256(b256);
+      __m256i c = _mm256_cmpeq_epi32(v0, v1);
+
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(c);
+      if (mask != 0xffffffffu)
+      {
+         size_t ret = (((uint8_t*)a256 - (uint8_t*)a) |
+               (__builtin_ctz(~mask))) >> 1;
+         return ret | (a[ret] == b[ret]);
+      }
+
+      a256++;
+      b256++;
+   }
+}
+
+static inline RETRO_TARGET("avx2") size_t find_same_AVX2(
+      const uint16_t *a, const uint16_t *b)
+{
+   const __m256i *a256 = (const __m256i*)a;
+   const __m256i *b256 = (const __m256i*)b;
+
+   for (;;)
+   {
+      __m256i v0 = _mm256_loadu_si256(a256);
+      __m256i v1 = _mm256_loadu_si256(b256);
+      __m256i c = _mm256_cmpeq_epi32(v0, v1);
+
+      uint32_t mask = (uint32_t)_mm256_movemask_epi8(c);
+      if (mask)
+      {
+         size_t ret = (((uint8_t*)a256 - (uint8_t*)a) |
+               (__builtin_ctz(mask))) >> 1;
+         return ret - (ret && a[ret - 1] == b[ret - 1]);
+      }
+
+      a256++;
+      b256++;
+   }
+}
+
+static inline RETRO_TARGET("avx2") size_t copy_AVX2(uint16_t *out,
+      const uint16_t *in, size_t num)
+{
+   size_t i = 0;
+   for (; i + 16 <= num; i += 16)
+      _mm256_storeu_si256((__m256i*)(out + i),
+            _mm256_loadu_si256((const __m256i*)(in + i)));
+   if (i + 8 <= num)
+   {
+      _mm_storeu_si128((__m128i*)(out + i),
+            _mm_loadu_si128((const __m128i*)(in + i)));
+      i += 8;
+   }
+   for (; i < num; i++)
+      out[i] = in[i];
+   return num;
+}
+#endif
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+
+/* NEON has no movemask. Narrowing the 32-bit compare result 
+ * gives one 16-bit lane per word, packed into 64 bits. */
+static inline uint64_t neon_eq_mask(const uint16_t *a, const uint16_t *b)
+{
+   uint32x4_t c = vceqq_u32(
+         vreinterpretq_u32_u16(vld1q_u16(a)),
+         vreinterpretq_u32_u16(vld1q_u16(b)));
+   return vget_lane_u64(vreinterpret_u64_u16(vmovn_u32(c)), 0);
+}
+
+static inline size_t find_change_NEON(const uint16_t *a, const uint16_t *b)
+{
+   size_t i;
+   for (i = 0; ; i += 8)
+   {
+      uint64_t mask = neon_eq_mask(a + i, b + i);
+      if (mask != UINT64_C(0xffffffffffffffff))
+      {
+         size_t ret = i + (__builtin_ctzll(~mask) >> 3);
+         return ret | (a[ret] == b[ret]);
+      }
+   }
+}
+
+static inline size_t find_same_NEON(const uint16_t *a, const uint16_t *b)
+{
+   size_t i;
+   for (i = 0; ; i += 8)
+   {
+      uint64_t mask = neon_eq_mask(a + i, b + i);
+      if (mask)
+      {
+         size_t ret = i + (__builtin_ctzll(mask) >> 3);
+         return ret - (ret && a[ret - 1] == b[ret - 1]);
+      }
+   }
+}
+
+static inline size_t copy_NEON(uint16_t *out, const uint16_t *in, size_t num)
+{
+   size_t i = 0;
+   for (; i + 8 <= num; i += 8)
+      vst1q_u16(out + i, vld1q_u16(in + i));
+   for (; i < num; i++)
+      out[i] = in[i];
+   return num;
+}
+#endif
+
+RETRO_SIMD_INLINE uint8_t *compress_generic(const uint8_t *oldb,
+      const uint8_t *newb, size_t blocksize, uint8_t *compressed,
+      state_manager_find_t find_change, state_manager_find_t find_same,
+      state_manager_copy_t copy)
+{
+   const uint16_t *old16 = (const uint16_t*)oldb;
+   const uint16_t *new16 = (const uint16_t*)newb;
+   uint16_t *compressed16 = (uint16_t*)compressed;
+   size_t num16s = blocksize / sizeof(uint16_t);
+
+   while (num16s)
+   {
+      size_t changed;
+      size_t skip = find_change(old16, new16);
+
+      if (skip >= num16s)
+         break;
+
+      old16 += skip;
+      new16 += skip;
+      num16s -= skip;
+
+      if (skip > UINT16_MAX)
+      {
+         if (skip > UINT32_MAX)
+         {
+            /* This will make it scan the entire thing again, 
+             * but it only hits on 8GB unchanged data anyways,
+             * and if you're doing that, you've got bigger problems. */
+            skip = UINT32_MAX;
+         }
+         *compressed16++ = 0;
+         *compressed16++ = skip;
+         *compressed16++ = skip >> 16;
+         skip = 0;
+         continue;
+      }
+
+      changed = find_same(old16, new16);
+      if (changed > UINT16_MAX)
+         changed = UINT16_MAX;
+
+      *compressed16++ = changed;
+      *compressed16++ = skip;
+
+      compressed16 += copy(compressed16, old16, changed);
+
+      old16 += changed;
+      new16 += changed;
+      num16s -= changed;
+   }
+
+   compressed16[0] = 0;
+   compressed16[1] = 0;
+   compressed16[2] = 0;
+   return (uint8_t*)(compressed16 + 3);
+}
+
+RETRO_SIMD_INLINE const uint8_t *decompress_generic(
+      const uint8_t *compressed, uint8_t *out, state_manager_copy_t copy)
+{
+   const uint16_t *compressed16 = (const uint16_t*)compressed;
+   uint16_t *out16 = (uint16_t*)out;
+
+   for (;;)
+   {
+      uint16_t numchanged = *(compressed16++);
+      if (numchanged)
+      {
+         out16 += *compressed16++;
+         copy(out16, compressed16, numchanged);
+         compressed16 += numchanged;
+         out16 += numchanged;
+      }
+      else
+      {
+         uint32_t numunchanged = compressed16[0] | (compressed16[1] << 16);
+         compressed16 += 2;
+         if (!numunchanged)
+            break;
+         out16 += numunchanged;
+      }
+   }
+
+   return (const uint8_t*)compressed16;
+}
+
+#define STATE_MANAGER_KERNELS(isa, attr) \
+static attr uint8_t *compress_##isa(const uint8_t *oldb, const uint8_t *newb, \
+      size_t blocksize, uint8_t *out) \
+{ \
+   return compress_generic(oldb, newb, blocksize, out, \
+         find_change_##isa, find_same_##isa, copy_##isa); \
+} \
+static attr const uint8_t *decompress_##isa(const uint8_t *compressed, \
+      uint8_t *out) \
+{ \
+   return decompress_generic(compressed, out, copy_##isa); \
+}
+
+STATE_MANAGER_KERNELS(C, )
+
+#if __SSE2__
+STATE_MANAGER_KERNELS(SSE2, )
+#endif
+
+#ifdef HAVE_RETRO_TARGET_X86
+STATE_MANAGER_KERNELS(AVX2, RETRO_TARGET("avx2"))
+#endif
+
+#ifdef __ARM_NEON__
+STATE_MANAGER_KERNELS(NEON, )
+#endif
+
+static void state_manager_init_kernels(state_manager_t *state)
+{
+   const char *ident = "C";
+   uint64_t cpu = rarch_get_cpu_features();
+
+   (void)cpu;
+
+   state->compress = compress_C;
+   state->decompress = decompress_C;
+
+#if __SSE2__
+   state->compress = compress_SSE2;
+   state->decompress = decompress_SSE2;
+   ident = "SSE2";
+#endif
+#ifdef HAVE_RETRO_TARGET_X86
+   if (cpu & RETRO_SIMD_AVX2)
+   {
+      state->compress = compress_AVX2;
+      state->decompress = decompress_AVX2;
+      ident = "AVX2";
+   }
+#endif
+#ifdef __ARM_NEON__
+   if (cpu & RETRO_SIMD_NEON)
+   {
+      state->compress = compress_NEON;
+      state->decompress = decompress_NEON;
+      ident = "NEON";
+   }
+#endif
+
+   RARCH_LOG("[Rewind]: Using %s delta kernels.\n", ident);
+}
+
+#ifdef HAVE_THREADS
+static bool state_manager_queue_push(struct state_manager_queue *queue,
+      uint8_t *block)
+{
+   size_t write = queue->write;
+   size_t next = (write + 1) % (STATE_MANAGER_BLOCKS + 1);
+
+   if (next == ratomic_load_acquire(&queue->read))
+      return false;
+
+   queue->slots[write] = block;
+   ratomic_store_release(&queue->write, next);
+   return true;
+}
+
+static uint8_t *state_manager_queue_pop(struct state_manager_queue *queue)
+{
+   uint8_t *block;
+   size_t read = queue->read;
+
+   if (read == ratomic_load_acquire(&queue->write))
+      return NULL;
+
+   block = queue->slots[read];
+   ratomic_store_release(&queue->read, (read + 1) % (STATE_MANAGER_BLOCKS + 1));
+   return block;
+}
+
+static void state_manager_thread(void *data);
+
+static bool state_manager_init_thread(state_manager_t *state)
+{
+   unsigned i;
+
+   for (i = 0; i < STATE_MANAGER_POOL_SIZE - 1; i++)
+   {
+      state->blocks[i] = (uint8_t*)
+         calloc(state->blocksize + STATE_MANAGER_BLOCK_PADDING, 1);
+      if (!state->blocks[i])
+         return false;
+      state_manager_queue_push(&state->free_blocks, state->blocks[i]);
+   }
+   state_manager_queue_push(&state->free_blocks, state->nextblock);
+
+   state->lock = slock_new();
+   state->worker_cond = scond_new();
+   state->cond = scond_new();
+   if (!state->lock || !state->worker_cond || !state->cond)
+      return false;
+
+   state->thread = sthread_create(state_manager_thread, state);
+   if (!state->thread)
+      return false;
+
+   state->threaded = true;
+   return true;
+}
+#endif
+
+/* Returns the entry holding the delta from 'frame' to the frame 
+ * before it, or NULL if it's not in the ring anymore. */
+static uint8_t *state_manager_find_entry(state_manager_t *state, size_t frame)
+{
+   uint8_t *entry;
+
+   if (state->head == state->tail)
+      return NULL;
+
+   entry = state->data + read_size_t(state->head - sizeof(size_t));
+   for (;;)
+   {
+      size_t entry_frame = read_size_t(entry + sizeof(size_t));
+      if (entry_frame == frame)
+         return entry;
+      if (entry_frame < frame || entry == state->tail)
+         return NULL;
+      entry = state->data + read_size_t(entry - sizeof(size_t));
+   }
+}
+
+/* Oldest frame which can be reached by walking the ring. */
+static size_t state_manager_oldest_frame(state_manager_t *state)
+{
+   if (state->head == state->tail)
+      return state->frame;
+   return read_size_t(state->tail + sizeof(size_t)) - 1;
+}
+
+#ifdef HAVE_REWIND_ARCHIVE
+static size_t state_manager_patch_size(const uint8_t *patch)
+{
+   const uint16_t *patch16 = (const uint16_t*)patch;
+
+   for (;;)
+   {
+      uint16_t numchanged = *patch16++;
+      if (numchanged)
+         patch16 += numchanged + 1;
+      else
+      {
+         uint32_t numunchanged = patch16[0] | (patch16[1] << 16);
+         patch16 += 2;
+         if (!numunchanged)
+            break;
+      }
+   }
+
+   return (const uint8_t*)patch16 - patch;
+}
+
+static void state_manager_archive_thread(void *data)
+{
+   state_manager_t *state = (state_manager_t*)data;
+
+   slock_lock(state->archive_lock);
+
+   for (;;)
+   {
+      struct state_manager_packed *job;
+      uLongf size;
+      uint8_t *packed;
+
+      while (!state->jobs && !state->archive_quit)
+         scond_wait(state->archive_cond, state->archive_lock);
+      if (state->archive_quit)
+         break;
+
+      job = state->jobs;
+      state->jobs = job->next;
+      if (!state->jobs)
+         state->jobs_last = NULL;
+      slock_unlock(state->archive_lock);
+
+      size = compressBound(job->raw_size);
+      packed = (uint8_t*)malloc(size);
+      if (packed && compress2(packed, &size, job->raw, job->raw_size,
+               Z_DEFAULT_COMPRESSION) == Z_OK)
+      {
+         uint8_t *shrunk = (uint8_t*)realloc(packed, size);
+         if (shrunk)
+            packed = shrunk;
+      }
+      else
+      {
+         free(packed);
+         packed = NULL;
+         size = 0;
+      }
+
+      slock_lock(state->archive_lock);
+      free(job->raw);
+      job->raw = NULL;
+      job->data = packed;
+      job->size = size;
+      job->pending = false;
+      if (!job->refs)
+      {
+         free(job->data);
+         free(job);
+      }
+      scond_broadcast(state->archive_done_cond);
+   }
+
+   slock_unlock(state->archive_lock);
+}
+
+/* Takes ownership of raw. */
+static struct state_manager_packed *state_manager_pack(
+      state_manager_t *state, uint8_t *raw, size_t raw_size)
+{
+   struct state_manager_packed *packed = (struct state_manager_packed*)
+      calloc(1, sizeof(*packed));
+   if (!packed)
+   {
+      free(raw);
+      return NULL;
+   }
+
+   packed->raw = raw;
+   packed->raw_size = raw_size;
+   packed->refs = 1;
+   packed->pending = true;
+
+   slock_lock(state->archive_lock);
+   if (state->jobs_last)
+      state->jobs_last->next = packed;
+   else
+      state->jobs = packed;
+   state->jobs_last = packed;
+   scond_signal(state->archive_cond);
+   slock_unlock(state->archive_lock);
+
+   return packed;
+}
+
+static void state_manager_packed_ref(state_manager_t *state,
+      struct state_manager_packed *packed)
+{
+   slock_lock(state->archive_lock);
+   packed->refs++;
+   slock_unlock(state->archive_lock);
+}
+
+static void state_manager_packed_unref(state_manager_t *state,
+      struct state_manager_packed *packed)
+{
+   if (!packed)
+      return;
+
+   slock_lock(state->archive_lock);
+   /* Pending jobs are freed by the archive thread once done. */
+   if (!--packed->refs && !packed->pending)
+   {
+      free(packed->raw);
+      free(packed->data);
+      free(packed);
+   }
+   slock_unlock(state->archive_lock);
+}
+
+/* Unpacks into out, which must hold raw_size bytes. 
+ * Waits for the archive thread if needed. */
+static bool state_manager_unpack(state_manager_t *state,
+      struct state_manager_packed *packed, uint8_t *out)
+{
+   uLongf size = packed->raw_size;
+
+   slock_lock(state->archive_lock);
+   while (packed->pending)
+      scond_wait(state->archive_done_cond, state->archive_lock);
+   slock_unlock(state->archive_lock);
+
+   return packed->data && uncompress(out, &size,
+         packed->data, packed->size) == Z_OK && size == packed->raw_size;
+}
+
+static bool state_manager_packed_pending(state_manager_t *state,
+      struct state_manager_packed *packed)
+{
+   bool pending;
+   slock_lock(state->archive_lock);
+   pending = packed->pending;
+   slock_unlock(state->archive_lock);
+   return pending;
+}
+
+static bool state_manager_packed_ready(state_manager_t *state,
+      struct state_manager_packed *packed)
+{
+   bool ready;
+   slock_lock(state->archive_lock);
+   ready = !packed->pending && packed->data;
+   slock_unlock(state->archive_lock);
+   return ready;
+}
+
+static void state_manager_drop_keyframe(state_manager_t *state, unsigned i)
+{
+   state_manager_packed_unref(state, state->keyframes[i].state);
+   memmove(state->keyframes + i, state->keyframes + i + 1,
+         (state->num_keyframes - i - 1) * sizeof(*state->keyframes));
+   state->num_keyframes--;
+}
+
+static void state_manager_drop_segment(state_manager_t *state, unsigned i)
+{
+   state_manager_packed_unref(state, state->segments[i].keyframe);
+   state_manager_packed_unref(state, state->segments[i].deltas);
+   memmove(state->segments + i, state->segments + i + 1,
+         (state->num_segments - i - 1) * sizeof(*state->segments));
+   state->num_segments--;
+}
+
+static size_t state_manager_packed_size(state_manager_t *state,
+      struct state_manager_packed *packed)
+{
+   size_t size;
+   slock_lock(state->archive_lock);
+   size = packed->pending ? packed->raw_size : packed->size;
+   slock_unlock(state->archive_lock);
+   return size;
+}
+
+static void state_manager_archive_trim(state_manager_t *state)
+{
+   unsigned i;
+   size_t total = 0;
+
+   for (i = 0; i < state->num_segments; i++)
+   {
+      total += state_manager_packed_size(state, state->segments[i].keyframe);
+      total += state_manager_packed_size(state, state->segments[i].deltas);
+   }
+
+   while (state->num_segments && total > state->archive_capacity)
+   {
+      total -= state_manager_packed_size(state, state->segments[0].keyframe);
+      total -= state_manager_packed_size(state, state->segments[0].deltas);
+      state_manager_drop_segment(state, 0);
+   }
+}
+
+/* Called with the state in thisblock just pushed. */
+static void state_manager_archive_push(state_manager_t *state)
+{
+   uint8_t *raw;
+   struct state_manager_packed *packed;
+
+   if (!state->keyframe_interval || state->frame % state->keyframe_interval)
+      return;
+
+   /* Packing can take longer than the interval on large states. 
+    * Skip keyframes while the last one is still queued, so that 
+    * the backlog stays bounded. Runs get longer instead. */
+   if (state->num_keyframes && state_manager_packed_pending(state,
+            state->keyframes[state->num_keyframes - 1].state))
+      return;
+
+   if (state->num_keyframes == state->keyframes_size)
+   {
+      unsigned size = state->keyframes_size ? state->keyframes_size * 2 : 16;
+      struct state_manager_keyframe *keyframes = 
+         (struct state_manager_keyframe*)realloc(state->keyframes,
+               size * sizeof(*keyframes));
+      if (!keyframes)
+         return;
+      state->keyframes = keyframes;
+      state->keyframes_size = size;
+   }
+
+   raw = (uint8_t*)malloc(state->blocksize);
+   if (!raw)
+      return;
+   memcpy(raw, state->thisblock, state->blocksize);
+
+   packed = state_manager_pack(state, raw, state->blocksize);
+   if (!packed)
+      return;
+
+   state->keyframes[state->num_keyframes].frame = state->frame;
+   state->keyframes[state->num_keyframes].state = packed;
+   state->num_keyframes++;
+}
+
+/* Called before the entry at the tail is overwritten. 
+ * Archives the run leading up to the next keyframe when its 
+ * oldest delta is about to go. */
+static void state_manager_archive_evict(state_manager_t *state)
+{
+   size_t size = 0;
+   uint8_t *raw, *out;
+   const uint8_t *entry;
+   struct state_manager_segment *segment;
+   struct state_manager_keyframe *keyframe = NULL;
+   size_t frame = read_size_t(state->tail + sizeof(size_t));
+
+   /* The tail frame is no longer reachable through the ring. */
+   while (state->num_keyframes && state->keyframes[0].frame < frame)
+      state_manager_drop_keyframe(state, 0);
+
+   if (!state->keyframe_interval || (frame - 1) % state->keyframe_interval)
+      return;
+
+   /* Already archived as part of a run over skipped keyframes. */
+   if (state->num_segments &&
+         state->segments[state->num_segments - 1].last > frame - 1)
+      return;
+
+   /* The run goes up to the next keyframe, which is not 
+    * necessarily one interval away. */
+   if (state->num_keyframes)
+      keyframe = &state->keyframes[0];
+
+   if (!keyframe || !(entry = state_manager_find_entry(state, keyframe->frame)))
+   {
+      if (!state->archive_warned)
+         RARCH_WARN("[Rewind]: Buffer holds less than a keyframe interval, "
+               "not archiving.\n");
+      state->archive_warned = true;
+      return;
+   }
+
+   if (state->num_segments == state->segments_size)
+   {
+      unsigned size = state->segments_size ? state->segments_size * 2 : 16;
+      struct state_manager_segment *segments = 
+         (struct state_manager_segment*)realloc(state->segments,
+               size * sizeof(*segments));
+      if (!segments)
+         return;
+      state->segments = segments;
+      state->segments_size = size;
+   }
+
+   /* Deltas are gathered newest first, which is the order 
+    * they are applied in. */
+   for (;;)
+   {
+      size += state_manager_patch_size(entry + STATE_MANAGER_ENTRY_HEADER);
+      if (entry == state->tail)
+         break;
+      entry = state->data + read_size_t(entry - sizeof(size_t));
+   }
+
+   raw = (uint8_t*)malloc(size);
+   if (!raw)
+      return;
+
+   out = raw;
+   entry = state_manager_find_entry(state, keyframe->frame);
+   for (;;)
+   {
+      size_t patch_size = 
+         state_manager_patch_size(entry + STATE_MANAGER_ENTRY_HEADER);
+      memcpy(out, entry + STATE_MANAGER_ENTRY_HEADER, patch_size);
+      out += patch_size;
+      if (entry == state->tail)
+         break;
+      entry = state->data + read_size_t(entry - sizeof(size_t));
+   }
+
+   segment = &state->segments[state->num_segments];
+   segment->first = frame - 1;
+   segment->last = keyframe->frame;
+   segment->frame = keyframe->frame;
+   segment->keyframe = keyframe->state;
+   segment->deltas = state_manager_pack(state, raw, size);
+   if (!segment->deltas)
+      return;
+   state_manager_packed_ref(state, segment->keyframe);
+   state->num_segments++;
+
+   state_manager_archive_trim(state);
+}
+
+/* Forgets about everything from 'frame' onwards. */
+static void state_manager_archive_discard(state_manager_t *state, size_t frame)
+{
+   while (state->num_keyframes &&
+         state->keyframes[state->num_keyframes - 1].frame >= frame)
+      state_manager_drop_keyframe(state, state->num_keyframes - 1);
+
+   while (state->num_segments &&
+         state->segments[state->num_segments - 1].first >= frame)
+      state_manager_drop_segment(state, state->num_segments - 1);
+
+   if (state->num_segments &&
+         state->segments[state->num_segments - 1].last >= frame)
+      state->segments[state->num_segments - 1].last = frame - 1;
+}
+
+/* Closest archived frame at or after *frame. */
+static int state_manager_archive_find(state_manager_t *state, size_t *frame)
+{
+   unsigned i;
+
+   for (i = 0; i < state->num_segments; i++)
+   {
+      if (state->segments[i].last < *frame)
+         continue;
+      if (state->segments[i].first > *frame)
+         *frame = state->segments[i].first;
+      return i;
+   }
+
+   return -1;
+}
+
+static bool state_manager_archive_restore(state_manager_t *state,
+      unsigned index, size_t frame)
+{
+   size_t i;
+   uint8_t *deltas;
+   const uint8_t *patch;
+   struct state_manager_segment *segment = &state->segments[index];
+
+   if (!state_manager_unpack(state, segment->keyframe, state->thisblock))
+      return false;
+
+   deltas = (uint8_t*)malloc(segment->deltas->raw_size);
+   if (!deltas || !state_manager_unpack(state, segment->deltas, deltas))
+   {
+      free(deltas);
+      return false;
+   }
+
+   patch = deltas;
+   for (i = segment->frame; i > frame; i--)
+      patch = state->decompress(patch, state->thisblock);
+
+   free(deltas);
+   return true;
+}
+
+static bool state_manager_init_archive(state_manager_t *state,
+      unsigned keyframe_interval, size_t archive_size)
+{
+   state->archive_lock = slock_new();
+   state->archive_cond = scond_new();
+   state->archive_done_cond = scond_new();
+   if (!state->archive_lock || !state->archive_cond ||
+         !state->archive_done_cond)
+      return false;
+
+   state->archive_thread = sthread_create(state_manager_archive_thread, state);
+   if (!state->archive_thread)
+      return false;
+
+   state->keyframe_interval = keyframe_interval;
+   state->archive_capacity = archive_size;
+   return true;
+}
+
+static void state_manager_deinit_archive(state_manager_t *state)
+{
+   struct state_manager_packed *job;
+
+   if (state->archive_thread)
+   {
+      slock_lock(state->archive_lock);
+      state->archive_quit = true;
+      scond_signal(state->archive_cond);
+      slock_unlock(state->archive_lock);
+      sthread_join(state->archive_thread);
+
+      /* Nobody will pack these anymore. */
+      job = state->jobs;
+      while (job)
+      {
+         struct state_manager_packed *next = job->next;
+         job->pending = false;
+         if (!job->refs)
+         {
+            free(job->raw);
+            free(job);
+         }
+         job = next;
+      }
+   }
+
+   while (state->num_keyframes)
+      state_manager_drop_keyframe(state, state->num_keyframes - 1);
+   while (state->num_segments)
+      state_manager_drop_segment(state, state->num_segments - 1);
+   free(state->keyframes);
+   free(state->segments);
+
+   if (state->archive_lock)
+      slock_free(state->archive_lock);
+   if (state->archive_cond)
+      scond_free(state->archive_cond);
+   if (state->archive_done_cond)
+      scond_free(state->archive_done_cond);
+}
+#endif
+
+state_manager_t *state_manager_new(size_t state_size, size_t buffer_size,
+      bool threaded, unsigned keyframe_interval, size_t archive_size)
+{
+   state_manager_t *state = (state_manager_t*)calloc(1, sizeof(*state));
+   if (!state)
+      return NULL;
+
+   size_t newblocksize = ((state_size - 1) | (sizeof(uint16_t) - 1)) + 1;
+   state->blocksize = newblocksize;
+
+   const int maxcblkcover = UINT16_MAX * sizeof(uint16_t);
+   const int maxcblks = (state->blocksize + maxcblkcover - 1) / maxcblkcover;
+   state->maxcompsize = state->blocksize + maxcblks * sizeof(uint16_t) * 2 +
+      sizeof(uint16_t) + sizeof(uint32_t) + sizeof(size_t) * 3;
+
+   state->data = (uint8_t*)malloc(buffer_size);
+
+   state->thisblock = (uint8_t*)
+      calloc(state->blocksize + STATE_MANAGER_BLOCK_PADDING, 1);
+   state->nextblock = (uint8_t*)
+      calloc(state->blocksize + STATE_MANAGER_BLOCK_PADDING, 1);
+   if (!state->data || !state->thisblock || !state->nextblock)
+      goto error;
+
+   /* Force in a different byte at the end, so we don't need to check 
+    * bounds in the innermost loop (it's expensive).
+    *
+    * There is also a large amount of data that's the same, to stop 
+    * the other scan.
+    *
+    * There is also some padding at the end. This is so we don't 
+    * read outside the buffer end if we're reading in large blocks;
+    *
+    * It doesn't make any difference to us, but sacrificing 32 bytes to get 
+    * Valgrind happy is worth it. */
+   *(uint16_t*)(state->thisblock + state->blocksize + sizeof(uint16_t) * 3) =
+      0xFFFF;
+   *(uint16_t*)(state->nextblock + state->blocksize + sizeof(uint16_t) * 3) =
+      0x0000;
+
+   state->capacity = buffer_size;
+
+   state->head = state->data + sizeof(size_t);
+   state->tail = state->data + sizeof(size_t);
+
+   state_manager_init_kernels(state);
+   rarch_perf_register(&gen_deltas);
+
+#ifdef HAVE_THREADS
+   if (threaded)
+   {
+      if (!state_manager_init_thread(state))
+         goto error;
+      RARCH_LOG("[Rewind]: Generating deltas on a worker thread.\n");
+   }
+#else
+   (void)threaded;
+#endif
+
+#ifdef HAVE_REWIND_ARCHIVE
+   if (keyframe_interval)
+   {
+      if (!state_manager_init_archive(state, keyframe_interval, archive_size))
+         goto error;
+      RARCH_LOG("[Rewind]: Keyframe every %u frames, archiving up to %u KiB.\n",
+            keyframe_interval, (unsigned)(archive_size >> 10));
+   }
+#else
+   if (keyframe_interval)
+      RARCH_WARN("[Rewind]: Keyframes need threads and zlib, ignoring.\n");
+   (void)archive_size;
+#endif
+
+   return state;
+
+error:
+   state_manager_free(state);
+   return NULL;
+}
+
+void state_manager_free(state_manager_t *state)
+{
+   if (!state)
+      return;
+
+#ifdef HAVE_THREADS
+   if (state->threaded)
+   {
+      uint8_t *block;
+
+      slock_lock(state->lock);
+      state->quit = true;
+      scond_signal(state->worker_cond);
+      slock_unlock(state->lock);
+      sthread_join(state->thread);
+
+      /* Every block besides the worker's is either free or 
+       * reserved by push_where now. nextblock aliases one of them. */
+      while ((block = state_manager_queue_pop(&state->free_blocks)))
+         free(block);
+      free(state->pending);
+      state->nextblock = NULL;
+   }
+   else
+   {
+      unsigned i;
+      for (i = 0; i < STATE_MANAGER_POOL_SIZE - 1; i++)
+         free(state->blocks[i]);
+   }
+
+   if (state->lock)
+      slock_free(state->lock);
+   if (state->worker_cond)
+      scond_free(state->worker_cond);
+   if (state->cond)
+      scond_free(state->cond);
+#endif
+
+#ifdef HAVE_REWIND_ARCHIVE
+   state_manager_deinit_archive(state);
+#endif
+
+   free(state->data);
+   free(state->thisblock);
+   free(state->nextblock);
+   free(state);
+}
+
+static bool state_manager_pop_block(state_manager_t *state,
+      const void **data)
+{
+   *data = NULL;
+
+   if (state->thisblock_valid)
+   {
+      state->thisblock_valid = false;
+      state->entries--;
+      *data = state->thisblock;
+      return true;
+   }
+
+   if (state->head == state->tail)
+      return false;
+
+   size_t start = read_size_t(state->head - sizeof(size_t));
+   state->head = state->data + start;
+
+   /* out is the last pushed (or returned) state. */
+   state->decompress(state->data + start + STATE_MANAGER_ENTRY_HEADER,
+         state->thisblock);
+
+   state->entries--;
+   state->frame--;
+#ifdef HAVE_REWIND_ARCHIVE
+   state_manager_archive_discard(state, state->frame + 1);
+#endif
+   *data = state->thisblock;
+   return true;
+}
+
+/* We need to ensure we have an uncompressed copy of the last
+ * pushed state, or we could end up applying a 'patch' to wrong 
+ * savestate, and that'd blow up rather quickly. */
+static void state_manager_prepare_block(state_manager_t *state)
+{
+   if (!state->thisblock_valid) 
+   {
+      const void *ignored;
+      if (state_manager_pop_block(state, &ignored))
+      {
+         state->thisblock_valid = true;
+         state->entries++;
+      }
+   }
+}
+
+/* Compresses nextblock against thisblock and makes it the new thisblock. */
+static void state_manager_push_block(state_manager_t *state)
+{
+   if (state->thisblock_valid)
+   {
+      if (state->capacity < sizeof(size_t) + state->maxcompsize)
+         return;
 
-         for (i = 0; i < changed; i++)
-            compressed16[i] = old16[i];
+recheckcapacity:;
+
+      size_t headpos = state->head - state->data;
+      size_t tailpos = state->tail - state->data;
+      size_t remaining = (tailpos + state->capacity -
+            sizeof(size_t) - headpos - 1) % state->capacity + 1;
 
-         old16 += changed;
-         new16 += changed;
-         num16s -= changed;
-         compressed16 += changed;
+      if (remaining <= state->maxcompsize)
+      {
+#ifdef HAVE_REWIND_ARCHIVE
+         state_manager_archive_evict(state);
+#endif
+         state->tail = state->data + read_size_t(state->tail);
+         state->entries--;
+         goto recheckcapacity;
       }
 
-      compressed16[0] = 0;
-      compressed16[1] = 0;
-      compressed16[2] = 0;
-      compressed = (uint8_t*)(compressed16 + 3);
-      /* End compression code. */
+      RARCH_PERFORMANCE_START(gen_deltas);
+
+      /* Blocks don't keep their role in threaded mode, 
+       * so (re)place the end markers here. */
+      *(uint16_t*)(state->thisblock + state->blocksize + sizeof(uint16_t) * 3) =
+         0xFFFF;
+      *(uint16_t*)(state->nextblock + state->blocksize + sizeof(uint16_t) * 3) =
+         0x0000;
+
+      write_size_t(state->head + sizeof(size_t), state->frame + 1);
+
+      /* 'compressed' will point to the end of the compressed 
+       * data (excluding the prev pointer). */
+      uint8_t *compressed = state->compress(state->thisblock,
+            state->nextblock, state->blocksize,
+            state->head + STATE_MANAGER_ENTRY_HEADER);
 
       if (compressed - state->data + state->maxcompsize > state->capacity)
       {
          compressed = state->data;
          if (state->tail == state->data + sizeof(size_t))
+         {
+#ifdef HAVE_REWIND_ARCHIVE
+            state_manager_archive_evict(state);
+#endif
             state->tail = state->data + read_size_t(state->tail);
+         }
       }
       write_size_t(compressed, state->head-state->data);
       compressed += sizeof(size_t);
@@ -482,21 +1528,238 @@ recheckcapacity:;
       state->head = compressed;
 
       RARCH_PERFORMANCE_STOP(gen_deltas);
+      state->frame++;
    }
    else
+   {
+      /* Replaces whatever was returned at this frame. */
+#ifdef HAVE_REWIND_ARCHIVE
+      state_manager_archive_discard(state, state->frame);
+#endif
       state->thisblock_valid = true;
+   }
 
    uint8_t *swap = state->thisblock;
    state->thisblock = state->nextblock;
    state->nextblock = swap;
 
    state->entries++;
-   return;
+
+#ifdef HAVE_REWIND_ARCHIVE
+   state_manager_archive_push(state);
+#endif
+}
+
+#ifdef HAVE_THREADS
+static void state_manager_thread(void *data)
+{
+   state_manager_t *state = (state_manager_t*)data;
+
+   for (;;)
+   {
+      uint8_t *block = state_manager_queue_pop(&state->pushed_blocks);
+
+      if (!block)
+      {
+         slock_lock(state->lock);
+         ratomic_store_release(&state->worker_asleep, 1);
+         ratomic_fence();
+         while (!(block = state_manager_queue_pop(&state->pushed_blocks))
+               && !state->quit)
+            scond_wait(state->worker_cond, state->lock);
+         ratomic_store_release(&state->worker_asleep, 0);
+         slock_unlock(state->lock);
+
+         if (!block)
+            break;
+      }
+
+      state_manager_prepare_block(state);
+      state->nextblock = block;
+      state_manager_push_block(state);
+      state_manager_queue_push(&state->free_blocks, state->nextblock);
+      ratomic_store_release(&state->done, state->done + 1);
+
+      /* Either the frontend sees the block is done, 
+       * or we see it's asleep. */
+      ratomic_fence();
+      if (ratomic_load_acquire(&state->frontend_asleep))
+      {
+         slock_lock(state->lock);
+         scond_signal(state->cond);
+         slock_unlock(state->lock);
+      }
+   }
+}
+
+/* Waits until the worker has processed every pushed block. 
+ * Afterwards, the worker won't touch anything until the 
+ * next push. */
+static void state_manager_flush(state_manager_t *state)
+{
+   if (!state->threaded)
+      return;
+
+   if (ratomic_load_acquire(&state->done) == state->pushed)
+      return;
+
+   slock_lock(state->lock);
+   ratomic_store_release(&state->frontend_asleep, 1);
+   ratomic_fence();
+   while (ratomic_load_acquire(&state->done) != state->pushed)
+      scond_wait(state->cond, state->lock);
+   ratomic_store_release(&state->frontend_asleep, 0);
+   slock_unlock(state->lock);
+}
+#endif
+
+bool state_manager_pop(state_manager_t *state, const void **data)
+{
+#ifdef HAVE_THREADS
+   state_manager_flush(state);
+#endif
+   return state_manager_pop_block(state, data);
+}
+
+bool state_manager_seek(state_manager_t *state, unsigned frames,
+      const void **data)
+{
+   size_t target;
+
+#ifdef HAVE_THREADS
+   state_manager_flush(state);
+#endif
+
+   *data = NULL;
+   if (!frames || !state->frame)
+      return false;
+   target = state->frame - (frames < state->frame ? frames : state->frame);
+
+   if ((state->head != state->tail || state->thisblock_valid) &&
+         target >= state_manager_oldest_frame(state))
+   {
+      /* thisblock always holds the state at 'frame'. */
+      size_t frame = state->frame;
+      uint8_t *entry = state_manager_find_entry(state, frame);
+
+#ifdef HAVE_REWIND_ARCHIVE
+      unsigned i;
+      for (i = 0; i < state->num_keyframes; i++)
+      {
+         struct state_manager_keyframe *keyframe = &state->keyframes[i];
+         if (keyframe->frame < target)
+            continue;
+         if (keyframe->frame + state->keyframe_interval <= frame &&
+               state_manager_packed_ready(state, keyframe->state) &&
+               state_manager_unpack(state, keyframe->state, state->thisblock))
+         {
+            state->head = state_manager_find_entry(state, keyframe->frame + 1);
+            entry = state_manager_find_entry(state, keyframe->frame);
+            frame = keyframe->frame;
+         }
+         break;
+      }
+#endif
+
+      for (; frame > target; frame--)
+      {
+         state->decompress(entry + STATE_MANAGER_ENTRY_HEADER,
+               state->thisblock);
+         state->head = entry;
+         entry = state->data + read_size_t(entry - sizeof(size_t));
+      }
+
+      state->entries -= state->thisblock_valid + (state->frame - target);
+   }
+   else
+   {
+#ifdef HAVE_REWIND_ARCHIVE
+      int index = state_manager_archive_find(state, &target);
+      if (index < 0 || target >= state->frame ||
+            !state_manager_archive_restore(state, index, target))
+         return false;
+
+      state->head = state->tail;
+      state->entries = 0;
+#else
+      return false;
+#endif
+   }
+
+   state->frame = target;
+   state->thisblock_valid = false;
+#ifdef HAVE_REWIND_ARCHIVE
+   state_manager_archive_discard(state, target + 1);
+#endif
+
+   *data = state->thisblock;
+   return true;
+}
+
+void state_manager_push_where(state_manager_t *state, void **data)
+{
+#ifdef HAVE_THREADS
+   if (state->threaded)
+   {
+      if (!state->pending)
+         state->pending = state_manager_queue_pop(&state->free_blocks);
+
+      if (!state->pending)
+      {
+         /* Worker is more than a pool behind, wait for it. */
+         slock_lock(state->lock);
+         ratomic_store_release(&state->frontend_asleep, 1);
+         ratomic_fence();
+         while (!(state->pending = 
+                  state_manager_queue_pop(&state->free_blocks)))
+            scond_wait(state->cond, state->lock);
+         ratomic_store_release(&state->frontend_asleep, 0);
+         slock_unlock(state->lock);
+      }
+
+      *data = state->pending;
+      return;
+   }
+#endif
+
+   state_manager_prepare_block(state);
+   *data = state->nextblock;
+}
+
+void state_manager_push_do(state_manager_t *state)
+{
+#ifdef HAVE_THREADS
+   if (state->threaded)
+   {
+      if (!state->pending)
+         return;
+
+      state_manager_queue_push(&state->pushed_blocks, state->pending);
+      state->pending = NULL;
+      state->pushed++;
+
+      /* Either the worker sees the new block, or we see it's asleep. */
+      ratomic_fence();
+      if (ratomic_load_acquire(&state->worker_asleep))
+      {
+         slock_lock(state->lock);
+         scond_signal(state->worker_cond);
+         slock_unlock(state->lock);
+      }
+      return;
+   }
+#endif
+
+   state_manager_push_block(state);
 }
 
 void state_manager_capacity(state_manager_t *state,
       unsigned *entries, size_t *bytes, bool *full)
 {
+#ifdef HAVE_THREADS
+   state_manager_flush(state);
+#endif
+
    size_t headpos = state->head - state->data;
    size_t tailpos = state->tail - state->data;
    size_t remaining = (tailpos + state->capacity -
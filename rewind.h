@@ -21,12 +21,28 @@
 
 typedef struct state_manager state_manager_t;
 
-state_manager_t *state_manager_new(size_t state_size, size_t buffer_size);
+/* If threaded is set, deltas are generated on a worker thread.
+ * push_where/push_do then only hand over the serialized state, 
+ * and pop waits for any pushes still in flight.
+ *
+ * If keyframe_interval is non-zero, every keyframe_interval-th state 
+ * is compressed in the background, and runs of deltas falling off 
+ * the buffer are archived behind them, using up to archive_size bytes. 
+ * Needs threads and zlib, ignored otherwise. */
+state_manager_t *state_manager_new(size_t state_size, size_t buffer_size,
+      bool threaded, unsigned keyframe_interval, size_t archive_size);
 
 void state_manager_free(state_manager_t *state);
 
 bool state_manager_pop(state_manager_t *state, const void **data);
 
+/* Goes back 'frames' pushes at once, using the closest keyframe. 
+ * Once the buffer runs out, continues into the archive, landing 
+ * on the closest archived state. Like pop, the returned state 
+ * is dropped from the buffer. */
+bool state_manager_seek(state_manager_t *state, unsigned frames,
+      const void **data);
+
 void state_manager_push_where(state_manager_t *state, void **data);
 
 void state_manager_push_do(state_manager_t *state);
@@ -20,6 +20,7 @@
 #include "performance.h"
 #include "retroarch_logger.h"
 #include "intl/intl.h"
+#include "screenshot.h"
 
 #ifdef HAVE_MENU
 #include "frontend/menu/menu_common.h"
@@ -171,7 +172,12 @@ static void check_rewind(bool pressed)
       const void *buf = NULL;
 
       msg_queue_clear(g_extern.msg_queue);
-      if (state_manager_pop(g_extern.state_manager, &buf))
+      /* Past the buffer, keep going through the archive 
+       * a keyframe at a time. */
+      if (state_manager_pop(g_extern.state_manager, &buf) ||
+            (g_settings.rewind_keyframe_interval &&
+             state_manager_seek(g_extern.state_manager,
+                g_settings.rewind_keyframe_interval, &buf)))
       {
          g_extern.frame_is_reverse = true;
          setup_rewind_audio();
@@ -667,6 +673,8 @@ int rarch_main_iterate(void)
    if (g_extern.system.frame_time.callback)
       update_frame_time();
 
+   screenshot_async_poll();
+
 #ifdef HAVE_MENU
    if (check_enter_menu_func(trigger_input) || (g_extern.libretro_dummy))
       do_state_check_menu_toggle();
@@ -23,6 +23,13 @@
 #include "general.h"
 #include <file/file_path.h>
 #include "gfx/scaler/scaler.h"
+#include "intl/intl.h"
+#include "performance.h"
+
+#ifdef HAVE_THREADS
+#include <rthreads/rthreads.h>
+#endif
+#include <rthreads/rpool.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -104,7 +111,8 @@ static void dump_line_32(uint8_t *line, const uint32_t *src, unsigned width)
 }
 
 static void dump_content(FILE *file, const void *frame,
-      int width, int height, int pitch, bool bgr24)
+      int width, int height, int pitch, bool bgr24,
+      enum retro_pixel_format pix_fmt)
 {
    int i, j;
    union
@@ -133,7 +141,7 @@ static void dump_content(FILE *file, const void *frame,
       for (j = 0; j < height; j++, u.u8 += pitch)
          dump_line_bgr(lines[j], u.u8, width);
    }
-   else if (g_extern.system.pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888)
+   else if (pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888)
    {
       for (j = 0; j < height; j++, u.u8 += pitch)
          dump_line_32(lines[j], u.u32, width);
@@ -153,22 +161,16 @@ end:
 }
 #endif
 
+/* Helps encode PNGs, created along with the screenshot thread. 
+ * A pool of its own, so that encoding never holds up the filters 
+ * of the next frame on the shared one. */
+static rpool_t *screenshot_pool;
+
 /* Take frame bottom-up. */
-bool screenshot_dump(const char *folder, const void *frame,
-      unsigned width, unsigned height, int pitch, bool bgr24)
+static bool screenshot_dump_file(const char *filename, const void *frame,
+      unsigned width, unsigned height, int pitch, bool bgr24,
+      enum retro_pixel_format pix_fmt)
 {
-   char filename[PATH_MAX];
-   char shotname[PATH_MAX];
-
-#ifdef HAVE_ZLIB_DEFLATE
-#define IMG_EXT "png"
-#else
-#define IMG_EXT "bmp"
-#endif
-
-   fill_dated_filename(shotname, IMG_EXT, sizeof(shotname));
-   fill_pathname_join(filename, folder, shotname, sizeof(filename));
-
 #ifdef HAVE_ZLIB_DEFLATE
    uint8_t *out_buffer = (uint8_t*)malloc(width * height * 3);
    if (!out_buffer)
@@ -186,7 +188,7 @@ bool screenshot_dump(const char *folder, const void *frame,
 
    if (bgr24)
       scaler.in_fmt = SCALER_FMT_BGR24;
-   else if (g_extern.system.pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888)
+   else if (pix_fmt == RETRO_PIXEL_FORMAT_XRGB8888)
       scaler.in_fmt = SCALER_FMT_ARGB8888;
    else
       scaler.in_fmt = SCALER_FMT_RGB565;
@@ -197,8 +199,9 @@ bool screenshot_dump(const char *folder, const void *frame,
    scaler_ctx_gen_reset(&scaler);
 
    RARCH_LOG("Using RPNG for PNG screenshots.\n");
-   bool ret = rpng_save_image_bgr24(filename,
-         out_buffer, width, height, width * 3);
+   bool ret = rpng_save_image_bgr24_level(filename,
+         out_buffer, width, height, width * 3,
+         RPNG_SAVE_DEFAULT, screenshot_pool);
    if (!ret)
       RARCH_ERR("Failed to take screenshot.\n");
    free(out_buffer);
@@ -214,7 +217,7 @@ bool screenshot_dump(const char *folder, const void *frame,
    bool ret = write_header_bmp(file, width, height);
 
    if (ret)
-      dump_content(file, frame, width, height, pitch, bgr24);
+      dump_content(file, frame, width, height, pitch, bgr24, pix_fmt);
    else
       RARCH_ERR("Failed to write image header.\n");
 
@@ -223,3 +226,349 @@ bool screenshot_dump(const char *folder, const void *frame,
 #endif
 }
 
+static void screenshot_fill_filename(char *filename, const char *folder,
+      size_t size)
+{
+   char shotname[PATH_MAX];
+
+#ifdef HAVE_ZLIB_DEFLATE
+#define IMG_EXT "png"
+#else
+#define IMG_EXT "bmp"
+#endif
+
+   fill_dated_filename(shotname, IMG_EXT, sizeof(shotname));
+   fill_pathname_join(filename, folder, shotname, size);
+}
+
+/* Take frame bottom-up. */
+bool screenshot_dump(const char *folder, const void *frame,
+      unsigned width, unsigned height, int pitch, bool bgr24)
+{
+   char filename[PATH_MAX];
+
+   screenshot_fill_filename(filename, folder, sizeof(filename));
+   return screenshot_dump_file(filename, frame, width, height, pitch,
+         bgr24, g_extern.system.pix_fmt);
+}
+
+/* Screenshots in flight at once. Taking one more waits for
+ * the oldest to be written out. */
+#define SCREENSHOT_ASYNC_SLOTS 3
+
+enum screenshot_slot_state
+{
+   SCREENSHOT_SLOT_FREE = 0,
+   /* Handed out by screenshot_async_buffer(), not submitted yet. */
+   SCREENSHOT_SLOT_FILLING,
+   SCREENSHOT_SLOT_QUEUED,
+   /* Written out, waiting for screenshot_async_poll() to report it. */
+   SCREENSHOT_SLOT_DONE
+};
+
+struct screenshot_slot
+{
+   enum screenshot_slot_state state;
+   /* Submission order, slots are written and reported oldest first. */
+   unsigned sequence;
+   bool ret;
+
+   uint8_t *buffer;
+   size_t capacity;
+
+   char filename[PATH_MAX];
+   const uint8_t *frame;
+   unsigned width;
+   unsigned height;
+   int pitch;
+   bool bgr24;
+   enum retro_pixel_format pix_fmt;
+};
+
+struct screenshot_async
+{
+   struct screenshot_slot slots[SCREENSHOT_ASYNC_SLOTS];
+   struct screenshot_slot *filling;
+   unsigned sequence;
+
+#ifdef HAVE_THREADS
+   slock_t *lock;
+   /* Signalled whenever a slot is queued or done. */
+   scond_t *cond;
+   sthread_t *thread;
+   bool quit;
+#endif
+};
+
+static struct screenshot_async screenshot_async;
+
+static struct screenshot_slot *screenshot_async_oldest(
+      struct screenshot_async *async, enum screenshot_slot_state state)
+{
+   unsigned i;
+   struct screenshot_slot *oldest = NULL;
+
+   for (i = 0; i < SCREENSHOT_ASYNC_SLOTS; i++)
+   {
+      struct screenshot_slot *slot = &async->slots[i];
+      if (slot->state != state)
+         continue;
+      if (!oldest || (int)(slot->sequence - oldest->sequence) < 0)
+         oldest = slot;
+   }
+
+   return oldest;
+}
+
+static void screenshot_async_lock(struct screenshot_async *async)
+{
+#ifdef HAVE_THREADS
+   slock_lock(async->lock);
+#endif
+}
+
+static void screenshot_async_unlock(struct screenshot_async *async)
+{
+#ifdef HAVE_THREADS
+   slock_unlock(async->lock);
+#endif
+}
+
+#ifdef HAVE_THREADS
+static void screenshot_async_thread(void *data)
+{
+   struct screenshot_async *async = (struct screenshot_async*)data;
+
+   slock_lock(async->lock);
+
+   /* Whatever is queued when asked to quit is still written out. */
+   for (;;)
+   {
+      bool ret;
+      struct screenshot_slot *slot = screenshot_async_oldest(async,
+            SCREENSHOT_SLOT_QUEUED);
+
+      if (!slot)
+      {
+         if (async->quit)
+            break;
+
+         scond_wait(async->cond, async->lock);
+         continue;
+      }
+
+      /* The main thread leaves queued slots alone. */
+      slock_unlock(async->lock);
+      ret = screenshot_dump_file(slot->filename, slot->frame,
+            slot->width, slot->height, slot->pitch,
+            slot->bgr24, slot->pix_fmt);
+      slock_lock(async->lock);
+
+      slot->ret = ret;
+      slot->state = SCREENSHOT_SLOT_DONE;
+      scond_broadcast(async->cond);
+   }
+
+   slock_unlock(async->lock);
+}
+#endif
+
+static bool screenshot_async_init(struct screenshot_async *async)
+{
+#ifdef HAVE_THREADS
+   if (async->thread)
+      return true;
+
+   async->lock = slock_new();
+   async->cond = scond_new();
+   if (async->lock && async->cond)
+      async->thread = sthread_create(screenshot_async_thread, async);
+
+   /* The screenshot thread encodes too, hence one worker less. */
+   if (async->thread && rarch_get_cpu_cores() > 1)
+      screenshot_pool = rpool_new(rarch_get_cpu_cores() - 1);
+
+   if (!async->thread)
+   {
+      RARCH_ERR("Failed to start screenshot thread.\n");
+      if (async->lock)
+         slock_free(async->lock);
+      if (async->cond)
+         scond_free(async->cond);
+      async->lock = NULL;
+      async->cond = NULL;
+      return false;
+   }
+#else
+   (void)async;
+#endif
+   return true;
+}
+
+/* Frees finished slots and counts them. Call with the lock held. */
+static void screenshot_async_collect(
+      struct screenshot_async *async, unsigned *done, unsigned *failed)
+{
+   struct screenshot_slot *slot;
+
+   while ((slot = screenshot_async_oldest(async, SCREENSHOT_SLOT_DONE)))
+   {
+      if (slot->ret)
+         RARCH_LOG("Screenshot saved: %s.\n", slot->filename);
+      else
+         (*failed)++;
+      (*done)++;
+      slot->state = SCREENSHOT_SLOT_FREE;
+   }
+}
+
+static void screenshot_async_report(unsigned done, unsigned failed)
+{
+   const char *msg;
+
+   if (!done)
+      return;
+
+   if (failed)
+   {
+      RARCH_WARN(RETRO_LOG_TAKE_SCREENSHOT_FAILED);
+      msg = RETRO_MSG_TAKE_SCREENSHOT_FAILED;
+   }
+   else
+   {
+      RARCH_LOG(RETRO_LOG_TAKE_SCREENSHOT);
+      msg = RETRO_MSG_TAKE_SCREENSHOT;
+   }
+
+   msg_queue_push(g_extern.msg_queue, msg, 1, g_extern.is_paused ? 1 : 180);
+}
+
+void *screenshot_async_buffer(size_t size)
+{
+   unsigned done = 0, failed = 0;
+   struct screenshot_async *async = &screenshot_async;
+   struct screenshot_slot *slot = async->filling;
+
+   if (!screenshot_async_init(async))
+      return NULL;
+
+   screenshot_async_lock(async);
+   while (!slot)
+   {
+      unsigned i;
+
+      screenshot_async_collect(async, &done, &failed);
+      for (i = 0; i < SCREENSHOT_ASYNC_SLOTS && !slot; i++)
+         if (async->slots[i].state == SCREENSHOT_SLOT_FREE)
+            slot = &async->slots[i];
+
+#ifdef HAVE_THREADS
+      if (!slot)
+         scond_wait(async->cond, async->lock);
+#endif
+   }
+   screenshot_async_unlock(async);
+
+   screenshot_async_report(done, failed);
+
+   if (slot->capacity < size)
+   {
+      free(slot->buffer);
+      slot->buffer = (uint8_t*)malloc(size);
+      slot->capacity = slot->buffer ? size : 0;
+      if (!slot->buffer)
+      {
+         slot->state = SCREENSHOT_SLOT_FREE;
+         async->filling = NULL;
+         return NULL;
+      }
+   }
+
+   slot->state = SCREENSHOT_SLOT_FILLING;
+   async->filling = slot;
+   return slot->buffer;
+}
+
+bool screenshot_async_submit(const char *folder, const void *frame,
+      unsigned width, unsigned height, int pitch, bool bgr24)
+{
+   struct screenshot_async *async = &screenshot_async;
+   struct screenshot_slot *slot = async->filling;
+
+   if (!slot)
+      return false;
+
+   screenshot_fill_filename(slot->filename, folder, sizeof(slot->filename));
+   slot->frame    = (const uint8_t*)frame;
+   slot->width    = width;
+   slot->height   = height;
+   slot->pitch    = pitch;
+   slot->bgr24    = bgr24;
+   slot->pix_fmt  = g_extern.system.pix_fmt;
+   slot->sequence = async->sequence++;
+   async->filling = NULL;
+
+#ifdef HAVE_THREADS
+   slock_lock(async->lock);
+   slot->state = SCREENSHOT_SLOT_QUEUED;
+   scond_broadcast(async->cond);
+   slock_unlock(async->lock);
+#else
+   slot->ret = screenshot_dump_file(slot->filename, slot->frame,
+         slot->width, slot->height, slot->pitch,
+         slot->bgr24, slot->pix_fmt);
+   slot->state = SCREENSHOT_SLOT_DONE;
+#endif
+
+   return true;
+}
+
+void screenshot_async_poll(void)
+{
+   unsigned done = 0, failed = 0;
+   struct screenshot_async *async = &screenshot_async;
+
+#ifdef HAVE_THREADS
+   if (!async->thread)
+      return;
+#endif
+
+   screenshot_async_lock(async);
+   screenshot_async_collect(async, &done, &failed);
+   screenshot_async_unlock(async);
+
+   screenshot_async_report(done, failed);
+
+   /* Nothing else redraws the message while paused. */
+   if (done && g_extern.is_paused)
+      rarch_render_cached_frame();
+}
+
+void screenshot_async_deinit(void)
+{
+   unsigned i;
+   struct screenshot_async *async = &screenshot_async;
+
+#ifdef HAVE_THREADS
+   if (async->thread)
+   {
+      slock_lock(async->lock);
+      async->quit = true;
+      scond_broadcast(async->cond);
+      slock_unlock(async->lock);
+
+      sthread_join(async->thread);
+      slock_free(async->lock);
+      scond_free(async->cond);
+   }
+
+   if (screenshot_pool)
+      rpool_free(screenshot_pool);
+   screenshot_pool = NULL;
+#endif
+
+   for (i = 0; i < SCREENSHOT_ASYNC_SLOTS; i++)
+      free(async->slots[i].buffer);
+
+   memset(async, 0, sizeof(*async));
+}
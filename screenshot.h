@@ -25,4 +25,25 @@ bool screenshot_dump(const char *folder, const void *frame,
 
 void screenshot_generate_filename(char *filename, size_t size);
 
+/* Screenshots taken through these are converted, encoded and
+ * written on a thread of their own. The main thread only pays
+ * for getting the frame into a buffer.
+ *
+ * screenshot_async_buffer() returns a pooled buffer of at least
+ * size bytes to read the frame into, or NULL on failure.
+ * Once filled, screenshot_async_submit() queues it, with the frame
+ * pointing into that buffer, as for screenshot_dump().
+ * A buffer that is never submitted is handed out again. */
+void *screenshot_async_buffer(size_t size);
+
+bool screenshot_async_submit(const char *folder, const void *frame,
+      unsigned width, unsigned height, int pitch, bool bgr24);
+
+/* Posts finished screenshots to the message queue.
+ * Call once per frame from the main thread. */
+void screenshot_async_poll(void);
+
+/* Waits for queued screenshots to be written. */
+void screenshot_async_deinit(void);
+
 #endif
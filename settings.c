@@ -318,6 +318,7 @@ static void config_set_defaults(void)
    if (def_audio_resampler)
       strlcpy(g_settings.audio.resampler,
             def_audio_resampler, sizeof(g_settings.audio.resampler));
+   *g_settings.audio.resampler_quality = '\0';
    if (def_input)
       strlcpy(g_settings.input.driver,
             def_input, sizeof(g_settings.input.driver));
@@ -404,14 +405,19 @@ static void config_set_defaults(void)
 
    g_settings.audio.latency = g_defaults.settings.out_latency;
    g_settings.audio.sync = audio_sync;
+   g_settings.audio.threaded = audio_threaded;
    g_settings.audio.rate_control = rate_control;
    g_settings.audio.rate_control_delta = rate_control_delta;
+   g_settings.audio.latency_adaptive = audio_latency_adaptive;
    g_settings.audio.volume = audio_volume;
    g_extern.audio_data.volume_gain = db_to_gain(g_settings.audio.volume);
 
    g_settings.rewind_enable = rewind_enable;
    g_settings.rewind_buffer_size = rewind_buffer_size;
    g_settings.rewind_granularity = rewind_granularity;
+   g_settings.rewind_threaded = rewind_threaded;
+   g_settings.rewind_keyframe_interval = rewind_keyframe_interval;
+   g_settings.rewind_archive_size = rewind_archive_size;
    g_settings.slowmotion_ratio = slowmotion_ratio;
    g_settings.fastforward_ratio = fastforward_ratio;
    g_settings.fastforward_ratio_throttle_enable = fastforward_ratio_throttle_enable;
@@ -1015,10 +1021,13 @@ static bool config_load_file(const char *path, bool set_defaults)
    CONFIG_GET_STRING(audio.device, "audio_device");
    CONFIG_GET_INT(audio.latency, "audio_latency");
    CONFIG_GET_BOOL(audio.sync, "audio_sync");
+   CONFIG_GET_BOOL(audio.threaded, "audio_threaded");
    CONFIG_GET_BOOL(audio.rate_control, "audio_rate_control");
    CONFIG_GET_FLOAT(audio.rate_control_delta, "audio_rate_control_delta");
+   CONFIG_GET_BOOL(audio.latency_adaptive, "audio_latency_adaptive");
    CONFIG_GET_FLOAT(audio.volume, "audio_volume");
    CONFIG_GET_STRING(audio.resampler, "audio_resampler");
+   CONFIG_GET_STRING(audio.resampler_quality, "audio_resampler_quality");
    g_extern.audio_data.volume_gain = db_to_gain(g_settings.audio.volume);
 
    CONFIG_GET_STRING(camera.device, "camera_device");
@@ -1113,6 +1122,12 @@ static bool config_load_file(const char *path, bool set_defaults)
       g_settings.rewind_buffer_size = buffer_size * UINT64_C(1000000);
 
    CONFIG_GET_INT(rewind_granularity, "rewind_granularity");
+   CONFIG_GET_BOOL(rewind_threaded, "rewind_threaded");
+   CONFIG_GET_INT(rewind_keyframe_interval, "rewind_keyframe_interval");
+
+   int archive_size = 0;
+   if (config_get_int(conf, "rewind_archive_size", &archive_size))
+      g_settings.rewind_archive_size = archive_size * UINT64_C(1000000);
    CONFIG_GET_FLOAT(slowmotion_ratio, "slowmotion_ratio");
    if (g_settings.slowmotion_ratio < 1.0f)
       g_settings.slowmotion_ratio = 1.0f;
@@ -1175,6 +1190,10 @@ static bool config_load_file(const char *path, bool set_defaults)
       CONFIG_GET_PATH_EXTERN(netplay_server, "netplay_ip_address");
    if (!g_extern.has_set_netplay_delay_frames)
       CONFIG_GET_INT_EXTERN(netplay_sync_frames, "netplay_delay_frames");
+   if (!g_extern.has_set_netplay_input_delay)
+      CONFIG_GET_INT_EXTERN(netplay_input_delay, "netplay_input_delay_frames");
+   if (!g_extern.has_set_netplay_players)
+      CONFIG_GET_INT_EXTERN(netplay_players, "netplay_players");
    if (!g_extern.has_set_netplay_ip_port)
       CONFIG_GET_INT_EXTERN(netplay_port, "netplay_ip_port");
 #endif
@@ -1546,8 +1565,14 @@ bool config_save_file(const char *path)
    config_set_bool(conf,  "rewind_enable", g_settings.rewind_enable);
    config_set_int(conf,   "audio_latency", g_settings.audio.latency);
    config_set_bool(conf,  "audio_sync",    g_settings.audio.sync);
+   config_set_bool(conf,  "audio_threaded", g_settings.audio.threaded);
    config_set_int(conf,   "audio_block_frames", g_settings.audio.block_frames);
    config_set_int(conf,   "rewind_granularity", g_settings.rewind_granularity);
+   config_set_bool(conf,  "rewind_threaded", g_settings.rewind_threaded);
+   config_set_int(conf,   "rewind_keyframe_interval",
+         g_settings.rewind_keyframe_interval);
+   config_set_int(conf,   "rewind_archive_size",
+         g_settings.rewind_archive_size / UINT64_C(1000000));
    config_set_path(conf,  "video_shader", g_settings.video.shader_path);
    config_set_bool(conf,  "video_shader_enable",
          g_settings.video.shader_enable);
@@ -1608,6 +1633,8 @@ bool config_save_file(const char *path)
    config_set_bool(conf, "audio_rate_control", g_settings.audio.rate_control);
    config_set_float(conf, "audio_rate_control_delta",
          g_settings.audio.rate_control_delta);
+   config_set_bool(conf, "audio_latency_adaptive",
+         g_settings.audio.latency_adaptive);
    config_set_float(conf, "audio_volume", g_settings.audio.volume);
    config_set_string(conf, "video_context_driver", g_settings.video.context_driver);
    config_set_string(conf, "audio_driver", g_settings.audio.driver);
@@ -1627,6 +1654,8 @@ bool config_save_file(const char *path)
    config_set_path(conf, "resampler_directory",
          g_settings.resampler_directory);
    config_set_string(conf, "audio_resampler", g_settings.audio.resampler);
+   config_set_string(conf, "audio_resampler_quality",
+         g_settings.audio.resampler_quality);
    config_set_path(conf, "savefile_directory",
          *g_extern.savefile_dir ? g_extern.savefile_dir : "default");
    config_set_path(conf, "savestate_directory",
@@ -1732,6 +1761,9 @@ bool config_save_file(const char *path)
    config_set_string(conf, "netplay_ip_address", g_extern.netplay_server);
    config_set_int(conf, "netplay_ip_port", g_extern.netplay_port);
    config_set_int(conf, "netplay_delay_frames", g_extern.netplay_sync_frames);
+   config_set_int(conf, "netplay_input_delay_frames",
+         g_extern.netplay_input_delay);
+   config_set_int(conf, "netplay_players", g_extern.netplay_players);
 #endif
    config_set_string(conf, "netplay_nickname", g_settings.username);
    config_set_int(conf, "user_language", g_settings.user_language);
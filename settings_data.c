@@ -2105,6 +2105,24 @@ int setting_data_get_description(const char *label, char *msg,
             "at a time, increasing the rewinding \n"
             "speed.");
    }
+   else if (!strcmp(label, "rewind_threaded"))
+   {
+      snprintf(msg, sizeof_msg,
+            " -- Threaded rewind.\n"
+            " \n"
+            "Compresses rewind states on a separate \n"
+            "thread. Lowers the cost of rewind on \n"
+            "multi-core systems, but uses more memory.");
+   }
+   else if (!strcmp(label, "rewind_keyframe_interval"))
+   {
+      snprintf(msg, sizeof_msg,
+            " -- Rewind keyframe interval.\n"
+            " \n"
+            "Compresses every Nth rewind state in \n"
+            "the background, so rewinding can go on \n"
+            "past the rewind buffer. 0 disables it.");
+   }
    else if (!strcmp(label, "rewind_enable"))
    {
       snprintf(msg, sizeof_msg,
@@ -2791,6 +2809,10 @@ static void general_write_handler(void *data)
    }
    else if (!strcmp(setting->name, "netplay_delay_frames"))
       g_extern.has_set_netplay_delay_frames = (g_extern.netplay_sync_frames > 0);
+   else if (!strcmp(setting->name, "netplay_input_delay_frames"))
+      g_extern.has_set_netplay_input_delay = (g_extern.netplay_input_delay > 0);
+   else if (!strcmp(setting->name, "netplay_players"))
+      g_extern.has_set_netplay_players = true;
 #endif
    else if (!strcmp(setting->name, "log_verbosity"))
    {
@@ -3428,6 +3450,35 @@ static bool setting_data_append_list_general_options(
             general_read_handler);
    settings_list_current_add_range(list, list_info, 1, 32768, 1, true, false);
 
+#ifdef HAVE_THREADS
+   CONFIG_BOOL(
+         g_settings.rewind_threaded,
+         "rewind_threaded",
+         "Threaded Rewind",
+         rewind_threaded,
+         "OFF",
+         "ON",
+         group_info.name,
+         subgroup_info.name,
+         general_write_handler,
+         general_read_handler);
+   settings_list_current_add_cmd(list, list_info, RARCH_CMD_REWIND_TOGGLE);
+   settings_data_list_current_add_flags(list, list_info, SD_FLAG_CMD_APPLY_AUTO);
+
+   CONFIG_UINT(
+         g_settings.rewind_keyframe_interval,
+         "rewind_keyframe_interval",
+         "Rewind Keyframe Interval",
+         rewind_keyframe_interval,
+         group_info.name,
+         subgroup_info.name,
+         general_write_handler,
+         general_read_handler);
+   settings_list_current_add_range(list, list_info, 0, 3600, 1, true, true);
+   settings_list_current_add_cmd(list, list_info, RARCH_CMD_REWIND_TOGGLE);
+   settings_data_list_current_add_flags(list, list_info, SD_FLAG_CMD_APPLY_AUTO);
+#endif
+
    CONFIG_BOOL(
          g_settings.block_sram_overwrite,
          "block_sram_overwrite",
@@ -4378,6 +4429,19 @@ static bool setting_data_append_list_audio_options(
          general_write_handler,
          general_read_handler);
 
+   CONFIG_BOOL(
+         g_settings.audio.threaded,
+         "audio_threaded",
+         "Threaded Audio",
+         audio_threaded,
+         "OFF",
+         "ON",
+         group_info.name,
+         subgroup_info.name,
+         general_write_handler,
+         general_read_handler);
+   settings_data_list_current_add_flags(list, list_info, SD_FLAG_IS_DEFERRED);
+
    CONFIG_UINT(
          g_settings.audio.latency,
          "audio_latency",
@@ -4410,6 +4474,18 @@ static bool setting_data_append_list_audio_options(
          true,
          false);
 
+   CONFIG_BOOL(
+         g_settings.audio.latency_adaptive,
+         "audio_latency_adaptive",
+         "Adaptive Audio Latency",
+         audio_latency_adaptive,
+         "OFF",
+         "ON",
+         group_info.name,
+         subgroup_info.name,
+         general_write_handler,
+         general_read_handler);
+
    CONFIG_UINT(
          g_settings.audio.block_frames,
          "audio_block_frames",
@@ -4951,6 +5027,28 @@ static bool setting_data_append_list_netplay_options(
          general_read_handler);
    settings_list_current_add_range(list, list_info, 0, 10, 1, true, false);
 
+   CONFIG_UINT(
+         g_extern.netplay_input_delay,
+         "netplay_input_delay_frames",
+         "Netplay Input Delay Frames",
+         0,
+         group_info.name,
+         subgroup_info.name,
+         general_write_handler,
+         general_read_handler);
+   settings_list_current_add_range(list, list_info, 0, 10, 1, true, false);
+
+   CONFIG_UINT(
+         g_extern.netplay_players,
+         "netplay_players",
+         "Netplay Players",
+         2,
+         group_info.name,
+         subgroup_info.name,
+         general_write_handler,
+         general_read_handler);
+   settings_list_current_add_range(list, list_info, 2, MAX_PLAYERS, 1, true, true);
+
    CONFIG_UINT(
          g_extern.netplay_port,
          "netplay_tcp_udp_port",
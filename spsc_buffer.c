@@ -0,0 +1,178 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *  Copyright (C) 2011-2014 - Daniel De Matteis
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <rthreads/ratomic.h>
+#include "spsc_buffer.h"
+
+/* Each packet starts with a header holding its size.
+ * A header of SPSC_WRAP means the next packet is at the start. */
+#define SPSC_WRAP ((size_t)-1)
+#define SPSC_ALIGN_UP(x) (((x) + SPSC_ALIGN - 1) & ~(size_t)(SPSC_ALIGN - 1))
+
+spsc_buffer_t *spsc_new(size_t size)
+{
+   spsc_buffer_t *buf = (spsc_buffer_t*)calloc(1, sizeof(*buf));
+   if (!buf)
+      return NULL;
+
+   /* One byte (one header in packet mode) is always kept free,
+    * so that a full buffer can be told apart from an empty one. */
+   buf->size = size;
+   buf->bufsize = SPSC_ALIGN_UP(size + SPSC_ALIGN);
+   buf->buffer = (uint8_t*)calloc(1, buf->bufsize);
+   if (!buf->buffer)
+   {
+      free(buf);
+      return NULL;
+   }
+
+   return buf;
+}
+
+void spsc_free(spsc_buffer_t *buffer)
+{
+   if (!buffer)
+      return;
+
+   free(buffer->buffer);
+   free(buffer);
+}
+
+size_t spsc_read_avail(spsc_buffer_t *buffer)
+{
+   size_t first = ratomic_load_acquire(&buffer->first);
+   size_t end = ratomic_load_acquire(&buffer->end);
+   if (end < first)
+      end += buffer->bufsize;
+   return end - first;
+}
+
+size_t spsc_write_avail(spsc_buffer_t *buffer)
+{
+   return buffer->size - spsc_read_avail(buffer);
+}
+
+void spsc_write(spsc_buffer_t *buffer, const void *in_buf, size_t size)
+{
+   size_t end = buffer->end;
+   size_t first_write = size;
+   size_t rest_write = 0;
+   if (end + size > buffer->bufsize)
+   {
+      first_write = buffer->bufsize - end;
+      rest_write = size - first_write;
+   }
+
+   memcpy(buffer->buffer + end, in_buf, first_write);
+   memcpy(buffer->buffer, (const uint8_t*)in_buf + first_write, rest_write);
+
+   ratomic_store_release(&buffer->end, (end + size) % buffer->bufsize);
+}
+
+void spsc_read(spsc_buffer_t *buffer, void *in_buf, size_t size)
+{
+   size_t first = buffer->first;
+   size_t first_read = size;
+   size_t rest_read = 0;
+   if (first + size > buffer->bufsize)
+   {
+      first_read = buffer->bufsize - first;
+      rest_read = size - first_read;
+   }
+
+   memcpy(in_buf, buffer->buffer + first, first_read);
+   memcpy((uint8_t*)in_buf + first_read, buffer->buffer, rest_read);
+
+   ratomic_store_release(&buffer->first, (first + size) % buffer->bufsize);
+}
+
+void *spsc_reserve(spsc_buffer_t *buffer, size_t size)
+{
+   size_t end = buffer->end;
+   size_t first = ratomic_load_acquire(&buffer->first);
+   size_t total = SPSC_ALIGN + SPSC_ALIGN_UP(size);
+
+   if (end >= first)
+   {
+      /* end may only come back around to 0 if first has moved on. */
+      if (end + total < buffer->bufsize ||
+            (end + total == buffer->bufsize && first != 0))
+         buffer->reserved_wrap = false;
+      else if (total < first)
+         buffer->reserved_wrap = true;
+      else
+         return NULL;
+   }
+   else if (end + total < first)
+      buffer->reserved_wrap = false;
+   else
+      return NULL;
+
+   return buffer->buffer + (buffer->reserved_wrap ? 0 : end) + SPSC_ALIGN;
+}
+
+void spsc_commit(spsc_buffer_t *buffer, size_t size)
+{
+   size_t end = buffer->end;
+
+   if (buffer->reserved_wrap)
+   {
+      *(size_t*)(buffer->buffer + end) = SPSC_WRAP;
+      end = 0;
+   }
+
+   *(size_t*)(buffer->buffer + end) = size;
+   end += SPSC_ALIGN + SPSC_ALIGN_UP(size);
+   if (end == buffer->bufsize)
+      end = 0;
+
+   ratomic_store_release(&buffer->end, end);
+}
+
+const void *spsc_peek(spsc_buffer_t *buffer, size_t *size)
+{
+   size_t first = buffer->first;
+   size_t end = ratomic_load_acquire(&buffer->end);
+
+   if (first == end)
+      return NULL;
+
+   if (*(const size_t*)(buffer->buffer + first) == SPSC_WRAP)
+   {
+      /* A wrap marker is always followed by a packet. */
+      first = 0;
+      ratomic_store_release(&buffer->first, 0);
+   }
+
+   *size = *(const size_t*)(buffer->buffer + first);
+   return buffer->buffer + first + SPSC_ALIGN;
+}
+
+void spsc_release(spsc_buffer_t *buffer)
+{
+   size_t first = buffer->first;
+   size_t size = *(const size_t*)(buffer->buffer + first);
+
+   first += SPSC_ALIGN + SPSC_ALIGN_UP(size);
+   if (first == buffer->bufsize)
+      first = 0;
+
+   ratomic_store_release(&buffer->first, first);
+}
@@ -0,0 +1,90 @@
+/*  RetroArch - A frontend for libretro.
+ *  Copyright (C) 2010-2014 - Hans-Kristian Arntzen
+ *  Copyright (C) 2011-2014 - Daniel De Matteis
+ *
+ *  RetroArch is free software: you can redistribute it and/or modify it under the terms
+ *  of the GNU General Public License as published by the Free Software Found-
+ *  ation, either version 3 of the License, or (at your option) any later version.
+ *
+ *  RetroArch is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+ *  without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along with RetroArch.
+ *  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SPSC_BUFFER_H
+#define __SPSC_BUFFER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <boolean.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Lock-free ring buffer for exactly one producer thread and
+ * one consumer thread. Unlike fifo_buffer, no external locking
+ * is needed; waking up the other side is up to the caller.
+ *
+ * A buffer is used either as a byte stream (write/read), or
+ * as a queue of packets (reserve/commit, peek/release).
+ * Packets are contiguous and SPSC_ALIGN aligned, so both sides
+ * can work on them in place. Don't mix the two on one buffer. */
+
+#define SPSC_ALIGN 16
+
+struct spsc_buffer
+{
+   uint8_t *buffer;
+   size_t bufsize;
+   /* Usable size in byte stream mode. */
+   size_t size;
+
+   /* Written by the consumer only. */
+   volatile size_t first;
+   uint8_t pad0[64];
+   /* Written by the producer only. */
+   volatile size_t end;
+   /* Set by reserve if the packet goes at the start. */
+   bool reserved_wrap;
+   uint8_t pad1[64];
+};
+
+typedef struct spsc_buffer spsc_buffer_t;
+
+spsc_buffer_t *spsc_new(size_t size);
+
+void spsc_free(spsc_buffer_t *buffer);
+
+/* Byte stream. */
+size_t spsc_read_avail(spsc_buffer_t *buffer);
+
+size_t spsc_write_avail(spsc_buffer_t *buffer);
+
+void spsc_write(spsc_buffer_t *buffer, const void *in_buf, size_t size);
+
+void spsc_read(spsc_buffer_t *buffer, void *in_buf, size_t size);
+
+/* Packets.
+ * Producer: returns room for a packet of size bytes,
+ * or NULL if the buffer is too full. commit may pass on
+ * a smaller size than was reserved. */
+void *spsc_reserve(spsc_buffer_t *buffer, size_t size);
+
+void spsc_commit(spsc_buffer_t *buffer, size_t size);
+
+/* Consumer: returns the oldest packet, or NULL if none.
+ * It stays valid until released. */
+const void *spsc_peek(spsc_buffer_t *buffer, size_t *size);
+
+void spsc_release(spsc_buffer_t *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
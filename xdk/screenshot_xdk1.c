@@ -50,3 +50,31 @@ bool screenshot_dump(const char *folder, const void *frame,
 
    return false;
 }
+
+/* The back buffer can only be read on the main thread,
+ * so screenshots are taken right away. */
+static void *screenshot_xdk1_buffer;
+
+void *screenshot_async_buffer(size_t size)
+{
+   void *buffer = realloc(screenshot_xdk1_buffer, size);
+   if (buffer)
+      screenshot_xdk1_buffer = buffer;
+   return buffer;
+}
+
+bool screenshot_async_submit(const char *folder, const void *frame,
+      unsigned width, unsigned height, int pitch, bool bgr24)
+{
+   return screenshot_dump(folder, frame, width, height, pitch, bgr24);
+}
+
+void screenshot_async_poll(void)
+{
+}
+
+void screenshot_async_deinit(void)
+{
+   free(screenshot_xdk1_buffer);
+   screenshot_xdk1_buffer = NULL;
+}